@@ -0,0 +1,335 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    AsyncWriter.cpp
+ * \brief   Asynchronous writes of exported statistics through io_uring.
+ *          Implementation of AsyncWriter.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "utils.hpp"
+#include "allocators.hpp"
+#include "AsyncWriter.hpp"
+
+using namespace std;
+
+/**
+ * @brief Creates writer of given output.
+ *
+ * (See AsyncWriter.hpp for more info.)
+ */
+unique_ptr<AsyncWriter> AsyncWriter::create(int fd, unsigned int depth, size_t bufferSize) {
+  unique_ptr<AsyncWriter> writer(new AsyncWriter());
+  if (!writer->init(fd, depth, bufferSize))
+    return nullptr;
+  return writer;
+}
+
+/**
+ * Constructor, writer is usable after successful init.
+ */
+AsyncWriter::AsyncWriter() {
+  _fd = -1;
+  _ringFd = -1;
+  _isFile = false;
+  _offset = 0;
+  _bufferSize = 0;
+  _depth = 0;
+  _buffers = nullptr;
+  _slots = nullptr;
+  _freeSlots = nullptr;
+  _freeCount = 0;
+  _pending = 0;
+  _failures = 0;
+  _stalls = 0;
+  _sqRing = MAP_FAILED;
+  _sqRingSize = 0;
+  _cqRing = MAP_FAILED;
+  _cqRingSize = 0;
+  _sqes = MAP_FAILED;
+  _sqesSize = 0;
+}
+
+/** Destructor, waits for all queued writes. */
+AsyncWriter::~AsyncWriter() {
+  if (_ringFd != -1 && _sqes != MAP_FAILED)
+    drain();
+  if (_sqes != MAP_FAILED)
+    munmap(_sqes, _sqesSize);
+  if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+    munmap(_cqRing, _cqRingSize);
+  if (_sqRing != MAP_FAILED)
+    munmap(_sqRing, _sqRingSize);
+  if (_ringFd != -1)
+    close(_ringFd);
+  if (_buffers != nullptr)
+    allocators::deallocate(_buffers, (size_t)_depth * _bufferSize);
+  delete[] _slots;
+  delete[] _freeSlots;
+}
+
+/**
+ * @brief Queues copy of data to be written.
+ *
+ * (See AsyncWriter.hpp for more info.)
+ */
+bool AsyncWriter::write(const char *data, size_t len) {
+  if (len > _bufferSize) {
+    drain(); // keeps order of file data
+    return writeDirect(data, len);
+  }
+  reap();
+  if (_freeCount == 0) {
+    ++_stalls;
+    while (_freeCount == 0) {
+      if (!enter(_pending, 1))
+        return false;
+      reap();
+    }
+  }
+  unsigned int slot = _freeSlots[--_freeCount];
+  memcpy(_buffers + (size_t)slot * _bufferSize, data, len);
+  _slots[slot].len = len;
+  _slots[slot].done = 0;
+  _slots[slot].offset = _offset;
+  if (_isFile)
+    _offset += len;
+  queueSlot(slot);
+  if (_pending >= ASYNC_SUBMIT_BATCH)
+    submit();
+  return true;
+}
+
+/**
+ * @brief Submits all queued writes to kernel and processes finished ones without waiting.
+ *
+ * (See AsyncWriter.hpp for more info.)
+ */
+void AsyncWriter::submit() {
+  if (_pending > 0)
+    enter(_pending, 0);
+  reap();
+}
+
+/**
+ * @brief Submits all queued writes and waits until all of them are finished.
+ *
+ * (See AsyncWriter.hpp for more info.)
+ */
+void AsyncWriter::drain() {
+  reap();
+  while (inFlight() > 0) {
+    if (!enter(_pending, 1))
+      return;
+    reap();
+  }
+}
+
+/** @brief Returns number of failed writes finished since last call. */
+unsigned int AsyncWriter::takeFailures() {
+  unsigned int failures = _failures;
+  _failures = 0;
+  return failures;
+}
+
+/** @brief Returns number of writes queued or submitted and not finished yet. */
+unsigned int AsyncWriter::inFlight() const {
+  return _depth - _freeCount;
+}
+
+/** @brief Returns number of times writer waited because all buffers were in flight. */
+__u64 AsyncWriter::stalls() const {
+  return _stalls;
+}
+
+/**
+ * @brief Private method setting up io_uring instance with registered buffers and output file.
+ * On failure reason is written on stderr as warning.
+ */
+bool AsyncWriter::init(int fd, unsigned int depth, size_t bufferSize) {
+  struct stat fileStat;
+  int socketType = 0;
+  socklen_t typeLen = sizeof(socketType);
+  if (fstat(fd, &fileStat) != 0)
+    return false;
+  _isFile = S_ISREG(fileStat.st_mode);
+  bool isDatagram = S_ISSOCK(fileStat.st_mode) &&
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, &socketType, &typeLen) == 0 && socketType == SOCK_DGRAM;
+  if (!_isFile && !isDatagram) {
+    cerr << "Warning: asynchronous output supports only regular files and datagram sockets, writing synchronously." << endl;
+    return false;
+  }
+  // writes of file are placed at explicit offsets, which append flag would override,
+  // flag is not cleared here, because descriptor belongs to caller
+  int flags = _isFile ? fcntl(fd, F_GETFL) : 0;
+  if (flags == -1 || (flags & O_APPEND) != 0) {
+    cerr << "Warning: output file is opened for appending and cannot be written at offsets, writing synchronously." << endl;
+    return false;
+  }
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  _ringFd = syscall(__NR_io_uring_setup, depth, &params);
+  if (_ringFd == -1) {
+    cerr << "Warning: io_uring is not available (" << strerror(errno) << "), writing synchronously." << endl;
+    return false;
+  }
+
+  // map submission and completion rings, they share mapping on newer kernels
+  _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool isSingleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (isSingleMmap)
+    _sqRingSize = _cqRingSize = max(_sqRingSize, _cqRingSize);
+  _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+  if (_sqRing != MAP_FAILED)
+    _cqRing = isSingleMmap ? _sqRing : mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+  _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  if (_cqRing != MAP_FAILED)
+    _sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+  if (_sqes == MAP_FAILED) {
+    cerr << "Warning: io_uring rings cannot be mapped (" << strerror(errno) << "), writing synchronously." << endl;
+    return false;
+  }
+  char *sq = (char *)_sqRing;
+  char *cq = (char *)_cqRing;
+  _sqHead = (unsigned int *)(sq + params.sq_off.head);
+  _sqTail = (unsigned int *)(sq + params.sq_off.tail);
+  _sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+  _sqArray = (unsigned int *)(sq + params.sq_off.array);
+  _cqHead = (unsigned int *)(cq + params.cq_off.head);
+  _cqTail = (unsigned int *)(cq + params.cq_off.tail);
+  _cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+  _cqes = cq + params.cq_off.cqes;
+
+  // each slot has at most one submission, so depth cannot exceed submission ring
+  _depth = min(depth, params.sq_entries);
+  _bufferSize = bufferSize;
+  _buffers = (char *)allocators::allocate((size_t)_depth * _bufferSize);
+  _slots = new SSlot[_depth];
+  _freeSlots = new unsigned int[_depth];
+  struct iovec *buffers = new struct iovec[_depth];
+  for (unsigned int i = 0; i < _depth; ++i) {
+    buffers[i].iov_base = _buffers + (size_t)i * _bufferSize;
+    buffers[i].iov_len = _bufferSize;
+    _freeSlots[i] = _depth - 1 - i;
+  }
+  _freeCount = _depth;
+  int isRegistered = syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_BUFFERS, buffers, _depth);
+  delete[] buffers;
+  if (isRegistered == 0)
+    isRegistered = syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_FILES, &fd, 1);
+  if (isRegistered != 0) {
+    cerr << "Warning: io_uring buffers cannot be registered (" << strerror(errno) << "), writing synchronously." << endl;
+    return false;
+  }
+
+  // file is continued from its current end
+  if (_isFile) {
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end == -1) {
+      cerr << "Warning: output file cannot be written at offsets (" << strerror(errno) << "), writing synchronously." << endl;
+      return false;
+    }
+    _offset = end;
+  }
+  _fd = fd;
+  DWRITE("AsyncWriter: io_uring with " << _depth << " buffers of " << _bufferSize << " B");
+  return true;
+}
+
+/**
+ * @brief Private method queueing write of not yet written part of slot buffer.
+ */
+void AsyncWriter::queueSlot(unsigned int slot) {
+  const SSlot &actSlot = _slots[slot];
+  unsigned int tail = *_sqTail;
+  unsigned int index = tail & *_sqMask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)_sqes + index;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = 0; // index of registered file
+  sqe->addr = (__u64)(unsigned long)(_buffers + (size_t)slot * _bufferSize + actSlot.done);
+  sqe->len = actSlot.len - actSlot.done;
+  sqe->off = _isFile ? actSlot.offset + actSlot.done : 0;
+  sqe->buf_index = slot;
+  sqe->user_data = slot;
+  _sqArray[index] = index;
+  __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+  ++_pending;
+}
+
+/**
+ * @brief Private method submitting queued writes and waiting for given number of finished ones.
+ */
+bool AsyncWriter::enter(unsigned int toSubmit, unsigned int minComplete) {
+  int result;
+  do {
+    result = syscall(__NR_io_uring_enter, _ringFd, toSubmit, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+  } while (result == -1 && errno == EINTR);
+  _pending = *_sqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+  if (result == -1) {
+    cerr << "Error: io_uring_enter failed: " << strerror(errno) << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Private method processing finished writes, short writes of file are queued again.
+ */
+void AsyncWriter::reap() {
+  unsigned int head = *_cqHead;
+  unsigned int tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe *cqe = (const struct io_uring_cqe *)_cqes + (head & *_cqMask);
+    unsigned int slot = cqe->user_data;
+    SSlot &actSlot = _slots[slot];
+    if (cqe->res > 0)
+      actSlot.done += cqe->res;
+    if (cqe->res > 0 && actSlot.done < actSlot.len && _isFile) {
+      queueSlot(slot);
+      continue;
+    }
+    if (actSlot.done < actSlot.len)
+      ++_failures;
+    _freeSlots[_freeCount++] = slot;
+  }
+  __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Private method writing data longer than buffer synchronously.
+ */
+bool AsyncWriter::writeDirect(const char *data, size_t len) {
+  if (!_isFile)
+    return ::write(_fd, data, len) == (ssize_t)len;
+  while (len > 0) {
+    ssize_t written = pwrite(_fd, data, len, _offset);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    len -= written;
+    _offset += written;
+  }
+  return true;
+}
@@ -0,0 +1,120 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    AsyncWriter.hpp
+ * @brief   Asynchronous writes of exported statistics through io_uring.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <linux/types.h>
+
+#define ASYNC_SUBMIT_BATCH    16    // queued writes are submitted to kernel at least after this many
+
+/**
+ * @brief Writes data to one file descriptor asynchronously by io_uring.
+ *
+ * Each write is copied into free one of registered buffers and queued,
+ * caller waits only when all buffers are still in flight, so slow syslog
+ * collector or disk shows up as in-flight depth instead of blocking capture.
+ * Output descriptor is registered as fixed file.
+ *
+ * Datagram sockets get one datagram per write. Regular files are written at
+ * explicit offsets, starting at end of file when writer is created, so writes
+ * may complete in any order and short writes are resubmitted. Such writes do
+ * not append: file must not be opened with O_APPEND (writer is not created
+ * then, flags of caller's descriptor are never changed) and nobody else may
+ * write the file while writer exists, otherwise data are overwritten. Other
+ * outputs (pipes, stream sockets) keep order only when written synchronously,
+ * so writer is not created for them.
+ *
+ * Writer has to be used by one thread at a time.
+ */
+class AsyncWriter {
+public:
+  /**
+   * @brief Creates writer of given output.
+   *
+   * @param fd          output file descriptor (regular file without O_APPEND or datagram socket),
+   *                    it stays owned by caller and must be open while writer exists
+   * @param depth       number of registered buffers, maximal number of writes in flight
+   * @param bufferSize  size of each buffer, longer writes are written synchronously
+   * @return std::unique_ptr<AsyncWriter>  nullptr when kernel does not support io_uring
+   *                                       or output is not supported, reason is written on stderr
+   */
+  static std::unique_ptr<AsyncWriter> create(int fd, unsigned int depth, size_t bufferSize);
+
+  /** Destructor, waits for all queued writes. */
+  ~AsyncWriter();
+
+  /**
+   * @brief Queues copy of data to be written.
+   *
+   * @return false when write could not be queued or written, error is written on stderr.
+   *         Failures of queued writes are reported later by takeFailures.
+   */
+  bool write(const char *data, size_t len);
+
+  /** @brief Submits all queued writes to kernel and processes finished ones without waiting. */
+  void submit();
+
+  /** @brief Submits all queued writes and waits until all of them are finished. */
+  void drain();
+
+  /** @brief Returns number of failed writes finished since last call. */
+  unsigned int takeFailures();
+
+  /** @brief Returns number of writes queued or submitted and not finished yet. */
+  unsigned int inFlight() const;
+
+  /** @brief Returns number of times writer waited because all buffers were in flight. */
+  __u64 stalls() const;
+
+private: /* private implementation is documented in *.cpp file */
+  struct SSlot {
+    size_t len;       // bytes of data in buffer
+    size_t done;      // bytes already written
+    __u64 offset;     // file offset of buffer, unused for sockets
+  };
+
+  int _fd;
+  int _ringFd;
+  bool _isFile;
+  __u64 _offset;          // end of file after all queued writes
+  size_t _bufferSize;
+  unsigned int _depth;
+  char *_buffers;         // depth buffers of bufferSize bytes
+  SSlot *_slots;
+  unsigned int *_freeSlots;
+  unsigned int _freeCount;
+  unsigned int _pending;  // queued and not submitted SQEs
+  unsigned int _failures;
+  __u64 _stalls;
+
+  // mapped rings of io_uring instance
+  void *_sqRing;
+  size_t _sqRingSize;
+  void *_cqRing;
+  size_t _cqRingSize;
+  void *_sqes;
+  size_t _sqesSize;
+  unsigned int *_sqHead;
+  unsigned int *_sqTail;
+  unsigned int *_sqMask;
+  unsigned int *_sqArray;
+  unsigned int *_cqHead;
+  unsigned int *_cqTail;
+  unsigned int *_cqMask;
+  void *_cqes;
+
+  AsyncWriter();
+  bool init(int fd, unsigned int depth, size_t bufferSize);
+  void queueSlot(unsigned int slot);
+  bool enter(unsigned int toSubmit, unsigned int minComplete);
+  void reap();
+  bool writeDirect(const char *data, size_t len);
+};
@@ -0,0 +1,234 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    ClientTracker.cpp
+ * \brief   Bounded tracking of clients receiving most DNS answers (top talkers).
+ *          Implementation of ClientTracker.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "utils.hpp"
+#include "ClientTracker.hpp"
+#include "DNSStatistic.hpp"
+
+using namespace std;
+
+/* IPv4 addresses are stored as IPv4-mapped IPv6 addresses with this prefix */
+static const __u8 glb_client_mappedPrefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+/**
+ * @brief Supportive function hashing 16 byte address by finalizer of MurmurHash3.
+ */
+static inline __u32 addrHash(const __u8 *addr) {
+  __u64 high, low;
+  memcpy(&high, addr, 8);
+  memcpy(&low, addr + 8, 8);
+  __u64 hash = high * 0x9e3779b97f4a7c15ull ^ low;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return (__u32)hash;
+}
+
+/**
+ * @brief Supportive function composing readable address, IPv4-mapped addresses are written as IPv4.
+ */
+static string addrToString(const __u8 *addr) {
+  char buffer[INET6_ADDRSTRLEN];
+  bool isIpv4 = memcmp(addr, glb_client_mappedPrefix, sizeof(glb_client_mappedPrefix)) == 0;
+  if (inet_ntop(isIpv4 ? AF_INET : AF_INET6, isIpv4 ? addr + 12 : addr, buffer, sizeof(buffer)) == nullptr)
+    return "";
+  return buffer;
+}
+
+/**
+ * Constructor
+ */
+ClientTracker::ClientTracker(unsigned int capacity) {
+  _capacity = max(1u, min(capacity, (unsigned int)CLIENT_MAX_TRACKED));
+  _clients.reserve(_capacity);
+  size_t slotCount = 1;
+  while (slotCount < 2 * (size_t)_capacity)
+    slotCount *= 2;
+  _slots.assign(slotCount, 0);
+  _slotMask = slotCount - 1;
+}
+
+/**
+ * @brief Adds answers and bytes of response received by client.
+ *
+ * (See ClientTracker.hpp for more info.)
+ */
+void ClientTracker::add(const __u8 *addr, __u64 answers, __u64 bytes) {
+  __u32 slot = findSlot(addr);
+  if (_slots[slot] != 0) {
+    size_t index = _slots[slot] - 1;
+    _clients[index].answers += answers;
+    _clients[index].bytes += bytes;
+    siftDown(index);
+    return;
+  }
+
+  if (_clients.size() < _capacity) {
+    SClient client;
+    memcpy(client.addr, addr, sizeof(client.addr));
+    client.answers = answers;
+    client.bytes = bytes;
+    client.slot = slot;
+    _clients.push_back(client);
+    _slots[slot] = _clients.size();
+    siftUp(_clients.size() - 1);
+    return;
+  }
+
+  // client with fewest answers is replaced, new one inherits its count
+  SClient &minimum = _clients[0];
+  removeSlot(minimum.slot);
+  slot = findSlot(addr); // removal could shift slots
+  memcpy(minimum.addr, addr, sizeof(minimum.addr));
+  minimum.answers += answers;
+  minimum.bytes = bytes;
+  minimum.slot = slot;
+  _slots[slot] = 1;
+  siftDown(0);
+}
+
+/**
+ * @brief Adds count of exported client record, other records are ignored.
+ */
+void ClientTracker::addRecord(const SDnsAnswerRecord &record, __u64 count) {
+  if (record.typeString != CLIENT_RECORD_TYPE)
+    return;
+  __u8 addr[16];
+  memcpy(addr, glb_client_mappedPrefix, sizeof(glb_client_mappedPrefix));
+  if (inet_pton(AF_INET, record.domainName.c_str(), addr + 12) != 1 && inet_pton(AF_INET6, record.domainName.c_str(), addr) != 1)
+    return;
+  if (record.answerData == CLIENT_DATA_ANSWERS)
+    add(addr, count, 0);
+  else if (record.answerData == CLIENT_DATA_BYTES)
+    add(addr, 0, count);
+}
+
+/**
+ * @brief Adds counters of all clients of other tracker to this one.
+ */
+void ClientTracker::merge(const ClientTracker &other) {
+  for (const auto &client : other._clients)
+    add(client.addr, client.answers, client.bytes);
+}
+
+/**
+ * @brief Appends records of tracked clients ordered by answers.
+ */
+void ClientTracker::appendRecords(StatRecordVector &records) const {
+  vector<const SClient *> order;
+  order.reserve(_clients.size());
+  for (const auto &client : _clients)
+    order.push_back(&client);
+  sort(order.begin(), order.end(), [](const SClient *a, const SClient *b) { return a->answers > b->answers; });
+
+  records.reserve(records.size() + recordCount());
+  SDnsStatRecord rec;
+  memset(&rec.answerRec.header, 0, sizeof(SDnsAnswerHeader));
+  rec.answerRec.typeString = CLIENT_RECORD_TYPE;
+  rec.variance = 0;
+  for (const SClient *client : order) {
+    rec.answerRec.domainName = addrToString(client->addr);
+    rec.answerRec.answerData = CLIENT_DATA_ANSWERS;
+    rec.count = (unsigned int)min(client->answers, (__u64)UINT_MAX);
+    records.push_back(rec);
+    rec.answerRec.answerData = CLIENT_DATA_BYTES;
+    rec.count = (unsigned int)min(client->bytes, (__u64)UINT_MAX);
+    records.push_back(rec);
+  }
+}
+
+/** @brief Returns number of records appendRecords would append. */
+size_t ClientTracker::recordCount() const {
+  return 2 * _clients.size();
+}
+
+/**
+ * @brief Returns estimate of memory used by tracker in bytes.
+ */
+size_t ClientTracker::memoryUsage() const {
+  return _clients.capacity() * sizeof(SClient) + _slots.capacity() * sizeof(__u32);
+}
+
+/**
+ * @brief Private method returning slot of address or empty slot where it belongs.
+ */
+__u32 ClientTracker::findSlot(const __u8 *addr) const {
+  __u32 slot = addrHash(addr) & _slotMask;
+  while (_slots[slot] != 0 && memcmp(_clients[_slots[slot] - 1].addr, addr, 16) != 0)
+    slot = (slot + 1) & _slotMask;
+  return slot;
+}
+
+/**
+ * @brief Private method emptying slot, following slots of same probe
+ * sequence are shifted back, so lookups need no deleted markers.
+ */
+void ClientTracker::removeSlot(__u32 slot) {
+  __u32 hole = slot;
+  for (__u32 next = (hole + 1) & _slotMask; _slots[next] != 0; next = (next + 1) & _slotMask) {
+    __u32 home = addrHash(_clients[_slots[next] - 1].addr) & _slotMask;
+    // entry can move to hole when hole lies between its home slot and its slot
+    if (((next - home) & _slotMask) >= ((next - hole) & _slotMask)) {
+      _slots[hole] = _slots[next];
+      _clients[_slots[hole] - 1].slot = hole;
+      hole = next;
+    }
+  }
+  _slots[hole] = 0;
+}
+
+/**
+ * @brief Private method swapping two clients in heap and updating their slots.
+ */
+void ClientTracker::swapClients(size_t a, size_t b) {
+  swap(_clients[a], _clients[b]);
+  _slots[_clients[a].slot] = a + 1;
+  _slots[_clients[b].slot] = b + 1;
+}
+
+/**
+ * @brief Private method moving client towards heap root while its parent has more answers.
+ */
+void ClientTracker::siftUp(size_t index) {
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (_clients[parent].answers <= _clients[index].answers)
+      return;
+    swapClients(parent, index);
+    index = parent;
+  }
+}
+
+/**
+ * @brief Private method moving client towards heap leaves while a child has fewer answers.
+ */
+void ClientTracker::siftDown(size_t index) {
+  while (true) {
+    size_t smallest = index;
+    size_t left = 2 * index + 1;
+    size_t right = left + 1;
+    if (left < _clients.size() && _clients[left].answers < _clients[smallest].answers)
+      smallest = left;
+    if (right < _clients.size() && _clients[right].answers < _clients[smallest].answers)
+      smallest = right;
+    if (smallest == index)
+      return;
+    swapClients(index, smallest);
+    index = smallest;
+  }
+}
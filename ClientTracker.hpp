@@ -0,0 +1,100 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    ClientTracker.hpp
+ * @brief   Bounded tracking of clients receiving most DNS answers (top talkers).
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+#include "allocators.hpp"
+
+struct SDnsStatRecord;
+typedef std::vector<SDnsStatRecord, HugePageAllocator<SDnsStatRecord>> StatRecordVector; // see DNSStatistic.hpp
+
+#define CLIENT_MAX_TRACKED    1048576     // maximal number of tracked clients
+#define CLIENT_RECORD_TYPE    "CLIENT"    // type string of exported client records
+#define CLIENT_DATA_ANSWERS   "answers"   // data of record with answer count of client
+#define CLIENT_DATA_BYTES     "bytes"     // data of record with bytes of DNS messages of client
+
+/*
+ * Exported records ("domain type data count"), clients ordered by answers:
+ *   192.0.2.1 CLIENT answers 1234      answers received by client
+ *   192.0.2.1 CLIENT bytes 98765       bytes of DNS responses received by client
+ *
+ * Records loaded back (e.g. from snapshot) are added to tracked clients.
+ */
+
+/**
+ * @brief Top-N clients by received answers with their answer and byte counters.
+ *
+ * Clients are tracked by Space-Saving algorithm: when all slots are taken,
+ * client with fewest answers is replaced by new one which inherits its
+ * answer count, so counts are upper estimates and every client with more
+ * than 1/N of all answers is guaranteed to be tracked. Bytes are counted
+ * since client got its slot. Slots are kept in binary min-heap by answers
+ * and found by open addressing table of 16 byte addresses, so each response
+ * costs one hash lookup and a few heap swaps and memory is fixed by N.
+ */
+class ClientTracker {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param capacity  number of tracked clients (N), 1 to CLIENT_MAX_TRACKED
+   */
+  explicit ClientTracker(unsigned int capacity);
+
+  /**
+   * @brief Adds answers and bytes of response received by client.
+   */
+  void add(const __u8 *addr, __u64 answers, __u64 bytes);
+
+  /**
+   * @brief Adds count of exported client record (CLIENT_RECORD_TYPE), other records are ignored.
+   */
+  void addRecord(const SDnsAnswerRecord &record, __u64 count);
+
+  /**
+   * @brief Adds counters of all clients of other tracker to this one.
+   */
+  void merge(const ClientTracker &other);
+
+  /**
+   * @brief Appends records of tracked clients ordered by answers.
+   */
+  void appendRecords(StatRecordVector &records) const;
+
+  /** @brief Returns number of records appendRecords would append. */
+  size_t recordCount() const;
+
+  /** @brief Returns estimate of memory used by tracker in bytes. */
+  size_t memoryUsage() const;
+
+private: /* private implementation is documented in *.cpp file */
+  struct SClient {
+    __u8 addr[16];
+    __u64 answers;
+    __u64 bytes;
+    __u32 slot;     // index to _slots
+  };
+
+  unsigned int _capacity;
+  std::vector<SClient, HugePageAllocator<SClient>> _clients;  // min-heap by answers
+  std::vector<__u32, HugePageAllocator<__u32>> _slots;        // index to _clients + 1 or 0 for empty slot
+  __u32 _slotMask;
+
+  __u32 findSlot(const __u8 *addr) const;
+  void removeSlot(__u32 slot);
+  void swapClients(size_t a, size_t b);
+  void siftUp(size_t index);
+  void siftDown(size_t index);
+};
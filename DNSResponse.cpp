@@ -21,6 +21,7 @@
 #include <netinet/in.h>
 
 #include "DNSResponse.hpp"
+#include "DomainFilter.hpp"
 #include "utils.hpp"
 
 using namespace std;
@@ -36,31 +37,57 @@ using namespace std;
  */
 bool DNSResponse::parse(const unsigned char *packet) {
 
-  answers.clear();
+  // answers of previous response are kept for reuse instead of being destroyed
+  while (!answers.empty()) {
+    _spareAnswers.push_back(move(answers.back()));
+    answers.pop_back();
+  }
+  _lastError = DNS_PARSE_OK;
 
-  if (packet == nullptr)
+  if (packet == nullptr) {
+    _lastError = DNS_PARSE_NULL;
     return false;
+  }
 
   _beginOfPacket = (unsigned char *)packet;
 
   SDnsHeader mainHeader = parseDnsHeader(_beginOfPacket);
   // check if header is reasonable
   if ((mainHeader.flags & 0x7f) != 0) // check of reserved zeros and zero error codes
-    return false;
-  if ((mainHeader.flags & 0x8000) == 0) // we care only about responses
-    return false;
+    _lastError = DNS_PARSE_BAD_FLAGS;
+  else if ((mainHeader.flags & 0x8000) == 0) // we care only about responses
+    _lastError = DNS_PARSE_NOT_RESPONSE;
   // rough data check: we proceeds if amount of data is reasonable and fits to 1500
-  if (mainHeader.questions > 100 ||
+  else if (mainHeader.questions > 100 ||
       mainHeader.ansversRRs > 100 ||
       mainHeader.authorityRRs > 100 ||
       mainHeader.additionalRRs > 100 )
-    return false;
-  if (mainHeader.ansversRRs < 1) // nothing to do if there aren't any ansvers
-    return false;
-  if (!resolveAnswers(mainHeader.ansversRRs))
-    return false; // error
+    _lastError = DNS_PARSE_BAD_COUNTS;
+  else if (mainHeader.ansversRRs < 1) // nothing to do if there aren't any ansvers
+    _lastError = DNS_PARSE_NO_ANSWERS;
+  else if (mainHeader.questions > 0 && !isQuestionWanted()) // unwanted zones are dropped before answers are decoded
+    _lastError = DNS_PARSE_FILTERED;
+  else if (!resolveAnswers(mainHeader.ansversRRs))
+    _lastError = DNS_PARSE_BAD_ANSWER; // error
+
+  return _lastError == DNS_PARSE_OK;
+}
 
-  return true;
+/**
+ * @brief Returns reason why last call of parse method failed.
+ *
+ * (See DNSResponse.hpp for more info.)
+ */
+EDnsParseError DNSResponse::lastParseError() const {
+  return _lastError;
+}
+
+/**
+ * @brief Private method checking name of first question by active domain filter.
+ */
+bool DNSResponse::isQuestionWanted() const {
+  const DomainFilter *filter = DomainFilter::active();
+  return filter == nullptr || filter->isWanted(_beginOfPacket + DNS_HEADER_SIZE, DOMAIN_FILTER_MAX_NAME);
 }
 
 /**
@@ -172,12 +199,20 @@ bool DNSResponse::resolveAnswers(unsigned short count) {
     if (ansHeader.recClass != 1 || ansHeader.dataLen > 1400)
       return false;
 
-    SDnsAnswerRecord answerRec = createAnswerRecord(ansHeader, actPointerToPacket);
+    if (_spareAnswers.empty())
+      answers.emplace_back();
+    else {
+      answers.push_back(move(_spareAnswers.back()));
+      _spareAnswers.pop_back();
+    }
+    createAnswerRecord(ansHeader, actPointerToPacket, answers.back());
 
     #ifndef INCLUDE_UNKNOWN
-    if (answerRec.answerData != "???")
+    if (answers.back().answerData == "???") {
+      _spareAnswers.push_back(move(answers.back()));
+      answers.pop_back();
+    }
     #endif
-    answers.push_back(answerRec);
     actPointerToPacket += ansHeader.dataLen + DNS_ASWER_HEADER_SIZE;
   }
   return true;
@@ -189,10 +224,21 @@ bool DNSResponse::resolveAnswers(unsigned short count) {
  * (See DNSResponse.hpp for more info.)
  */
 string DNSResponse::readDomainName(const unsigned short offsetOfName, unsigned int *length) {
+  string result;
+  readDomainName(offsetOfName, result, length);
+  return result;
+}
+
+/**
+ * @brief Resolves domain name coded inside of DNS response into given string.
+ *
+ * (See DNSResponse.hpp for more info.)
+ */
+void DNSResponse::readDomainName(const unsigned short offsetOfName, string &result, unsigned int *length) {
   unsigned short actOffset = offsetOfName;
   unsigned char actChar = 0;
   bool wasJump = false;
-  string result = "";
+  result.clear();
   DPRINTF("readDomainName on offset: %d | ", (int)offsetOfName);
   while ((actChar = _beginOfPacket[actOffset]) != 0) {
     DPRINTF("%02x ", actChar);
@@ -210,29 +256,27 @@ string DNSResponse::readDomainName(const unsigned short offsetOfName, unsigned i
     }
     // char signalizing number of octets
     else if (actChar < 64) {
-      char label[64];
       ++actOffset;
-      // read corresponding number of octets
-      memcpy(label, _beginOfPacket + actOffset, actChar);
-      actOffset += actChar;
       if (length != nullptr && !wasJump) {
         *length += actChar + 1;
       }
-      label[actChar] = 0;
       if (!result.empty())
-        result += ".";
-      result += string(label);
+        result += '.';
+      // read corresponding number of octets, label ends on first zero octet as before
+      const char *label = (const char *)_beginOfPacket + actOffset;
+      result.append(label, strnlen(label, actChar));
+      actOffset += actChar;
     }
     // we shouldn't get anything but ptr or number of next label octets
     else {
-      return "error";
+      result.assign("error");
+      return;
     }
   }
   // we reached zero character
   if (length != nullptr && !wasJump)
     *length +=  1;
   DWRITE(""); // \n
-  return result;
 }
 
 /**
@@ -240,76 +284,102 @@ string DNSResponse::readDomainName(const unsigned short offsetOfName, unsigned i
  *
  * (See DNSResponse.hpp for more info.)
  */
-SDnsAnswerRecord DNSResponse::createAnswerRecord(SDnsAnswerHeader answerHeader, const unsigned char *actPointerToAnswer) {
-  SDnsAnswerRecord resultRecord;
+void DNSResponse::createAnswerRecord(SDnsAnswerHeader answerHeader, const unsigned char *actPointerToAnswer, SDnsAnswerRecord &resultRecord) {
   resultRecord.header = answerHeader;
-  resultRecord.domainName = readDomainName(answerHeader.domainNameOffset);
-  resultRecord.answerData = "???";
+  readDomainName(answerHeader.domainNameOffset, resultRecord.domainName);
+  resultRecord.answerData.assign("???");
 
   unsigned short offsetToData = actPointerToAnswer - _beginOfPacket + DNS_ASWER_HEADER_SIZE;
 
   switch (answerHeader.type) {
     case DNS_RECTYPE_A: {
-      resultRecord.typeString = "A";
+      resultRecord.typeString.assign("A");
       struct in_addr *address = (struct in_addr *)(actPointerToAnswer + DNS_ASWER_HEADER_SIZE);
-      resultRecord.answerData = string(inet_ntoa(*address));
+      resultRecord.answerData.assign(inet_ntoa(*address));
     } break;
     case DNS_RECTYPE_NS:
-      resultRecord.typeString = "NS";
+      resultRecord.typeString.assign("NS");
       // to next function we need to calculate offset of data from the begining of the packet
-      resultRecord.answerData  = readDomainName(offsetToData);
+      readDomainName(offsetToData, resultRecord.answerData);
       break;
     case DNS_RECTYPE_AAAA: {
-      resultRecord.typeString = "AAAA";
+      resultRecord.typeString.assign("AAAA");
       struct in6_addr *address = (struct in6_addr *)(actPointerToAnswer + DNS_ASWER_HEADER_SIZE);
       char buff[INET6_ADDRSTRLEN];
-      resultRecord.answerData = string(inet_ntop(AF_INET6, address, buff, INET6_ADDRSTRLEN));
+      resultRecord.answerData.assign(inet_ntop(AF_INET6, address, buff, INET6_ADDRSTRLEN));
     } break;
     case DNS_RECTYPE_CNAME:
-      resultRecord.typeString = "CNAME";
-      resultRecord.answerData  = readDomainName(offsetToData);
+      resultRecord.typeString.assign("CNAME");
+      readDomainName(offsetToData, resultRecord.answerData);
       break;
     case DNS_RECTYPE_MX:
-      resultRecord.typeString = "MX";
+      resultRecord.typeString.assign("MX");
       // same as in CNAME + 2 bytes of preference
-      resultRecord.answerData  = readDomainName(offsetToData + 2);
+      readDomainName(offsetToData + 2, resultRecord.answerData);
       break;
     case DNS_RECTYPE_SOA:
-      resultRecord.typeString = "SOA";
-      resultRecord.answerData = getSoaPayload(_beginOfPacket + offsetToData);
+      resultRecord.typeString.assign("SOA");
+      getSoaPayload(_beginOfPacket + offsetToData, resultRecord.answerData);
       break;
     case DNS_RECTYPE_TXT:
-      resultRecord.typeString = "TXT";
-      resultRecord.answerData = readTextData(_beginOfPacket + offsetToData, answerHeader.dataLen);
+      resultRecord.typeString.assign("TXT");
+      readTextData(_beginOfPacket + offsetToData, answerHeader.dataLen, resultRecord.answerData);
       break;
     case DNS_RECTYPE_SPF:
-      resultRecord.typeString = "SPF";
-      resultRecord.answerData = readTextData(_beginOfPacket + offsetToData, answerHeader.dataLen);
+      resultRecord.typeString.assign("SPF");
+      readTextData(_beginOfPacket + offsetToData, answerHeader.dataLen, resultRecord.answerData);
       break;
     case DNS_RECTYPE_RSIG:
-      resultRecord.typeString = "RSIG";
-      resultRecord.answerData = getRsicPayload(_beginOfPacket + offsetToData);
+      resultRecord.typeString.assign("RSIG");
+      getRsicPayload(_beginOfPacket + offsetToData, resultRecord.answerData);
       break;
     case DNS_RECTYPE_DNSKEY:
-      resultRecord.typeString = "DNSKEY";
-      resultRecord.answerData = getDnskeyOrDSPayload(_beginOfPacket + offsetToData, answerHeader.dataLen);
+      resultRecord.typeString.assign("DNSKEY");
+      getDnskeyOrDSPayload(_beginOfPacket + offsetToData, answerHeader.dataLen, resultRecord.answerData);
       break;
     case DNS_RECTYPE_DS:
-      resultRecord.typeString = "DS";
-      resultRecord.answerData = getDnskeyOrDSPayload(_beginOfPacket + offsetToData, answerHeader.dataLen);
+      resultRecord.typeString.assign("DS");
+      getDnskeyOrDSPayload(_beginOfPacket + offsetToData, answerHeader.dataLen, resultRecord.answerData);
       break;
     case DNS_RECTYPE_NSEC:
-      resultRecord.typeString = "NSEC";
-      resultRecord.answerData  = readDomainName(offsetToData);
+      resultRecord.typeString.assign("NSEC");
+      readDomainName(offsetToData, resultRecord.answerData);
       break;
     default:
       resultRecord.typeString = STREAM_TO_STR("unknown(" << (int)answerHeader.type << ")");
   }
 
-  return resultRecord;
 }
 
 
+/**
+ * @brief Supportive function appending unsigned number in base 10 or 16 zero
+ * padded to given width, same as formatting of number by output stream.
+ */
+static void appendNumber(string &result, unsigned int value, unsigned int base = 10, unsigned int width = 1) {
+  char digits[10];
+  unsigned int pos = sizeof(digits);
+  do {
+    digits[--pos] = "0123456789abcdef"[value % base];
+    value /= base;
+  } while (value != 0);
+  while (sizeof(digits) - pos < width)
+    digits[--pos] = '0';
+  result.append(digits + pos, sizeof(digits) - pos);
+}
+
+/**
+ * @brief Supportive function appending signed decimal number.
+ */
+static void appendSigned(string &result, int value) {
+  if (value < 0) {
+    result += '-';
+    appendNumber(result, 0u - (unsigned int)value);
+  } else {
+    appendNumber(result, value);
+  }
+}
+
 /**
  * @brief Private method to parse data of DNSKEY or DS answer
  *
@@ -317,34 +387,36 @@ SDnsAnswerRecord DNSResponse::createAnswerRecord(SDnsAnswerHeader answerHeader,
  *
  * @param firstCharOfData pointer to the first char of data in answer
  * @param len             expected length of data to correctly resolve Public Key or Digest
- * @return string         data summarize as string in quotes
+ * @param result          filled with data summarize as string in quotes
  */
-string DNSResponse::getDnskeyOrDSPayload(const unsigned char *firstCharOfData, unsigned short len) {
+void DNSResponse::getDnskeyOrDSPayload(const unsigned char *firstCharOfData, unsigned short len, string &result) {
   unsigned char *actDataChar = (unsigned char *)firstCharOfData;
-  stringstream resStream;
-  resStream << "\"";
+  result.assign("\"");
 
   // DNSKEY/DS
 
   // flags/Key Tag   2B
-  resStream << "0x" << setfill('0') << setw(4) << hex << ntohs(*((unsigned short *)(actDataChar))) << " ";
+  result.append("0x");
+  appendNumber(result, ntohs(*((unsigned short *)(actDataChar))), 16, 4);
+  result += ' ';
   actDataChar += sizeof(__u16);
 
-  // protocol/Algorithm  1B
-  resStream << (int)(*((char *)(actDataChar))) << " ";
+  // protocol/Algorithm  1B (in hex as rest of data)
+  appendNumber(result, (int)(*((char *)(actDataChar))), 16);
+  result += ' ';
   actDataChar += sizeof(char);
 
   // algorithm/Digest Type 1B
-  resStream << (int)(*((char *)(actDataChar))) << " ";
+  appendNumber(result, (int)(*((char *)(actDataChar))), 16);
+  result += ' ';
   actDataChar += sizeof(char);
 
   // Public Key/Digest
   for (int i = 0; i < actDataChar - firstCharOfData + len; ++i) {
-    resStream << hex << std::setfill('0') << std::setw(2) << static_cast<unsigned>(actDataChar[i]);
+    appendNumber(result, actDataChar[i], 16, 2);
   }
 
-  resStream << "\"";
-  return resStream.str();
+  result += '"';
 }
 
 /**
@@ -354,103 +426,112 @@ string DNSResponse::getDnskeyOrDSPayload(const unsigned char *firstCharOfData, u
  *
  * @param firstCharOfData pointer to the first char of data in answer
  * @param len             expected length of data to correctly load text
- * @return string         data summarize as string in quotes
+ * @param result          filled with data summarize as string in quotes
  */
-string DNSResponse::readTextData(const unsigned char *firstCharOfData, unsigned short len) {
-  stringstream resStream;
-  resStream << "\"";
-  for (unsigned short i = 0; i < len; ++i)
-    resStream << firstCharOfData[i];
-  resStream << "\"";
-  return resStream.str();
+void DNSResponse::readTextData(const unsigned char *firstCharOfData, unsigned short len, string &result) {
+  result.assign("\"");
+  result.append((const char *)firstCharOfData, len);
+  result += '"';
 }
 
 /**
  * @brief Private method to parse data of SOA answer
  *
  * @param firstCharOfData pointer to the first char of data in answer
- * @return string         data summarize as string in quotes
+ * @param result          filled with data summarize as string in quotes
  */
-string DNSResponse::getSoaPayload(const unsigned char *firstCharOfData) {
+void DNSResponse::getSoaPayload(const unsigned char *firstCharOfData, string &result) {
   unsigned char *actDataChar = (unsigned char *)firstCharOfData;
   unsigned int length = 0;
-  stringstream resStream;
-  resStream << "\"";
+  result.assign("\"");
 
   // domain of primary name server
-  resStream << readDomainName(actDataChar - _beginOfPacket, &length) << " ";
+  readDomainName(actDataChar - _beginOfPacket, _nameBuffer, &length);
+  result.append(_nameBuffer);
+  result += ' ';
   actDataChar += length;
 
   // domain of responsible authority mail box
-  resStream << readDomainName(actDataChar - _beginOfPacket, &length) << " ";
+  readDomainName(actDataChar - _beginOfPacket, _nameBuffer, &length);
+  result.append(_nameBuffer);
+  result += ' ';
   actDataChar += length;
 
   // serial number 4B
-  resStream << ntohs(*((__u32 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u32);
 
   // REFRESH 4B
-  resStream << ntohs(*((__u32 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u32);
 
   // RETRY 4B
-  resStream << ntohs(*((__u32 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u32);
 
   // EXPIRE 4B
-  resStream << ntohs(*((__u32 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u32);
 
   // MINIMUM 4B
-  resStream << ntohs(*((__u32 *)(actDataChar)));
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
   actDataChar += sizeof(__u32);
 
-  resStream << "\"";
-  return resStream.str();
+  result += '"';
 }
 
 /**
  * @brief Private method to parse data of RSIG answer
  *
  * @param firstCharOfData pointer to the first char of data in answer
- * @return string         data summarize as string in quotes
+ * @param result          filled with data summarize as string in quotes
  */
-string DNSResponse::getRsicPayload(const unsigned char *firstCharOfData) {
+void DNSResponse::getRsicPayload(const unsigned char *firstCharOfData, string &result) {
   unsigned char *actDataChar = (unsigned char *)firstCharOfData;
-  stringstream resStream;
-  resStream << "\"";
+  result.assign("\"");
 
   // type covered 2B
-  resStream << ntohs(*((__u16 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u16 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u16);
 
   // alghorithm 1B
-  resStream << (int)(*((char *)(actDataChar))) << " ";
+  appendSigned(result, (int)(*((char *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(char);
 
   // labels 1B
-  resStream << (int)(*((char *)(actDataChar))) << " ";
+  appendSigned(result, (int)(*((char *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(char);
 
   // orig TTL 4B
-  resStream << ntohs(*((__u32 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u32);
 
   // Signature Expiration 4B
-  resStream << ntohs(*((__u32 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u32);
 
   // Signature Inception 4B
-  resStream << ntohs(*((__u32 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u32 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u32);
 
   // keytag 2B
-  resStream << ntohs(*((__u16 *)(actDataChar))) << " ";
+  appendNumber(result, ntohs(*((__u16 *)(actDataChar))));
+  result += ' ';
   actDataChar += sizeof(__u16);
 
   // Signer's Name domain ...
-  resStream << readDomainName(actDataChar - _beginOfPacket);
+  readDomainName(actDataChar - _beginOfPacket, _nameBuffer);
+  result.append(_nameBuffer);
 
-  resStream << "\"";
-  return resStream.str();
+  result += '"';
 }
@@ -28,6 +28,21 @@
 #define DNS_RECTYPE_DS              43 // DS      - The record used to identify the DNSSEC signing key of a delegated zone.
 #define DNS_RECTYPE_NSEC            47 // NSEC    - Part of DNSSEC—used to prove a name does not exist.
 
+/**
+ * @brief Reasons why DNSResponse::parse rejected packet.
+ */
+enum EDnsParseError {
+  DNS_PARSE_OK = 0,
+  DNS_PARSE_NULL,           /*!< no data were given */
+  DNS_PARSE_BAD_FLAGS,      /*!< reserved bits or error code are not zero */
+  DNS_PARSE_NOT_RESPONSE,   /*!< QR bit is not set */
+  DNS_PARSE_BAD_COUNTS,     /*!< section counts are not reasonable */
+  DNS_PARSE_NO_ANSWERS,     /*!< response does not carry any answers */
+  DNS_PARSE_FILTERED,       /*!< question name is excluded by domain filter (see DomainFilter.hpp) */
+  DNS_PARSE_BAD_ANSWER,     /*!< answer header is corrupted */
+  DNS_PARSE_ERROR_COUNT     /*!< number of values in this enum */
+};
+
 /**
  * @brief Structure for parsing DNS header
  */
@@ -73,6 +88,9 @@ class DNSResponse {
 public:
   /**
    * @brief Vector of answers parsed from one DNS response packet.
+   *
+   * Answers are kept until next parse, which reuses them (also when their
+   * strings were moved away) for answers of next response.
    */
   std::vector<SDnsAnswerRecord> answers;
 
@@ -87,10 +105,18 @@ public:
    * @return true   on successfull parse of all answers in DNS response packet
    * @return false  on any discovered data corruption or inconsistency
    *                or packet is not DNS response
-   *                or response does not carry any answers.
+   *                or response does not carry any answers
+   *                or question name is excluded by domain filter (see DomainFilter.hpp).
    */
   bool parse(const unsigned char *packet);
 
+  /**
+   * @brief Returns reason why last call of parse method failed.
+   *
+   * @return EDnsParseError DNS_PARSE_OK when last parse was successful.
+   */
+  EDnsParseError lastParseError() const;
+
   /**
    * @brief Parsing raw data to SDnsHeader structure
    *
@@ -135,6 +161,14 @@ public:
    */
   std::string readDomainName(const unsigned short offsetOfName, unsigned int *lenght = nullptr);
 
+  /**
+   * @brief Resolves domain name coded inside of DNS response into given string.
+   *
+   * Same as readDomainName above, but result replaces content of given string
+   * and reuses its allocated capacity.
+   */
+  void readDomainName(const unsigned short offsetOfName, std::string &result, unsigned int *lenght = nullptr);
+
   /**
    * @brief Resolves DNS answer data to DNS answer record.
    *
@@ -142,18 +176,25 @@ public:
    * Resolves data to which asked domain translates to.
    * Also get string representation of DNS record type.
    *
+   * Record is filled in place, so strings of record reused from previous
+   * response keep their capacity and most answers are resolved without allocation.
+   *
    * @param answerHeader        resolved dns ansver header structure
    * @param actPointerToAnswer  pointer to beginign af actual answer
-   * @return SDnsAnswerRecord   fully resolved answer record
+   * @param resultRecord        record to be filled with fully resolved answer
    * If type is unknown or fails to be resolved, it will translated to unknown(<number of unknown type>)
    * If data fails to be resolved "???" string is filled.
    */
-  SDnsAnswerRecord createAnswerRecord(SDnsAnswerHeader answerHeader, const unsigned char *actPointerToAnswer);
+  void createAnswerRecord(SDnsAnswerHeader answerHeader, const unsigned char *actPointerToAnswer, SDnsAnswerRecord &resultRecord);
 
 private: /* private implementation is documented in *.cpp file */
   unsigned char *_beginOfPacket;
-  std::string getDnskeyOrDSPayload(const unsigned char *firstCharOfData, unsigned short len);
-  std::string readTextData(const unsigned char *firstCharOfData, unsigned short len);
-  std::string getSoaPayload(const unsigned char *firstCharOfData);
-  std::string getRsicPayload(const unsigned char *firstCharOfData);
+  EDnsParseError _lastError = DNS_PARSE_OK;
+  std::vector<SDnsAnswerRecord> _spareAnswers; // records of previous responses reused with capacity of their strings
+  std::string _nameBuffer;                      // domain names read inside answer data, reused to avoid allocation
+  void getDnskeyOrDSPayload(const unsigned char *firstCharOfData, unsigned short len, std::string &result);
+  void readTextData(const unsigned char *firstCharOfData, unsigned short len, std::string &result);
+  void getSoaPayload(const unsigned char *firstCharOfData, std::string &result);
+  void getRsicPayload(const unsigned char *firstCharOfData, std::string &result);
+  bool isQuestionWanted() const;
 };
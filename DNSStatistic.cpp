@@ -11,28 +11,67 @@
 
 #include <iostream>
 #include <string>
-#include <sstream>
 #include <vector>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <string.h>
+#include <math.h>
 
 #include "utils.hpp"
 #include "DNSStatistic.hpp"
+#include "perfStats.hpp"
+#include "metrics.hpp"
+#include "StatisticExporter.hpp"
+#include "ZoneRollup.hpp"
+#include "DistinctCounter.hpp"
+#include "ClientTracker.hpp"
+#include "AsyncWriter.hpp"
 
 #define SYSLOG_PORT_NUMBER_TXT "514"  // port of syslog server
 #define MAX_SEND_ERRORS_IN_ROW 5      // maximal number of errors that are allowed to occur while
                                       // sending list of statistics to syslog server.
+#define SYSLOG_ASYNC_DEPTH     256    // datagrams in flight when sent asynchronously
+#define SYSLOG_ASYNC_BUFFER    2048   // longer datagrams are sent synchronously
+#define EVICT_STEP_RECORDS     8      // records checked by eviction after each added record
+#define EVICT_OVER_CAP_RECORDS 64     // records checked when memory cap is exceeded
 
 using namespace std;
 
+/**
+ * @brief Supportive function hashing key of record 8 bytes at once,
+ * mixed by finalizer of MurmurHash3.
+ */
+static inline __u32 keyHash(const char *key, size_t len) {
+  __u64 hash = 0x9e3779b97f4a7c15ull ^ len;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __u64 word;
+    memcpy(&word, key + i, 8);
+    hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+    hash ^= hash >> 32;
+  }
+  __u64 tail = 0;
+  memcpy(&tail, key + i, len - i);
+  hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return (__u32)hash;
+}
+
 /** Constructor */
 DNSStatistic::DNSStatistic() {
   _isSyslogInitialized = false;
   _syslogSocket = 0;
   _localAddrString = "";
+  _stringBytes = 0;
+  _deadKeyBytes = 0;
+  _isBuiltChanged = false;
+  _expiryFloor = 0;
+  _memoryCap = 0;
+  _clockHand = 0;
+  _now = 0;
 }
 
 /** Destructor */
@@ -45,21 +84,8 @@ DNSStatistic::~DNSStatistic() {
  *
  * (See DNSStatistic.hpp for more info.)
  */
-void DNSStatistic::addAnswerRecord(const SDnsAnswerRecord& record) {
-  bool isNew = true;
-  for (unsigned int i = 0; i < _statistics.size(); ++i) {
-    SDnsStatRecord *actRec = &(_statistics[i]);
-    if (actRec->answerRec.domainName     == record.domainName &&
-        actRec->answerRec.answerData == record.answerData &&
-        actRec->answerRec.typeString     == record.typeString) {
-      actRec->count++;
-      isNew = false;
-      break;
-    }
-  }
-
-  if (isNew)
-    _statistics.push_back({ record, 1 });
+void DNSStatistic::addAnswerRecord(const SDnsAnswerRecord& record, unsigned int count) {
+  addStatRecord(record, count, 0);
 }
 
 /**
@@ -67,11 +93,571 @@ void DNSStatistic::addAnswerRecord(const SDnsAnswerRecord& record) {
  *
  * (See DNSStatistic.hpp for more info.)
  */
-void DNSStatistic::addAnswerRecords(const std::vector<SDnsAnswerRecord>& records) {
+void DNSStatistic::addAnswerRecords(const std::vector<SDnsAnswerRecord>& records, unsigned int weight, const SDnsClient *client) {
+  countAnswers(records, weight, client);
+  if (weight > 1) {
+    for (auto &rec : records)
+      addStatRecord(rec, weight, (__u64)weight * (weight - 1));
+    return;
+  }
   for (auto &rec : records)
     addAnswerRecord(rec);
 }
 
+/**
+ * @brief Adds vector of SDnsAnswerRecords to statistics, records creating new
+ * statistic records are moved from.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::addAnswerRecords(std::vector<SDnsAnswerRecord>& records, unsigned int weight, const SDnsClient *client) {
+  countAnswers(records, weight, client);
+  __u64 variance = (__u64)weight * (weight - 1);
+  for (auto &rec : records)
+    addStatRecord(rec, weight, variance, &rec);
+}
+
+/**
+ * @brief Private method passing answers of one response to client tracking and distinct counting.
+ */
+void DNSStatistic::countAnswers(const std::vector<SDnsAnswerRecord>& records, unsigned int weight, const SDnsClient *client) {
+  if (client != nullptr && client->time > _now)
+    _now = client->time;
+  if (_clients != nullptr && client != nullptr) {
+    _clients->add(client->addr, (__u64)records.size() * weight, (__u64)client->bytes * weight);
+    _isBuiltChanged = true;
+  }
+  if (_distinct != nullptr) {
+    _distinct->add(records, client != nullptr ? client->addr : nullptr);
+    _isBuiltChanged = true;
+  }
+}
+
+/**
+ * @brief Adds all records of other statistics to this one, counts of same records are summed.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::mergeStatistics(const DNSStatistic& other) {
+  _now = max(_now, other._now);
+  if (_distinct != nullptr && other._distinct != nullptr) {
+    _distinct->merge(*other._distinct);
+    _isBuiltChanged = true;
+  }
+  if (_clients != nullptr && other._clients != nullptr) {
+    _clients->merge(*other._clients);
+    _isBuiltChanged = true;
+  }
+  if (_rollup != nullptr && other._rollup != nullptr) {
+    _rollup->merge(*other._rollup);
+    _isBuiltChanged = true;
+    return;
+  }
+  // built records of other are needed only when it counts differently
+  for (const auto &rec : other._rollup == nullptr ? StatRecords(other._statistics) : other.getStatistics())
+    addStatRecord(rec.answerRec, rec.count, rec.variance);
+}
+
+/**
+ * @brief Returns all statistic records in order of their first occurrence.
+ */
+StatRecords DNSStatistic::getStatistics() const {
+  if (_rollup == nullptr && _clients == nullptr && _distinct == nullptr)
+    return StatRecords(_statistics);
+  if (_isBuiltChanged) {
+    _builtStatistics.clear();
+    if (_rollup != nullptr)
+      _rollup->appendRecords(_builtStatistics);
+    if (_clients != nullptr)
+      _clients->appendRecords(_builtStatistics);
+    if (_distinct != nullptr)
+      _distinct->appendRecords(_builtStatistics);
+    _isBuiltChanged = false;
+  }
+  return StatRecords(_statistics, _builtStatistics); // table is empty in rollup mode
+}
+
+/**
+ * @brief Returns table of exactly counted records without records built from them.
+ */
+const StatRecordVector &DNSStatistic::getRecordTable() const {
+  return _statistics;
+}
+
+/**
+ * @brief Returns number of records getStatistics would return without building them.
+ */
+size_t DNSStatistic::recordCount() const {
+  return
+    (_rollup != nullptr ? _rollup->recordCount() : _statistics.size()) +
+    (_clients != nullptr ? _clients->recordCount() : 0) +
+    (_distinct != nullptr ? _distinct->recordCount() : 0);
+}
+
+/**
+ * @brief Switches statistics to rollup mode.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::setRollup(unsigned int depth) {
+  _rollup.reset(new ZoneRollup(depth));
+  _isBuiltChanged = true;
+}
+
+/**
+ * @brief Enables estimation of distinct counts.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::setDistinctCounting(unsigned int zoneDepth) {
+  _distinct.reset(new DistinctCounter(zoneDepth));
+  _isBuiltChanged = true;
+}
+
+/**
+ * @brief Merges registers of exported distinct estimate into its estimator.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::addDistinctRegisters(const SDnsAnswerRecord &record, const __u8 *registers) {
+  if (_distinct == nullptr)
+    return;
+  _distinct->mergeRegisters(record, registers);
+  _isBuiltChanged = true;
+}
+
+/**
+ * @brief Returns registers of estimator of exported distinct estimate.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+const __u8 *DNSStatistic::getDistinctRegisters(const SDnsAnswerRecord &record) const {
+  return _distinct != nullptr ? _distinct->getRegisters(record) : nullptr;
+}
+
+/**
+ * @brief Enables tracking of answers and bytes received by top clients.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::setClientTracking(unsigned int capacity) {
+  _clients.reset(new ClientTracker(capacity));
+  _isBuiltChanged = true;
+}
+
+/**
+ * @brief Enables eviction of records.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::setEviction(unsigned int expiryFloor, size_t memoryCap) {
+  _expiryFloor = expiryFloor;
+  _memoryCap = memoryCap;
+  if (_expiryFloor > 0 || _memoryCap > 0)
+    _recordStates.resize(_statistics.size(), { 0, true });
+  else
+    _recordStates.clear();
+}
+
+/**
+ * @brief Preallocates space for given number of statistic records.
+ */
+void DNSStatistic::reserve(size_t recordCount) {
+  _statistics.reserve(recordCount);
+  _recordKeys.reserve(recordCount);
+  if (recordCount * 2 > _slots.size())
+    growSlots(recordCount * 2);
+  if (!_recordStates.empty() || _expiryFloor > 0 || _memoryCap > 0)
+    _recordStates.reserve(recordCount);
+}
+
+/**
+ * @brief Returns estimate of memory used by statistic records and their index in bytes.
+ *
+ * Allocator overhead and short strings stored inside of string objects are not counted exactly.
+ */
+size_t DNSStatistic::memoryUsage() const {
+  size_t builtUsage =
+    _builtStatistics.capacity() * sizeof(SDnsStatRecord) +
+    (_clients != nullptr ? _clients->memoryUsage() : 0) +
+    (_distinct != nullptr ? _distinct->memoryUsage() : 0);
+  if (_rollup != nullptr)
+    return _rollup->memoryUsage() + builtUsage;
+  return
+    builtUsage +
+    _statistics.capacity() * sizeof(SDnsStatRecord) +
+    _recordStates.capacity() * sizeof(SRecordState) +
+    _recordKeys.capacity() * sizeof(SRecordKey) +
+    _slots.capacity() * sizeof(__u32) +
+    _keys.capacity() +
+    _stringBytes;
+}
+
+/**
+ * @brief Private method composing key identifying statistic record from its domain name, type and data.
+ */
+void DNSStatistic::recordKey(const SDnsAnswerRecord& record, string &key) {
+  key.clear();
+  key.reserve(record.domainName.size() + record.typeString.size() + record.answerData.size() + 2);
+  key += record.domainName;
+  key += '\0';
+  key += record.typeString;
+  key += '\0';
+  key += record.answerData;
+}
+
+/**
+ * @brief Private method creating new record in statistics or adding count to existing one.
+ *
+ * Key is composed in reused buffer and looked up in index before anything is
+ * inserted, so counting already known record does not allocate. Keys of new
+ * records are appended to arena, index and arena are backed by huge pages,
+ * so lookup touches no memory of general heap. When movedRecord is not
+ * nullptr (it is the same record as given one) it is moved into new record
+ * instead of being copied.
+ */
+void DNSStatistic::addStatRecord(const SDnsAnswerRecord& record, unsigned int count, __u64 variance, SDnsAnswerRecord *movedRecord) {
+  // estimates cannot be summed, they are merged only with their estimators
+  if (record.typeString == DISTINCT_RECORD_TYPE)
+    return;
+  _isBuiltChanged = true;
+  if (_clients != nullptr && record.typeString == CLIENT_RECORD_TYPE) {
+    _clients->addRecord(record, count);
+    return;
+  }
+  if (_rollup != nullptr) {
+    _rollup->add(record, count);
+    return;
+  }
+  recordKey(record, _keyBuffer);
+  bool isInserted;
+  size_t index = findOrAddKey(_keyBuffer.data(), _keyBuffer.size(), isInserted);
+  __u32 timeToLive = record.header.timeToLive;
+  if (isInserted) {
+    if (movedRecord != nullptr)
+      _statistics.push_back({ move(*movedRecord), count, variance });
+    else
+      _statistics.push_back({ record, count, variance });
+  }
+  else {
+    _statistics[index].count += count;
+    _statistics[index].variance += variance;
+  }
+  touchRecord(index, isInserted, timeToLive);
+}
+
+/**
+ * @brief Adds records given by their keys.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::addKeyedRecords(const vector<SKeyedRecord> &records) {
+  // strictly ascending keys cannot repeat, special records are added the usual way at end
+  bool isUnique = _statistics.empty() && _rollup == nullptr;
+  const SKeyedRecord *previous = nullptr;
+  size_t keyBytes = 0;
+  for (size_t i = 0; isUnique && i < records.size(); ++i) {
+    const SKeyedRecord &rec = records[i];
+    if (isSpecialRecord(rec))
+      continue;
+    if (previous != nullptr) {
+      int cmp = memcmp(previous->key, rec.key, min(previous->keyLen, rec.keyLen));
+      isUnique = cmp < 0 || (cmp == 0 && previous->keyLen < rec.keyLen);
+    }
+    previous = &rec;
+    keyBytes += rec.keyLen;
+  }
+  if (!isUnique) {
+    for (const auto &rec : records)
+      addKeyedRecord(rec);
+    return;
+  }
+
+  // records are appended and index is built at once, its probes do not wait for each other
+  _keys.reserve(_keys.size() + keyBytes);
+  reserve(records.size());
+  for (const auto &rec : records) {
+    if (isSpecialRecord(rec))
+      continue;
+    appendKey(rec.key, rec.keyLen, keyHash(rec.key, rec.keyLen));
+    appendKeyedRecord(rec);
+  }
+  growSlots(max((size_t)STAT_INDEX_MIN_SLOTS, (_statistics.size() + 1) * 2));
+  _isBuiltChanged = true;
+  if (_expiryFloor > 0 || _memoryCap > 0) {
+    for (const auto &rec : _statistics) {
+      __u32 timeToLive = rec.answerRec.header.timeToLive;
+      _recordStates.push_back({ _now > 0 ? _now + max(timeToLive, (__u32)_expiryFloor) : 0, true });
+    }
+    for (size_t i = 0; i < _statistics.size(); ++i)
+      evictStep();
+  }
+  for (const auto &rec : records) {
+    if (isSpecialRecord(rec))
+      addKeyedRecord(rec);
+  }
+}
+
+/**
+ * @brief Private method adding one record given by its key, records not
+ * counted in table (rollup, clients and estimates) take the usual way.
+ */
+void DNSStatistic::addKeyedRecord(const SKeyedRecord &record) {
+  if (_rollup != nullptr || isSpecialRecord(record)) {
+    size_t dataPos = record.domainLen + record.typeLen + 2;
+    SDnsAnswerRecord answer;
+    answer.header = record.header;
+    answer.domainName.assign(record.key, record.domainLen);
+    answer.typeString.assign(record.key + record.domainLen + 1, record.typeLen);
+    answer.answerData.assign(record.key + dataPos, record.keyLen - dataPos);
+    addStatRecord(answer, record.count, 0);
+    return;
+  }
+  _isBuiltChanged = true;
+  bool isInserted;
+  size_t index = findOrAddKey(record.key, record.keyLen, isInserted);
+  if (isInserted)
+    appendKeyedRecord(record);
+  else
+    _statistics[index].count += record.count;
+  touchRecord(index, isInserted, record.header.timeToLive);
+}
+
+/**
+ * @brief Private method returning true for exported records of client tracking
+ * and distinct counting, they are added the usual way.
+ */
+bool DNSStatistic::isSpecialRecord(const SKeyedRecord &record) {
+  const char *typeString = record.key + record.domainLen + 1;
+  return
+    (record.typeLen == strlen(DISTINCT_RECORD_TYPE) && memcmp(typeString, DISTINCT_RECORD_TYPE, record.typeLen) == 0) ||
+    (record.typeLen == strlen(CLIENT_RECORD_TYPE) && memcmp(typeString, CLIENT_RECORD_TYPE, record.typeLen) == 0);
+}
+
+/**
+ * @brief Private method appending record with key already appended by appendKey
+ * to table, its strings are created directly from key.
+ */
+void DNSStatistic::appendKeyedRecord(const SKeyedRecord &record) {
+  size_t dataPos = record.domainLen + record.typeLen + 2;
+  _statistics.emplace_back();
+  SDnsStatRecord &rec = _statistics.back();
+  rec.answerRec.header = record.header;
+  rec.answerRec.domainName.assign(record.key, record.domainLen);
+  rec.answerRec.typeString.assign(record.key + record.domainLen + 1, record.typeLen);
+  rec.answerRec.answerData.assign(record.key + dataPos, record.keyLen - dataPos);
+  rec.count = record.count;
+  rec.variance = 0;
+}
+
+/**
+ * @brief Private method returning index of record with given key. Key of new
+ * record is appended to arena and indexed, caller has to append the record
+ * to _statistics when isInserted is set.
+ */
+size_t DNSStatistic::findOrAddKey(const char *key, size_t keyLen, bool &isInserted) {
+  __u32 hash = keyHash(key, keyLen);
+  if ((_statistics.size() + 1) * 2 > _slots.size())
+    growSlots(max((size_t)STAT_INDEX_MIN_SLOTS, (_statistics.size() + 1) * 2));
+  __u32 slot = findSlot(key, keyLen, hash);
+  isInserted = _slots[slot] == 0;
+  if (!isInserted)
+    return _slots[slot] - 1;
+  _slots[slot] = _statistics.size() + 1;
+  appendKey(key, keyLen, hash);
+  return _statistics.size();
+}
+
+/**
+ * @brief Private method appending key of record which will be appended to
+ * table into arena, key is not indexed.
+ */
+void DNSStatistic::appendKey(const char *key, size_t keyLen, __u32 hash) {
+  _stringBytes += keyLen - 2;
+  _recordKeys.push_back({ _keys.size(), (__u32)keyLen, hash });
+  _keys.insert(_keys.end(), key, key + keyLen);
+}
+
+/**
+ * @brief Private method updating eviction state of added or counted record
+ * and running one step of eviction.
+ */
+void DNSStatistic::touchRecord(size_t index, bool isInserted, __u32 timeToLive) {
+  if (_expiryFloor == 0 && _memoryCap == 0)
+    return;
+  if (isInserted)
+    _recordStates.push_back({ 0, true });
+  SRecordState &state = _recordStates[index];
+  state.isReferenced = true;
+  if (_now > 0)
+    state.expiresAt = _now + max(timeToLive, (__u32)_expiryFloor);
+  evictStep();
+}
+
+/**
+ * @brief Private method returning slot of index holding record with given key,
+ * or empty slot where such record would be inserted.
+ */
+__u32 DNSStatistic::findSlot(const char *key, size_t keyLen, __u32 hash) const {
+  __u32 mask = _slots.size() - 1;
+  __u32 slot = hash & mask;
+  for (; _slots[slot] != 0; slot = (slot + 1) & mask) {
+    const SRecordKey &recKey = _recordKeys[_slots[slot] - 1];
+    if (recKey.hash == hash && recKey.len == keyLen && memcmp(_keys.data() + recKey.offset, key, keyLen) == 0)
+      break;
+  }
+  return slot;
+}
+
+/**
+ * @brief Private method returning slot of index holding record with given index.
+ */
+__u32 DNSStatistic::findSlotOf(size_t index) const {
+  __u32 mask = _slots.size() - 1;
+  __u32 slot = _recordKeys[index].hash & mask;
+  while (_slots[slot] != index + 1)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+/**
+ * @brief Private method emptying slot of index by backward shift, following
+ * entries of its probe sequence are moved closer to their home slots.
+ */
+void DNSStatistic::removeSlot(__u32 slot) {
+  __u32 mask = _slots.size() - 1;
+  __u32 hole = slot;
+  for (__u32 next = (hole + 1) & mask; _slots[next] != 0; next = (next + 1) & mask) {
+    __u32 home = _recordKeys[_slots[next] - 1].hash & mask;
+    // entry can move to hole when hole lies between its home slot and its slot
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      _slots[hole] = _slots[next];
+      hole = next;
+    }
+  }
+  _slots[hole] = 0;
+}
+
+/**
+ * @brief Private method resizing index to power of two of at least minSlots
+ * slots, records are inserted again by their stored hashes.
+ */
+void DNSStatistic::growSlots(size_t minSlots) {
+  size_t size = STAT_INDEX_MIN_SLOTS;
+  while (size < minSlots)
+    size *= 2;
+  _slots.assign(size, 0);
+  __u32 mask = size - 1;
+  for (size_t i = 0; i < _recordKeys.size(); ++i) {
+    __u32 slot = _recordKeys[i].hash & mask;
+    while (_slots[slot] != 0)
+      slot = (slot + 1) & mask;
+    _slots[slot] = i + 1;
+  }
+}
+
+/**
+ * @brief Private method removing keys of evicted records from arena, keys of
+ * remaining records are moved to its beginning in order of records.
+ */
+void DNSStatistic::compactKeys() {
+  vector<char, HugePageAllocator<char>> keys;
+  keys.reserve(_keys.size() - _deadKeyBytes);
+  for (SRecordKey &recKey : _recordKeys) {
+    size_t offset = keys.size();
+    keys.insert(keys.end(), _keys.begin() + recKey.offset, _keys.begin() + recKey.offset + recKey.len);
+    recKey.offset = offset;
+  }
+  _keys.swap(keys);
+  _deadKeyBytes = 0;
+}
+
+/**
+ * @brief Private method returning estimated memory of records and their index,
+ * unlike memoryUsage it does not count unused capacity, so it drops with evictions.
+ */
+size_t DNSStatistic::recordsMemory() const {
+  return
+    _statistics.size() * (sizeof(SDnsStatRecord) + sizeof(SRecordState) + sizeof(SRecordKey)) +
+    _slots.size() * sizeof(__u32) +
+    _keys.size() - _deadKeyBytes +
+    _stringBytes;
+}
+
+/**
+ * @brief Private method checking EVICT_STEP_RECORDS records under clock hand,
+ * or EVICT_OVER_CAP_RECORDS when memory cap is exceeded.
+ *
+ * Expired records are evicted. While memory cap is exceeded, records with
+ * cleared CLOCK bit are evicted and set bits are cleared, so records used
+ * since last pass of hand get second chance.
+ */
+void DNSStatistic::evictStep() {
+  bool isOverCap = _memoryCap > 0 && recordsMemory() > _memoryCap;
+  unsigned int budget = isOverCap ? EVICT_OVER_CAP_RECORDS : EVICT_STEP_RECORDS;
+  for (unsigned int i = 0; i < budget && !_statistics.empty(); ++i) {
+    if (_clockHand >= _statistics.size())
+      _clockHand = 0;
+    SRecordState &state = _recordStates[_clockHand];
+    if (state.expiresAt == 0 && _now > 0) // loaded before capture time was known
+      state.expiresAt = _now + _expiryFloor;
+    if (_expiryFloor > 0 && state.expiresAt != 0 && state.expiresAt < _now) {
+      evictRecord(_clockHand, METRICS_EVICT_EXPIRED); // last record moved under hand is checked next
+      keepMovedRecord();
+      continue;
+    }
+    if (isOverCap) {
+      if (!state.isReferenced) {
+        evictRecord(_clockHand, METRICS_EVICT_MEMORY);
+        isOverCap = recordsMemory() > _memoryCap;
+        keepMovedRecord();
+        continue;
+      }
+      state.isReferenced = false;
+    }
+    ++_clockHand;
+  }
+}
+
+/**
+ * @brief Private method giving second chance to record moved under clock hand.
+ *
+ * Moved record was the last one, so the hand may have just cleared its
+ * reference when wrapping around. Without this it would be evicted right after
+ * being cleared instead of after whole revolution of the hand.
+ */
+void DNSStatistic::keepMovedRecord() {
+  if (_clockHand < _recordStates.size())
+    _recordStates[_clockHand].isReferenced = true;
+}
+
+/**
+ * @brief Private method removing record, last record is moved to its place.
+ *
+ * Key of removed record stays in arena until keys of evicted records take
+ * more than half of it, then arena is compacted.
+ */
+void DNSStatistic::evictRecord(size_t index, EMetricsEviction reason) {
+  _stringBytes -= _recordKeys[index].len - 2;
+  _deadKeyBytes += _recordKeys[index].len;
+  removeSlot(findSlotOf(index));
+
+  size_t last = _statistics.size() - 1;
+  if (index != last) {
+    _slots[findSlotOf(last)] = index + 1;
+    _statistics[index] = move(_statistics[last]);
+    _recordStates[index] = _recordStates[last];
+    _recordKeys[index] = _recordKeys[last];
+  }
+  _statistics.pop_back();
+  _recordStates.pop_back();
+  _recordKeys.pop_back();
+  if (_deadKeyBytes * 2 > _keys.size())
+    compactKeys();
+  _isBuiltChanged = true;
+  metrics::countEviction(reason);
+}
+
 /**
  * @brief Function initialize connection to syslog server.
  *
@@ -166,28 +752,59 @@ bool DNSStatistic::initSyslogServer(const std::string& servername) {
 void DNSStatistic::deinitSyslogServer() {
   DWRITE("deinitSyslogServer()");
   if (_isSyslogInitialized) {
+    if (_syslogWriter != nullptr) {
+      _syslogWriter->drain();
+      unsigned int failCnt = _syslogWriter->takeFailures();
+      if (failCnt > 0)
+        cerr << "Warning: " << failCnt << " queued statistics failed to send to syslog server." << endl;
+      _syslogWriter.reset();
+    }
     close(_syslogSocket);
     _syslogSocket = 0;
     _isSyslogInitialized = false;
   }
 }
 
+/**
+ * @brief Sends datagrams to syslog server asynchronously by io_uring.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+void DNSStatistic::enableAsyncSyslog() {
+  if (!_isSyslogInitialized)
+    return;
+  _syslogWriter = AsyncWriter::create(_syslogSocket, SYSLOG_ASYNC_DEPTH, SYSLOG_ASYNC_BUFFER);
+  if (_syslogWriter == nullptr)
+    cerr << "Warning: statistics are sent to syslog server synchronously." << endl;
+}
+
 /**
  * @brief Send all statistics to syslog server.
  *
  * (See DNSStatistic.hpp for more info.)
  */
 bool DNSStatistic::sendToSyslog() {
+  return sendToSyslog(getStatistics());
+}
+
+/**
+ * @brief Same as sendToSyslog(), but given records are sent instead of records of this object.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+bool DNSStatistic::sendToSyslog(const StatRecords &records) {
   DWRITE("sendToSyslog ... (" << _isSyslogInitialized << ")");
   if (!_isSyslogInitialized)
     return true;
 
+  __u64 syslogBegin = metrics::now();
   string message;
   unsigned int errorCnt = 0;
   unsigned int sendCnt = 0;
 
   // for each string in statistic
-  for (const auto &rec : _statistics) {
+  for (const auto &rec : records) {
+    PERF_BEGIN(exportBegin);
     // build message
     // <local0 = 16 + Informational = 6> version = 1
     //  (16)1000      (6)110 = 134
@@ -199,8 +816,11 @@ bool DNSStatistic::sendToSyslog() {
 
     DWRITE("Sending statistic: " << message);
 
-    // send ...
-    if (write(_syslogSocket, message.c_str(), message.length()) != (int)message.length()) {
+    // send ... (only queued when sent asynchronously, its failure is counted by reapSyslog)
+    bool isSent = _syslogWriter != nullptr ?
+      _syslogWriter->write(message.c_str(), message.length()) :
+      write(_syslogSocket, message.c_str(), message.length()) == (int)message.length();
+    if (!isSent) {
       cerr << "Sending statistic to syslog server failed or partial write." << endl;
       ++errorCnt;
     }
@@ -208,39 +828,102 @@ bool DNSStatistic::sendToSyslog() {
       errorCnt = 0;
       ++sendCnt;
     }
+    PERF_END(PERF_STAGE_EXPORT, exportBegin);
 
     if (errorCnt >= MAX_SEND_ERRORS_IN_ROW) {
+      unsigned int queuedFailCnt = reapSyslog();
       cerr << "Error: Too much unsuccessful send tries in the row when reporting statistics to syslog server:" << endl;
-      cerr << "\t" <<  _statistics.size() - sendCnt << " out of " << _statistics.size() << " failed to send." << endl;
+      cerr << "\t" <<  records.size() - sendCnt << " out of " << records.size() << " failed to send." << endl;
+      metrics::recordExport(METRICS_EXPORT_SYSLOG, metrics::now() - syslogBegin, records.size() - sendCnt + queuedFailCnt, false);
       return false;
     }
   }
-  if (sendCnt != _statistics.size()) {
+  unsigned int queuedFailCnt = reapSyslog();
+  if (sendCnt != records.size() || queuedFailCnt > 0) {
     cerr << "Warning: Errors ocurred while sending statistics to syslog server:\n";
-    cerr << "\t" <<  _statistics.size() - sendCnt << " out of " << _statistics.size() << " failed to send." << endl;
+    cerr << "\t" <<  records.size() - sendCnt << " out of " << records.size() << " failed to send";
+    if (queuedFailCnt > 0)
+      cerr << ", " << queuedFailCnt << " queued ones failed later";
+    cerr << "." << endl;
   }
+  metrics::recordExport(METRICS_EXPORT_SYSLOG, metrics::now() - syslogBegin, records.size() - sendCnt + queuedFailCnt, true);
   return true;
 }
 
 /**
- * @brief Prints statistinc in specific format to stdout, each line for one statistic record.
+ * @brief Private method submitting datagrams queued by sendToSyslog without waiting
+ * for them and publishing depth of queue left by export.
+ *
+ * Datagrams still in flight finish later, their failures are counted by next export.
+ *
+ * @return number of queued datagrams which failed to send since last call,
+ *         0 when sent synchronously
  */
-void DNSStatistic::printStatistics() {
-    DWRITE("printStatistics: " << _statistics.size());
-    for (const auto &rec : _statistics) {
-      cout << statToString(rec) << endl;
-  }
+unsigned int DNSStatistic::reapSyslog() {
+  if (_syslogWriter == nullptr)
+    return 0;
+  _syslogWriter->submit();
+  metrics::setExportQueue(METRICS_EXPORT_SYSLOG, _syslogWriter->inFlight(), _syslogWriter->stalls());
+  return _syslogWriter->takeFailures();
+}
+
+/**
+ * @brief Sets exporter used by printStatistics.
+ */
+void DNSStatistic::setExporter(shared_ptr<StatisticExporter> exporter) {
+  _exporter = exporter;
+}
+
+/**
+ * @brief Exports statistics by exporter given to setExporter.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+bool DNSStatistic::printStatistics() {
+  return printStatistics(getStatistics());
+}
+
+/**
+ * @brief Same as printStatistics(), but given records are exported instead of records of this object.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+bool DNSStatistic::printStatistics(const StatRecords &records) {
+  DWRITE("printStatistics: " << records.size());
+  if (_exporter == nullptr)
+    _exporter = createStatisticExporter("text", "");
+  __u64 exportBegin = metrics::now();
+  bool isOk = _exporter != nullptr && _exporter->exportStatistics(records);
+  metrics::recordExport(METRICS_EXPORT_EXPORTER, metrics::now() - exportBegin, 0, isOk);
+  return isOk;
 }
 
 /**
  * @brief Takes record and get formated string representing one statistic record.
  */
 string DNSStatistic::statToString(const SDnsStatRecord &rec) {
-  stringstream resStream;
-  resStream <<
-    rec.answerRec.domainName      << " " <<
-    rec.answerRec.typeString      << " " <<
-    rec.answerRec.answerData  << " " <<
-    rec.count;
-  return resStream.str();
+  string count = to_string(rec.count);
+  string result;
+  result.reserve(rec.answerRec.domainName.size() + rec.answerRec.typeString.size() + rec.answerRec.answerData.size() + count.size() + 3);
+  result += rec.answerRec.domainName;
+  result += ' ';
+  result += rec.answerRec.typeString;
+  result += ' ';
+  result += rec.answerRec.answerData;
+  result += ' ';
+  result += count;
+  if (rec.variance > 0) {
+    result += " +-";
+    result += to_string(countMargin(rec));
+  }
+  return result;
+}
+
+/**
+ * @brief Returns half width of confidence interval of sampled count, 0 when count is exact.
+ *
+ * (See DNSStatistic.hpp for more info.)
+ */
+__u64 DNSStatistic::countMargin(const SDnsStatRecord &rec) {
+  return (__u64)ceil(STAT_CONFIDENCE_Z * sqrt((double)rec.variance));
 }
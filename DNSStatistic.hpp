@@ -14,17 +14,129 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <memory>
+#include <iterator>
 
 #include "DNSResponse.hpp"
+#include "metrics.hpp"
+#include "allocators.hpp"
+
+class StatisticExporter;
+class ZoneRollup;
+class DistinctCounter;
+class ClientTracker;
+class AsyncWriter;
+
+#define STAT_CONFIDENCE_Z 1.96  // z-score of reported confidence interval of sampled counts (95 %)
+#define STAT_INDEX_MIN_SLOTS 1024   // initial number of slots of index of records
 
 /**
  * @brief One record of statistics. Holding information about concrete DNS ansver
  *        record from DNSResponse module and counter to store how many times this
  *        record was reserved.
+ *
+ * When packets are sampled (see PacketSampler.hpp) count is an estimate scaled
+ * by weights of sampled packets and variance is its estimated variance
+ * (sum of w * (w - 1) over all counted answers of weight w).
  */
 struct SDnsStatRecord {
   SDnsAnswerRecord answerRec;
   unsigned int count;
+  __u64 variance;   /*!< 0 when all answers were counted */
+};
+
+/** @brief Table of statistic records, large tables are backed by huge pages (see allocators.hpp). */
+typedef std::vector<SDnsStatRecord, HugePageAllocator<SDnsStatRecord>> StatRecordVector;
+
+/**
+ * @brief Statistic record given by its key "domain\0type\0data" held elsewhere
+ *        (e.g. in mapped snapshot), see DNSStatistic::addKeyedRecords.
+ */
+struct SKeyedRecord {
+  const char *key;
+  __u32 keyLen;
+  __u16 domainLen;   /*!< length of domain name at the beginning of key */
+  __u8  typeLen;     /*!< length of type string following domain name and '\0' */
+  SDnsAnswerHeader header;
+  unsigned int count;
+};
+
+/**
+ * @brief Read only sequence of records of two tables, records of first table
+ *        followed by records of second one, tables are not copied.
+ *
+ * Used to export records of statistics together with records built from them
+ * (see DNSStatistic::getStatistics), it is valid only while both tables are
+ * not changed.
+ */
+class StatRecords {
+public:
+  /** @brief Forward iterator over records of both tables. */
+  class const_iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef SDnsStatRecord value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const SDnsStatRecord *pointer;
+    typedef const SDnsStatRecord &reference;
+
+    const_iterator(pointer pos, pointer end, pointer nextPos, pointer nextEnd) :
+      _pos(pos), _end(end), _nextPos(nextPos), _nextEnd(nextEnd) {}
+
+    reference operator*() const { return *_pos; }
+    pointer operator->() const { return _pos; }
+    const_iterator &operator++() {
+      if (++_pos == _end && _end != _nextEnd) { // continue by second table
+        _pos = _nextPos;
+        _end = _nextEnd;
+      }
+      return *this;
+    }
+    const_iterator operator++(int) { const_iterator old = *this; ++*this; return old; }
+    bool operator==(const const_iterator &other) const { return _pos == other._pos; }
+    bool operator!=(const const_iterator &other) const { return _pos != other._pos; }
+
+  private:
+    pointer _pos, _end, _nextPos, _nextEnd;
+  };
+
+  /** @brief Sequence of records of one table. */
+  StatRecords(const StatRecordVector &records) : _first(records), _second(records), _isSingle(true) {}
+
+  /** @brief Sequence of records of first table followed by records of second one. */
+  StatRecords(const StatRecordVector &first, const StatRecordVector &second) : _first(first), _second(second), _isSingle(false) {}
+
+  size_t size() const { return _first.size() + (_isSingle ? 0 : _second.size()); }
+  bool empty() const { return size() == 0; }
+
+  const_iterator begin() const {
+    const SDnsStatRecord *secondBegin = _isSingle ? recordsEnd(_first) : _second.data();
+    const SDnsStatRecord *secondEnd = _isSingle ? recordsEnd(_first) : recordsEnd(_second);
+    if (_first.empty())
+      return const_iterator(secondBegin, secondEnd, secondEnd, secondEnd);
+    return const_iterator(_first.data(), recordsEnd(_first), secondBegin, secondEnd);
+  }
+
+  const_iterator end() const {
+    const SDnsStatRecord *last = _isSingle ? recordsEnd(_first) : recordsEnd(_second);
+    return const_iterator(last, last, last, last);
+  }
+
+private:
+  const StatRecordVector &_first;
+  const StatRecordVector &_second;
+  bool _isSingle;
+
+  static const SDnsStatRecord *recordsEnd(const StatRecordVector &records) { return records.data() + records.size(); }
+};
+
+/**
+ * @brief Client which received DNS response (destination of response packet).
+ */
+struct SDnsClient {
+  __u8 addr[16];        /*!< IPv6 address or IPv4-mapped IPv6 address */
+  unsigned int bytes;   /*!< bytes of DNS message */
+  __u32 time;           /*!< capture time of response in seconds, used by record expiry */
 };
 
 /**
@@ -45,14 +157,130 @@ public:
   /**
    * @brief Adds given record to statistics.
    *
-   * Creates new record in statistics or increment counter of existing statistic record.
+   * Creates new record in statistics or increment counter of existing statistic record
+   * by given count.
    */
-  void addAnswerRecord(const SDnsAnswerRecord&);
+  void addAnswerRecord(const SDnsAnswerRecord&, unsigned int count = 1);
+
+  /**
+   * @brief Same as addAnswerRecord called for each of records, but records
+   *        are given by their keys (e.g. records of loaded snapshot).
+   *
+   * Strings of new records are created directly from keys, no temporary
+   * record or key is built. When table of statistics is empty and keys are
+   * strictly ascending (as in snapshot), no key can repeat, so records are
+   * appended without lookup and index is built once for all of them.
+   */
+  void addKeyedRecords(const std::vector<SKeyedRecord> &records);
 
   /**
    * @brief Adds vector of SDnsAnswerRecords to statistics via addAnswerRecord method.
+   *
+   * @param weight      number of answers each record stands for when packets are
+   *                    sampled, variance of records is increased accordingly
+   * @param client  client which got records, used by client tracking and
+   *                distinct counting, can be nullptr
+   */
+  void addAnswerRecords(const std::vector<SDnsAnswerRecord>&, unsigned int weight = 1, const SDnsClient *client = nullptr);
+
+  /**
+   * @brief Same as addAnswerRecords above, but records which create new statistic
+   *        records are moved into them instead of being copied. Records counted
+   *        to existing statistic records are left untouched.
+   */
+  void addAnswerRecords(std::vector<SDnsAnswerRecord>&, unsigned int weight = 1, const SDnsClient *client = nullptr);
+
+  /**
+   * @brief Adds all records of other statistics to this one, counts of same records are summed.
+   */
+  void mergeStatistics(const DNSStatistic&);
+
+  /**
+   * @brief Returns all statistic records in order of their first occurrence.
+   *
+   * Eviction (see setEviction) moves last record to place of evicted one.
+   *
+   * In rollup mode records of zones and their top children are returned
+   * (see ZoneRollup.hpp), with client tracking records of top clients follow
+   * (see ClientTracker.hpp) and with distinct counting its estimates follow
+   * (see DistinctCounter.hpp), such records are rebuilt when statistics changed.
+   * Records of table are not copied, returned sequence is valid until
+   * statistics are changed.
+   */
+  StatRecords getStatistics() const;
+
+  /**
+   * @brief Returns table of exactly counted records without records built
+   *        from them, table is empty in rollup mode.
+   */
+  const StatRecordVector &getRecordTable() const;
+
+  /**
+   * @brief Returns number of records getStatistics would return without building them.
    */
-  void addAnswerRecords(const std::vector<SDnsAnswerRecord>&);
+  size_t recordCount() const;
+
+  /**
+   * @brief Switches statistics to rollup mode, answers are counted by zones
+   *        of given depth instead of exact records (see ZoneRollup.hpp).
+   *
+   * Has to be called before any record is added.
+   */
+  void setRollup(unsigned int depth);
+
+  /**
+   * @brief Enables estimation of distinct names per zone of given depth and
+   *        distinct addresses and clients per name (see DistinctCounter.hpp).
+   *
+   * Has to be called before any record is added. Exported estimates added
+   * back as records are ignored, estimates are restored only with their
+   * registers (see addDistinctRegisters).
+   */
+  void setDistinctCounting(unsigned int zoneDepth);
+
+  /**
+   * @brief Merges HyperLogLog registers of exported DISTINCT_RECORD_TYPE record
+   *        (e.g. loaded from snapshot) into estimator of its key.
+   *
+   * Has no effect when distinct counting is disabled.
+   */
+  void addDistinctRegisters(const SDnsAnswerRecord &record, const __u8 *registers);
+
+  /**
+   * @brief Returns HLL_REGISTERS registers of estimator of exported
+   *        DISTINCT_RECORD_TYPE record, nullptr when there is none.
+   */
+  const __u8 *getDistinctRegisters(const SDnsAnswerRecord &record) const;
+
+  /**
+   * @brief Enables tracking of answers and bytes received by top clients
+   *        (see ClientTracker.hpp).
+   *
+   * @param capacity  number of tracked clients
+   */
+  void setClientTracking(unsigned int capacity);
+
+  /**
+   * @brief Enables eviction of records, it runs in small steps while records
+   *        are added, so there are no long sweeps of whole table.
+   *
+   * Records are evicted when they were not seen for max(TTL, expiryFloor)
+   * seconds of capture time and by approximate LRU (CLOCK) while their
+   * estimated memory exceeds memoryCap bytes. Has no effect in rollup mode.
+   * @param expiryFloor  minimal lifetime of record in seconds, 0 disables expiry
+   * @param memoryCap    maximal memory of records in bytes, 0 disables cap
+   */
+  void setEviction(unsigned int expiryFloor, size_t memoryCap);
+
+  /**
+   * @brief Preallocates space for given number of statistic records.
+   */
+  void reserve(size_t recordCount);
+
+  /**
+   * @brief Returns estimate of memory used by statistic records and their index in bytes.
+   */
+  size_t memoryUsage() const;
 
   /**
    * @brief Function initialize connection to syslog server.
@@ -75,6 +303,19 @@ public:
    */
   void deinitSyslogServer();
 
+  /**
+   * @brief Sends datagrams to syslog server asynchronously by io_uring.
+   *
+   * Datagrams are queued and sendToSyslog waits while queuing only when all
+   * buffers are in flight, datagrams left in flight at end of export are not
+   * waited for, their failures are counted by next export (or reported when
+   * server is disconnected).
+   * When io_uring is not available, warning is written on stderr and
+   * datagrams are sent synchronously.
+   * @note Server connection has to be initialized before.
+   */
+  void enableAsyncSyslog();
+
   /**
    * @brief Send all statistics to syslog server.
    *
@@ -94,9 +335,33 @@ public:
   bool sendToSyslog();
 
   /**
-   * @brief Prints statistinc in specific format to stdout, each line for one statistic record.
+   * @brief Same as sendToSyslog(), but given records are sent instead of
+   *        records of this object.
+   *
+   * Method does not read records of this object, so it can be called from
+   * other thread than one adding records (see PacketPipeline.hpp).
+   */
+  bool sendToSyslog(const StatRecords &records);
+
+  /**
+   * @brief Sets exporter used by printStatistics.
    */
-  void printStatistics();
+  void setExporter(std::shared_ptr<StatisticExporter>);
+
+  /**
+   * @brief Exports statistics by exporter given to setExporter.
+   *
+   * When no exporter was set, statistics are printed in specific text format
+   * to stdout, each line for one statistic record.
+   * @return false when writing of statistics failed.
+   */
+  bool printStatistics();
+
+  /**
+   * @brief Same as printStatistics(), but given records are exported instead of
+   *        records of this object, can be called from other thread as sendToSyslog(records).
+   */
+  bool printStatistics(const StatRecords &records);
 
   /**
    * @brief Takes record and get formated string representing one statistic record.
@@ -104,9 +369,65 @@ public:
    * @return std::string formated statistic record.
    */
   std::string statToString(const SDnsStatRecord &);
+
+  /**
+   * @brief Returns half width of confidence interval of sampled count
+   *        (STAT_CONFIDENCE_Z standard deviations), 0 when count is exact.
+   */
+  static __u64 countMargin(const SDnsStatRecord &);
 private:
+  struct SRecordState {
+    __u32 expiresAt;    // capture time in seconds, 0 when no capture time was known yet
+    bool isReferenced;  // CLOCK bit, set on each use of record
+  };
+
+  struct SRecordKey {
+    __u64 offset;       // position of key in _keys
+    __u32 len;
+    __u32 hash;
+  };
+
   bool _isSyslogInitialized;
   int _syslogSocket;
+  std::unique_ptr<AsyncWriter> _syslogWriter;               // nullptr when datagrams are sent synchronously
   std::string _localAddrString;
-  std::vector<SDnsStatRecord> _statistics;
+  StatRecordVector _statistics;
+  std::vector<char, HugePageAllocator<char>> _keys;         // arena of keys of records (see recordKey)
+  std::vector<SRecordKey, HugePageAllocator<SRecordKey>> _recordKeys; // parallel to _statistics
+  std::vector<__u32, HugePageAllocator<__u32>> _slots;      // open addressing index of keys, index to _statistics + 1 or 0 for empty slot
+  size_t _deadKeyBytes;                                     // bytes of keys of evicted records left in _keys
+  std::unique_ptr<ZoneRollup> _rollup;                      // nullptr when records are counted exactly
+  std::unique_ptr<DistinctCounter> _distinct;               // nullptr when distinct counting is disabled
+  std::unique_ptr<ClientTracker> _clients;                  // nullptr when clients are not tracked
+  mutable StatRecordVector _builtStatistics;     // records of rollup, clients and distinct estimates, exported after _statistics
+  mutable bool _isBuiltChanged;
+  std::vector<SRecordState, HugePageAllocator<SRecordState>> _recordStates; // parallel to _statistics when eviction is enabled
+  unsigned int _expiryFloor;
+  size_t _memoryCap;
+  size_t _clockHand;                                        // next index of _statistics checked for eviction
+  __u32 _now;                                               // latest capture time of added records
+  std::shared_ptr<StatisticExporter> _exporter;
+  size_t _stringBytes; // bytes of strings of records
+
+  std::string _keyBuffer;  // key of looked up record, reused to avoid allocation per record
+
+  static void recordKey(const SDnsAnswerRecord&, std::string &key);
+  void countAnswers(const std::vector<SDnsAnswerRecord>&, unsigned int weight, const SDnsClient *client);
+  void addStatRecord(const SDnsAnswerRecord&, unsigned int count, __u64 variance, SDnsAnswerRecord *movedRecord = nullptr);
+  static bool isSpecialRecord(const SKeyedRecord &record);
+  void addKeyedRecord(const SKeyedRecord &record);
+  void appendKeyedRecord(const SKeyedRecord &record);
+  size_t findOrAddKey(const char *key, size_t keyLen, bool &isInserted);
+  void appendKey(const char *key, size_t keyLen, __u32 hash);
+  void touchRecord(size_t index, bool isInserted, __u32 timeToLive);
+  __u32 findSlot(const char *key, size_t keyLen, __u32 hash) const;
+  __u32 findSlotOf(size_t index) const;
+  void removeSlot(__u32 slot);
+  void growSlots(size_t minSlots);
+  void compactKeys();
+  size_t recordsMemory() const;
+  void evictStep();
+  void keepMovedRecord();
+  void evictRecord(size_t index, EMetricsEviction reason);
+  unsigned int reapSyslog();
 };
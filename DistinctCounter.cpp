@@ -0,0 +1,268 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    DistinctCounter.cpp
+ * \brief   Estimation of distinct names per zone, distinct addresses per
+ *          name and distinct clients per name by HyperLogLog.
+ *          Implementation of DistinctCounter.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+
+#include "utils.hpp"
+#include "DistinctCounter.hpp"
+#include "DNSStatistic.hpp"
+#include "ZoneRollup.hpp"
+
+using namespace std;
+
+/* data strings of exported records of each kind */
+static const char *glb_distinct_kindNames[DISTINCT_KIND_COUNT] = { "names", "addresses", "clients" };
+
+/* hll::hash */
+__u64 hll::hash(const void *data, size_t len) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  __u64 hash = 14695981039346656037ull;
+  for (size_t i = 0; i < len; ++i)
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/* hll::merge */
+void hll::merge(__u8 *registers, const __u8 *other) {
+  for (unsigned int i = 0; i < HLL_REGISTERS; ++i)
+    registers[i] = max(registers[i], other[i]);
+}
+
+/* hll::estimate */
+__u64 hll::estimate(const __u8 *registers, bool *isLinear) {
+  double sum = 0;
+  unsigned int zeros = 0;
+  for (unsigned int i = 0; i < HLL_REGISTERS; ++i) {
+    sum += ldexp(1.0, -registers[i]);
+    zeros += registers[i] == 0;
+  }
+  double m = HLL_REGISTERS;
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  bool isSmall = estimate <= 2.5 * m && zeros > 0;
+  if (isSmall)
+    estimate = m * log(m / zeros); // linear counting
+  if (isLinear != nullptr)
+    *isLinear = isSmall;
+  return (__u64)llround(estimate);
+}
+
+/**
+ * Constructor
+ */
+DistinctCounter::DistinctCounter(unsigned int zoneDepth) {
+  _zoneDepth = max(1u, zoneDepth);
+  _stringBytes = 0;
+  _isLimitReported = false;
+  for (auto &estimators : _estimators)
+    estimators.slots.assign(DISTINCT_INDEX_SLOTS, 0);
+}
+
+/**
+ * @brief Adds answers of one response.
+ *
+ * Names and clients are counted once for consecutive answers of same name.
+ * (See DistinctCounter.hpp for more info.)
+ */
+void DistinctCounter::add(const vector<SDnsAnswerRecord> &answers, const __u8 *clientAddr) {
+  const string *previousName = nullptr;
+  __u8 *addresses = nullptr;
+  __u64 nameHash = 0;
+  for (const auto &answer : answers) {
+    if (previousName == nullptr || answer.domainName != *previousName) {
+      previousName = &answer.domainName;
+      _name.resize(answer.domainName.size());
+      transform(answer.domainName.begin(), answer.domainName.end(), _name.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+      nameHash = hll::hash(_name.data(), _name.size());
+
+      // zone is looked up in place, it is suffix of name
+      size_t zone = ZoneRollup::zoneOffset(_name, _zoneDepth);
+      __u64 zoneHash = zone == 0 ? nameHash : hll::hash(_name.data() + zone, _name.size() - zone);
+      __u8 *names = findOrAdd(DISTINCT_NAMES, _name.data() + zone, _name.size() - zone, zoneHash);
+      if (names != nullptr)
+        hll::add(names, nameHash);
+      if (clientAddr != nullptr) {
+        __u8 *clients = findOrAdd(DISTINCT_CLIENTS, _name.data(), _name.size(), nameHash);
+        if (clients != nullptr)
+          hll::add(clients, hll::hash(clientAddr, DISTINCT_CLIENT_SIZE));
+      }
+      addresses = nullptr;
+    }
+    if (answer.header.type == DNS_RECTYPE_A || answer.header.type == DNS_RECTYPE_AAAA) {
+      if (addresses == nullptr)
+        addresses = findOrAdd(DISTINCT_ADDRESSES, _name.data(), _name.size(), nameHash);
+      if (addresses != nullptr)
+        hll::add(addresses, hll::hash(answer.answerData.data(), answer.answerData.size()));
+    }
+  }
+}
+
+/**
+ * @brief Merges estimators of other counter into this one.
+ */
+void DistinctCounter::merge(const DistinctCounter &other) {
+  for (unsigned int kind = 0; kind < DISTINCT_KIND_COUNT; ++kind) {
+    const SEstimators &otherEstimators = other._estimators[kind];
+    for (size_t i = 0; i < otherEstimators.keys.size(); ++i) {
+      const string &key = otherEstimators.keys[i];
+      __u8 *registers = findOrAdd((EDistinctKind)kind, key.data(), key.size(), hll::hash(key.data(), key.size()));
+      if (registers != nullptr)
+        hll::merge(registers, otherEstimators.registers.data() + i * HLL_REGISTERS);
+    }
+  }
+}
+
+/**
+ * @brief Merges registers of estimator of exported record into estimator of its key.
+ *
+ * (See DistinctCounter.hpp for more info.)
+ */
+void DistinctCounter::mergeRegisters(const SDnsAnswerRecord &record, const __u8 *registers) {
+  int kind = recordKind(record);
+  if (kind < 0)
+    return;
+  const string &key = record.domainName;
+  __u8 *ownRegisters = findOrAdd((EDistinctKind)kind, key.data(), key.size(), hll::hash(key.data(), key.size()));
+  if (ownRegisters != nullptr)
+    hll::merge(ownRegisters, registers);
+}
+
+/**
+ * @brief Returns registers of estimator of exported record.
+ *
+ * (See DistinctCounter.hpp for more info.)
+ */
+const __u8 *DistinctCounter::getRegisters(const SDnsAnswerRecord &record) const {
+  int kind = recordKind(record);
+  if (kind < 0)
+    return nullptr;
+  const SEstimators &estimators = _estimators[kind];
+  const string &key = record.domainName;
+  __u32 slot = findSlot((EDistinctKind)kind, key.data(), key.size(), hll::hash(key.data(), key.size()));
+  if (estimators.slots[slot] == 0)
+    return nullptr;
+  return estimators.registers.data() + (size_t)(estimators.slots[slot] - 1) * HLL_REGISTERS;
+}
+
+/**
+ * @brief Appends estimates of all tracked keys as DISTINCT_RECORD_TYPE records.
+ *
+ * Estimates of HyperLogLog range get variance of its standard error.
+ */
+void DistinctCounter::appendRecords(StatRecordVector &records) const {
+  records.reserve(records.size() + recordCount());
+  SDnsStatRecord rec;
+  memset(&rec.answerRec.header, 0, sizeof(SDnsAnswerHeader));
+  rec.answerRec.typeString = DISTINCT_RECORD_TYPE;
+  for (unsigned int kind = 0; kind < DISTINCT_KIND_COUNT; ++kind) {
+    const SEstimators &estimators = _estimators[kind];
+    rec.answerRec.answerData = glb_distinct_kindNames[kind];
+    for (size_t i = 0; i < estimators.keys.size(); ++i) {
+      bool isLinear = false;
+      __u64 estimate = hll::estimate(estimators.registers.data() + i * HLL_REGISTERS, &isLinear);
+      double deviation = isLinear ? 0 : estimate * HLL_STANDARD_ERROR;
+      rec.answerRec.domainName = estimators.keys[i];
+      rec.count = (unsigned int)min(estimate, (__u64)UINT_MAX);
+      rec.variance = (__u64)ceil(deviation * deviation);
+      records.push_back(rec);
+    }
+  }
+}
+
+/** @brief Returns number of records appendRecords would append. */
+size_t DistinctCounter::recordCount() const {
+  size_t count = 0;
+  for (const auto &estimators : _estimators)
+    count += estimators.keys.size();
+  return count;
+}
+
+/**
+ * @brief Returns estimate of memory used by estimators in bytes.
+ */
+size_t DistinctCounter::memoryUsage() const {
+  size_t usage = _stringBytes;
+  for (const auto &estimators : _estimators) {
+    usage +=
+      estimators.registers.capacity() +
+      estimators.keys.capacity() * sizeof(string) +
+      estimators.slots.capacity() * sizeof(__u32);
+  }
+  return usage;
+}
+
+/**
+ * @brief Private method returning kind of exported DISTINCT_RECORD_TYPE record
+ * by its data, -1 for other records.
+ */
+int DistinctCounter::recordKind(const SDnsAnswerRecord &record) {
+  if (record.typeString != DISTINCT_RECORD_TYPE)
+    return -1;
+  for (int kind = 0; kind < DISTINCT_KIND_COUNT; ++kind) {
+    if (record.answerData == glb_distinct_kindNames[kind])
+      return kind;
+  }
+  return -1;
+}
+
+/**
+ * @brief Private method returning slot of index holding given key, or empty
+ * slot where it would be inserted. Index has twice as many slots as keys
+ * can be tracked, so empty slot is always found.
+ */
+__u32 DistinctCounter::findSlot(EDistinctKind kind, const char *key, size_t len, __u64 hash) const {
+  const SEstimators &estimators = _estimators[kind];
+  __u32 slot = hash & (DISTINCT_INDEX_SLOTS - 1);
+  for (; estimators.slots[slot] != 0; slot = (slot + 1) & (DISTINCT_INDEX_SLOTS - 1)) {
+    const string &slotKey = estimators.keys[estimators.slots[slot] - 1];
+    if (slotKey.size() == len && memcmp(slotKey.data(), key, len) == 0)
+      break;
+  }
+  return slot;
+}
+
+/**
+ * @brief Private method returning registers of key given by its bytes and hash,
+ * zeroed registers are added for new key. Returns nullptr when DISTINCT_MAX_KEYS
+ * keys of kind are tracked.
+ */
+__u8 *DistinctCounter::findOrAdd(EDistinctKind kind, const char *key, size_t len, __u64 hash) {
+  SEstimators &estimators = _estimators[kind];
+  __u32 slot = findSlot(kind, key, len, hash);
+  if (estimators.slots[slot] != 0)
+    return estimators.registers.data() + (size_t)(estimators.slots[slot] - 1) * HLL_REGISTERS;
+
+  if (estimators.keys.size() >= DISTINCT_MAX_KEYS) {
+    if (!_isLimitReported) {
+      cerr << "Warning: more than " << DISTINCT_MAX_KEYS << " keys of distinct " << glb_distinct_kindNames[kind] << " counts, new keys are not counted." << endl;
+      _isLimitReported = true;
+    }
+    return nullptr;
+  }
+  size_t index = estimators.keys.size();
+  estimators.slots[slot] = index + 1;
+  estimators.keys.emplace_back(key, len);
+  estimators.registers.resize(estimators.registers.size() + HLL_REGISTERS, 0);
+  _stringBytes += len;
+  return estimators.registers.data() + index * HLL_REGISTERS;
+}
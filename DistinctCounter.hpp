@@ -0,0 +1,157 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    DistinctCounter.hpp
+ * @brief   Estimation of distinct names per zone, distinct addresses per
+ *          name and distinct clients per name by HyperLogLog.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+#include "allocators.hpp"
+
+struct SDnsStatRecord;
+typedef std::vector<SDnsStatRecord, HugePageAllocator<SDnsStatRecord>> StatRecordVector; // see DNSStatistic.hpp
+
+#define HLL_PRECISION         11                      // bits of hash selecting register
+#define HLL_REGISTERS         (1u << HLL_PRECISION)   // registers (bytes) of one estimator, 2 KB
+#define HLL_STANDARD_ERROR    (1.04 / 45.254834)      // relative standard error 1.04 / sqrt(HLL_REGISTERS)
+#define DISTINCT_MAX_KEYS     16384                   // tracked keys of each kind, further keys are ignored
+#define DISTINCT_INDEX_SLOTS  (2 * DISTINCT_MAX_KEYS)   // slots of index of keys of each kind, power of two
+#define DISTINCT_RECORD_TYPE  "DISTINCT"              // type string of exported estimates
+#define DISTINCT_CLIENT_SIZE  16                      // bytes of client address (IPv6 or IPv4-mapped IPv6)
+
+/*
+ * Exported records ("domain type data count"):
+ *   example.com DISTINCT names 1234          distinct names in zone example.com
+ *   www.example.com DISTINCT addresses 3     distinct A and AAAA data of name
+ *   www.example.com DISTINCT clients 17      distinct clients which got answer for name
+ *
+ * Estimates above linear counting range carry variance of HLL_STANDARD_ERROR,
+ * so they are printed with margin as sampled counts (see DNSStatistic.hpp).
+ */
+
+/**
+ * @brief Kinds of estimated distinct counts.
+ */
+enum EDistinctKind {
+  DISTINCT_NAMES = 0,   /*!< names per zone */
+  DISTINCT_ADDRESSES,   /*!< A and AAAA data per name */
+  DISTINCT_CLIENTS,     /*!< client addresses per name */
+  DISTINCT_KIND_COUNT   /*!< number of values in this enum */
+};
+
+namespace hll {
+  /**
+   * @brief Returns 64 bit hash of data (FNV-1a mixed by finalizer of MurmurHash3).
+   */
+  __u64 hash(const void *data, size_t len);
+
+  /**
+   * @brief Adds hashed value to HLL_REGISTERS registers, first bits of hash
+   *        select register which keeps maximal rank of remaining bits.
+   */
+  inline void add(__u8 *registers, __u64 hash) {
+    __u64 rest = (hash << HLL_PRECISION) | (1ull << (HLL_PRECISION - 1)); // rank is at most 64 - precision + 1
+    __u8 rank = __builtin_clzll(rest) + 1;
+    __u8 &reg = registers[hash >> (64 - HLL_PRECISION)];
+    if (rank > reg)
+      reg = rank;
+  }
+
+  /**
+   * @brief Merges other registers into registers, result estimates union of both sets.
+   */
+  void merge(__u8 *registers, const __u8 *other);
+
+  /**
+   * @brief Returns estimated number of distinct values added to registers.
+   *
+   * @param isLinear  set to true when estimate was computed by linear counting
+   *                  (small sets), such estimates are nearly exact, can be nullptr
+   */
+  __u64 estimate(const __u8 *registers, bool *isLinear = nullptr);
+}
+
+/**
+ * @brief Fixed size HyperLogLog estimators of distinct counts kept per zone or name.
+ *
+ * Registers of all keys of each kind are stored in one arena indexed by key
+ * number, so each tracked key costs HLL_REGISTERS bytes and its name.
+ * Keys are looked up by open addressing table of key numbers directly in
+ * name of answer, so every answer costs a hash and a maximum per estimator
+ * it updates and nothing is allocated for known keys.
+ * Estimators are mergeable, merged statistics of threads or shards estimate
+ * distinct counts of all their answers. Registers are persisted in snapshots
+ * (see StatisticSnapshot.hpp), so snapshots of shards are merged too.
+ */
+class DistinctCounter {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param zoneDepth  labels of zone before public suffix (see ZoneRollup::zoneOffset)
+   */
+  explicit DistinctCounter(unsigned int zoneDepth);
+
+  /**
+   * @brief Adds answers of one response.
+   *
+   * @param clientAddr  DISTINCT_CLIENT_SIZE bytes of address of client which
+   *                    got response, nullptr when unknown
+   */
+  void add(const std::vector<SDnsAnswerRecord> &answers, const __u8 *clientAddr);
+
+  /**
+   * @brief Merges estimators of other counter into this one.
+   */
+  void merge(const DistinctCounter &other);
+
+  /**
+   * @brief Merges registers of estimator of exported DISTINCT_RECORD_TYPE
+   *        record (e.g. loaded from snapshot) into estimator of its key.
+   */
+  void mergeRegisters(const SDnsAnswerRecord &record, const __u8 *registers);
+
+  /**
+   * @brief Returns HLL_REGISTERS registers of estimator of exported
+   *        DISTINCT_RECORD_TYPE record, nullptr when its key is not tracked.
+   */
+  const __u8 *getRegisters(const SDnsAnswerRecord &record) const;
+
+  /**
+   * @brief Appends estimates of all tracked keys as DISTINCT_RECORD_TYPE records.
+   */
+  void appendRecords(StatRecordVector &records) const;
+
+  /** @brief Returns number of records appendRecords would append. */
+  size_t recordCount() const;
+
+  /** @brief Returns estimate of memory used by estimators in bytes. */
+  size_t memoryUsage() const;
+
+private: /* private implementation is documented in *.cpp file */
+  struct SEstimators {
+    std::vector<__u32> slots;       // index of keys, key number + 1 or 0 for empty slot
+    std::vector<std::string> keys;
+    std::vector<__u8> registers;    // HLL_REGISTERS registers of each key
+  };
+
+  unsigned int _zoneDepth;
+  SEstimators _estimators[DISTINCT_KIND_COUNT];
+  std::string _name;          // lower case name of actual answer
+  size_t _stringBytes;
+  bool _isLimitReported;
+
+  static int recordKind(const SDnsAnswerRecord &record);
+  __u32 findSlot(EDistinctKind kind, const char *key, size_t len, __u64 hash) const;
+  __u8 *findOrAdd(EDistinctKind kind, const char *key, size_t len, __u64 hash);
+};
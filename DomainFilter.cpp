@@ -0,0 +1,339 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    DomainFilter.cpp
+ * \brief   Allow and deny filter of DNS responses by zone of question name.
+ *          Implementation of DomainFilter.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "utils.hpp"
+#include "DomainFilter.hpp"
+
+#define FILTER_HASH_BASIS   14695981039346656037ull  // FNV-1a 64 offset basis
+#define FILTER_HASH_PRIME   1099511628211ull         // FNV-1a 64 prime
+
+using namespace std;
+
+/**
+ * Node of trie used while filter is built, flattened into DomainFilter::_nodes.
+ */
+struct SFilterBuildNode {
+  map<string, unique_ptr<SFilterBuildNode>> children;
+  EDomainFilterAction action = DOMAIN_FILTER_NONE;
+};
+
+/* active filter, replaced by install and reload thread */
+static shared_ptr<const DomainFilter> glb_domainFilter;
+/* incremented on each replacement, so threads know when to take new filter */
+static atomic<unsigned int> glb_domainFilterGeneration(0);
+
+static thread_local shared_ptr<const DomainFilter> tl_domainFilter;
+static thread_local unsigned int tl_domainFilterGeneration = 0;
+
+/**
+ * @brief Supportive function adding lower case label to hash of suffix, labels
+ * are added from the last one (TLD), so hash of every suffix is computed on the way.
+ */
+static inline __u64 hashLabel(__u64 hash, const char *label, unsigned int len) {
+  for (unsigned int i = 0; i < len; ++i)
+    hash = (hash ^ (unsigned char)label[i]) * FILTER_HASH_PRIME;
+  return (hash ^ '.') * FILTER_HASH_PRIME;
+}
+
+/**
+ * @brief Supportive function splitting text suffix into lower case labels, last label first.
+ *
+ * @return false when suffix is not valid domain name.
+ */
+static bool splitSuffix(const string &suffix, vector<string> &labels) {
+  labels.clear();
+  string name = suffix;
+  if (!name.empty() && name.back() == '.')
+    name.pop_back();
+  if (name.empty() || name.size() > DOMAIN_FILTER_MAX_NAME - 2)
+    return false;
+  size_t end = name.size();
+  while (true) {
+    size_t dot = name.rfind('.', end - 1);
+    size_t begin = dot == string::npos ? 0 : dot + 1;
+    if (end - begin < 1 || end - begin > 63)
+      return false;
+    string label = name.substr(begin, end - begin);
+    for (auto &c : label)
+      c = tolower((unsigned char)c);
+    labels.push_back(label);
+    if (dot == string::npos)
+      return true;
+    end = dot;
+  }
+}
+
+/**
+ * @brief Supportive function with main loop of thread reloading filter on SIGHUP.
+ */
+static void reloadOnSignal(string fileName) {
+  sigset_t hangup;
+  sigemptyset(&hangup);
+  sigaddset(&hangup, SIGHUP);
+  while (true) {
+    int signum = 0;
+    if (sigwait(&hangup, &signum) != 0)
+      continue;
+    shared_ptr<const DomainFilter> filter = DomainFilter::load(fileName);
+    if (filter == nullptr) {
+      cerr << "Warning: domain filter \"" << fileName << "\" not reloaded, previous filter is kept." << endl;
+      continue;
+    }
+    atomic_store(&glb_domainFilter, filter);
+    glb_domainFilterGeneration.fetch_add(1, memory_order_release);
+    DWRITE("Domain filter reloaded, suffixes: " << filter->suffixCount());
+  }
+}
+
+/**
+ * Constructor, used by load only.
+ */
+DomainFilter::DomainFilter() {
+  _bloomMask = 0;
+  _suffixCount = 0;
+  _isDefaultWanted = true;
+}
+
+/**
+ * @brief Loads filter from file.
+ *
+ * (See DomainFilter.hpp for more info.)
+ */
+shared_ptr<const DomainFilter> DomainFilter::load(const string &fileName) {
+  ifstream file(fileName);
+  if (!file.is_open()) {
+    cerr << "Cannot open domain filter \"" << fileName << "\": " << strerror(errno) << endl;
+    return nullptr;
+  }
+
+  SFilterBuildNode root;
+  size_t suffixCount = 0;
+  bool hasAllow = false;
+  vector<string> labels;
+  string line;
+  for (unsigned int lineNumber = 1; getline(file, line); ++lineNumber) {
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == string::npos || line[begin] == '#')
+      continue;
+    size_t end = line.find_last_not_of(" \t\r");
+    string suffix = line.substr(begin, end - begin + 1);
+    EDomainFilterAction action = DOMAIN_FILTER_ALLOW;
+    if (suffix[0] == '!') {
+      action = DOMAIN_FILTER_DENY;
+      suffix.erase(0, 1);
+    }
+    if (!splitSuffix(suffix, labels)) {
+      cerr << "Invalid domain \"" << suffix << "\" on line " << lineNumber << " of domain filter \"" << fileName << "\"." << endl;
+      return nullptr;
+    }
+    SFilterBuildNode *node = &root;
+    for (const auto &label : labels) {
+      unique_ptr<SFilterBuildNode> &child = node->children[label];
+      if (child == nullptr)
+        child.reset(new SFilterBuildNode());
+      node = child.get();
+    }
+    if (node->action == DOMAIN_FILTER_NONE)
+      ++suffixCount;
+    node->action = action;
+    hasAllow = hasAllow || action == DOMAIN_FILTER_ALLOW;
+  }
+
+  shared_ptr<DomainFilter> filter(new DomainFilter());
+  filter->_suffixCount = suffixCount;
+  filter->_isDefaultWanted = !hasAllow;
+  size_t bloomWords = 1;
+  while (bloomWords * 64 < suffixCount * DOMAIN_FILTER_BLOOM_BITS)
+    bloomWords <<= 1;
+  filter->_bloom.assign(bloomWords, 0);
+  filter->_bloomMask = bloomWords * 64 - 1;
+
+  // flatten trie breadth first, so children of each node are contiguous
+  deque<pair<const SFilterBuildNode *, __u64>> queue; // node and hash of its suffix
+  filter->_nodes.push_back({ 1, (__u32)root.children.size(), 0, 0, DOMAIN_FILTER_NONE });
+  queue.push_back({ &root, FILTER_HASH_BASIS });
+  while (!queue.empty()) {
+    const SFilterBuildNode *node = queue.front().first;
+    __u64 hash = queue.front().second;
+    queue.pop_front();
+    for (const auto &child : node->children) {
+      __u64 childHash = hashLabel(hash, child.first.data(), child.first.size());
+      if (child.second->action != DOMAIN_FILTER_NONE)
+        filter->addToBloom(childHash);
+      // index of first child is known once all nodes queued before are placed
+      filter->_nodes.push_back({ 0, (__u32)child.second->children.size(), (__u32)filter->_labels.size(), (__u8)child.first.size(), (__u8)child.second->action });
+      filter->_labels += child.first;
+      queue.push_back({ child.second.get(), childHash });
+    }
+  }
+  __u32 nextChild = 1;
+  for (auto &node : filter->_nodes) {
+    node.childBegin = nextChild;
+    nextChild += node.childCount;
+  }
+
+  DWRITE("Domain filter " << fileName << " loaded, suffixes: " << suffixCount << " trie nodes: " << filter->_nodes.size());
+  return filter;
+}
+
+/**
+ * @brief Loads filter from file, makes it active and starts reloading thread.
+ *
+ * (See DomainFilter.hpp for more info.)
+ */
+bool DomainFilter::install(const string &fileName) {
+  shared_ptr<const DomainFilter> filter = load(fileName);
+  if (filter == nullptr)
+    return false;
+  atomic_store(&glb_domainFilter, filter);
+  glb_domainFilterGeneration.fetch_add(1, memory_order_release);
+
+  // SIGHUP is delivered only to reloading thread waiting for it
+  sigset_t hangup;
+  sigemptyset(&hangup);
+  sigaddset(&hangup, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &hangup, nullptr);
+  thread(reloadOnSignal, fileName).detach();
+  return true;
+}
+
+/**
+ * @brief Returns active filter for calling thread or nullptr when filtering is disabled.
+ *
+ * Shared filter is taken only when generation changed, so no lock is taken on packet path.
+ */
+const DomainFilter *DomainFilter::active() {
+  unsigned int generation = glb_domainFilterGeneration.load(memory_order_acquire);
+  if (generation != tl_domainFilterGeneration) {
+    tl_domainFilter = atomic_load(&glb_domainFilter);
+    tl_domainFilterGeneration = generation;
+  }
+  return tl_domainFilter.get();
+}
+
+/**
+ * @brief Checks domain name in DNS wire format.
+ *
+ * (See DomainFilter.hpp for more info.)
+ */
+bool DomainFilter::isWanted(const unsigned char *name, unsigned int maxLen) const {
+  char lowerName[DOMAIN_FILTER_MAX_NAME];
+  unsigned char labelBegin[DOMAIN_FILTER_MAX_LABELS];
+  unsigned char labelLen[DOMAIN_FILTER_MAX_LABELS];
+  unsigned int labelCount = 0;
+  unsigned int pos = 0;
+  while (true) {
+    if (pos >= maxLen || pos >= DOMAIN_FILTER_MAX_NAME)
+      return true;
+    unsigned int len = name[pos];
+    if (len == 0)
+      break;
+    if (len > 63 || pos + 1 + len > maxLen || pos + 1 + len >= DOMAIN_FILTER_MAX_NAME || labelCount == DOMAIN_FILTER_MAX_LABELS)
+      return true; // compression pointer or malformed name
+    labelBegin[labelCount] = pos;
+    labelLen[labelCount] = len;
+    ++labelCount;
+    for (unsigned int i = 0; i < len; ++i)
+      lowerName[pos + i] = tolower(name[pos + 1 + i]);
+    pos += len + 1;
+  }
+
+  // Bloom filter holds only terminal suffixes, without hit no suffix can match
+  __u64 hash = FILTER_HASH_BASIS;
+  bool isCandidate = false;
+  for (unsigned int i = labelCount; i-- > 0 && !isCandidate;) {
+    hash = hashLabel(hash, lowerName + labelBegin[i], labelLen[i]);
+    isCandidate = isInBloom(hash);
+  }
+  if (!isCandidate)
+    return _isDefaultWanted;
+
+  int action = DOMAIN_FILTER_NONE;
+  const STrieNode *node = &_nodes[0];
+  for (unsigned int i = labelCount; i-- > 0;) {
+    int child = findChild(*node, lowerName + labelBegin[i], labelLen[i]);
+    if (child < 0)
+      break;
+    node = &_nodes[child];
+    if (node->action != DOMAIN_FILTER_NONE)
+      action = node->action;
+  }
+  return action == DOMAIN_FILTER_NONE ? _isDefaultWanted : action == DOMAIN_FILTER_ALLOW;
+}
+
+/** @brief Returns number of suffixes of filter. */
+size_t DomainFilter::suffixCount() const {
+  return _suffixCount;
+}
+
+/**
+ * @brief Private method setting bits of hash in Bloom filter, probes are derived
+ * from two halves of hash (double hashing).
+ */
+void DomainFilter::addToBloom(__u64 hash) {
+  __u64 step = (hash >> 32) | 1;
+  for (unsigned int i = 0; i < DOMAIN_FILTER_BLOOM_PROBES; ++i) {
+    __u64 bit = (hash + i * step) & _bloomMask;
+    _bloom[bit >> 6] |= 1ull << (bit & 63);
+  }
+}
+
+/**
+ * @brief Private method testing bits of hash in Bloom filter.
+ */
+bool DomainFilter::isInBloom(__u64 hash) const {
+  __u64 step = (hash >> 32) | 1;
+  for (unsigned int i = 0; i < DOMAIN_FILTER_BLOOM_PROBES; ++i) {
+    __u64 bit = (hash + i * step) & _bloomMask;
+    if ((_bloom[bit >> 6] & (1ull << (bit & 63))) == 0)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Private method searching child of node by label, children are sorted
+ * same way as std::string compares them.
+ *
+ * @return index of child in _nodes or -1.
+ */
+int DomainFilter::findChild(const STrieNode &node, const char *label, unsigned int len) const {
+  __u32 low = node.childBegin;
+  __u32 high = node.childBegin + node.childCount;
+  while (low < high) {
+    __u32 middle = low + (high - low) / 2;
+    const STrieNode &child = _nodes[middle];
+    int cmp = memcmp(_labels.data() + child.labelOffset, label, min<unsigned int>(child.labelLen, len));
+    if (cmp == 0)
+      cmp = (int)child.labelLen - (int)len;
+    if (cmp == 0)
+      return middle;
+    if (cmp < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return -1;
+}
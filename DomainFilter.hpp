@@ -0,0 +1,116 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    DomainFilter.hpp
+ * @brief   Allow and deny filter of DNS responses by zone of question name
+ *          checked before answers are decoded.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <linux/types.h>
+
+#define DOMAIN_FILTER_MAX_NAME    255   // maximal length of domain name in wire format
+#define DOMAIN_FILTER_MAX_LABELS  128   // maximal number of labels of domain name
+#define DOMAIN_FILTER_BLOOM_BITS  16    // bits of Bloom filter per suffix
+#define DOMAIN_FILTER_BLOOM_PROBES 4    // bits set and tested for each suffix
+
+/*
+ * Filter file format, one suffix per line:
+ *
+ *   # comment
+ *   example.com        names under example.com (including it) are allowed
+ *   !ads.example.com   names under ads.example.com are denied
+ *
+ * Longest matching suffix decides. Names matching no suffix are allowed
+ * only when file contains no allow suffix. Comparison is case insensitive.
+ */
+
+/**
+ * @brief Actions of filter suffixes.
+ */
+enum EDomainFilterAction {
+  DOMAIN_FILTER_NONE,   /*!< node is only part of path to longer suffix */
+  DOMAIN_FILTER_ALLOW,
+  DOMAIN_FILTER_DENY
+};
+
+/**
+ * @brief Immutable filter of domain names by suffixes.
+ *
+ * Suffixes are stored in trie of reversed labels ("com" -> "example" -> "ads")
+ * flattened into array, children of each node are contiguous and sorted,
+ * so they are searched by binary search. Bloom filter of hashes of all
+ * suffixes is checked first, names with no suffix in Bloom filter (most of
+ * traffic for small filters) skip the trie.
+ *
+ * Filter used by parsing threads is replaced on SIGHUP by newly loaded one
+ * (see install), threads switch to it on their next packet without locking.
+ */
+class DomainFilter {
+public:
+  /**
+   * @brief Loads filter from file.
+   *
+   * @return filter or nullptr on error, error is written on stderr.
+   */
+  static std::shared_ptr<const DomainFilter> load(const std::string &fileName);
+
+  /**
+   * @brief Loads filter from file, makes it active and starts thread which
+   *        reloads it on each SIGHUP.
+   *
+   * Has to be called before any other thread is created, SIGHUP is blocked
+   * in calling thread and all its future threads. When reload fails, previous
+   * filter stays active.
+   * @return false when file cannot be loaded.
+   */
+  static bool install(const std::string &fileName);
+
+  /**
+   * @brief Returns active filter for calling thread or nullptr when filtering is disabled.
+   *
+   * Pointer is valid until next call of this method in same thread.
+   */
+  static const DomainFilter *active();
+
+  /**
+   * @brief Checks domain name in DNS wire format (sequence of labels).
+   *
+   * Compressed or malformed names are always wanted.
+   * @param name    first length octet of name
+   * @param maxLen  number of bytes which can be read from name
+   * @return true when responses for name should be processed.
+   */
+  bool isWanted(const unsigned char *name, unsigned int maxLen) const;
+
+  /** @brief Returns number of suffixes of filter. */
+  size_t suffixCount() const;
+
+private: /* private implementation is documented in *.cpp file */
+  struct STrieNode {
+    __u32 childBegin;   // index of first child in _nodes
+    __u32 childCount;
+    __u32 labelOffset;  // label of edge from parent in _labels
+    __u8 labelLen;
+    __u8 action;        // EDomainFilterAction
+  };
+
+  std::vector<STrieNode> _nodes;    // root is first
+  std::string _labels;              // arena of lower case labels
+  std::vector<__u64> _bloom;
+  __u64 _bloomMask;
+  size_t _suffixCount;
+  bool _isDefaultWanted;
+
+  DomainFilter();
+  void addToBloom(__u64 hash);
+  bool isInBloom(__u64 hash) const;
+  int findChild(const STrieNode &node, const char *label, unsigned int len) const;
+};
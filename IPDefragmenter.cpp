@@ -0,0 +1,221 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    IPDefragmenter.cpp
+ * \brief   Module providing reassembly of fragmented IPv4 and IPv6 datagrams.
+ *          Implementation of IPDefragmenter.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string.h>
+
+#include "utils.hpp"
+#include "IPDefragmenter.hpp"
+
+using namespace std;
+
+/** Constructor */
+IPDefragmenter::IPDefragmenter() : _pool(DEFRAG_POOL_SIZE) {
+  for (int i = 0; i < DEFRAG_HASH_SIZE; ++i)
+    _buckets[i] = -1;
+  // chain whole pool to free list
+  for (int i = 0; i < DEFRAG_POOL_SIZE; ++i) {
+    _pool[i].isUsed = false;
+    _pool[i].next = (i + 1 < DEFRAG_POOL_SIZE) ? i + 1 : -1;
+  }
+  _freeList = 0;
+  _usedCount = 0;
+  _completed = -1;
+  _lastExpire = 0;
+  memset(&_counters, 0, sizeof(SIpDefragCounters));
+}
+
+/**
+ * @brief Adds one fragment to reassembly.
+ *
+ * (See IPDefragmenter.hpp for more info.)
+ */
+bool IPDefragmenter::addFragment(
+  const SIpFragmentKey &key,
+  unsigned int offset,
+  bool moreFragments,
+  const unsigned char *data,
+  unsigned int len,
+  time_t now,
+  const unsigned char **datagram,
+  unsigned int *datagramLen
+) {
+  // datagram completed by previous call is no longer needed by caller
+  if (_completed != -1) {
+    releaseDatagram(_completed);
+    _completed = -1;
+  }
+
+  ++_counters.fragments;
+
+  if (now != _lastExpire)
+    expire(now);
+
+  int index = findDatagram(key);
+  if (index == -1) {
+    index = allocDatagram(key, now);
+  }
+  SFragDatagram *actDatagram = &(_pool[index]);
+
+  // every fragment except the last one has to carry multiple of 8 bytes
+  bool isValid = (offset + len <= DEFRAG_MAX_DATAGRAM_SIZE) && (!moreFragments || (len % 8) == 0);
+  if (isValid && actDatagram->rangeCount >= DEFRAG_MAX_FRAGMENTS_PER_DATAGRAM)
+    isValid = false;
+  if (isValid && !moreFragments) {
+    if (actDatagram->totalLen != 0 && actDatagram->totalLen != offset + len)
+      isValid = false; // two different last fragments
+    actDatagram->totalLen = offset + len;
+  }
+  if (isValid && actDatagram->totalLen != 0 && offset + len > actDatagram->totalLen)
+    isValid = false;
+  // overlapping fragments are not legitimate traffic, drop whole datagram
+  for (unsigned int i = 0; isValid && i < actDatagram->rangeCount; ++i) {
+    if (offset < actDatagram->ranges[i].end && actDatagram->ranges[i].begin < offset + len)
+      isValid = false;
+  }
+  if (!isValid) {
+    DWRITE("defragmenter: malformed fragment -> datagram dumped");
+    ++_counters.malformed;
+    releaseDatagram(index);
+    return false;
+  }
+
+  memcpy(actDatagram->buffer + offset, data, len);
+  actDatagram->ranges[actDatagram->rangeCount++] = {
+    (unsigned short)offset,
+    (unsigned short)(offset + len)
+  };
+  actDatagram->receivedLen += len;
+
+  // non overlapping ranges covering whole length means datagram is complete
+  if (actDatagram->totalLen == 0 || actDatagram->receivedLen != actDatagram->totalLen)
+    return false;
+
+  DWRITE("defragmenter: datagram reassembled from " << actDatagram->rangeCount << " fragments");
+  ++_counters.reassembled;
+  _completed = index;
+  *datagram = actDatagram->buffer;
+  *datagramLen = actDatagram->totalLen;
+  return true;
+}
+
+/**
+ * @brief Drops all datagrams which were not completed in DEFRAG_TIMEOUT_SEC until now.
+ *
+ * (See IPDefragmenter.hpp for more info.)
+ */
+void IPDefragmenter::expire(time_t now) {
+  _lastExpire = now;
+  if (_usedCount == 0)
+    return;
+  for (int i = 0; i < DEFRAG_POOL_SIZE; ++i) {
+    if (_pool[i].isUsed && i != _completed && now - _pool[i].firstSeen > DEFRAG_TIMEOUT_SEC) {
+      ++_counters.timedOut;
+      releaseDatagram(i);
+    }
+  }
+}
+
+/**
+ * @brief Returns counters of defragmenter work.
+ *
+ * (See IPDefragmenter.hpp for more info.)
+ */
+const SIpDefragCounters &IPDefragmenter::counters() const {
+  return _counters;
+}
+
+/**
+ * @brief Private method computing FNV-1a hash of datagram key into bucket index.
+ */
+unsigned int IPDefragmenter::hashKey(const SIpFragmentKey &key) const {
+  __u32 hash = 2166136261u;
+  for (unsigned int i = 0; i < 16; ++i)
+    hash = (hash ^ key.srcAddr[i]) * 16777619u;
+  for (unsigned int i = 0; i < 16; ++i)
+    hash = (hash ^ key.dstAddr[i]) * 16777619u;
+  hash = (hash ^ key.id) * 16777619u;
+  hash = (hash ^ key.protocol) * 16777619u;
+  return hash & (DEFRAG_HASH_SIZE - 1);
+}
+
+/**
+ * @brief Private method finding datagram with given key in pool.
+ *
+ * @return int  index of datagram in pool or -1 if datagram is not in reassembly.
+ */
+int IPDefragmenter::findDatagram(const SIpFragmentKey &key) const {
+  for (int index = _buckets[hashKey(key)]; index != -1; index = _pool[index].next) {
+    const SIpFragmentKey *actKey = &(_pool[index].key);
+    if (actKey->id == key.id &&
+        actKey->protocol == key.protocol &&
+        memcmp(actKey->srcAddr, key.srcAddr, 16) == 0 &&
+        memcmp(actKey->dstAddr, key.dstAddr, 16) == 0)
+      return index;
+  }
+  return -1;
+}
+
+/**
+ * @brief Private method taking datagram from free list and inserting it to hash table.
+ *
+ * When pool is exhausted the oldest datagram in reassembly is evicted.
+ *
+ * @return int  index of new datagram in pool.
+ */
+int IPDefragmenter::allocDatagram(const SIpFragmentKey &key, time_t now) {
+  if (_freeList == -1) {
+    int oldest = -1;
+    for (int i = 0; i < DEFRAG_POOL_SIZE; ++i) {
+      if (oldest == -1 || _pool[i].firstSeen < _pool[oldest].firstSeen)
+        oldest = i;
+    }
+    DWRITE("defragmenter: pool exhausted -> oldest datagram evicted");
+    ++_counters.evicted;
+    releaseDatagram(oldest);
+  }
+
+  int index = _freeList;
+  SFragDatagram *actDatagram = &(_pool[index]);
+  _freeList = actDatagram->next;
+
+  unsigned int bucket = hashKey(key);
+  actDatagram->key = key;
+  actDatagram->next = _buckets[bucket];
+  actDatagram->isUsed = true;
+  actDatagram->firstSeen = now;
+  actDatagram->totalLen = 0;
+  actDatagram->receivedLen = 0;
+  actDatagram->rangeCount = 0;
+  _buckets[bucket] = index;
+  ++_usedCount;
+  return index;
+}
+
+/**
+ * @brief Private method removing datagram from hash table and returning it to free list.
+ */
+void IPDefragmenter::releaseDatagram(int index) {
+  SFragDatagram *actDatagram = &(_pool[index]);
+  if (!actDatagram->isUsed)
+    return;
+
+  // unlink from hash chain
+  int *link = &(_buckets[hashKey(actDatagram->key)]);
+  while (*link != index)
+    link = &(_pool[*link].next);
+  *link = actDatagram->next;
+
+  actDatagram->isUsed = false;
+  actDatagram->next = _freeList;
+  _freeList = index;
+  --_usedCount;
+}
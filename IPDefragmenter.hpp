@@ -0,0 +1,125 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    IPDefragmenter.hpp
+ * @brief   Module providing reassembly of fragmented IPv4 and IPv6 datagrams.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <ctime>
+#include <linux/types.h>
+
+#define DEFRAG_POOL_SIZE                  64     // number of datagrams reassembled at the same time
+#define DEFRAG_HASH_SIZE                  128    // number of hash buckets, must be power of two
+#define DEFRAG_MAX_FRAGMENTS_PER_DATAGRAM 64     // more fragments of one datagram are considered a flood
+#define DEFRAG_MAX_DATAGRAM_SIZE          65535  // maximal size of reassembled datagram payload
+#define DEFRAG_TIMEOUT_SEC                30     // datagram is dropped when not completed in this time
+
+/**
+ * @brief Key identifying one fragmented datagram.
+ *
+ * IPv4 addresses are stored as IPv4-mapped IPv6 addresses so both families
+ * share one key format.
+ */
+struct SIpFragmentKey {
+  unsigned char srcAddr[16];
+  unsigned char dstAddr[16];
+  __u32 id;
+  __u8 protocol;
+};
+
+/**
+ * @brief Counters describing work of the defragmenter.
+ */
+struct SIpDefragCounters {
+  unsigned long fragments;    /*!< fragments passed to the defragmenter */
+  unsigned long reassembled;  /*!< datagrams successfully reassembled */
+  unsigned long timedOut;     /*!< datagrams dropped because of timeout */
+  unsigned long evicted;      /*!< datagrams dropped because pool was full */
+  unsigned long malformed;    /*!< datagrams dropped because of overlap, size or fragment count */
+};
+
+/**
+ * @brief Class reassembling IP fragments into whole datagrams.
+ *
+ * All memory is preallocated in constructor, fragment floods are bounded by
+ * DEFRAG_* limits and oldest unfinished datagram is evicted when pool is full.
+ * Overlapping fragments cause drop of whole datagram.
+ */
+class IPDefragmenter {
+public:
+  /** Constructor */
+  IPDefragmenter();
+
+  /**
+   * @brief Adds one fragment to reassembly.
+   *
+   * @param key           identification of datagram the fragment belongs to
+   * @param offset        offset of fragment data in datagram payload in bytes
+   * @param moreFragments flag if this is not last fragment of datagram
+   * @param data          pointer to fragment payload (data after IP header)
+   * @param len           length of fragment payload
+   * @param now           time of fragment capture in seconds
+   * @param datagram      filled with pointer to reassembled datagram payload
+   *                      when function returns true. Pointer is valid until next
+   *                      call of this method.
+   * @param datagramLen   filled with length of reassembled datagram payload
+   * @return true         when fragment completed datagram
+   * @return false        when datagram is still incomplete or fragment was dropped
+   */
+  bool addFragment(
+    const SIpFragmentKey &key,
+    unsigned int offset,
+    bool moreFragments,
+    const unsigned char *data,
+    unsigned int len,
+    time_t now,
+    const unsigned char **datagram,
+    unsigned int *datagramLen
+  );
+
+  /**
+   * @brief Drops all datagrams which were not completed in DEFRAG_TIMEOUT_SEC until now.
+   */
+  void expire(time_t now);
+
+  /**
+   * @brief Returns counters of defragmenter work.
+   */
+  const SIpDefragCounters &counters() const;
+
+private: /* private implementation is documented in *.cpp file */
+  struct SFragRange {
+    unsigned short begin;
+    unsigned short end;
+  };
+  struct SFragDatagram {
+    SIpFragmentKey key;
+    int next;                 // next datagram in hash chain or free list
+    bool isUsed;
+    time_t firstSeen;
+    unsigned int totalLen;    // zero until last fragment arrives
+    unsigned int receivedLen;
+    unsigned int rangeCount;
+    SFragRange ranges[DEFRAG_MAX_FRAGMENTS_PER_DATAGRAM];
+    unsigned char buffer[DEFRAG_MAX_DATAGRAM_SIZE];
+  };
+
+  std::vector<SFragDatagram> _pool;
+  int _buckets[DEFRAG_HASH_SIZE];
+  int _freeList;
+  int _usedCount;
+  int _completed;
+  time_t _lastExpire;
+  SIpDefragCounters _counters;
+
+  unsigned int hashKey(const SIpFragmentKey &key) const;
+  int findDatagram(const SIpFragmentKey &key) const;
+  int allocDatagram(const SIpFragmentKey &key, time_t now);
+  void releaseDatagram(int index);
+};
@@ -0,0 +1,448 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    PacketPipeline.cpp
+ * \brief   Staged processing of captured packets by capture, parser,
+ *          aggregator and exporter threads connected by lock-free queues.
+ *          Implementation of PacketPipeline.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "utils.hpp"
+#include "PacketPipeline.hpp"
+#include "perfStats.hpp"
+#include "metrics.hpp"
+#include "numaPlacement.hpp"
+#include "headerClassifier.hpp"
+
+#define PIPELINE_STAGE_CAPTURE      0     // index of capture core in SPipelineConfig::cpus
+#define PIPELINE_STAGE_AGGREGATOR   1     // index of aggregator core in SPipelineConfig::cpus
+#define PIPELINE_STAGE_EXPORTER     2     // index of exporter core in SPipelineConfig::cpus
+#define PIPELINE_STAGE_PARSER       3     // index of core of first parser in SPipelineConfig::cpus
+#define PIPELINE_SPIN_ROUNDS        64    // empty polls of queue before thread starts sleeping
+#define PIPELINE_IDLE_SLEEP_USEC    100   // sleep of idle thread
+#define PIPELINE_PUBLISH_ANSWERS    4096  // statistics size is published at least after this many answers
+
+using namespace std;
+
+/**
+ * Queues and counters of one parser thread.
+ */
+struct PacketPipeline::SParser {
+  SpscRing<SPipelinePacket> packets;              // capture -> parser
+  SpscRing<SPipelineAnswers> answers;             // parser -> aggregator
+  atomic<__u64> dropped;                          // packets dropped by capture because packets queue was full
+  atomic<__u64> stalls;                           // times parser waited because answers queue was full
+  thread worker;
+
+  SParser(size_t packetDepth, size_t answerDepth) : packets(packetDepth), answers(answerDepth) {
+    dropped.store(0, memory_order_relaxed);
+    stalls.store(0, memory_order_relaxed);
+  }
+};
+
+/**
+ * @brief Increments counter owned by calling thread without locked instruction.
+ */
+static inline void add(atomic<__u64> &counter, __u64 value) {
+  counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * @brief Supportive function waiting while queue is empty or full, first by
+ * yielding processor and after PIPELINE_SPIN_ROUNDS by sleeping.
+ */
+static void idleWait(unsigned int &idleRounds) {
+  if (++idleRounds < PIPELINE_SPIN_ROUNDS)
+    this_thread::yield();
+  else
+    usleep(PIPELINE_IDLE_SLEEP_USEC);
+}
+
+/**
+ * Constructor, starts threads and pins calling (capture) thread.
+ */
+PacketPipeline::PacketPipeline(
+  const SPipelineConfig &config,
+  shared_ptr<DNSStatistic> statObj,
+  ParseFunction parse,
+  ExportFunction exportRecords,
+  ExportedFunction exported
+) {
+  _config = config;
+  if (_config.queueDepth == 0)
+    _config.queueDepth = PIPELINE_DEFAULT_DEPTH;
+  _statObj = statObj;
+  _parse = parse;
+  _export = exportRecords;
+  _exported = exported;
+  _captureStalls.store(0, memory_order_relaxed);
+  _exportSkips.store(0, memory_order_relaxed);
+  _requests.store(0, memory_order_relaxed);
+  _isParsing.store(true, memory_order_relaxed);
+  _isAggregating.store(true, memory_order_relaxed);
+  _isExporterBusy.store(false, memory_order_relaxed);
+  _isFailed.store(false, memory_order_relaxed);
+  _exportRequests = 0;
+  _isStopping = false;
+  _isStopped = false;
+
+  // without parser threads capture parses packets itself and its packet queue is not used
+  if (_config.parserCount == 0)
+    _parsers.emplace_back(new SParser(1, _config.queueDepth));
+  for (unsigned int i = 0; i < _config.parserCount; ++i)
+    _parsers.emplace_back(new SParser(_config.queueDepth, _config.queueDepth));
+  if (_config.memoryNode >= 0) {
+    for (unsigned int i = 0; i < _parsers.size(); ++i) {
+      placement::bindMemory(_parsers[i]->packets.storage(), _parsers[i]->packets.storageSize(), _config.memoryNode, "packet queue " + to_string(i));
+      placement::bindMemory(_parsers[i]->answers.storage(), _parsers[i]->answers.storageSize(), _config.memoryNode, "answer queue " + to_string(i));
+    }
+  }
+
+  // signals driving exports have to be delivered to capture thread waiting in pcap
+  sigset_t allSignals, oldSignals;
+  sigfillset(&allSignals);
+  pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+  for (unsigned int i = 0; i < _config.parserCount; ++i) {
+    _parsers[i]->worker = thread(&PacketPipeline::runParser, this, i);
+    placement::pinThread(_parsers[i]->worker.native_handle(), cpuOf(PIPELINE_STAGE_PARSER + i), "parser " + to_string(i));
+  }
+  _aggregator = thread(&PacketPipeline::runAggregator, this);
+  placement::pinThread(_aggregator.native_handle(), cpuOf(PIPELINE_STAGE_AGGREGATOR), "aggregator");
+  _exporter = thread(&PacketPipeline::runExporter, this);
+  placement::pinThread(_exporter.native_handle(), cpuOf(PIPELINE_STAGE_EXPORTER), "exporter");
+  pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+  placement::pinThread(pthread_self(), cpuOf(PIPELINE_STAGE_CAPTURE), "capture");
+
+  _metricsCollector = metrics::addCollector([this](string &out) { writeMetrics(out); });
+  DWRITE("Pipeline started, parsers: " << _config.parserCount << " queue depth: " << _config.queueDepth);
+}
+
+/** Destructor, processes queued data and stops all threads (see stop). */
+PacketPipeline::~PacketPipeline() {
+  stop(0);
+}
+
+/**
+ * @brief Processes all queued packets and answers and stops all threads.
+ *
+ * (See PacketPipeline.hpp for more info.)
+ */
+bool PacketPipeline::stop(int requests) {
+  if (_isStopped)
+    return !isFailed();
+  _isStopped = true;
+  metrics::removeCollector(_metricsCollector);
+  _isParsing.store(false, memory_order_release);
+  for (auto &parser : _parsers) {
+    if (parser->worker.joinable())
+      parser->worker.join();
+  }
+  _isAggregating.store(false, memory_order_release);
+  _aggregator.join();
+  // aggregator has finished, statistics are complete and can be handed over by this thread
+  if (requests != 0) {
+    while (_isExporterBusy.load(memory_order_acquire))
+      usleep(PIPELINE_IDLE_SLEEP_USEC);
+    handleRequests(requests);
+  }
+  {
+    lock_guard<mutex> lock(_exportMutex);
+    _isStopping = true;
+  }
+  _exportCondition.notify_one();
+  _exporter.join();
+  return !isFailed();
+}
+
+/**
+ * @brief Passes captured packet to parser, called by capture thread only.
+ *
+ * (See PacketPipeline.hpp for more info.)
+ */
+void PacketPipeline::pushPacket(const struct pcap_pkthdr *header, const unsigned char *packet, unsigned int weight) {
+  if (_config.parserCount == 0) {
+    SDnsClient client;
+    _captureAnswers.clear();
+    _parse(0, header, packet, _captureAnswers, client);
+    if (!_captureAnswers.empty())
+      pushAnswers(_parsers[0]->answers, _captureAnswers, weight, client, _captureStalls);
+    return;
+  }
+
+  SParser &parser = *_parsers[parserOf(packet, header->caplen)];
+  SPipelinePacket *slot = header->caplen <= PIPELINE_PACKET_SIZE ? parser.packets.claim() : nullptr;
+  if (slot == nullptr) {
+    add(parser.dropped, 1);
+    return;
+  }
+  slot->header = *header;
+  slot->weight = weight;
+  memcpy(slot->data, packet, header->caplen);
+  parser.packets.publish();
+}
+
+/** @brief Returns number of packets dropped because parser queues were full. */
+__u64 PacketPipeline::droppedPackets() const {
+  __u64 dropped = 0;
+  for (size_t i = 0; i < _config.parserCount; ++i)
+    dropped += _parsers[i]->dropped.load(memory_order_relaxed);
+  return dropped;
+}
+
+/**
+ * @brief Requests export or print of statistics (EPipelineRequest mask).
+ */
+void PacketPipeline::request(int requests) {
+  _requests.fetch_or(requests, memory_order_release);
+}
+
+/** @brief Returns true when export function failed. */
+bool PacketPipeline::isFailed() const {
+  return _isFailed.load(memory_order_acquire);
+}
+
+/**
+ * @brief Appends queue depths and drop and stall counters in metrics text format.
+ */
+void PacketPipeline::writeMetrics(string &out) const {
+  metrics::appendHeader(out, "dns_export_pipeline_queue_depth", "gauge", "Slots used in pipeline queue.");
+  for (size_t i = 0; i < _parsers.size(); ++i) {
+    if (_config.parserCount > 0)
+      metrics::appendSample(out, "dns_export_pipeline_queue_depth", "queue", ("packets_" + to_string(i)).c_str(), _parsers[i]->packets.size());
+    metrics::appendSample(out, "dns_export_pipeline_queue_depth", "queue", ("answers_" + to_string(i)).c_str(), _parsers[i]->answers.size());
+  }
+  metrics::appendHeader(out, "dns_export_pipeline_queue_capacity", "gauge", "Slots of every pipeline queue.");
+  metrics::appendSample(out, "dns_export_pipeline_queue_capacity", nullptr, nullptr, _parsers[0]->answers.capacity());
+
+  metrics::appendHeader(out, "dns_export_pipeline_dropped_packets_total", "counter", "Packets dropped by capture because parser queue was full.");
+  for (size_t i = 0; i < _config.parserCount; ++i)
+    metrics::appendSample(out, "dns_export_pipeline_dropped_packets_total", "parser", to_string(i).c_str(), _parsers[i]->dropped.load(memory_order_relaxed));
+
+  metrics::appendHeader(out, "dns_export_pipeline_stalls_total", "counter", "Times producer waited because aggregator queue was full.");
+  if (_config.parserCount == 0)
+    metrics::appendSample(out, "dns_export_pipeline_stalls_total", "stage", "capture", _captureStalls.load(memory_order_relaxed));
+  for (size_t i = 0; i < _config.parserCount; ++i)
+    metrics::appendSample(out, "dns_export_pipeline_stalls_total", "stage", ("parser_" + to_string(i)).c_str(), _parsers[i]->stalls.load(memory_order_relaxed));
+
+  metrics::appendHeader(out, "dns_export_pipeline_skipped_exports_total", "counter", "Exports skipped because exporter was busy.");
+  metrics::appendSample(out, "dns_export_pipeline_skipped_exports_total", nullptr, nullptr, _exportSkips.load(memory_order_relaxed));
+}
+
+/**
+ * @brief Private method returning configured core of stage or -1.
+ */
+int PacketPipeline::cpuOf(unsigned int stage) const {
+  return stage < _config.cpus.size() ? _config.cpus[stage] : -1;
+}
+
+/**
+ * @brief Private method choosing parser of packet by FNV-1a hash of its IP
+ * addresses, so all fragments of one datagram are processed by same parser.
+ */
+unsigned int PacketPipeline::parserOf(const unsigned char *packet, unsigned int len) const {
+  const unsigned char *addresses = nullptr;
+  unsigned int addressesLen = 0;
+  if (len >= 14 + 20 && packet[12] == 0x08 && packet[13] == 0x00) {        // IPv4 source and destination
+    addresses = packet + 14 + 12;
+    addressesLen = 8;
+  } else if (len >= 14 + 40 && packet[12] == 0x86 && packet[13] == 0xdd) { // IPv6 source and destination
+    addresses = packet + 14 + 8;
+    addressesLen = 32;
+  }
+  __u32 hash = 2166136261u;
+  for (unsigned int i = 0; i < addressesLen; ++i)
+    hash = (hash ^ addresses[i]) * 16777619u;
+  return hash % _config.parserCount;
+}
+
+/**
+ * @brief Private method swapping answers into answer queue, waits while queue is full.
+ */
+void PacketPipeline::pushAnswers(SpscRing<SPipelineAnswers> &queue, vector<SDnsAnswerRecord> &answers, unsigned int weight, const SDnsClient &client, atomic<__u64> &stalls) {
+  SPipelineAnswers *slot = queue.claim();
+  if (slot == nullptr) {
+    add(stalls, 1);
+    unsigned int idleRounds = 0;
+    while ((slot = queue.claim()) == nullptr)
+      idleWait(idleRounds);
+  }
+  slot->answers.swap(answers); // consumed vector of slot comes back to be reused
+  slot->weight = weight;
+  slot->client = client;
+  queue.publish();
+}
+
+/**
+ * @brief Supportive function classifying DNS headers of up to CLASSIFY_BATCH_SIZE
+ * oldest queued packets (see headerClassifier.hpp), packets which cannot be
+ * classified without full decode get DNS_PARSE_OK.
+ *
+ * @return unsigned int  number of classified packets (at least 1 when queue is not empty)
+ */
+static unsigned int classifyQueued(SpscRing<SPipelinePacket> &packets, EDnsParseError *verdicts, __u16 *etherTypes) {
+  const unsigned char *messages[CLASSIFY_BATCH_SIZE];
+  unsigned int located[CLASSIFY_BATCH_SIZE];
+  EDnsParseError results[CLASSIFY_BATCH_SIZE];
+  unsigned int size = 0;
+  unsigned int locatedCount = 0;
+  SPipelinePacket *packet;
+  while (size < CLASSIFY_BATCH_SIZE && (packet = packets.peek(size)) != nullptr) {
+    verdicts[size] = DNS_PARSE_OK;
+    const unsigned char *message = classify::locateUdpMessage(packet->data, packet->header.caplen, &etherTypes[size]);
+    if (message != nullptr) {
+      messages[locatedCount] = message;
+      located[locatedCount++] = size;
+    }
+    ++size;
+  }
+  classify::headerBatch(messages, locatedCount, results);
+  for (unsigned int i = 0; i < locatedCount; ++i)
+    verdicts[located[i]] = results[i];
+  return size;
+}
+
+/**
+ * @brief Supportive function counting packet rejected by header classification
+ * the same way as it would be counted by full decode and parse.
+ */
+static void countRejected(EDnsParseError verdict, __u16 etherType) {
+  PERF_PACKET();
+  PERF_PARSE_ERROR(verdict);
+  metrics::countPacket();
+  metrics::countEtherType(etherType);
+  metrics::countProtocol(IPPROTO_UDP);
+  metrics::countParseResult(verdict, 0);
+}
+
+/**
+ * @brief Private method with main loop of parser thread.
+ *
+ * Queued packets are taken by batches, headers of whole batch are classified
+ * first and only packets which can carry wanted answers are decoded and parsed.
+ */
+void PacketPipeline::runParser(unsigned int index) {
+  SParser &parser = *_parsers[index];
+  vector<SDnsAnswerRecord> answers;
+  EDnsParseError verdicts[CLASSIFY_BATCH_SIZE];
+  __u16 etherTypes[CLASSIFY_BATCH_SIZE];
+  unsigned int idleRounds = 0;
+  while (true) {
+    unsigned int batchSize = classifyQueued(parser.packets, verdicts, etherTypes);
+    if (batchSize == 0) {
+      if (!_isParsing.load(memory_order_acquire) && parser.packets.front() == nullptr)
+        return;
+      idleWait(idleRounds);
+      continue;
+    }
+    idleRounds = 0;
+    for (unsigned int i = 0; i < batchSize; ++i) {
+      SPipelinePacket *packet = parser.packets.front();
+      if (verdicts[i] != DNS_PARSE_OK) {
+        countRejected(verdicts[i], etherTypes[i]);
+        parser.packets.pop();
+        continue;
+      }
+      answers.clear();
+      SDnsClient client;
+      _parse(index, &packet->header, packet->data, answers, client);
+      unsigned int weight = packet->weight;
+      parser.packets.pop();
+      if (!answers.empty())
+        pushAnswers(parser.answers, answers, weight, client, parser.stalls);
+    }
+  }
+}
+
+/**
+ * @brief Private method with main loop of aggregator thread.
+ */
+void PacketPipeline::runAggregator() {
+  unsigned int idleRounds = 0;
+  unsigned int unpublishedAnswers = 0;
+  while (true) {
+    bool isStopping = !_isAggregating.load(memory_order_acquire);
+    bool isIdle = true;
+    for (auto &parser : _parsers) {
+      SPipelineAnswers *answers;
+      while ((answers = parser->answers.front()) != nullptr) {
+        PERF_BEGIN(aggregateBegin);
+        _statObj->addAnswerRecords(answers->answers, answers->weight, &answers->client);
+        PERF_END(PERF_STAGE_AGGREGATE, aggregateBegin);
+        unpublishedAnswers += answers->answers.size();
+        answers->answers.clear();
+        parser->answers.pop();
+        isIdle = false;
+      }
+    }
+
+    if (unpublishedAnswers >= PIPELINE_PUBLISH_ANSWERS || (isIdle && unpublishedAnswers > 0)) {
+      metrics::setStatisticsSize(_statObj->recordCount(), _statObj->memoryUsage());
+      unpublishedAnswers = 0;
+    }
+    int requests = _requests.exchange(0, memory_order_acquire);
+    if (requests != 0)
+      handleRequests(requests);
+
+    if (isIdle) {
+      if (isStopping)
+        return; // queues were empty after producers stopped
+      idleWait(idleRounds);
+    } else {
+      idleRounds = 0;
+    }
+  }
+}
+
+/**
+ * @brief Private method passing copy of statistics to exporter thread, called by aggregator.
+ */
+void PacketPipeline::handleRequests(int requests) {
+  if ((requests & PIPELINE_REQUEST_EXPORT) && _exported)
+    _exported(*_statObj);
+  if (_isExporterBusy.load(memory_order_acquire)) {
+    DWRITE("Exporter is busy, export skipped");
+    add(_exportSkips, 1);
+    return;
+  }
+  // exporter does not touch records until it is notified, it is the only copy of records
+  StatRecords records = _statObj->getStatistics();
+  _exportRecords.assign(records.begin(), records.end());
+  _isExporterBusy.store(true, memory_order_release);
+  {
+    lock_guard<mutex> lock(_exportMutex);
+    _exportRequests = requests;
+  }
+  _exportCondition.notify_one();
+}
+
+/**
+ * @brief Private method with main loop of exporter thread.
+ */
+void PacketPipeline::runExporter() {
+  unique_lock<mutex> lock(_exportMutex);
+  while (true) {
+    _exportCondition.wait(lock, [this]() { return _exportRequests != 0 || _isStopping; });
+    if (_exportRequests == 0)
+      return; // stopping and nothing to export
+    int requests = _exportRequests;
+    _exportRequests = 0;
+    lock.unlock();
+    if (!_export(requests, _exportRecords))
+      _isFailed.store(true, memory_order_release);
+    _exportRecords.clear(); // strings of copy are not kept until next export
+    _isExporterBusy.store(false, memory_order_release);
+    lock.lock();
+  }
+}
@@ -0,0 +1,200 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    PacketPipeline.hpp
+ * @brief   Staged processing of captured packets by capture, parser,
+ *          aggregator and exporter threads connected by lock-free queues.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <pcap/pcap.h>
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+#include "DNSStatistic.hpp"
+#include "SpscRing.hpp"
+
+#define PIPELINE_PACKET_SIZE    2048  // bytes of packet copied into queue slot, live snapshot length has to fit
+#define PIPELINE_DEFAULT_DEPTH  4096  // default number of slots of every queue
+#define PIPELINE_MAX_PARSERS    64    // maximal number of parser threads
+
+/*
+ * Stages and queues:
+ *
+ *   capture (calling thread)  --packets[i]-->  parser i  --answers[i]-->  aggregator  --records-->  exporter
+ *
+ * Capture copies each packet into slot of packet queue of parser chosen by
+ * hash of IP addresses (all fragments of datagram meet in same parser and
+ * its defragmenter). When queue is full packet is dropped and counted, so
+ * capture never waits. Parser passes answers of each packet to aggregator
+ * and waits when answer queue is full (counted as stall). Aggregator is the
+ * only thread changing DNSStatistic object. On export request it copies
+ * records for exporter thread, export is skipped and counted when exporter
+ * is still busy with previous one. With 0 parsers capture thread parses
+ * packets itself and feeds aggregator directly.
+ */
+
+/**
+ * @brief Requests passed from capture thread to exporter (bit mask).
+ */
+enum EPipelineRequest {
+  PIPELINE_REQUEST_EXPORT = 0x1,  /*!< periodic export (sendToSyslog) */
+  PIPELINE_REQUEST_PRINT = 0x2    /*!< print statistics (SIGUSR1) */
+};
+
+/**
+ * @brief Configuration of pipeline stages.
+ */
+struct SPipelineConfig {
+  unsigned int parserCount;   /*!< number of parser threads, 0 means parsing in capture thread */
+  unsigned int queueDepth;    /*!< number of slots of every queue */
+  std::vector<int> cpus;      /*!< cores of capture, aggregator, exporter and parser threads in this order,
+                                   negative value or missing item means thread is not pinned */
+  int memoryNode;             /*!< NUMA node where queues are bound, negative means no binding */
+};
+
+/**
+ * @brief Packet copied from capture buffer into packet queue.
+ */
+struct SPipelinePacket {
+  struct pcap_pkthdr header;
+  unsigned int weight;                      /*!< sampling weight of packet (see PacketSampler.hpp) */
+  unsigned char data[PIPELINE_PACKET_SIZE];
+};
+
+/**
+ * @brief Answers of one packet passed from parser to aggregator.
+ */
+struct SPipelineAnswers {
+  std::vector<SDnsAnswerRecord> answers;
+  unsigned int weight;                      /*!< sampling weight of packet */
+  SDnsClient client;                        /*!< destination of packet (see DNSStatistic::addAnswerRecords) */
+};
+
+/**
+ * @brief Multithreaded pipeline processing packets pushed by capture thread.
+ *
+ * Threads are started by constructor and stopped by stop or destructor after all
+ * queued packets and answers were processed. Queue depths and drop and stall
+ * counters are published as metrics (see metrics.hpp).
+ */
+class PacketPipeline {
+public:
+  /**
+   * @brief Parses one packet, answers are appended to given vector and client
+   *        is filled. Called on parser thread of given index (or capture thread
+   *        with 0 parsers).
+   */
+  typedef std::function<void(unsigned int parserIndex, const struct pcap_pkthdr *header,
+                             const unsigned char *packet, std::vector<SDnsAnswerRecord> &answers,
+                             SDnsClient &client)> ParseFunction;
+
+  /**
+   * @brief Exports copy of statistic records, requests is EPipelineRequest mask.
+   *        Called on exporter thread, returns false on fatal failure.
+   */
+  typedef std::function<bool(int requests, const StatRecords &records)> ExportFunction;
+
+  /**
+   * @brief Called on aggregator thread on each PIPELINE_REQUEST_EXPORT with
+   *        statistics which cannot change during call (e.g. to request snapshot).
+   */
+  typedef std::function<void(const DNSStatistic &statistic)> ExportedFunction;
+
+  /**
+   * @brief Constructor, starts threads and pins calling (capture) thread.
+   *
+   * @param statObj   statistics filled by aggregator thread, must not be used
+   *                  by other threads until pipeline is destroyed
+   */
+  PacketPipeline(
+    const SPipelineConfig &config,
+    std::shared_ptr<DNSStatistic> statObj,
+    ParseFunction parse,
+    ExportFunction exportRecords,
+    ExportedFunction exported
+  );
+
+  /** Destructor, processes queued data and stops all threads (see stop). */
+  ~PacketPipeline();
+
+  /**
+   * @brief Passes captured packet to parser, called by capture thread only.
+   *
+   * @param weight  number of captured packets this one stands for when packets are sampled
+   */
+  void pushPacket(const struct pcap_pkthdr *header, const unsigned char *packet, unsigned int weight = 1);
+
+  /** @brief Returns number of packets dropped because parser queues were full. */
+  __u64 droppedPackets() const;
+
+  /**
+   * @brief Requests export or print of statistics (EPipelineRequest mask).
+   */
+  void request(int requests);
+
+  /** @brief Returns true when export function failed. */
+  bool isFailed() const;
+
+  /**
+   * @brief Processes all queued packets and answers and stops all threads,
+   *        called by capture thread at end of its input (e.g. replayed file).
+   *
+   * @param requests  EPipelineRequest mask handled after last answer was
+   *                  aggregated, waits for exporter instead of skipping export
+   * @return false when export function failed
+   */
+  bool stop(int requests);
+
+  /** @brief Appends queue depths and drop and stall counters in metrics text format. */
+  void writeMetrics(std::string &out) const;
+
+private: /* private implementation is documented in *.cpp file */
+  struct SParser;
+
+  SPipelineConfig _config;
+  std::shared_ptr<DNSStatistic> _statObj;
+  ParseFunction _parse;
+  ExportFunction _export;
+  ExportedFunction _exported;
+  std::vector<std::unique_ptr<SParser>> _parsers;
+  std::vector<SDnsAnswerRecord> _captureAnswers;
+  std::atomic<__u64> _captureStalls;
+  std::atomic<__u64> _exportSkips;
+  std::atomic<int> _requests;
+  std::atomic<bool> _isParsing;
+  std::atomic<bool> _isAggregating;
+  std::atomic<bool> _isExporterBusy;
+  std::atomic<bool> _isFailed;
+  bool _isStopped;
+
+  std::mutex _exportMutex;
+  std::condition_variable _exportCondition;
+  StatRecordVector _exportRecords;   // copy of records for exporter thread, cleared after export
+  int _exportRequests;
+  bool _isStopping;
+
+  std::thread _aggregator;
+  std::thread _exporter;
+  unsigned int _metricsCollector;
+
+  int cpuOf(unsigned int stage) const;
+  unsigned int parserOf(const unsigned char *packet, unsigned int len) const;
+  void pushAnswers(SpscRing<SPipelineAnswers> &queue, std::vector<SDnsAnswerRecord> &answers, unsigned int weight, const SDnsClient &client, std::atomic<__u64> &stalls);
+  void runParser(unsigned int index);
+  void runAggregator();
+  void runExporter();
+  void handleRequests(int requests);
+};
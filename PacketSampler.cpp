@@ -0,0 +1,254 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    PacketSampler.cpp
+ * \brief   Sampling of captured packets with adaptive sampling rate.
+ *          Implementation of PacketSampler.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "utils.hpp"
+#include "PacketSampler.hpp"
+#include "metrics.hpp"
+
+#define SAMPLER_ETHERNET_SIZE   14  // bytes of Ethernet header
+#define SAMPLER_IPV6_FRAGMENT   44  // IPv6 next header value of fragment header
+
+using namespace std;
+
+/**
+ * @brief Increments counter owned by calling thread without locked instruction.
+ */
+static inline void add(atomic<__u64> &counter, __u64 value) {
+  counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * @brief Supportive function adding bytes to FNV-1a hash.
+ */
+static inline __u32 hashBytes(__u32 hash, const unsigned char *data, unsigned int len) {
+  for (unsigned int i = 0; i < len; ++i)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
+/**
+ * @brief Supportive function adding two same sized fields to hash in order independent
+ * way, so both directions of transaction (e.g. source and destination address) get same hash.
+ */
+static inline __u32 hashPair(__u32 hash, const unsigned char *a, const unsigned char *b, unsigned int len) {
+  bool isSwapped = lexicographical_compare(b, b + len, a, a + len);
+  hash = hashBytes(hash, isSwapped ? b : a, len);
+  return hashBytes(hash, isSwapped ? a : b, len);
+}
+
+/**
+ * Constructor
+ */
+PacketSampler::PacketSampler(ESamplingMode mode, unsigned int rate, unsigned int maxRate) {
+  _mode = mode;
+  _minRate = max(1u, rate);
+  _maxRate = max(_minRate, maxRate);
+  _rate.store(_minRate, memory_order_relaxed);
+  _counter = 0;
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  _random = ((__u64)now.tv_sec * 1000000 + now.tv_usec) | 1; // xorshift state must not be 0
+  _lastAdaptUsec = metrics::now() / 1000;
+  _lastReceived = 0;
+  _lastDropped = 0;
+  _maxLatencyUsec = 0;
+  _kept.store(0, memory_order_relaxed);
+  _skipped.store(0, memory_order_relaxed);
+  _rateChanges.store(0, memory_order_relaxed);
+  _metricsCollector = metrics::addCollector([this](string &out) { writeMetrics(out); });
+}
+
+/** Destructor */
+PacketSampler::~PacketSampler() {
+  metrics::removeCollector(_metricsCollector);
+}
+
+/**
+ * @brief Decides if packet is processed.
+ *
+ * (See PacketSampler.hpp for more info.)
+ */
+unsigned int PacketSampler::sample(const struct pcap_pkthdr *header, const unsigned char *packet) {
+  unsigned int rate = _rate.load(memory_order_relaxed);
+  if (_maxRate > _minRate && (_kept.load(memory_order_relaxed) + _skipped.load(memory_order_relaxed)) % SAMPLING_LATENCY_EVERY == 0)
+    measureLatency(header);
+
+  bool isSampled = true;
+  switch (_mode) {
+    case SAMPLING_COUNT:
+      if (++_counter >= rate)
+        _counter = 0;
+      isSampled = _counter == 0;
+      break;
+    case SAMPLING_RANDOM:
+      _random ^= _random << 13; // xorshift64
+      _random ^= _random >> 7;
+      _random ^= _random << 17;
+      isSampled = _random % rate == 0;
+      break;
+    case SAMPLING_FLOW:
+      isSampled = flowHash(packet, header->caplen) % rate == 0;
+      break;
+    default:
+      rate = 1;
+  }
+
+  if (!isSampled) {
+    add(_skipped, 1);
+    return 0;
+  }
+  add(_kept, 1);
+  return rate;
+}
+
+/**
+ * @brief Adapts sampling rate to load, called periodically by capture thread.
+ *
+ * (See PacketSampler.hpp for more info.)
+ */
+void PacketSampler::adapt(__u64 receivedPackets, __u64 droppedPackets) {
+  __u64 nowUsec = metrics::now() / 1000;
+  if (_maxRate == _minRate || nowUsec - _lastAdaptUsec < SAMPLING_ADAPT_INTERVAL_USEC)
+    return;
+
+  // counters of pcap can be reset (e.g. by reopening), differences are then taken from zero
+  __u64 received = receivedPackets >= _lastReceived ? receivedPackets - _lastReceived : receivedPackets;
+  __u64 dropped = droppedPackets >= _lastDropped ? droppedPackets - _lastDropped : droppedPackets;
+  double dropRatio = received + dropped > 0 ? (double)dropped / (received + dropped) : 0;
+  unsigned int rate = _rate.load(memory_order_relaxed);
+  unsigned int newRate = rate;
+  if (dropRatio > SAMPLING_DROP_THRESHOLD || _maxLatencyUsec > SAMPLING_LATENCY_THRESHOLD)
+    newRate = min(_maxRate, rate * 2);
+  else if (dropped == 0 && _maxLatencyUsec < SAMPLING_LATENCY_THRESHOLD / 4)
+    newRate = max(_minRate, rate / 2);
+
+  if (newRate != rate) {
+    DWRITE("Sampling rate " << rate << " -> " << newRate << ", drops: " << dropRatio << " latency: " << _maxLatencyUsec << " us");
+    _rate.store(newRate, memory_order_relaxed);
+    _counter = 0;
+    add(_rateChanges, 1);
+  }
+  _lastAdaptUsec = nowUsec;
+  _lastReceived = receivedPackets;
+  _lastDropped = droppedPackets;
+  _maxLatencyUsec = 0;
+}
+
+/** @brief Returns actual N. */
+unsigned int PacketSampler::rate() const {
+  return _rate.load(memory_order_relaxed);
+}
+
+/**
+ * @brief Appends sampling rate and counters in metrics text format.
+ */
+void PacketSampler::writeMetrics(string &out) const {
+  metrics::appendHeader(out, "dns_export_sampling_rate", "gauge", "Actual N of 1-in-N packet sampling.");
+  metrics::appendSample(out, "dns_export_sampling_rate", nullptr, nullptr, rate());
+  metrics::appendHeader(out, "dns_export_sampled_packets_total", "counter", "Captured packets kept or skipped by sampling.");
+  metrics::appendSample(out, "dns_export_sampled_packets_total", "result", "kept", _kept.load(memory_order_relaxed));
+  metrics::appendSample(out, "dns_export_sampled_packets_total", "result", "skipped", _skipped.load(memory_order_relaxed));
+  metrics::appendHeader(out, "dns_export_sampling_rate_changes_total", "counter", "Changes of sampling rate by adaptive sampling.");
+  metrics::appendSample(out, "dns_export_sampling_rate_changes_total", nullptr, nullptr, _rateChanges.load(memory_order_relaxed));
+}
+
+/**
+ * @brief Private method computing hash identifying DNS transaction of packet.
+ *
+ * Addresses, ports and DNS ID are hashed independently on direction, so query and
+ * its response get same hash. All fragments of IP datagram are hashed by addresses
+ * and fragment identification, because only first of them has transport header.
+ * Result is mixed by finalizer of MurmurHash3, so its remainders are uniform.
+ */
+__u32 PacketSampler::flowHash(const unsigned char *packet, unsigned int len) const {
+  __u32 hash = 2166136261u;
+  const unsigned char *transport = nullptr;
+  __u8 protocol = 0;
+  if (len >= SAMPLER_ETHERNET_SIZE + 20 && packet[12] == 0x08 && packet[13] == 0x00) {
+    const unsigned char *ip = packet + SAMPLER_ETHERNET_SIZE;
+    hash = hashPair(hash, ip + 12, ip + 16, 4);
+    if ((((ip[6] << 8) | ip[7]) & 0x3fff) != 0)         // fragment: more fragments flag or offset
+      hash = hashBytes(hash, ip + 4, 2);                // identification
+    else {
+      transport = ip + (ip[0] & 0x0f) * 4;
+      protocol = ip[9];
+    }
+  } else if (len >= SAMPLER_ETHERNET_SIZE + 40 && packet[12] == 0x86 && packet[13] == 0xdd) {
+    const unsigned char *ip6 = packet + SAMPLER_ETHERNET_SIZE;
+    hash = hashPair(hash, ip6 + 8, ip6 + 24, 16);
+    if (ip6[6] == SAMPLER_IPV6_FRAGMENT && len >= SAMPLER_ETHERNET_SIZE + 48)
+      hash = hashBytes(hash, ip6 + 44, 4);              // identification of fragment header
+    else {
+      transport = ip6 + 40;
+      protocol = ip6[6];
+    }
+  }
+
+  if (transport != nullptr && (protocol == IPPROTO_UDP || protocol == IPPROTO_TCP) && transport + 4 <= packet + len) {
+    hash = hashPair(hash, transport, transport + 2, 2);  // ports
+    // DNS ID, TCP payload starts with two bytes of message length
+    const unsigned char *dnsId = nullptr;
+    if (protocol == IPPROTO_UDP)
+      dnsId = transport + 8;
+    else if (transport + 13 <= packet + len)              // TCP data offset is captured
+      dnsId = transport + (transport[12] >> 4) * 4 + 2;
+    if (dnsId != nullptr && dnsId + 2 <= packet + len)
+      hash = hashBytes(hash, dnsId, 2);
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+/**
+ * @brief Private method measuring ingest latency of packet as difference of
+ * wall clock and capture time stamp, maximum of adaptation period is kept.
+ */
+void PacketSampler::measureLatency(const struct pcap_pkthdr *header) {
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  __s64 latency = ((__s64)now.tv_sec - header->ts.tv_sec) * 1000000 + (now.tv_usec - header->ts.tv_usec);
+  if (latency > 0 && (__u64)latency > _maxLatencyUsec)
+    _maxLatencyUsec = latency;
+}
+
+/* createPacketSampler */
+unique_ptr<PacketSampler> createPacketSampler(const string &spec, unsigned int maxRate) {
+  static const char *modeNames[SAMPLING_MODE_COUNT] = { "none", "count", "random", "flow" };
+  size_t colon = spec.find(':');
+  string modeName = spec.substr(0, colon);
+  int mode = SAMPLING_NONE;
+  while (mode < SAMPLING_MODE_COUNT && modeName != modeNames[mode])
+    ++mode;
+  char *end = nullptr;
+  long rate = colon == string::npos ? 0 : strtol(spec.c_str() + colon + 1, &end, 10);
+  if (mode == SAMPLING_NONE || mode == SAMPLING_MODE_COUNT || rate < 1 || rate > SAMPLING_MAX_RATE || *end != 0) {
+    cerr << "Invalid sampling \"" << spec << "\", expected count:<N>, random:<N> or flow:<N> with N from 1 to " << SAMPLING_MAX_RATE << "." << endl;
+    return nullptr;
+  }
+  if (maxRate > SAMPLING_MAX_RATE || (maxRate > 0 && maxRate < rate)) {
+    cerr << "Invalid maximal sampling rate " << maxRate << ", expected number from " << rate << " to " << SAMPLING_MAX_RATE << "." << endl;
+    return nullptr;
+  }
+  DWRITE("Sampling " << modeNames[mode] << " 1 in " << rate << (maxRate > 0 ? " adaptive up to " + to_string(maxRate) : string()));
+  return unique_ptr<PacketSampler>(new PacketSampler((ESamplingMode)mode, rate, maxRate));
+}
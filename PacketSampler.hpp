@@ -0,0 +1,115 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    PacketSampler.hpp
+ * @brief   Sampling of captured packets with adaptive sampling rate, so
+ *          approximate statistics are gathered when packets cannot be
+ *          processed all.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <pcap/pcap.h>
+#include <linux/types.h>
+
+#define SAMPLING_MAX_RATE             65536   // maximal N of 1-in-N sampling
+#define SAMPLING_ADAPT_INTERVAL_USEC  1000000 // period of adaptive rate changes
+#define SAMPLING_DROP_THRESHOLD       0.01    // fraction of dropped packets in period raising rate
+#define SAMPLING_LATENCY_THRESHOLD    100000  // ingest latency (usec) raising rate
+#define SAMPLING_LATENCY_EVERY        64      // ingest latency is measured on every n-th packet
+
+/**
+ * @brief Ways of choosing sampled packets.
+ */
+enum ESamplingMode {
+  SAMPLING_NONE,    /*!< all packets are processed */
+  SAMPLING_COUNT,   /*!< every N-th packet */
+  SAMPLING_RANDOM,  /*!< each packet with probability 1/N */
+  SAMPLING_FLOW,    /*!< packets whose hash of transaction is divisible by N, so query,
+                         response and all fragments of one datagram are sampled together */
+  SAMPLING_MODE_COUNT
+};
+
+/**
+ * @brief Decides which captured packets are processed and with which weight.
+ *
+ * Each sampled packet stands for N captured packets, so its answers are
+ * counted N times (weight). DNSStatistic keeps variance of such estimates
+ * to report their confidence (see SDnsStatRecord).
+ *
+ * Adaptive sampler doubles N (up to maximal rate) when more than
+ * SAMPLING_DROP_THRESHOLD packets were dropped in last period or ingest
+ * latency (time between capture of packet and its sampling) passes
+ * SAMPLING_LATENCY_THRESHOLD, and halves N (down to initial rate) when
+ * there were no drops and latency was under quarter of threshold.
+ * Sampler is used by capture thread only, metrics can be read from any thread.
+ */
+class PacketSampler {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param rate     initial (and minimal) N
+   * @param maxRate  maximal N of adaptive sampling, 0 or rate for fixed N
+   */
+  PacketSampler(ESamplingMode mode, unsigned int rate, unsigned int maxRate);
+
+  /** Destructor */
+  ~PacketSampler();
+
+  /**
+   * @brief Decides if packet is processed.
+   *
+   * @return weight of packet (actual N) or 0 when packet is skipped.
+   */
+  unsigned int sample(const struct pcap_pkthdr *header, const unsigned char *packet);
+
+  /**
+   * @brief Adapts sampling rate to load, called periodically by capture thread.
+   *
+   * Rate is changed at most once per SAMPLING_ADAPT_INTERVAL_USEC.
+   * @param receivedPackets  total number of packets received by capture
+   * @param droppedPackets   total number of packets dropped before they were processed
+   */
+  void adapt(__u64 receivedPackets, __u64 droppedPackets);
+
+  /** @brief Returns actual N. */
+  unsigned int rate() const;
+
+  /** @brief Appends sampling rate and counters in metrics text format. */
+  void writeMetrics(std::string &out) const;
+
+private: /* private implementation is documented in *.cpp file */
+  ESamplingMode _mode;
+  unsigned int _minRate;
+  unsigned int _maxRate;
+  std::atomic<unsigned int> _rate;
+  unsigned int _counter;
+  __u64 _random;
+  __u64 _lastAdaptUsec;
+  __u64 _lastReceived;
+  __u64 _lastDropped;
+  __u64 _maxLatencyUsec;
+  std::atomic<__u64> _kept;
+  std::atomic<__u64> _skipped;
+  std::atomic<__u64> _rateChanges;
+  unsigned int _metricsCollector;
+
+  __u32 flowHash(const unsigned char *packet, unsigned int len) const;
+  void measureLatency(const struct pcap_pkthdr *header);
+};
+
+/**
+ * @brief Creates sampler from specification "<mode>:<N>".
+ *
+ * @param spec     mode "count", "random" or "flow" and N, e.g. "flow:16"
+ * @param maxRate  maximal N of adaptive sampling, 0 for fixed N
+ * @return sampler or nullptr on error, error is written on stderr.
+ */
+std::unique_ptr<PacketSampler> createPacketSampler(const std::string &spec, unsigned int maxRate);
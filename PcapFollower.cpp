@@ -0,0 +1,293 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    PcapFollower.cpp
+ * \brief   Class reading *.pcap files which are still being written
+ *          (e.g. by tcpdump -w) and following their rotation.
+ *          Implementation of PcapFollower.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "utils.hpp"
+#include "PcapFollower.hpp"
+#include "pcapProcessor.hpp"
+
+#define PCAP_FILE_HEADER_SIZE   (24)
+#define PCAP_RECORD_HEADER_SIZE (16)
+#define PCAP_MAGIC_USEC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+
+using namespace std;
+
+/**
+ * @brief Supportive function comparing file names in natural order (digit runs compared as numbers).
+ */
+static bool naturalLess(const string &a, const string &b) {
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    if (isdigit(a[i]) && isdigit(b[j])) {
+      size_t endA = i, endB = j;
+      while (endA < a.size() && isdigit(a[endA])) ++endA;
+      while (endB < b.size() && isdigit(b[endB])) ++endB;
+      // skip leading zeros and compare by length, then by digits
+      size_t beginA = i, beginB = j;
+      while (beginA + 1 < endA && a[beginA] == '0') ++beginA;
+      while (beginB + 1 < endB && b[beginB] == '0') ++beginB;
+      if (endA - beginA != endB - beginB)
+        return endA - beginA < endB - beginB;
+      int cmp = a.compare(beginA, endA - beginA, b, beginB, endB - beginB);
+      if (cmp != 0)
+        return cmp < 0;
+      i = endA;
+      j = endB;
+    } else {
+      if (a[i] != b[j])
+        return a[i] < b[j];
+      ++i;
+      ++j;
+    }
+  }
+  return a.size() - i < b.size() - j;
+}
+
+/**
+ * @brief Supportive function reading 32 bit value from file header or record header.
+ */
+static __u32 readU32(const unsigned char *data, bool isSwapped) {
+  __u32 value;
+  memcpy(&value, data, sizeof(__u32));
+  return isSwapped ? __builtin_bswap32(value) : value;
+}
+
+/** Constructor */
+PcapFollower::PcapFollower(const vector<string> &paths) : _paths(paths) {
+  _file = nullptr;
+  _inode = 0;
+  _isHeaderRead = false;
+  _isSwapped = false;
+  _isNanosecond = false;
+  _watchFd = -1;
+  _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (_inotifyFd == -1)
+    cerr << "Warning: inotify is not available, follower will poll for new data." << endl;
+}
+
+/** Destructor */
+PcapFollower::~PcapFollower() {
+  closeFile();
+  if (_inotifyFd != -1)
+    close(_inotifyFd);
+}
+
+/**
+ * @brief Reads next packet.
+ *
+ * (See PcapFollower.hpp for more info.)
+ */
+int PcapFollower::next(struct pcap_pkthdr *header, const unsigned char **data) {
+  while (true) {
+    if (_file == nullptr) {
+      string firstFile = findNextFile();
+      if (firstFile.empty() || !openFile(firstFile))
+        return 0;
+    }
+
+    if (!_isHeaderRead) {
+      if (!readFileHeader())
+        return _file == nullptr ? -1 : 0;
+    }
+
+    long recordStart = ftell(_file);
+    unsigned char recordHeader[PCAP_RECORD_HEADER_SIZE];
+    if (fread(recordHeader, 1, PCAP_RECORD_HEADER_SIZE, _file) == PCAP_RECORD_HEADER_SIZE) {
+      __u32 caplen = readU32(recordHeader + 8, _isSwapped);
+      if (caplen > FOLLOW_MAX_CAPLEN) {
+        cerr << "Pcap file \"" << _currentFile << "\" is corrupted (record of " << caplen << " B)." << endl;
+        return -1;
+      }
+      if (_buffer.size() < caplen)
+        _buffer.resize(caplen);
+      if (fread(_buffer.data(), 1, caplen, _file) == caplen) {
+        header->ts.tv_sec = readU32(recordHeader, _isSwapped);
+        header->ts.tv_usec = readU32(recordHeader + 4, _isSwapped);
+        if (_isNanosecond)
+          header->ts.tv_usec /= 1000;
+        header->caplen = caplen;
+        header->len = readU32(recordHeader + 12, _isSwapped);
+        *data = _buffer.data();
+        return 1;
+      }
+    }
+
+    // record is not complete yet, return to its beginning and try it later
+    clearerr(_file);
+    fseek(_file, recordStart, SEEK_SET);
+
+    if (isReplaced()) {
+      DWRITE("Followed file \"" << _currentFile << "\" was truncated or replaced, reading from beginning");
+      string fileName = _currentFile;
+      closeFile();
+      if (!openFile(fileName))
+        return 0;
+      continue;
+    }
+
+    string nextFile = findNextFile();
+    if (nextFile.empty())
+      return 0;
+    DWRITE("Followed file rotated: \"" << _currentFile << "\" -> \"" << nextFile << "\"");
+    closeFile();
+    if (!openFile(nextFile))
+      return 0;
+  }
+}
+
+/**
+ * @brief Blocks until followed directory changes or timeout expires.
+ *
+ * (See PcapFollower.hpp for more info.)
+ */
+void PcapFollower::waitForData(int timeoutMs) {
+  if (_inotifyFd == -1 || _watchFd == -1) {
+    usleep(min(timeoutMs, 200) * 1000);
+    return;
+  }
+  struct pollfd pfd = { _inotifyFd, POLLIN, 0 };
+  if (poll(&pfd, 1, timeoutMs) > 0) {
+    // we do not care about particular events, just drain them
+    char events[4096];
+    while (read(_inotifyFd, events, sizeof(events)) > 0) {}
+  }
+}
+
+/**
+ * @brief Returns name of file which is actually read.
+ *
+ * (See PcapFollower.hpp for more info.)
+ */
+const string &PcapFollower::currentFile() const {
+  return _currentFile;
+}
+
+/**
+ * @brief Private method opening file for reading from its beginning.
+ */
+bool PcapFollower::openFile(const string &path) {
+  _file = fopen(path.c_str(), "rb");
+  if (_file == nullptr) {
+    cerr << "Cannot open pcap file \"" << path << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  struct stat fileStat;
+  _inode = (fstat(fileno(_file), &fileStat) == 0) ? fileStat.st_ino : 0;
+  _currentFile = path;
+  _isHeaderRead = false;
+  watchDirectoryOf(path);
+  DWRITE("Following file: " << path);
+  return true;
+}
+
+/**
+ * @brief Private method closing actual file.
+ */
+void PcapFollower::closeFile() {
+  if (_file != nullptr) {
+    fclose(_file);
+    _file = nullptr;
+  }
+}
+
+/**
+ * @brief Private method reading pcap file header.
+ *
+ * @return true   when header was read
+ * @return false  when header is not written yet, or file is not supported pcap file,
+ *                then file is closed and error is written on stderr.
+ */
+bool PcapFollower::readFileHeader() {
+  unsigned char fileHeader[PCAP_FILE_HEADER_SIZE];
+  if (fread(fileHeader, 1, PCAP_FILE_HEADER_SIZE, _file) != PCAP_FILE_HEADER_SIZE) {
+    clearerr(_file);
+    fseek(_file, 0, SEEK_SET);
+    return false;
+  }
+
+  __u32 magic = readU32(fileHeader, false);
+  _isSwapped = (magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+  magic = readU32(fileHeader, _isSwapped);
+  if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+    cerr << "File \"" << _currentFile << "\" is not a pcap file (pcapng is not supported in follow mode)." << endl;
+    closeFile();
+    return false;
+  }
+  _isNanosecond = magic == PCAP_MAGIC_NSEC;
+
+  __u32 linkType = readU32(fileHeader + 20, _isSwapped) & 0xffff;
+  if (linkType != DLT_EN10MB) {
+    cerr << "Pcap file \"" << _currentFile << "\" has unsupported link type " << linkType << "." << endl;
+    closeFile();
+    return false;
+  }
+  _isHeaderRead = true;
+  return true;
+}
+
+/**
+ * @brief Private method finding file which should be read after actual one.
+ *
+ * @return string   the newest file when no file is read yet,
+ *                  the first file after actual one in natural order otherwise,
+ *                  empty string when there is no such file.
+ */
+string PcapFollower::findNextFile() const {
+  vector<string> files;
+  if (!expandPcapPaths(_paths, files, true) || files.empty())
+    return "";
+  sort(files.begin(), files.end(), naturalLess);
+  if (_currentFile.empty())
+    return files.back();
+  for (const auto &file : files) {
+    if (naturalLess(_currentFile, file))
+      return file;
+  }
+  return "";
+}
+
+/**
+ * @brief Private method registering inotify watch on directory containing given file.
+ */
+void PcapFollower::watchDirectoryOf(const string &path) {
+  if (_inotifyFd == -1)
+    return;
+  size_t slash = path.find_last_of('/');
+  string dir = (slash == string::npos) ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+  if (dir == _watchedDir)
+    return;
+  if (_watchFd != -1)
+    inotify_rm_watch(_inotifyFd, _watchFd);
+  _watchFd = inotify_add_watch(_inotifyFd, dir.c_str(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+  _watchedDir = (_watchFd == -1) ? "" : dir;
+}
+
+/**
+ * @brief Private method checking if actual file was truncated or replaced by other file of same name.
+ */
+bool PcapFollower::isReplaced() const {
+  struct stat fileStat;
+  if (stat(_currentFile.c_str(), &fileStat) != 0)
+    return false; // removed or renamed, rest of it can be still read from open file
+  return fileStat.st_ino != _inode || fileStat.st_size < ftell(_file);
+}
@@ -0,0 +1,87 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    PcapFollower.hpp
+ * @brief   Class reading *.pcap files which are still being written
+ *          (e.g. by tcpdump -w) and following their rotation.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <sys/types.h>
+#include <pcap/pcap.h>
+
+#define FOLLOW_MAX_CAPLEN 262144  // records with larger capture length are treated as corruption
+
+/**
+ * @brief Class reading growing *.pcap files record by record.
+ *
+ * libpcap cannot continue reading file after it hits partially written record,
+ * so file format is read directly. Partially written record at the end of file
+ * is left unread until rest of it is written.
+ *
+ * Followed files are given by paths, glob patterns or directories (same as for
+ * processPcapFiles). Reading starts with the newest file. When current file
+ * does not grow and newer file appears (tcpdump -G or -C rotation), follower
+ * switches to it. Files are ordered by natural order of their names, so
+ * "dump9" < "dump10" for -C numbering and time stamps of -G sort naturally.
+ * When current file is truncated or replaced under same name, it is read again
+ * from beginning. New data are waited for with inotify.
+ */
+class PcapFollower {
+public:
+  /** Constructor */
+  PcapFollower(const std::vector<std::string> &paths);
+
+  /** Destructor */
+  ~PcapFollower();
+
+  /**
+   * @brief Reads next packet.
+   *
+   * @param header  filled with header of packet
+   * @param data    filled with pointer to packet data valid until next call
+   * @return int    1 when packet was read,
+   *                0 when no complete packet is available now (see waitForData),
+   *                -1 on unrecoverable error, written on stderr.
+   */
+  int next(struct pcap_pkthdr *header, const unsigned char **data);
+
+  /**
+   * @brief Blocks until followed directory changes or timeout expires.
+   *
+   * Returns earlier when interrupted by signal.
+   */
+  void waitForData(int timeoutMs);
+
+  /**
+   * @brief Returns name of file which is actually read.
+   */
+  const std::string &currentFile() const;
+
+private: /* private implementation is documented in *.cpp file */
+  std::vector<std::string> _paths;
+  std::string _currentFile;
+  FILE *_file;
+  ino_t _inode;
+  bool _isHeaderRead;
+  bool _isSwapped;
+  bool _isNanosecond;
+  std::vector<unsigned char> _buffer;
+  int _inotifyFd;
+  int _watchFd;
+  std::string _watchedDir;
+
+  bool openFile(const std::string &path);
+  void closeFile();
+  bool readFileHeader();
+  std::string findNextFile() const;
+  void watchDirectoryOf(const std::string &path);
+  bool isReplaced() const;
+};
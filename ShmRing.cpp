@@ -0,0 +1,255 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    ShmRing.cpp
+ * \brief   Shared memory ring buffer publishing parsed DNS answers to
+ *          consumers running on the same host.
+ *          Implementation of ShmRing.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.hpp"
+#include "ShmRing.hpp"
+
+#define SHM_RING_SEQUENCE_OFFSET  64   // offset of write sequence
+#define SHM_RING_SLOTS_OFFSET     128  // offset of first slot
+#define SHM_RING_GUARD_SIZE       (2 * SHM_RING_SLOT_SIZE) // torn lengths cannot point out of mapping
+
+using namespace std;
+
+/** Constructor */
+ShmRingProducer::ShmRingProducer() {
+  _memory = nullptr;
+  _size = 0;
+  _header = nullptr;
+  _writeSequence = nullptr;
+  _slots = nullptr;
+}
+
+/** Destructor, unmaps ring, shared memory object stays for consumers. */
+ShmRingProducer::~ShmRingProducer() {
+  if (_memory != nullptr)
+    munmap(_memory, _size);
+}
+
+/**
+ * @brief Creates (or recreates) shared memory object with ring.
+ *
+ * (See ShmRing.hpp for more info.)
+ */
+bool ShmRingProducer::create(const string &name, __u64 slotCount) {
+  if (slotCount == 0 || (slotCount & (slotCount - 1)) != 0) {
+    cerr << "Number of ring slots has to be power of two." << endl;
+    return false;
+  }
+  // recreate object, so consumers of previous instance do not see stale layout
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd == -1) {
+    cerr << "Cannot create shared memory \"" << name << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  _size = SHM_RING_SLOTS_OFFSET + slotCount * SHM_RING_SLOT_SIZE + SHM_RING_GUARD_SIZE;
+  if (ftruncate(fd, _size) != 0) {
+    cerr << "Cannot resize shared memory \"" << name << "\": " << strerror(errno) << endl;
+    close(fd);
+    return false;
+  }
+  void *mapped = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    cerr << "Cannot map shared memory \"" << name << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  _memory = (unsigned char *)mapped;
+  _header = (SShmRingHeader *)_memory;
+  _writeSequence = (__u64 *)(_memory + SHM_RING_SEQUENCE_OFFSET);
+  _slots = _memory + SHM_RING_SLOTS_OFFSET;
+
+  // memory of new object is zeroed, so all slots are empty and sequence is 0
+  _header->version = SHM_RING_VERSION;
+  _header->slotSize = SHM_RING_SLOT_SIZE;
+  _header->slotCount = slotCount;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(_header->magic, SHM_RING_MAGIC, sizeof(_header->magic)); // consumers check magic last
+  DWRITE("Shared memory ring " << name << " created, slots: " << slotCount);
+  return true;
+}
+
+/**
+ * @brief Publishes one answer.
+ *
+ * (See ShmRing.hpp for more info.)
+ */
+void ShmRingProducer::publish(const SDnsAnswerRecord &answer, __u64 timestampUsec) {
+  __u64 sequence = __atomic_fetch_add(_writeSequence, 1, __ATOMIC_RELAXED);
+  SShmRingEntry *entry = (SShmRingEntry *)(_slots + (sequence & (_header->slotCount - 1)) * SHM_RING_SLOT_SIZE);
+
+  __atomic_store_n(&entry->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE); // mark slot busy before payload changes
+
+  size_t free = SHM_RING_PAYLOAD_SIZE;
+  size_t domainLen = min(answer.domainName.size(), free);
+  free -= domainLen;
+  size_t typeLen = min(answer.typeString.size(), free);
+  free -= typeLen;
+  size_t dataLen = min(answer.answerData.size(), free);
+
+  entry->timestampUsec = timestampUsec;
+  entry->type = answer.header.type;
+  entry->recClass = answer.header.recClass;
+  entry->timeToLive = answer.header.timeToLive;
+  entry->domainLen = domainLen;
+  entry->typeLen = typeLen;
+  entry->dataLen = dataLen;
+  entry->flags = (domainLen + typeLen + dataLen <
+    answer.domainName.size() + answer.typeString.size() + answer.answerData.size()) ? SHM_RING_FLAG_TRUNCATED : 0;
+  unsigned char *payload = (unsigned char *)(entry + 1);
+  memcpy(payload, answer.domainName.data(), domainLen);
+  memcpy(payload + domainLen, answer.typeString.data(), typeLen);
+  memcpy(payload + domainLen + typeLen, answer.answerData.data(), dataLen);
+
+  __atomic_store_n(&entry->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+/** Constructor */
+ShmRingConsumer::ShmRingConsumer() {
+  _memory = nullptr;
+  _size = 0;
+  _header = nullptr;
+  _writeSequence = nullptr;
+  _slots = nullptr;
+  _readSequence = 0;
+  _dropped = 0;
+  _actEntry = nullptr;
+}
+
+/** Destructor */
+ShmRingConsumer::~ShmRingConsumer() {
+  if (_memory != nullptr)
+    munmap((void *)_memory, _size);
+}
+
+/**
+ * @brief Maps existing ring read only, reading starts at newest entry.
+ *
+ * (See ShmRing.hpp for more info.)
+ */
+bool ShmRingConsumer::open(const string &name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    cerr << "Cannot open shared memory \"" << name << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < SHM_RING_SLOTS_OFFSET + SHM_RING_GUARD_SIZE) {
+    cerr << "Shared memory \"" << name << "\" is not a ring." << endl;
+    close(fd);
+    return false;
+  }
+  void *mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    cerr << "Cannot map shared memory \"" << name << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  _memory = (const unsigned char *)mapped;
+  _size = fileStat.st_size;
+  _header = (const SShmRingHeader *)_memory;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (memcmp(_header->magic, SHM_RING_MAGIC, sizeof(_header->magic)) != 0 ||
+      _header->version != SHM_RING_VERSION || _header->slotSize != SHM_RING_SLOT_SIZE ||
+      _header->slotCount == 0 || (_header->slotCount & (_header->slotCount - 1)) != 0 ||
+      _header->slotCount > (_size - SHM_RING_SLOTS_OFFSET - SHM_RING_GUARD_SIZE) / SHM_RING_SLOT_SIZE) {
+    cerr << "Shared memory \"" << name << "\" is not a compatible ring." << endl;
+    munmap(mapped, _size);
+    _memory = nullptr;
+    return false;
+  }
+  _writeSequence = (const __u64 *)(_memory + SHM_RING_SEQUENCE_OFFSET);
+  _slots = _memory + SHM_RING_SLOTS_OFFSET;
+  _readSequence = __atomic_load_n(_writeSequence, __ATOMIC_ACQUIRE);
+  return true;
+}
+
+/**
+ * @brief Returns next entry directly in shared memory or nullptr when there is none.
+ *
+ * (See ShmRing.hpp for more info.)
+ */
+const SShmRingEntry *ShmRingConsumer::next() {
+  while (true) {
+    const SShmRingEntry *entry = (const SShmRingEntry *)(_slots + (_readSequence & (_header->slotCount - 1)) * SHM_RING_SLOT_SIZE);
+    __u64 slotSequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+    if (slotSequence == _readSequence + 1) {
+      if ((size_t)entry->domainLen + entry->typeLen + entry->dataLen > SHM_RING_PAYLOAD_SIZE) {
+        ++_dropped; // overwritten right now, lengths are torn
+        ++_readSequence;
+        continue;
+      }
+      _actEntry = entry;
+      return entry;
+    }
+
+    __u64 writeSequence = __atomic_load_n(_writeSequence, __ATOMIC_ACQUIRE);
+    if (writeSequence <= _readSequence)
+      return nullptr; // nothing new
+    if (slotSequence <= _readSequence && writeSequence - _readSequence <= _header->slotCount)
+      return nullptr; // entry is being written
+
+    // entry was overwritten, skip to the oldest entry which can be still in ring
+    __u64 oldest = writeSequence > _header->slotCount ? writeSequence - _header->slotCount : 0;
+    __u64 skipTo = max(oldest, _readSequence + 1);
+    _dropped += skipTo - _readSequence;
+    _readSequence = skipTo;
+  }
+}
+
+/**
+ * @brief Finishes work with entry returned by next.
+ *
+ * (See ShmRing.hpp for more info.)
+ */
+bool ShmRingConsumer::release() {
+  if (_actEntry == nullptr)
+    return false;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  bool isValid = __atomic_load_n(&_actEntry->sequence, __ATOMIC_RELAXED) == _readSequence + 1;
+  if (!isValid)
+    ++_dropped;
+  ++_readSequence;
+  _actEntry = nullptr;
+  return isValid;
+}
+
+/** @brief Returns number of entries lost because consumer was too slow. */
+__u64 ShmRingConsumer::dropped() const {
+  return _dropped;
+}
+
+/** @brief Returns pointer to domain name of entry. */
+const char *ShmRingConsumer::domain(const SShmRingEntry *entry) {
+  return (const char *)(entry + 1);
+}
+
+/** @brief Returns pointer to type string of entry. */
+const char *ShmRingConsumer::typeString(const SShmRingEntry *entry) {
+  return domain(entry) + entry->domainLen;
+}
+
+/** @brief Returns pointer to data of entry. */
+const char *ShmRingConsumer::data(const SShmRingEntry *entry) {
+  return typeString(entry) + entry->typeLen;
+}
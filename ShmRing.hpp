@@ -0,0 +1,176 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    ShmRing.hpp
+ * @brief   Shared memory ring buffer publishing parsed DNS answers to
+ *          consumers running on the same host.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+
+#define SHM_RING_MAGIC              "DNSERING"  // first 8 bytes of ring
+#define SHM_RING_VERSION            1
+#define SHM_RING_SLOT_SIZE          512         // size of one slot including its header
+#define SHM_RING_DEFAULT_SLOT_COUNT 65536       // has to be power of two
+#define SHM_RING_FLAG_TRUNCATED     0x1         // data did not fit into slot and were cut
+
+/*
+ * Ring layout (POSIX shared memory object, host byte order):
+ *
+ *   SShmRingHeader                  64 bytes
+ *   write sequence                  __u64 at offset 64, alone in its cache line
+ *   slots                           slotCount * SHM_RING_SLOT_SIZE bytes from offset 128
+ *   guard                           2 * SHM_RING_SLOT_SIZE zero bytes
+ *
+ * Every slot starts with SShmRingEntry followed by domain, type string and
+ * data bytes (not zero terminated). Producers never wait for consumers:
+ * entry with sequence S is written into slot S % slotCount, overwriting the
+ * oldest one. Entry sequence numbers are global, so consumer which falls
+ * behind detects overwritten entries and counts them as dropped.
+ *
+ * Slot protocol (seqlock): producer claims S by atomic increment of write
+ * sequence, stores 0 into SShmRingEntry::sequence, writes entry and stores
+ * S + 1 with release semantics. Consumer expecting S reads the slot when its
+ * sequence is S + 1 and checks sequence is unchanged after it is done with
+ * the entry (see ShmRingConsumer::release). Guard at the end keeps reads
+ * of torn entry inside of mapping.
+ */
+
+/**
+ * @brief Header of shared memory ring.
+ */
+struct SShmRingHeader {
+  char  magic[8];       /*!< SHM_RING_MAGIC without terminating zero */
+  __u32 version;        /*!< SHM_RING_VERSION */
+  __u32 slotSize;       /*!< SHM_RING_SLOT_SIZE */
+  __u64 slotCount;      /*!< number of slots, power of two */
+  __u8  reserved[40];   /*!< zero */
+};
+
+/**
+ * @brief Header of entry in slot, one parsed DNS answer.
+ */
+struct SShmRingEntry {
+  __u64 sequence;       /*!< sequence number of entry + 1, 0 while slot is written */
+  __u64 timestampUsec;  /*!< capture time of packet in microseconds since epoch */
+  __u16 type;           /*!< type of answer record */
+  __u16 recClass;       /*!< class of answer record */
+  __u32 timeToLive;     /*!< TTL of answer record */
+  __u16 domainLen;      /*!< length of domain name following this header */
+  __u16 typeLen;        /*!< length of type string following domain name */
+  __u16 dataLen;        /*!< length of data following type string */
+  __u16 flags;          /*!< SHM_RING_FLAG_* */
+};
+
+/** @brief Maximal number of bytes of domain, type and data in one slot. */
+#define SHM_RING_PAYLOAD_SIZE (SHM_RING_SLOT_SIZE - sizeof(SShmRingEntry))
+
+/**
+ * @brief Publisher of DNS answers into shared memory ring.
+ *
+ * publish can be called from more threads at once (MPSC), it never blocks.
+ */
+class ShmRingProducer {
+public:
+  /** Constructor */
+  ShmRingProducer();
+
+  /** Destructor, unmaps ring, shared memory object stays for consumers. */
+  ~ShmRingProducer();
+
+  /**
+   * @brief Creates (or recreates) shared memory object with ring.
+   *
+   * @param name      name of POSIX shared memory object (e.g. "/dns-export")
+   * @param slotCount number of slots, power of two
+   * @return false on failure, error is written on stderr.
+   */
+  bool create(const std::string &name, __u64 slotCount = SHM_RING_DEFAULT_SLOT_COUNT);
+
+  /**
+   * @brief Publishes one answer.
+   *
+   * @param timestampUsec  capture time of packet
+   */
+  void publish(const SDnsAnswerRecord &answer, __u64 timestampUsec);
+
+private: /* private implementation is documented in *.cpp file */
+  unsigned char *_memory;
+  size_t _size;
+  SShmRingHeader *_header;
+  __u64 *_writeSequence;
+  unsigned char *_slots;
+};
+
+/**
+ * @brief Zero copy reader of shared memory ring.
+ *
+ * Usage:
+ *   while ((entry = consumer.next()) != nullptr) {
+ *     ... use entry, domain(entry), typeString(entry), data(entry) ...
+ *     if (!consumer.release()) ... entry was overwritten while used, discard results
+ *   }
+ */
+class ShmRingConsumer {
+public:
+  /** Constructor */
+  ShmRingConsumer();
+
+  /** Destructor */
+  ~ShmRingConsumer();
+
+  /**
+   * @brief Maps existing ring read only, reading starts at newest entry.
+   *
+   * Producer recreates ring on its start, so consumer has to open ring again
+   * after producer was restarted.
+   * @return false on failure, error is written on stderr.
+   */
+  bool open(const std::string &name);
+
+  /**
+   * @brief Returns next entry directly in shared memory or nullptr when there is none.
+   *
+   * Entry stays valid until release is called. Entries overwritten before
+   * they were read are counted by dropped().
+   */
+  const SShmRingEntry *next();
+
+  /**
+   * @brief Finishes work with entry returned by next.
+   *
+   * @return true   entry was not changed while it was used
+   * @return false  producer overwrote entry, it is counted as dropped.
+   */
+  bool release();
+
+  /** @brief Returns number of entries lost because consumer was too slow. */
+  __u64 dropped() const;
+
+  /** @brief Returns pointer to domain name of entry. */
+  static const char *domain(const SShmRingEntry *entry);
+
+  /** @brief Returns pointer to type string of entry. */
+  static const char *typeString(const SShmRingEntry *entry);
+
+  /** @brief Returns pointer to data of entry. */
+  static const char *data(const SShmRingEntry *entry);
+
+private: /* private implementation is documented in *.cpp file */
+  const unsigned char *_memory;
+  size_t _size;
+  const SShmRingHeader *_header;
+  const __u64 *_writeSequence;
+  const unsigned char *_slots;
+  __u64 _readSequence;
+  __u64 _dropped;
+  const SShmRingEntry *_actEntry;
+};
@@ -0,0 +1,130 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    SpscRing.hpp
+ * @brief   Lock-free bounded queue of one producer and one consumer thread.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+#define SPSC_RING_CACHE_LINE 64  // producer and consumer indexes are kept in different cache lines
+
+/**
+ * @brief Lock-free bounded queue of preallocated slots for one producer and one consumer thread.
+ *
+ * Slots are constructed once and reused, so producer fills slot in place
+ * (or swaps its content in) instead of copying items through the queue.
+ *
+ * Usage:
+ *   producer: if ((slot = ring.claim()) != nullptr) { ... fill *slot ...; ring.publish(); }
+ *   consumer: if ((slot = ring.front()) != nullptr) { ... use *slot ...; ring.pop(); }
+ *
+ * Each side caches last seen index of the other side, so shared index is
+ * read only when queue looks full (or empty) from cached value.
+ */
+template <typename T>
+class SpscRing {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param capacity  number of slots, rounded up to power of two
+   */
+  explicit SpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    _slots.resize(size);
+    _mask = size - 1;
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
+    _producerHead = 0;
+    _consumerTail = 0;
+  }
+
+  /** @brief Returns free slot to be filled by producer or nullptr when queue is full. */
+  T *claim() {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _producerHead > _mask) {
+      _producerHead = _head.load(std::memory_order_acquire);
+      if (tail - _producerHead > _mask)
+        return nullptr;
+    }
+    return &_slots[tail & _mask];
+  }
+
+  /** @brief Passes slot returned by claim to consumer. */
+  void publish() {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /** @brief Returns oldest published slot to consumer or nullptr when queue is empty. */
+  T *front() {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _consumerTail) {
+      _consumerTail = _tail.load(std::memory_order_acquire);
+      if (head == _consumerTail)
+        return nullptr;
+    }
+    return &_slots[head & _mask];
+  }
+
+  /**
+   * @brief Returns published slot at given distance from oldest one (0 is same
+   *        as front) or nullptr when fewer slots are published.
+   */
+  T *peek(size_t offset) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (_consumerTail - head <= offset) {
+      _consumerTail = _tail.load(std::memory_order_acquire);
+      if (_consumerTail - head <= offset)
+        return nullptr;
+    }
+    return &_slots[(head + offset) & _mask];
+  }
+
+  /** @brief Returns slot returned by front back to producer. */
+  void pop() {
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /** @brief Returns number of published slots, can be called from any thread. */
+  size_t size() const {
+    size_t head = _head.load(std::memory_order_acquire);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    return tail >= head ? tail - head : 0;
+  }
+
+  /** @brief Returns number of slots. */
+  size_t capacity() const {
+    return _mask + 1;
+  }
+
+  /** @brief Returns address of slot storage (e.g. to place it on NUMA node). */
+  const void *storage() const {
+    return _slots.data();
+  }
+
+  /** @brief Returns size of slot storage in bytes. */
+  size_t storageSize() const {
+    return _slots.size() * sizeof(T);
+  }
+
+private:
+  std::vector<T> _slots;
+  size_t _mask;
+  char _padding0[SPSC_RING_CACHE_LINE];
+  std::atomic<size_t> _head;    // next slot to be consumed, written by consumer
+  size_t _consumerTail;         // consumer's copy of _tail
+  char _padding1[SPSC_RING_CACHE_LINE];
+  std::atomic<size_t> _tail;    // next slot to be published, written by producer
+  size_t _producerHead;         // producer's copy of _head
+  char _padding2[SPSC_RING_CACHE_LINE];
+};
@@ -0,0 +1,360 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    StatisticExporter.cpp
+ * \brief   Pluggable sinks exporting DNS statistics in text, JSON Lines
+ *          or binary format.
+ *          Implementation of StatisticExporter.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "utils.hpp"
+#include "StatisticExporter.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+
+/** Constructor */
+StatisticExporter::StatisticExporter() {
+  _fd = -1;
+  _isOwnFd = false;
+  _isSocket = false;
+  _isError = false;
+  _used = 0;
+}
+
+/** Destructor, closes output opened by open method. */
+StatisticExporter::~StatisticExporter() {
+  flush();
+  _writer.reset(); // waits for writes in flight
+  if (_isOwnFd)
+    close(_fd);
+}
+
+/**
+ * @brief Opens output of exporter.
+ *
+ * (See StatisticExporter.hpp for more info.)
+ */
+bool StatisticExporter::open(const string &path) {
+  if (path.empty() || path == "-") {
+    _fd = STDOUT_FILENO;
+    _isOwnFd = false;
+  } else {
+    struct stat fileStat;
+    _isSocket = stat(path.c_str(), &fileStat) == 0 && S_ISSOCK(fileStat.st_mode);
+    if (_isSocket) {
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(struct sockaddr_un));
+      addr.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Socket path \"" << path << "\" is too long." << endl;
+        return false;
+      }
+      memcpy(addr.sun_path, path.c_str(), path.size());
+      _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (_fd != -1 && connect(_fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) != 0) {
+        close(_fd);
+        _fd = -1;
+      }
+    } else {
+      _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if (_fd == -1) {
+      cerr << "Cannot open export output \"" << path << "\": " << strerror(errno) << endl;
+      return false;
+    }
+    _isOwnFd = true;
+  }
+  DWRITE("Export output opened: " << (path.empty() ? "stdout" : path) << (_isSocket ? " (socket)" : ""));
+
+  // file with data is continued stream of previous run, its beginning is not repeated
+  struct stat outStat;
+  if (fstat(_fd, &outStat) == 0 && S_ISREG(outStat.st_mode) && outStat.st_size > 0)
+    return true;
+  beginStream();
+  return flush();
+}
+
+/**
+ * @brief Exports all given records as one batch.
+ *
+ * (See StatisticExporter.hpp for more info.)
+ */
+bool StatisticExporter::exportStatistics(const StatRecords &records) {
+  _isError = false;
+  for (const auto &rec : records)
+    writeRecord(rec);
+  endBatch(records.size());
+  flush();
+  if (_writer != nullptr) {
+    _writer->submit();
+    metrics::setExportQueue(METRICS_EXPORT_EXPORTER, _writer->inFlight(), _writer->stalls());
+    if (_writer->takeFailures() > 0) {
+      cerr << "Writing exported statistics failed." << endl;
+      _isError = true;
+    }
+  }
+  return !_isError;
+}
+
+/**
+ * @brief Writes output file asynchronously by io_uring.
+ *
+ * (See StatisticExporter.hpp for more info.)
+ */
+void StatisticExporter::enableAsyncOutput() {
+  if (_fd == -1 || !_isOwnFd || _isSocket) {
+    cerr << "Warning: asynchronous output is used only for export files, writing synchronously." << endl;
+    return;
+  }
+  flush(); // data of beginStream are written before any queued one
+  // writer places buffers at offsets, which append flag of file opened by open would override
+  int flags = fcntl(_fd, F_GETFL);
+  if (flags == -1 || fcntl(_fd, F_SETFL, flags & ~O_APPEND) == -1) {
+    cerr << "Warning: export file cannot be written at offsets (" << strerror(errno) << "), writing synchronously." << endl;
+    return;
+  }
+  _writer = AsyncWriter::create(_fd, EXPORT_ASYNC_DEPTH, EXPORT_BUFFER_SIZE);
+  if (_writer == nullptr)
+    fcntl(_fd, F_SETFL, flags); // synchronous writes append again
+}
+
+/**
+ * @brief Appends bytes to output buffer, buffer is flushed when full.
+ */
+void StatisticExporter::append(const char *data, size_t len) {
+  if (_used + len > EXPORT_BUFFER_SIZE) {
+    flush();
+    if (len > EXPORT_BUFFER_SIZE) {
+      writeOut(data, len);
+      return;
+    }
+  }
+  memcpy(_buffer + _used, data, len);
+  _used += len;
+}
+
+/** @brief Appends string to output buffer. */
+void StatisticExporter::append(const string &str) {
+  append(str.data(), str.size());
+}
+
+/** @brief Appends one character to output buffer. */
+void StatisticExporter::appendChar(char c) {
+  if (_used == EXPORT_BUFFER_SIZE)
+    flush();
+  _buffer[_used++] = c;
+}
+
+/** @brief Appends decimal representation of number to output buffer. */
+void StatisticExporter::appendUInt(unsigned long long value) {
+  char digits[20];
+  size_t pos = sizeof(digits);
+  do {
+    digits[--pos] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  append(digits + pos, sizeof(digits) - pos);
+}
+
+/** @brief Appends 16 bit number in little endian to output buffer. */
+void StatisticExporter::appendLE16(__u16 value) {
+  char bytes[2] = { (char)(value & 0xff), (char)(value >> 8) };
+  append(bytes, 2);
+}
+
+/** @brief Appends 32 bit number in little endian to output buffer. */
+void StatisticExporter::appendLE32(__u32 value) {
+  appendLE16(value & 0xffff);
+  appendLE16(value >> 16);
+}
+
+/** @brief Appends 64 bit number in little endian to output buffer. */
+void StatisticExporter::appendLE64(__u64 value) {
+  appendLE32(value & 0xffffffff);
+  appendLE32(value >> 32);
+}
+
+/**
+ * @brief Private method writing content of buffer to output.
+ */
+bool StatisticExporter::flush() {
+  if (_used > 0 && _fd != -1)
+    writeOut(_buffer, _used);
+  _used = 0;
+  return !_isError;
+}
+
+/**
+ * @brief Private method writing whole data to output file descriptor.
+ */
+bool StatisticExporter::writeOut(const char *data, size_t len) {
+  if (_fd == STDOUT_FILENO) {
+    // keep order with other output written through iostreams or stdio
+    cout.flush();
+    fflush(stdout);
+  }
+  if (_writer != nullptr) {
+    if (!_writer->write(data, len)) {
+      _isError = true;
+      return false;
+    }
+    return true;
+  }
+  while (len > 0) {
+    ssize_t written = _isSocket ? send(_fd, data, len, MSG_NOSIGNAL) : write(_fd, data, len);
+    if (written == -1 && errno == EINTR)
+      continue;
+    if (written <= 0) {
+      if (!_isError)
+        cerr << "Writing exported statistics failed: " << strerror(errno) << endl;
+      _isError = true;
+      return false;
+    }
+    data += written;
+    len -= written;
+  }
+  return true;
+}
+
+/**
+ * @brief Serializes record as "domain type data count" line, margin of sampled
+ * count is appended as " +-margin" (see DNSStatistic::countMargin).
+ */
+void TextStatisticExporter::writeRecord(const SDnsStatRecord &record) {
+  append(record.answerRec.domainName);
+  appendChar(' ');
+  append(record.answerRec.typeString);
+  appendChar(' ');
+  append(record.answerRec.answerData);
+  appendChar(' ');
+  appendUInt(record.count);
+  if (record.variance > 0) {
+    append(" +-", 3);
+    appendUInt(DNSStatistic::countMargin(record));
+  }
+  appendChar('\n');
+}
+
+/**
+ * @brief Serializes record as JSON object on one line.
+ */
+void JsonLinesStatisticExporter::writeRecord(const SDnsStatRecord &record) {
+  append("{\"domain\":", 10);
+  appendJsonString(record.answerRec.domainName);
+  append(",\"type\":", 8);
+  appendJsonString(record.answerRec.typeString);
+  append(",\"data\":", 8);
+  appendJsonString(record.answerRec.answerData);
+  append(",\"ttl\":", 7);
+  appendUInt(record.answerRec.header.timeToLive);
+  append(",\"count\":", 9);
+  appendUInt(record.count);
+  if (record.variance > 0) {
+    append(",\"margin\":", 10);
+    appendUInt(DNSStatistic::countMargin(record));
+  }
+  append("}\n", 2);
+}
+
+/**
+ * @brief Private method appending quoted and escaped JSON string.
+ */
+void JsonLinesStatisticExporter::appendJsonString(const string &str) {
+  static const char hexDigits[] = "0123456789abcdef";
+  appendChar('"');
+  size_t plainBegin = 0;
+  for (size_t i = 0; i < str.size(); ++i) {
+    unsigned char c = str[i];
+    if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\')
+      continue;
+    append(str.data() + plainBegin, i - plainBegin);
+    plainBegin = i + 1;
+    if (c == '"' || c == '\\') {
+      char escaped[2] = { '\\', (char)c };
+      append(escaped, 2);
+    } else {
+      char escaped[6] = { '\\', 'u', '0', '0', hexDigits[c >> 4], hexDigits[c & 0xf] };
+      append(escaped, 6);
+    }
+  }
+  append(str.data() + plainBegin, str.size() - plainBegin);
+  appendChar('"');
+}
+
+/**
+ * @brief Writes magic at the beginning of binary stream.
+ */
+void BinaryStatisticExporter::beginStream() {
+  append(EXPORT_BINARY_MAGIC, 8);
+}
+
+/**
+ * @brief Serializes record as EXPORT_FRAME_RECORD frame.
+ */
+void BinaryStatisticExporter::writeRecord(const SDnsStatRecord &record) {
+  const SDnsAnswerRecord &answer = record.answerRec;
+  size_t domainLen = min(answer.domainName.size(), (size_t)0xffff);
+  size_t typeLen = min(answer.typeString.size(), (size_t)0xffff);
+  size_t dataLen = answer.answerData.size();
+  appendLE32(1 + 8 + 2 + 2 + 4 + 2 + 2 + 4 + domainLen + typeLen + dataLen);
+  appendChar(EXPORT_FRAME_RECORD);
+  appendLE64(record.count);
+  appendLE16(answer.header.type);
+  appendLE16(answer.header.recClass);
+  appendLE32(answer.header.timeToLive);
+  appendLE16(domainLen);
+  appendLE16(typeLen);
+  appendLE32(dataLen);
+  append(answer.domainName.data(), domainLen);
+  append(answer.typeString.data(), typeLen);
+  append(answer.answerData.data(), dataLen);
+}
+
+/**
+ * @brief Writes EXPORT_FRAME_BATCH_END frame.
+ */
+void BinaryStatisticExporter::endBatch(size_t recordCount) {
+  appendLE32(1 + 8 + 8);
+  appendChar(EXPORT_FRAME_BATCH_END);
+  appendLE64(time(nullptr));
+  appendLE64(recordCount);
+}
+
+/**
+ * @brief Creates exporter of given format and opens its output.
+ *
+ * (See StatisticExporter.hpp for more info.)
+ */
+shared_ptr<StatisticExporter> createStatisticExporter(const string &format, const string &path) {
+  shared_ptr<StatisticExporter> exporter;
+  if (format == "text")
+    exporter = make_shared<TextStatisticExporter>();
+  else if (format == "json")
+    exporter = make_shared<JsonLinesStatisticExporter>();
+  else if (format == "binary")
+    exporter = make_shared<BinaryStatisticExporter>();
+  else {
+    cerr << "Unknown export format \"" << format << "\" (expected text, json or binary)." << endl;
+    return nullptr;
+  }
+  if (!exporter->open(path))
+    return nullptr;
+  return exporter;
+}
@@ -0,0 +1,164 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    StatisticExporter.hpp
+ * @brief   Pluggable sinks exporting DNS statistics in text, JSON Lines
+ *          or binary format.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <linux/types.h>
+
+#include "DNSStatistic.hpp"
+#include "AsyncWriter.hpp"
+
+#define EXPORT_BUFFER_SIZE    65536       // records are serialized into buffer of this size
+#define EXPORT_ASYNC_DEPTH    8           // filled buffers in flight when written asynchronously
+#define EXPORT_BINARY_MAGIC   "DNSEBIN1"  // first 8 bytes of binary stream
+
+/*
+ * Binary stream format (all numbers little endian):
+ *
+ *   magic         EXPORT_BINARY_MAGIC, once at the beginning of stream (not written
+ *                 again when export file already containing stream is appended to)
+ *   frame ...     u32 length of frame without this field, u8 frame kind (EExportFrameKind)
+ *
+ *   EXPORT_FRAME_RECORD:    u64 count, u16 type, u16 class, u32 ttl,
+ *                           u16 domain length, u16 type string length, u32 data length,
+ *                           domain bytes, type string bytes, data bytes
+ *   EXPORT_FRAME_BATCH_END: u64 unix time of export, u64 number of records in batch
+ */
+
+/**
+ * @brief Kinds of frames in binary stream.
+ */
+enum EExportFrameKind {
+  EXPORT_FRAME_RECORD = 1,    /*!< one statistic record */
+  EXPORT_FRAME_BATCH_END = 2  /*!< all records of one export were written */
+};
+
+/**
+ * @brief Base class of statistic export sinks.
+ *
+ * Derived sinks serialize records into fixed buffer by append* methods,
+ * no memory is allocated per record. Buffer is written to output file
+ * descriptor when full and at the end of each export.
+ */
+class StatisticExporter {
+public:
+  /** Constructor */
+  StatisticExporter();
+
+  /** Destructor, closes output opened by open method. */
+  virtual ~StatisticExporter();
+
+  /**
+   * @brief Opens output of exporter.
+   *
+   * @param path  empty string or "-" for stdout, path of UNIX stream socket
+   *              to connect to, or path of file to append to. Beginning of
+   *              stream (see beginStream) is written only when output is not
+   *              regular file which already contains data.
+   * @return false on failure, error is written on stderr.
+   */
+  bool open(const std::string &path);
+
+  /**
+   * @brief Exports all given records as one batch.
+   *
+   * @return false when writing to output failed, error is written on stderr.
+   */
+  bool exportStatistics(const StatRecords &records);
+
+  /**
+   * @brief Writes output file asynchronously by io_uring.
+   *
+   * Filled buffers are queued and export waits only when all of them are
+   * in flight. Writes which fail after export returned make next export fail.
+   * Export file is no longer appended to (O_APPEND is cleared), buffers are
+   * written at offsets following end of file at time of this call, so file
+   * must not be written by other processes meanwhile. Stdout and sockets keep
+   * order of written data only when written synchronously, so they stay
+   * synchronous, as all outputs do when io_uring is not available (warning
+   * is written on stderr).
+   */
+  void enableAsyncOutput();
+
+protected:
+  /** @brief Called once after output is opened, unless appended file already contains data. */
+  virtual void beginStream() {}
+
+  /** @brief Serializes one record. */
+  virtual void writeRecord(const SDnsStatRecord &record) = 0;
+
+  /** @brief Called after all records of batch were serialized. */
+  virtual void endBatch(size_t recordCount) { (void)recordCount; }
+
+  void append(const char *data, size_t len);
+  void append(const std::string &str);
+  void appendChar(char c);
+  void appendUInt(unsigned long long value);
+  void appendLE16(__u16 value);
+  void appendLE32(__u32 value);
+  void appendLE64(__u64 value);
+
+private: /* private implementation is documented in *.cpp file */
+  int _fd;
+  bool _isOwnFd;
+  bool _isSocket;
+  bool _isError;
+  size_t _used;
+  char _buffer[EXPORT_BUFFER_SIZE];
+  std::unique_ptr<AsyncWriter> _writer;  // nullptr when output is written synchronously
+
+  bool flush();
+  bool writeOut(const char *data, size_t len);
+};
+
+/**
+ * @brief Sink writing records in dns-export text format "domain type data count".
+ */
+class TextStatisticExporter : public StatisticExporter {
+protected:
+  void writeRecord(const SDnsStatRecord &record) override;
+};
+
+/**
+ * @brief Sink writing one JSON object per record and line.
+ *
+ * Bytes which are not printable ASCII are escaped as \u00XX (latin-1),
+ * so output is always valid UTF-8 even for binary TXT data.
+ */
+class JsonLinesStatisticExporter : public StatisticExporter {
+protected:
+  void writeRecord(const SDnsStatRecord &record) override;
+
+private: /* private implementation is documented in *.cpp file */
+  void appendJsonString(const std::string &str);
+};
+
+/**
+ * @brief Sink writing length prefixed binary frames (see format above).
+ */
+class BinaryStatisticExporter : public StatisticExporter {
+protected:
+  void beginStream() override;
+  void writeRecord(const SDnsStatRecord &record) override;
+  void endBatch(size_t recordCount) override;
+};
+
+/**
+ * @brief Creates exporter of given format and opens its output.
+ *
+ * @param format  "text", "json" or "binary"
+ * @param path    output path (see StatisticExporter::open)
+ * @return exporter or nullptr on error, error is written on stderr.
+ */
+std::shared_ptr<StatisticExporter> createStatisticExporter(const std::string &format, const std::string &path);
@@ -0,0 +1,540 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    StatisticSnapshot.cpp
+ * \brief   Persistent binary snapshots of DNS statistics resumed on restart.
+ *          Implementation of StatisticSnapshot.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.hpp"
+#include "StatisticSnapshot.hpp"
+#include "DistinctCounter.hpp"
+
+#define SNAPSHOT_ALIGN(N) (((N) + 7) & ~((__u64)7))  // record array is aligned to 8 bytes
+
+using namespace std;
+
+/**
+ * @brief Computes checksum of snapshot section.
+ *
+ * (See StatisticSnapshot.hpp for more info.)
+ */
+__u64 snapshotChecksum(const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  __u64 hash = 0x9e3779b97f4a7c15ULL ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    __u64 word;
+    memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 32;
+  }
+  __u64 tail = 0;
+  if (i < size)
+    memcpy(&tail, bytes + i, size - i);
+  hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ULL;
+  return hash ^ (hash >> 33);
+}
+
+/** Constructor */
+SnapshotReader::SnapshotReader() {
+  _data = nullptr;
+  _size = 0;
+  _header = nullptr;
+  _records = nullptr;
+  _strings = nullptr;
+  _registers = nullptr;
+}
+
+/** Destructor */
+SnapshotReader::~SnapshotReader() {
+  close();
+}
+
+/**
+ * @brief Maps snapshot file into memory and validates it.
+ *
+ * (See StatisticSnapshot.hpp for more info.)
+ */
+bool SnapshotReader::open(const string &fileName, bool verifyChecksums) {
+  close();
+  int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    cerr << "Cannot open snapshot \"" << fileName << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(SSnapshotHeader)) {
+    cerr << "Snapshot \"" << fileName << "\" is too short." << endl;
+    ::close(fd);
+    return false;
+  }
+  void *mapped = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    cerr << "Cannot map snapshot \"" << fileName << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  _data = (const unsigned char *)mapped;
+  _size = fileStat.st_size;
+  madvise(mapped, _size, MADV_WILLNEED);
+
+  // validate header and bounds of sections
+  _header = (const SSnapshotHeader *)_data;
+  const char *error = nullptr;
+  if (memcmp(_header->magic, SNAPSHOT_MAGIC, sizeof(_header->magic)) != 0)
+    error = "is not a snapshot file";
+  else if (_header->byteOrder != SNAPSHOT_BYTE_ORDER)
+    error = "was written on machine with different byte order";
+  else if (_header->version != SNAPSHOT_VERSION)
+    error = "has unsupported version";
+  else if (_header->stringTableOffset > _size || _header->stringTableSize > _size - _header->stringTableOffset)
+    error = "has string table out of file";
+  else if (_header->recordArrayOffset % 8 != 0 || _header->recordArrayOffset > _size ||
+           _header->recordCount > (_size - _header->recordArrayOffset) / sizeof(SSnapshotRecord))
+    error = "has record array out of file";
+  else if (_header->registerCount > 0 && _header->registerSize != HLL_REGISTERS)
+    error = "has registers of unsupported size";
+  else if (_header->registerArrayOffset > _size ||
+           _header->registerCount > (_size - _header->registerArrayOffset) / HLL_REGISTERS)
+    error = "has register array out of file";
+  else {
+    _records = (const SSnapshotRecord *)(_data + _header->recordArrayOffset);
+    _strings = (const char *)(_data + _header->stringTableOffset);
+    _registers = _data + _header->registerArrayOffset;
+    if (verifyChecksums && (
+        snapshotChecksum(_records, _header->recordCount * sizeof(SSnapshotRecord)) != _header->recordArrayChecksum ||
+        snapshotChecksum(_strings, _header->stringTableSize) != _header->stringTableChecksum ||
+        snapshotChecksum(_registers, _header->registerCount * HLL_REGISTERS) != _header->registerChecksum))
+      error = "is corrupted (checksum mismatch)";
+  }
+
+  // keys of all records has to be inside of string table, registers inside of register array
+  for (size_t i = 0; error == nullptr && i < _header->recordCount; ++i) {
+    const SSnapshotRecord &rec = _records[i];
+    if (rec.keyOffset > _header->stringTableSize || rec.keyLen > _header->stringTableSize - rec.keyOffset ||
+        (size_t)rec.domainLen + rec.typeLen + 2 > rec.keyLen)
+      error = "has record with invalid key";
+    else if ((rec.flags & SNAPSHOT_RECORD_HAS_REGISTERS) && rec.regIndex >= _header->registerCount)
+      error = "has record with invalid registers";
+  }
+
+  if (error != nullptr) {
+    cerr << "Snapshot \"" << fileName << "\" " << error << "." << endl;
+    close();
+    return false;
+  }
+  DWRITE("Snapshot " << fileName << " mapped, records: " << _header->recordCount);
+  return true;
+}
+
+/**
+ * @brief Unmaps file, called by destructor.
+ */
+void SnapshotReader::close() {
+  if (_data != nullptr)
+    munmap((void *)_data, _size);
+  _data = nullptr;
+  _size = 0;
+  _header = nullptr;
+  _records = nullptr;
+  _strings = nullptr;
+  _registers = nullptr;
+}
+
+/** @brief Returns number of records in snapshot. */
+size_t SnapshotReader::recordCount() const {
+  return _header == nullptr ? 0 : _header->recordCount;
+}
+
+/** @brief Returns record on given index, records are sorted by key. */
+const SSnapshotRecord &SnapshotReader::record(size_t index) const {
+  return _records[index];
+}
+
+/** @brief Returns pointer to key of given record in string table. */
+const char *SnapshotReader::key(const SSnapshotRecord &record) const {
+  return _strings + record.keyOffset;
+}
+
+/** @brief Creates answer record from snapshot record. */
+SDnsAnswerRecord SnapshotReader::answerRecord(const SSnapshotRecord &record) const {
+  const char *recordKey = key(record);
+  size_t dataPos = record.domainLen + record.typeLen + 2;
+  SDnsAnswerRecord answer;
+  memset(&answer.header, 0, sizeof(SDnsAnswerHeader));
+  answer.header.type = record.type;
+  answer.header.recClass = record.recClass;
+  answer.header.timeToLive = record.timeToLive;
+  answer.domainName.assign(recordKey, record.domainLen);
+  answer.typeString.assign(recordKey + record.domainLen + 1, record.typeLen);
+  answer.answerData.assign(recordKey + dataPos, record.keyLen - dataPos);
+  return answer;
+}
+
+/** @brief Returns registers of given record, nullptr when it has none. */
+const __u8 *SnapshotReader::registers(const SSnapshotRecord &record) const {
+  if (!(record.flags & SNAPSHOT_RECORD_HAS_REGISTERS))
+    return nullptr;
+  return _registers + (size_t)record.regIndex * HLL_REGISTERS;
+}
+
+/**
+ * @brief Compares keys of two records (possibly from different snapshots) in memcmp order.
+ */
+int SnapshotReader::compareKeys(const char *keyA, size_t lenA, const char *keyB, size_t lenB) {
+  int cmp = memcmp(keyA, keyB, min(lenA, lenB));
+  if (cmp != 0)
+    return cmp;
+  return lenA < lenB ? -1 : (lenA > lenB ? 1 : 0);
+}
+
+/**
+ * @brief Fills snapshot data with all records of statistics.
+ *
+ * (See StatisticSnapshot.hpp for more info.)
+ */
+void collectSnapshotData(const DNSStatistic &statistic, SSnapshotData &data) {
+  StatRecords records = statistic.getStatistics();
+  data.records.clear();
+  data.strings.clear();
+  data.registers.clear();
+  data.records.reserve(records.size());
+  for (const auto &rec : records) {
+    const SDnsAnswerRecord &answer = rec.answerRec;
+    SSnapshotRecord snapRec;
+    snapRec.count = rec.count;
+    snapRec.keyOffset = data.strings.size();
+    snapRec.keyLen = answer.domainName.size() + answer.typeString.size() + answer.answerData.size() + 2;
+    snapRec.domainLen = min(answer.domainName.size(), (size_t)USHRT_MAX);
+    snapRec.typeLen = min(answer.typeString.size(), (size_t)UCHAR_MAX);
+    snapRec.flags = 0;
+    snapRec.type = answer.header.type;
+    snapRec.recClass = answer.header.recClass;
+    snapRec.timeToLive = answer.header.timeToLive;
+    snapRec.regIndex = 0;
+    snapRec.reserved = 0;
+    if (snapRec.domainLen != answer.domainName.size() || snapRec.typeLen != answer.typeString.size())
+      continue; // cannot be represented, such names are not produced by DNSResponse anyway
+    const __u8 *registers = statistic.getDistinctRegisters(answer);
+    if (registers != nullptr) {
+      snapRec.flags = SNAPSHOT_RECORD_HAS_REGISTERS;
+      snapRec.regIndex = data.registers.size() / HLL_REGISTERS;
+      data.registers.insert(data.registers.end(), registers, registers + HLL_REGISTERS);
+    }
+    data.strings += answer.domainName;
+    data.strings += '\0';
+    data.strings += answer.typeString;
+    data.strings += '\0';
+    data.strings += answer.answerData;
+    data.records.push_back(snapRec);
+  }
+}
+
+/**
+ * @brief Sorts snapshot data and atomically replaces given file with them.
+ *
+ * (See StatisticSnapshot.hpp for more info.)
+ */
+bool writeSnapshotData(const string &fileName, SSnapshotData &data) {
+  const char *strings = data.strings.data();
+  sort(data.records.begin(), data.records.end(), [strings](const SSnapshotRecord &a, const SSnapshotRecord &b) {
+    return SnapshotReader::compareKeys(strings + a.keyOffset, a.keyLen, strings + b.keyOffset, b.keyLen) < 0;
+  });
+
+  SSnapshotHeader header;
+  memset(&header, 0, sizeof(SSnapshotHeader));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byteOrder = SNAPSHOT_BYTE_ORDER;
+  header.createdTime = time(nullptr);
+  header.recordCount = data.records.size();
+  header.stringTableOffset = sizeof(SSnapshotHeader);
+  header.stringTableSize = data.strings.size();
+  header.recordArrayOffset = SNAPSHOT_ALIGN(header.stringTableOffset + header.stringTableSize);
+  header.recordArrayChecksum = snapshotChecksum(data.records.data(), data.records.size() * sizeof(SSnapshotRecord));
+  header.stringTableChecksum = snapshotChecksum(data.strings.data(), data.strings.size());
+  header.registerArrayOffset = header.recordArrayOffset + data.records.size() * sizeof(SSnapshotRecord);
+  header.registerCount = data.registers.size() / HLL_REGISTERS;
+  header.registerSize = HLL_REGISTERS;
+  header.registerChecksum = snapshotChecksum(data.registers.data(), data.registers.size());
+
+  string tmpFileName = fileName + ".tmp";
+  FILE *file = fopen(tmpFileName.c_str(), "wb");
+  if (file == nullptr) {
+    cerr << "Cannot create snapshot \"" << tmpFileName << "\": " << strerror(errno) << endl;
+    return false;
+  }
+  static const char padding[8] = {};
+  size_t paddingLen = header.recordArrayOffset - header.stringTableOffset - header.stringTableSize;
+  bool isOk =
+    fwrite(&header, sizeof(SSnapshotHeader), 1, file) == 1 &&
+    fwrite(data.strings.data(), 1, data.strings.size(), file) == data.strings.size() &&
+    fwrite(padding, 1, paddingLen, file) == paddingLen &&
+    fwrite(data.records.data(), sizeof(SSnapshotRecord), data.records.size(), file) == data.records.size() &&
+    (data.registers.empty() || fwrite(data.registers.data(), 1, data.registers.size(), file) == data.registers.size()) &&
+    fflush(file) == 0 &&
+    fsync(fileno(file)) == 0;
+  isOk = (fclose(file) == 0) && isOk;
+  if (!isOk || rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+    cerr << "Writing snapshot \"" << fileName << "\" failed: " << strerror(errno) << endl;
+    unlink(tmpFileName.c_str());
+    return false;
+  }
+  DWRITE("Snapshot " << fileName << " written, records: " << header.recordCount);
+  return true;
+}
+
+/**
+ * @brief Synchronously writes snapshot of statistics into file.
+ */
+bool writeSnapshot(const string &fileName, const DNSStatistic &statistic) {
+  SSnapshotData data;
+  collectSnapshotData(statistic, data);
+  return writeSnapshotData(fileName, data);
+}
+
+/**
+ * @brief Adds all records of snapshot file to statistics.
+ *
+ * (See StatisticSnapshot.hpp for more info.)
+ */
+bool loadSnapshot(const string &fileName, DNSStatistic &statistic) {
+  SnapshotReader reader;
+  if (!reader.open(fileName))
+    return false;
+  // records are added by their keys in mapped string table, no temporary record is built
+  vector<SKeyedRecord> records;
+  records.reserve(reader.recordCount());
+  for (size_t i = 0; i < reader.recordCount(); ++i) {
+    const SSnapshotRecord &rec = reader.record(i);
+    const __u8 *registers = reader.registers(rec);
+    if (registers != nullptr) {
+      statistic.addDistinctRegisters(reader.answerRecord(rec), registers);
+      continue;
+    }
+    SKeyedRecord keyed;
+    keyed.key = reader.key(rec);
+    keyed.keyLen = rec.keyLen;
+    keyed.domainLen = rec.domainLen;
+    keyed.typeLen = rec.typeLen;
+    memset(&keyed.header, 0, sizeof(SDnsAnswerHeader));
+    keyed.header.type = rec.type;
+    keyed.header.recClass = rec.recClass;
+    keyed.header.timeToLive = rec.timeToLive;
+    keyed.count = (unsigned int)min(rec.count, (__u64)UINT_MAX);
+    records.push_back(keyed);
+  }
+  statistic.addKeyedRecords(records);
+  return true;
+}
+
+/** Constructor */
+SnapshotStreamWriter::SnapshotStreamWriter() {
+  _file = nullptr;
+  _recordsFile = nullptr;
+  _registersFile = nullptr;
+  _recordCount = 0;
+  _stringTableSize = 0;
+  _registerCount = 0;
+}
+
+/** Destructor, discards not closed file. */
+SnapshotStreamWriter::~SnapshotStreamWriter() {
+  discard();
+}
+
+/**
+ * @brief Creates temporary file "<fileName>.tmp" for snapshot.
+ */
+bool SnapshotStreamWriter::open(const string &fileName) {
+  discard();
+  _fileName = fileName;
+  _recordCount = 0;
+  _stringTableSize = 0;
+  _registerCount = 0;
+  string tmpFileName = fileName + ".tmp";
+  _file = fopen(tmpFileName.c_str(), "w+b");
+  _recordsFile = tmpfile();
+  _registersFile = tmpfile();
+  SSnapshotHeader header;
+  memset(&header, 0, sizeof(SSnapshotHeader));
+  if (_file == nullptr || _recordsFile == nullptr || _registersFile == nullptr || fwrite(&header, sizeof(SSnapshotHeader), 1, _file) != 1) {
+    cerr << "Cannot create snapshot \"" << tmpFileName << "\": " << strerror(errno) << endl;
+    discard();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Appends record with given key (see SSnapshotRecord for key layout).
+ */
+bool SnapshotStreamWriter::addRecord(const char *key, const SSnapshotRecord &record, const __u8 *registers) {
+  SSnapshotRecord outRecord = record;
+  outRecord.keyOffset = _stringTableSize;
+  outRecord.flags = registers != nullptr ? SNAPSHOT_RECORD_HAS_REGISTERS : 0;
+  outRecord.regIndex = registers != nullptr ? _registerCount : 0;
+  if (fwrite(key, 1, record.keyLen, _file) != record.keyLen ||
+      fwrite(&outRecord, sizeof(SSnapshotRecord), 1, _recordsFile) != 1 ||
+      (registers != nullptr && fwrite(registers, 1, HLL_REGISTERS, _registersFile) != HLL_REGISTERS)) {
+    cerr << "Writing snapshot \"" << _fileName << "\" failed: " << strerror(errno) << endl;
+    return false;
+  }
+  _stringTableSize += record.keyLen;
+  ++_recordCount;
+  if (registers != nullptr)
+    ++_registerCount;
+  return true;
+}
+
+/**
+ * @brief Finishes snapshot and renames it to file name given to open.
+ */
+bool SnapshotStreamWriter::close() {
+  if (_file == nullptr)
+    return false;
+  SSnapshotHeader header;
+  memset(&header, 0, sizeof(SSnapshotHeader));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byteOrder = SNAPSHOT_BYTE_ORDER;
+  header.createdTime = time(nullptr);
+  header.recordCount = _recordCount;
+  header.stringTableOffset = sizeof(SSnapshotHeader);
+  header.stringTableSize = _stringTableSize;
+  header.recordArrayOffset = SNAPSHOT_ALIGN(header.stringTableOffset + header.stringTableSize);
+  header.registerArrayOffset = header.recordArrayOffset + _recordCount * sizeof(SSnapshotRecord);
+  header.registerCount = _registerCount;
+  header.registerSize = HLL_REGISTERS;
+
+  // append padding, records and registers from temporary files
+  static const char padding[8] = {};
+  size_t paddingLen = header.recordArrayOffset - header.stringTableOffset - header.stringTableSize;
+  bool isOk = fwrite(padding, 1, paddingLen, _file) == paddingLen;
+  char buffer[65536];
+  size_t len;
+  for (FILE *section : { _recordsFile, _registersFile }) {
+    isOk = isOk && fseek(section, 0, SEEK_SET) == 0;
+    while (isOk && (len = fread(buffer, 1, sizeof(buffer), section)) > 0)
+      isOk = fwrite(buffer, 1, len, _file) == len;
+  }
+  isOk = isOk && fflush(_file) == 0;
+
+  // checksums are computed from mapped file, sections are not held in memory
+  size_t fileSize = header.registerArrayOffset + _registerCount * HLL_REGISTERS;
+  if (isOk) {
+    void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fileno(_file), 0);
+    if (mapped == MAP_FAILED) {
+      isOk = false;
+    } else {
+      const unsigned char *data = (const unsigned char *)mapped;
+      madvise(mapped, fileSize, MADV_SEQUENTIAL);
+      header.stringTableChecksum = snapshotChecksum(data + header.stringTableOffset, header.stringTableSize);
+      header.recordArrayChecksum = snapshotChecksum(data + header.recordArrayOffset, _recordCount * sizeof(SSnapshotRecord));
+      header.registerChecksum = snapshotChecksum(data + header.registerArrayOffset, _registerCount * HLL_REGISTERS);
+      munmap(mapped, fileSize);
+    }
+  }
+  isOk = isOk &&
+    fseek(_file, 0, SEEK_SET) == 0 &&
+    fwrite(&header, sizeof(SSnapshotHeader), 1, _file) == 1 &&
+    fflush(_file) == 0 &&
+    fsync(fileno(_file)) == 0;
+
+  string tmpFileName = _fileName + ".tmp";
+  isOk = (fclose(_file) == 0) && isOk;
+  _file = nullptr;
+  if (!isOk || rename(tmpFileName.c_str(), _fileName.c_str()) != 0) {
+    cerr << "Writing snapshot \"" << _fileName << "\" failed: " << strerror(errno) << endl;
+    discard();
+    return false;
+  }
+  DWRITE("Snapshot " << _fileName << " written, records: " << header.recordCount);
+  _fileName.clear(); // temporary file was renamed, nothing to unlink
+  discard();
+  return true;
+}
+
+/**
+ * @brief Private method closing and removing temporary files.
+ */
+void SnapshotStreamWriter::discard() {
+  if (_file != nullptr) {
+    fclose(_file);
+    _file = nullptr;
+  }
+  if (!_fileName.empty())
+    unlink((_fileName + ".tmp").c_str());
+  if (_recordsFile != nullptr) {
+    fclose(_recordsFile);
+    _recordsFile = nullptr;
+  }
+  if (_registersFile != nullptr) {
+    fclose(_registersFile);
+    _registersFile = nullptr;
+  }
+}
+
+/** Constructor, starts background thread. */
+SnapshotWriter::SnapshotWriter(const string &fileName) : _fileName(fileName) {
+  _isStopping = false;
+  _thread = thread(&SnapshotWriter::run, this);
+}
+
+/** Destructor, writes pending snapshot and stops background thread. */
+SnapshotWriter::~SnapshotWriter() {
+  {
+    lock_guard<mutex> lock(_mutex);
+    _isStopping = true;
+  }
+  _condition.notify_one();
+  _thread.join();
+}
+
+/**
+ * @brief Collects snapshot data of statistics and passes them to background thread.
+ */
+void SnapshotWriter::requestSnapshot(const DNSStatistic &statistic) {
+  unique_ptr<SSnapshotData> data(new SSnapshotData());
+  collectSnapshotData(statistic, *data);
+  {
+    lock_guard<mutex> lock(_mutex);
+    if (_pending != nullptr)
+      DWRITE("Previous snapshot was not written yet, dropping it");
+    _pending = move(data);
+  }
+  _condition.notify_one();
+}
+
+/**
+ * @brief Private method with main loop of background thread.
+ */
+void SnapshotWriter::run() {
+  unique_lock<mutex> lock(_mutex);
+  while (true) {
+    _condition.wait(lock, [this]() { return _pending != nullptr || _isStopping; });
+    if (_pending == nullptr)
+      return; // stopping and nothing to write
+    unique_ptr<SSnapshotData> data = move(_pending);
+    lock.unlock();
+    writeSnapshotData(_fileName, *data);
+    lock.lock();
+  }
+}
@@ -0,0 +1,269 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    StatisticSnapshot.hpp
+ * @brief   Persistent binary snapshots of DNS statistics resumed on restart.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <linux/types.h>
+
+#include "DNSStatistic.hpp"
+
+#define SNAPSHOT_MAGIC      "DNSESNAP"  // first 8 bytes of every snapshot file
+#define SNAPSHOT_VERSION    2           // incremented on every incompatible change of layout
+#define SNAPSHOT_BYTE_ORDER 0x01020304  // written in host order, detects foreign byte order
+#define SNAPSHOT_RECORD_HAS_REGISTERS 0x01  // record flag, estimate has registers in register array
+
+/*
+ * Snapshot file layout (all numbers in host byte order):
+ *
+ *   SSnapshotHeader
+ *   string table    keys of records, key is "domain\0type\0data" (see DNSStatistic)
+ *   record array    SSnapshotRecord[recordCount] sorted by key (memcmp order)
+ *   register array  registerSize bytes of HyperLogLog registers of each
+ *                   DISTINCT record (see DistinctCounter.hpp)
+ *
+ * Positions of sections are given by header, each of them is covered by its
+ * own checksum (see snapshotChecksum). Distinct estimates cannot be summed,
+ * so their registers are stored to restore or merge them register by register.
+ */
+
+/**
+ * @brief Header of snapshot file.
+ */
+struct SSnapshotHeader {
+  char  magic[8];             /*!< SNAPSHOT_MAGIC without terminating zero */
+  __u32 version;              /*!< SNAPSHOT_VERSION */
+  __u32 byteOrder;            /*!< SNAPSHOT_BYTE_ORDER */
+  __u64 createdTime;          /*!< unix time of snapshot creation */
+  __u64 recordCount;          /*!< number of items in record array */
+  __u64 recordArrayOffset;    /*!< position of record array in file */
+  __u64 stringTableOffset;    /*!< position of string table in file */
+  __u64 stringTableSize;      /*!< size of string table in bytes */
+  __u64 recordArrayChecksum;  /*!< snapshotChecksum of record array */
+  __u64 stringTableChecksum;  /*!< snapshotChecksum of string table */
+  __u64 registerArrayOffset;  /*!< position of register array in file */
+  __u64 registerCount;        /*!< number of register sets in register array */
+  __u64 registerChecksum;     /*!< snapshotChecksum of register array */
+  __u32 registerSize;         /*!< bytes of one register set, HLL_REGISTERS */
+  __u32 reserved;             /*!< always 0 */
+};
+
+/**
+ * @brief One statistic record in snapshot file.
+ */
+struct SSnapshotRecord {
+  __u64 count;        /*!< counter of statistic record */
+  __u64 keyOffset;    /*!< offset of record key in string table */
+  __u32 keyLen;       /*!< length of whole key */
+  __u16 domainLen;    /*!< length of domain name at the beginning of key */
+  __u8  typeLen;      /*!< length of type string following domain name and '\0' */
+  __u8  flags;        /*!< SNAPSHOT_RECORD_HAS_REGISTERS or 0 */
+  __u16 type;         /*!< SDnsAnswerHeader::type */
+  __u16 recClass;     /*!< SDnsAnswerHeader::recClass */
+  __u32 timeToLive;   /*!< SDnsAnswerHeader::timeToLive */
+  __u32 regIndex;     /*!< index of registers in register array when flagged */
+  __u32 reserved;     /*!< always 0 */
+};
+
+/**
+ * @brief Computes checksum of snapshot section.
+ *
+ * 64 bit multiplicative hash processing 8 bytes at once, fast enough to
+ * verify snapshot with millions of records in few milliseconds.
+ */
+__u64 snapshotChecksum(const void *data, size_t size);
+
+/**
+ * @brief Read only memory mapped snapshot file.
+ */
+class SnapshotReader {
+public:
+  /** Constructor */
+  SnapshotReader();
+
+  /** Destructor */
+  ~SnapshotReader();
+
+  /**
+   * @brief Maps snapshot file into memory and validates it.
+   *
+   * @param verifyChecksums when false, checksums are not computed
+   * @return true   on success
+   * @return false  when file cannot be mapped or is not valid snapshot,
+   *                error is written on stderr.
+   */
+  bool open(const std::string &fileName, bool verifyChecksums = true);
+
+  /**
+   * @brief Unmaps file, called by destructor.
+   */
+  void close();
+
+  /** @brief Returns number of records in snapshot. */
+  size_t recordCount() const;
+
+  /** @brief Returns record on given index, records are sorted by key. */
+  const SSnapshotRecord &record(size_t index) const;
+
+  /** @brief Returns pointer to key of given record in string table. */
+  const char *key(const SSnapshotRecord &record) const;
+
+  /** @brief Creates answer record from snapshot record. */
+  SDnsAnswerRecord answerRecord(const SSnapshotRecord &record) const;
+
+  /** @brief Returns registers of given record, nullptr when it has none. */
+  const __u8 *registers(const SSnapshotRecord &record) const;
+
+  /**
+   * @brief Compares keys of two records (possibly from different snapshots) in memcmp order.
+   */
+  static int compareKeys(const char *keyA, size_t lenA, const char *keyB, size_t lenB);
+
+private: /* private implementation is documented in *.cpp file */
+  const unsigned char *_data;
+  size_t _size;
+  const SSnapshotHeader *_header;
+  const SSnapshotRecord *_records;
+  const char *_strings;
+  const __u8 *_registers;
+};
+
+/**
+ * @brief Serialized statistics prepared for writing into snapshot file.
+ */
+struct SSnapshotData {
+  std::vector<SSnapshotRecord> records;
+  std::string strings;
+  std::vector<__u8> registers;
+};
+
+/**
+ * @brief Fills snapshot data with all records of statistics.
+ *
+ * Only copies keys, counts and registers of distinct estimates, records are
+ * sorted later by writeSnapshotData, so it is cheap enough to be called from
+ * packet processing thread.
+ */
+void collectSnapshotData(const DNSStatistic &statistic, SSnapshotData &data);
+
+/**
+ * @brief Sorts snapshot data and atomically replaces given file with them.
+ *
+ * Data are written into temporary file "<fileName>.tmp" which is synced and
+ * renamed to fileName, so fileName always contains complete snapshot.
+ *
+ * @return true   on success
+ * @return false  on failure, error is written on stderr.
+ */
+bool writeSnapshotData(const std::string &fileName, SSnapshotData &data);
+
+/**
+ * @brief Synchronously writes snapshot of statistics into file.
+ */
+bool writeSnapshot(const std::string &fileName, const DNSStatistic &statistic);
+
+/**
+ * @brief Adds all records of snapshot file to statistics.
+ *
+ * Registers of distinct estimates are merged into estimators of statistics.
+ * Snapshot is not used in place, every record is rebuilt in statistics (its
+ * strings are allocated and pages of tables touched), so restore takes time
+ * linear in number of records, about 0.3 s per million records. Into empty
+ * statistics records are appended without lookups and indexed at once.
+ * @return true   on success
+ * @return false  when snapshot cannot be read, error is written on stderr.
+ */
+bool loadSnapshot(const std::string &fileName, DNSStatistic &statistic);
+
+/**
+ * @brief Writes snapshot file record by record with bounded memory.
+ *
+ * Records has to be added in order of their keys (e.g. by k-way merge of
+ * other snapshots). Strings are written directly into snapshot file, records
+ * and registers into temporary files which are appended on close. Checksums are computed
+ * from finished file, so nothing is held in memory.
+ */
+class SnapshotStreamWriter {
+public:
+  /** Constructor */
+  SnapshotStreamWriter();
+
+  /** Destructor, discards not closed file. */
+  ~SnapshotStreamWriter();
+
+  /**
+   * @brief Creates temporary file "<fileName>.tmp" for snapshot.
+   *
+   * @return false on failure, error is written on stderr.
+   */
+  bool open(const std::string &fileName);
+
+  /**
+   * @brief Appends record with given key (see SSnapshotRecord for key layout).
+   *
+   * @param registers  HLL_REGISTERS registers of distinct estimate or nullptr
+   */
+  bool addRecord(const char *key, const SSnapshotRecord &record, const __u8 *registers = nullptr);
+
+  /**
+   * @brief Finishes snapshot and renames it to file name given to open.
+   *
+   * @return false on failure, error is written on stderr.
+   */
+  bool close();
+
+private: /* private implementation is documented in *.cpp file */
+  std::string _fileName;
+  FILE *_file;
+  FILE *_recordsFile;
+  FILE *_registersFile;
+  __u64 _recordCount;
+  __u64 _stringTableSize;
+  __u64 _registerCount;
+
+  void discard();
+};
+
+/**
+ * @brief Background thread writing snapshots of statistics.
+ *
+ * Packet processing thread only collects snapshot data by requestSnapshot,
+ * sorting, checksumming and disk IO are done by background thread. When new
+ * request comes before previous one is written, previous one is dropped.
+ */
+class SnapshotWriter {
+public:
+  /** Constructor, starts background thread. */
+  SnapshotWriter(const std::string &fileName);
+
+  /** Destructor, writes pending snapshot and stops background thread. */
+  ~SnapshotWriter();
+
+  /**
+   * @brief Collects snapshot data of statistics and passes them to background thread.
+   */
+  void requestSnapshot(const DNSStatistic &statistic);
+
+private: /* private implementation is documented in *.cpp file */
+  std::string _fileName;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::unique_ptr<SSnapshotData> _pending;
+  bool _isStopping;
+  std::thread _thread;
+
+  void run();
+};
@@ -0,0 +1,323 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    ZoneRollup.cpp
+ * \brief   Aggregation of answer counts by zone (registrable domain).
+ *          Implementation of ZoneRollup.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "utils.hpp"
+#include "ZoneRollup.hpp"
+#include "DNSStatistic.hpp"
+
+#define ROLLUP_MAX_LABELS     128   // labels of longer names are not rolled up beyond this
+#define ROLLUP_INITIAL_EDGES  1024  // initial size of edge table (power of two)
+
+using namespace std;
+
+/* public suffixes of two labels, names under them get one more label in zone */
+static const char *glb_rollup_twoLabelSuffixes[] = {
+  "ac.uk", "co.uk", "gov.uk", "org.uk", "me.uk", "net.uk",
+  "com.au", "net.au", "org.au", "edu.au", "gov.au",
+  "co.jp", "ne.jp", "or.jp", "ac.jp", "co.kr", "or.kr",
+  "com.br", "net.br", "org.br", "com.cn", "net.cn", "org.cn",
+  "co.nz", "co.za", "co.in", "com.mx", "com.tr", "com.sg",
+  "com.hk", "com.tw", "com.ar", "com.ua", "com.pl", "co.il"
+};
+
+/**
+ * @brief Supportive function hashing lower case label together with its parent node.
+ */
+static inline __u32 edgeHash(__u32 parent, const char *label, unsigned int len) {
+  __u32 hash = 2166136261u ^ parent;
+  for (unsigned int i = 0; i < len; ++i)
+    hash = (hash ^ (unsigned char)tolower(label[i])) * 16777619u;
+  return hash ^ (hash >> 15);
+}
+
+/**
+ * @brief Supportive function returning true when last two labels of name
+ * ("second" and "last") form one of built-in public suffixes.
+ */
+static bool isTwoLabelSuffix(const char *second, unsigned int secondLen, const char *last, unsigned int lastLen) {
+  char suffix[16];
+  if (secondLen + lastLen + 1 >= sizeof(suffix))
+    return false;
+  for (unsigned int i = 0; i < secondLen; ++i)
+    suffix[i] = tolower(second[i]);
+  suffix[secondLen] = '.';
+  for (unsigned int i = 0; i < lastLen; ++i)
+    suffix[secondLen + 1 + i] = tolower(last[i]);
+  suffix[secondLen + 1 + lastLen] = 0;
+  for (const char *known : glb_rollup_twoLabelSuffixes) {
+    if (strcmp(known, suffix) == 0)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Constructor
+ */
+ZoneRollup::ZoneRollup(unsigned int depth) {
+  _depth = max(1u, depth);
+  _nodes.push_back({ 0, 0, 0, -1 });
+  _edges.assign(ROLLUP_INITIAL_EDGES, 0);
+  _childRecords = 0;
+  _stringBytes = 0;
+}
+
+/**
+ * @brief Adds count of answer record to its zone.
+ *
+ * (See ZoneRollup.hpp for more info.)
+ */
+void ZoneRollup::add(const SDnsAnswerRecord &record, __u64 count) {
+  const char *childLabel = nullptr;
+  unsigned int childLen = 0;
+  SZone &zone = findOrAddZone(record.domainName, &childLabel, &childLen);
+  if (record.typeString == ROLLUP_RECORD_TYPE) {
+    if (record.answerData == ROLLUP_DATA_TOTAL)
+      zone.total += count;
+    else if (record.answerData == ROLLUP_DATA_CHILD && childLabel != nullptr)
+      addChild(zone, childLabel, childLen, count);
+    return;
+  }
+  zone.total += count;
+  if (childLabel != nullptr)
+    addChild(zone, childLabel, childLen, count);
+}
+
+/**
+ * @brief Adds all counts of other rollup of same depth to this one.
+ *
+ * Children are added by Space-Saving, so merged child counts stay upper estimates.
+ */
+void ZoneRollup::merge(const ZoneRollup &other) {
+  for (const auto &otherZone : other._zones) {
+    SZone &zone = findOrAddZone(otherZone.name, nullptr, nullptr);
+    zone.total += otherZone.total;
+    for (unsigned int i = 0; i < otherZone.childCount; ++i)
+      addChild(zone, otherZone.children[i].label.data(), otherZone.children[i].label.size(), otherZone.children[i].count);
+  }
+}
+
+/**
+ * @brief Appends zone totals each followed by its children ordered by count.
+ */
+void ZoneRollup::appendRecords(StatRecordVector &records) const {
+  records.reserve(records.size() + recordCount());
+  SDnsStatRecord rec;
+  memset(&rec.answerRec.header, 0, sizeof(SDnsAnswerHeader));
+  rec.answerRec.typeString = ROLLUP_RECORD_TYPE;
+  rec.variance = 0;
+  for (const auto &zone : _zones) {
+    rec.answerRec.domainName = zone.name;
+    rec.answerRec.answerData = ROLLUP_DATA_TOTAL;
+    rec.count = (unsigned int)min(zone.total, (__u64)UINT_MAX);
+    records.push_back(rec);
+
+    unsigned int order[ROLLUP_TOP_CHILDREN];
+    for (unsigned int i = 0; i < zone.childCount; ++i)
+      order[i] = i;
+    sort(order, order + zone.childCount, [&zone](unsigned int a, unsigned int b) {
+      return zone.children[a].count > zone.children[b].count;
+    });
+    rec.answerRec.answerData = ROLLUP_DATA_CHILD;
+    for (unsigned int i = 0; i < zone.childCount; ++i) {
+      const SChild &child = zone.children[order[i]];
+      rec.answerRec.domainName = child.label + "." + zone.name;
+      rec.count = (unsigned int)min(child.count, (__u64)UINT_MAX);
+      records.push_back(rec);
+    }
+  }
+}
+
+/** @brief Returns number of records appendRecords would append. */
+size_t ZoneRollup::recordCount() const {
+  return _zones.size() + _childRecords;
+}
+
+/**
+ * @brief Returns estimate of memory used by rollup in bytes.
+ */
+size_t ZoneRollup::memoryUsage() const {
+  return
+    _nodes.capacity() * sizeof(SNode) +
+    _labels.capacity() +
+    _edges.capacity() * sizeof(__u32) +
+    _zones.capacity() * sizeof(SZone) +
+    _stringBytes;
+}
+
+/**
+ * @brief Returns offset of zone of given depth in name.
+ *
+ * (See ZoneRollup.hpp for more info.)
+ */
+size_t ZoneRollup::zoneOffset(const string &name, unsigned int depth) {
+  size_t end = name.size();
+  if (end > 0 && name[end - 1] == '.')
+    --end;
+  size_t lastDot = name.rfind('.', end > 0 ? end - 1 : 0);
+  if (lastDot == string::npos || end == 0)
+    return 0;
+  size_t secondDot = lastDot > 0 ? name.rfind('.', lastDot - 1) : string::npos;
+  size_t secondBegin = secondDot == string::npos ? 0 : secondDot + 1;
+  unsigned int labels = max(1u, depth) + 1;
+  if (isTwoLabelSuffix(name.data() + secondBegin, lastDot - secondBegin, name.data() + lastDot + 1, end - lastDot - 1))
+    ++labels;
+
+  size_t begin = end;
+  for (unsigned int i = 0; i < labels; ++i) {
+    if (begin == 0)
+      return 0;
+    size_t dot = name.rfind('.', begin - 1);
+    if (dot == string::npos)
+      return 0;
+    begin = dot;
+  }
+  return begin + 1;
+}
+
+/**
+ * @brief Private method returning child of node with given label, child is
+ * created when it does not exist.
+ */
+__u32 ZoneRollup::findOrAddNode(__u32 parent, const char *label, unsigned int len) {
+  __u32 mask = _edges.size() - 1;
+  for (__u32 slot = edgeHash(parent, label, len) & mask; ; slot = (slot + 1) & mask) {
+    if (_edges[slot] == 0)
+      break;
+    const SNode &node = _nodes[_edges[slot] - 1];
+    if (node.parent == parent && node.labelLen == len && strncasecmp(_labels.data() + node.labelOffset, label, len) == 0)
+      return _edges[slot] - 1;
+  }
+
+  __u32 index = _nodes.size();
+  _nodes.push_back({ parent, (__u32)_labels.size(), (__u8)len, -1 });
+  for (unsigned int i = 0; i < len; ++i)
+    _labels += tolower(label[i]);
+  if (_nodes.size() * 2 > _edges.size())
+    growEdges(); // inserts all nodes including new one
+  else {
+    __u32 slot = edgeHash(parent, label, len) & mask;
+    while (_edges[slot] != 0)
+      slot = (slot + 1) & mask;
+    _edges[slot] = index + 1;
+  }
+  return index;
+}
+
+/**
+ * @brief Private method returning zone of name, zone is created when it does not exist.
+ *
+ * @param childLabel  filled with label of name directly under zone or nullptr
+ *                    when name is zone itself, can be nullptr
+ */
+ZoneRollup::SZone &ZoneRollup::findOrAddZone(const string &name, const char **childLabel, unsigned int *childLen) {
+  unsigned int labelBegin[ROLLUP_MAX_LABELS];
+  unsigned int labelLen[ROLLUP_MAX_LABELS];
+  unsigned int labelCount = 0;
+  size_t end = name.size();
+  if (end > 0 && name[end - 1] == '.')
+    --end;
+  // labels from the last one
+  while (end > 0 && labelCount < ROLLUP_MAX_LABELS) {
+    size_t dot = name.rfind('.', end - 1);
+    size_t begin = dot == string::npos ? 0 : dot + 1;
+    labelBegin[labelCount] = begin;
+    labelLen[labelCount] = min<size_t>(end - begin, 255);
+    ++labelCount;
+    if (dot == string::npos)
+      break;
+    end = dot;
+  }
+
+  unsigned int suffixLabels = 1;
+  if (labelCount >= 2 && isTwoLabelSuffix(name.data() + labelBegin[1], labelLen[1], name.data() + labelBegin[0], labelLen[0]))
+    suffixLabels = 2;
+  unsigned int zoneLabels = min(labelCount, suffixLabels + _depth);
+
+  __u32 node = 0;
+  for (unsigned int i = 0; i < zoneLabels; ++i)
+    node = findOrAddNode(node, name.data() + labelBegin[i], labelLen[i]);
+  if (childLabel != nullptr) {
+    *childLabel = zoneLabels < labelCount ? name.data() + labelBegin[zoneLabels] : nullptr;
+    *childLen = zoneLabels < labelCount ? labelLen[zoneLabels] : 0;
+  }
+
+  if (_nodes[node].zone < 0) {
+    _nodes[node].zone = _zones.size();
+    _zones.emplace_back();
+    SZone &zone = _zones.back();
+    for (unsigned int i = zoneLabels; i-- > 0;) {
+      zone.name.append(_labels, _nodes[node].labelOffset, _nodes[node].labelLen);
+      if (i > 0)
+        zone.name += '.';
+      node = _nodes[node].parent;
+    }
+    zone.total = 0;
+    zone.childCount = 0;
+    _stringBytes += zone.name.size();
+    return zone;
+  }
+  return _zones[_nodes[node].zone];
+}
+
+/**
+ * @brief Private method adding count to child of zone by Space-Saving algorithm,
+ * when all slots are taken child with smallest count is replaced and new child
+ * inherits its count.
+ */
+void ZoneRollup::addChild(SZone &zone, const char *label, unsigned int len, __u64 count) {
+  unsigned int minIndex = 0;
+  for (unsigned int i = 0; i < zone.childCount; ++i) {
+    SChild &child = zone.children[i];
+    if (child.label.size() == len && strncasecmp(child.label.data(), label, len) == 0) {
+      child.count += count;
+      return;
+    }
+    if (child.count < zone.children[minIndex].count)
+      minIndex = i;
+  }
+
+  SChild *slot = &zone.children[minIndex];
+  if (zone.childCount < ROLLUP_TOP_CHILDREN) {
+    slot = &zone.children[zone.childCount++];
+    slot->count = 0;
+    ++_childRecords;
+  }
+  _stringBytes -= slot->label.size();
+  slot->label.assign(label, len);
+  for (auto &c : slot->label)
+    c = tolower((unsigned char)c);
+  _stringBytes += len;
+  slot->count += count;
+}
+
+/**
+ * @brief Private method doubling edge table and inserting all nodes again.
+ */
+void ZoneRollup::growEdges() {
+  _edges.assign(_edges.size() * 2, 0);
+  __u32 mask = _edges.size() - 1;
+  for (__u32 i = 1; i < _nodes.size(); ++i) {
+    const SNode &node = _nodes[i];
+    __u32 slot = edgeHash(node.parent, _labels.data() + node.labelOffset, node.labelLen) & mask;
+    while (_edges[slot] != 0)
+      slot = (slot + 1) & mask;
+    _edges[slot] = i + 1;
+  }
+}
@@ -0,0 +1,121 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    ZoneRollup.hpp
+ * @brief   Aggregation of answer counts by zone (registrable domain) with
+ *          most frequent names directly under each zone.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+#include "allocators.hpp"
+
+struct SDnsStatRecord;
+typedef std::vector<SDnsStatRecord, HugePageAllocator<SDnsStatRecord>> StatRecordVector; // see DNSStatistic.hpp
+
+#define ROLLUP_TOP_CHILDREN   8         // tracked names directly under each zone
+#define ROLLUP_RECORD_TYPE    "ZONE"    // type string of exported rollup records
+#define ROLLUP_DATA_TOTAL     "total"   // data of record with total count of zone
+#define ROLLUP_DATA_CHILD     "child"   // data of record with count of name under zone
+
+/*
+ * Zone of name is its public suffix and "depth" labels before it, e.g. with
+ * depth 1 (eTLD+1) zone of "a1b2.cdn.example.co.uk" is "example.co.uk" and
+ * its child is "cdn". Public suffix is last label or one of built-in
+ * two label suffixes (co.uk, com.au, ...), full public suffix list is not used.
+ *
+ * Exported records ("domain type data count"):
+ *   example.co.uk ZONE total 1234        all answers of zone
+ *   cdn.example.co.uk ZONE child 1000    answers of names under cdn.example.co.uk
+ */
+
+/**
+ * @brief Counts of answers rolled up to zones in trie of reversed labels.
+ *
+ * Trie nodes and their labels are allocated in arenas (vectors indexed by
+ * node number) and looked up by open addressing table of edges
+ * (parent node, label), so no memory is allocated per counted answer.
+ * Children of each zone are tracked by Space-Saving algorithm in
+ * ROLLUP_TOP_CHILDREN slots, so memory depends on number of zones only.
+ * Counts of children are upper estimates when zone had more children than slots.
+ */
+class ZoneRollup {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param depth  number of labels of zone before public suffix, at least 1
+   */
+  explicit ZoneRollup(unsigned int depth);
+
+  /**
+   * @brief Adds count of answer record to its zone.
+   *
+   * Records of ROLLUP_RECORD_TYPE (e.g. loaded from snapshot) are added
+   * to total or child counts they represent.
+   */
+  void add(const SDnsAnswerRecord &record, __u64 count);
+
+  /**
+   * @brief Adds all counts of other rollup of same depth to this one.
+   */
+  void merge(const ZoneRollup &other);
+
+  /**
+   * @brief Appends zone totals each followed by its children ordered by count.
+   */
+  void appendRecords(StatRecordVector &records) const;
+
+  /** @brief Returns number of records appendRecords would append. */
+  size_t recordCount() const;
+
+  /** @brief Returns estimate of memory used by rollup in bytes. */
+  size_t memoryUsage() const;
+
+  /**
+   * @brief Returns offset of zone of given depth in name, name itself
+   *        (offset 0) when it has no more labels than zone.
+   */
+  static size_t zoneOffset(const std::string &name, unsigned int depth);
+
+private: /* private implementation is documented in *.cpp file */
+  struct SNode {
+    __u32 parent;
+    __u32 labelOffset;  // lower case label in _labels
+    __u8 labelLen;
+    __s32 zone;         // index to _zones or -1 when node is not zone
+  };
+
+  struct SChild {
+    std::string label;
+    __u64 count;
+  };
+
+  struct SZone {
+    std::string name;
+    __u64 total;
+    SChild children[ROLLUP_TOP_CHILDREN];
+    unsigned int childCount;
+  };
+
+  unsigned int _depth;
+  std::vector<SNode, HugePageAllocator<SNode>> _nodes;  // root is first
+  std::string _labels;
+  std::vector<__u32, HugePageAllocator<__u32>> _edges;  // node index + 1 or 0 for empty slot
+  std::vector<SZone> _zones;
+  size_t _childRecords;
+  size_t _stringBytes;              // bytes of zone names and child labels
+
+  __u32 findOrAddNode(__u32 parent, const char *label, unsigned int len);
+  SZone &findOrAddZone(const std::string &name, const char **childLabel, unsigned int *childLen);
+  void addChild(SZone &zone, const char *label, unsigned int len, __u64 count);
+  void growEdges();
+};
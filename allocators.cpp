@@ -0,0 +1,129 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    allocators.cpp
+ * \brief   Huge page backed allocation of large tables and thread local
+ *          pools of per-packet objects.
+ *          Implementation of allocators.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <sys/mman.h>
+
+#include "allocators.hpp"
+
+using namespace std;
+
+static const char *glb_alloc_backingNames[ALLOC_BACKING_COUNT] = { "hugetlb", "thp", "mapped", "heap" };
+
+static atomic<bool> glb_alloc_isHugePages(false);
+static atomic<unsigned long long> glb_alloc_blocks[ALLOC_BACKING_COUNT];
+static atomic<unsigned long long> glb_alloc_bytes[ALLOC_BACKING_COUNT];
+static atomic<unsigned long long> glb_alloc_mappedBytes(0);
+static atomic<unsigned long long> glb_alloc_mappedPeak(0);
+static atomic<unsigned long long> glb_alloc_poolAcquired(0);
+static atomic<unsigned long long> glb_alloc_poolCreated(0);
+
+/**
+ * @brief Supportive function counting allocated block of given backing.
+ */
+static void countBlock(EAllocBacking backing, size_t bytes) {
+  glb_alloc_blocks[backing].fetch_add(1, memory_order_relaxed);
+  glb_alloc_bytes[backing].fetch_add(bytes, memory_order_relaxed);
+  if (backing == ALLOC_BACKING_HEAP)
+    return;
+  unsigned long long mapped = glb_alloc_mappedBytes.fetch_add(bytes, memory_order_relaxed) + bytes;
+  unsigned long long peak = glb_alloc_mappedPeak.load(memory_order_relaxed);
+  while (mapped > peak && !glb_alloc_mappedPeak.compare_exchange_weak(peak, mapped, memory_order_relaxed))
+    ;
+}
+
+/**
+ * @brief Supportive function rounding size of mapped block up to whole huge pages,
+ * so block can be unmapped with the same size whatever backing it got.
+ */
+static inline size_t mappedSize(size_t bytes) {
+  return (bytes + ALLOC_HUGE_PAGE_SIZE - 1) & ~(size_t)(ALLOC_HUGE_PAGE_SIZE - 1);
+}
+
+/* reportAtExit */
+static void reportAtExit() {
+  allocators::report(cerr);
+}
+
+namespace allocators {
+  /* enableHugePages */
+  void enableHugePages() {
+    if (!glb_alloc_isHugePages.exchange(true))
+      atexit(reportAtExit);
+  }
+
+  /* allocate */
+  void *allocate(size_t bytes) {
+    if (bytes < ALLOC_LARGE_MIN_SIZE) {
+      void *block = ::operator new(bytes);
+      countBlock(ALLOC_BACKING_HEAP, bytes);
+      return block;
+    }
+
+    size_t size = mappedSize(bytes);
+    void *block = MAP_FAILED;
+    EAllocBacking backing = ALLOC_BACKING_MAPPED;
+    if (glb_alloc_isHugePages.load(memory_order_relaxed)) {
+      block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      backing = ALLOC_BACKING_HUGETLB;
+      if (block == MAP_FAILED) { // no reserved huge pages, transparent ones are requested
+        block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        backing = block != MAP_FAILED && madvise(block, size, MADV_HUGEPAGE) == 0 ? ALLOC_BACKING_THP : ALLOC_BACKING_MAPPED;
+      }
+    } else {
+      block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (block == MAP_FAILED)
+      throw bad_alloc();
+    countBlock(backing, size);
+    return block;
+  }
+
+  /* deallocate */
+  void deallocate(void *block, size_t bytes) {
+    if (block == nullptr)
+      return;
+    if (bytes < ALLOC_LARGE_MIN_SIZE) {
+      ::operator delete(block);
+      return;
+    }
+    size_t size = mappedSize(bytes);
+    munmap(block, size);
+    glb_alloc_mappedBytes.fetch_sub(size, memory_order_relaxed);
+  }
+
+  /* countPoolAcquire */
+  void countPoolAcquire(bool isCreated) {
+    glb_alloc_poolAcquired.fetch_add(1, memory_order_relaxed);
+    if (isCreated)
+      glb_alloc_poolCreated.fetch_add(1, memory_order_relaxed);
+  }
+
+  /* report */
+  void report(ostream &out) {
+    if (!glb_alloc_isHugePages.load(memory_order_relaxed))
+      return;
+    out << "Allocators:" << endl;
+    for (int backing = 0; backing < ALLOC_BACKING_COUNT; ++backing)
+      out << "  " << glb_alloc_backingNames[backing] << " blocks: "
+          << glb_alloc_blocks[backing].load(memory_order_relaxed) << " ("
+          << glb_alloc_bytes[backing].load(memory_order_relaxed) << " B)" << endl;
+    out << "  mapped peak: " << glb_alloc_mappedPeak.load(memory_order_relaxed) << " B" << endl;
+    unsigned long long acquired = glb_alloc_poolAcquired.load(memory_order_relaxed);
+    unsigned long long created = glb_alloc_poolCreated.load(memory_order_relaxed);
+    out << "  pooled objects: " << acquired << " acquired, " << created << " created, "
+        << (acquired - created) << " reused" << endl;
+  }
+}
@@ -0,0 +1,156 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    allocators.hpp
+ * @brief   Huge page backed allocation of large tables and thread local
+ *          pools of per-packet objects.
+ *
+ *          Large blocks (statistics table, index buckets, rollup and
+ *          estimator arenas) are mapped directly. With huge pages enabled
+ *          (-H option) explicit huge pages (MAP_HUGETLB) are tried first,
+ *          then transparent huge pages are requested by madvise and when
+ *          even that fails block stays on normal pages, so program works
+ *          on systems without any huge page support.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include <new>
+
+#define ALLOC_HUGE_PAGE_SIZE  (2u << 20)  // size of huge page, mapped blocks are rounded up to it
+#define ALLOC_LARGE_MIN_SIZE  (1u << 20)  // smaller blocks are allocated from heap
+#define ALLOC_POOL_MAX_FREE   16          // free objects kept by pool in each thread
+
+/**
+ * @brief Backing memory of allocated blocks.
+ */
+enum EAllocBacking {
+  ALLOC_BACKING_HUGETLB = 0,  /*!< explicit huge pages (MAP_HUGETLB) */
+  ALLOC_BACKING_THP,          /*!< mapping advised for transparent huge pages */
+  ALLOC_BACKING_MAPPED,       /*!< mapping on normal pages */
+  ALLOC_BACKING_HEAP,         /*!< small block from heap */
+  ALLOC_BACKING_COUNT         /*!< number of values in this enum */
+};
+
+namespace allocators {
+  /**
+   * @brief Enables huge pages for large blocks allocated from now on and
+   *        registers report of allocator counters on stderr at exit.
+   */
+  void enableHugePages();
+
+  /**
+   * @brief Allocates block, blocks of at least ALLOC_LARGE_MIN_SIZE bytes are mapped.
+   *
+   * @throw std::bad_alloc when memory cannot be allocated
+   */
+  void *allocate(size_t bytes);
+
+  /** @brief Frees block of given size allocated by allocate. */
+  void deallocate(void *block, size_t bytes);
+
+  /** @brief Counts object taken from pool, isCreated when pool had to create it. */
+  void countPoolAcquire(bool isCreated);
+
+  /**
+   * @brief Writes allocator counters in human readable form when huge pages
+   *        are enabled (on exit and with statistics written on SIGUSR1).
+   */
+  void report(std::ostream &out);
+}
+
+/**
+ * @brief STL allocator of large tables backed by allocators::allocate.
+ */
+template <class T>
+struct HugePageAllocator {
+  typedef T value_type;
+
+  HugePageAllocator() {}
+  template <class U> HugePageAllocator(const HugePageAllocator<U> &) {}
+
+  T *allocate(size_t count) {
+    return static_cast<T *>(allocators::allocate(count * sizeof(T)));
+  }
+
+  void deallocate(T *block, size_t count) {
+    allocators::deallocate(block, count * sizeof(T));
+  }
+
+  template <class U> struct rebind { typedef HugePageAllocator<U> other; };
+};
+
+template <class T, class U>
+bool operator==(const HugePageAllocator<T> &, const HugePageAllocator<U> &) { return true; }
+template <class T, class U>
+bool operator!=(const HugePageAllocator<T> &, const HugePageAllocator<U> &) { return false; }
+
+/**
+ * @brief Thread local pool of reusable objects of type T.
+ *
+ * Released objects keep their allocated memory (e.g. capacity of vectors),
+ * so object acquired for next packet does not allocate it again.
+ * Objects have to be released by thread which acquired them.
+ */
+template <class T>
+class ObjectPool {
+public:
+  /** @brief Returns free object of calling thread or new one. */
+  static T *acquire() {
+    std::vector<T *> &objects = freeObjects().objects;
+    bool isCreated = objects.empty();
+    allocators::countPoolAcquire(isCreated);
+    if (isCreated)
+      return new T();
+    T *object = objects.back();
+    objects.pop_back();
+    return object;
+  }
+
+  /** @brief Returns object to pool of calling thread, surplus objects are deleted. */
+  static void release(T *object) {
+    std::vector<T *> &objects = freeObjects().objects;
+    if (objects.size() < ALLOC_POOL_MAX_FREE)
+      objects.push_back(object);
+    else
+      delete object;
+  }
+
+private:
+  struct SFreeObjects {
+    std::vector<T *> objects;
+    ~SFreeObjects() {
+      for (T *object : objects)
+        delete object;
+    }
+  };
+
+  static SFreeObjects &freeObjects() {
+    static thread_local SFreeObjects tl_freeObjects;
+    return tl_freeObjects;
+  }
+};
+
+/**
+ * @brief Object of ObjectPool held for lifetime of this handle.
+ */
+template <class T>
+class PooledObject {
+public:
+  PooledObject() { _object = ObjectPool<T>::acquire(); }
+  ~PooledObject() { ObjectPool<T>::release(_object); }
+  PooledObject(const PooledObject &) = delete;
+  PooledObject &operator=(const PooledObject &) = delete;
+
+  T *get() const { return _object; }
+  T *operator->() const { return _object; }
+  T &operator*() const { return *_object; }
+
+private:
+  T *_object;
+};
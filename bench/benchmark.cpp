@@ -0,0 +1,744 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    benchmark.cpp
+ * \brief   Micro and throughput benchmarks of dns-export hot path.
+ *
+ *          Measures DNSResponse::parse on a corpus of record types,
+ *          DNSStatistic::addAnswerRecord on growing tables, statToString and
+ *          end-to-end processPcapFile throughput. Verdicts of hand-built BPF
+ *          filter, absence of allocations on repeated answers and results
+ *          of record eviction, client tracking, distinct estimates and zone
+ *          rollup against exact references are checked first. Results are
+ *          written as JSON to file given as first argument (stdout when
+ *          omitted).
+ *          Build and run with "make bench".
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <set>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <new>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../utils.hpp"
+#include "../DNSResponse.hpp"
+#include "../DNSStatistic.hpp"
+#include "../ClientTracker.hpp"
+#include "../DistinctCounter.hpp"
+#include "../ZoneRollup.hpp"
+#include "../pcapProcessor.hpp"
+#include "../headerClassifier.hpp"
+#include "../tools/DNSMessageBuilder.hpp"
+#include "../tools/PcapWriter.hpp"
+
+#define BENCH_MIN_TIME_SEC    0.3     // every micro benchmark runs at least this long
+#define BENCH_PCAP_PACKETS    200000  // number of packets in end-to-end benchmark file
+#define BENCH_BUFFER_SIZE     4096    // size of buffer holding one DNS message
+
+#define BENCH_ALLOC_ROUNDS    100     // repeated parses of corpus counted by allocation check
+#define BENCH_CHECK_STEPS     20000   // added answers or responses of each differential check
+#define BENCH_HLL_MAX_ERROR   4       // allowed error of distinct estimates in standard errors
+
+using namespace std;
+
+/* number of calls of replaced global operator new while counting is enabled, see checkSteadyStateAllocations */
+static atomic<unsigned long> glb_bench_allocations(0);
+static atomic<bool> glb_bench_isCountingAllocations(false);
+
+/**
+ * @brief Replaced global operator new counting allocations while allocation
+ * check runs, other benchmarks pay only one relaxed load per allocation.
+ */
+__attribute__((noinline)) void *operator new(size_t size) {
+  if (glb_bench_isCountingAllocations.load(memory_order_relaxed))
+    glb_bench_allocations.fetch_add(1, memory_order_relaxed);
+  void *block = malloc(size != 0 ? size : 1);
+  if (block == nullptr)
+    throw bad_alloc();
+  return block;
+}
+
+/** @brief Replaced global operator delete matching operator new above. */
+__attribute__((noinline)) void operator delete(void *block) noexcept {
+  free(block);
+}
+
+/**
+ * @brief Result of one benchmark.
+ */
+struct SBenchResult {
+  string name;
+  unsigned long iterations;
+  double nsPerOp;
+  double opsPerSec;
+};
+
+/**
+ * @brief Runs operation repeatedly for at least BENCH_MIN_TIME_SEC and measures it.
+ */
+SBenchResult runBenchmark(const string &name, function<void()> operation) {
+  unsigned long iterations = 0;
+  unsigned long batch = 1;
+  auto begin = chrono::steady_clock::now();
+  double elapsed = 0;
+  while (elapsed < BENCH_MIN_TIME_SEC) {
+    for (unsigned long i = 0; i < batch; ++i)
+      operation();
+    iterations += batch;
+    batch *= 2;
+    elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+  }
+  SBenchResult result = { name, iterations, elapsed * 1e9 / iterations, iterations / elapsed };
+  cerr << name << ": " << result.nsPerOp << " ns/op" << endl;
+  return result;
+}
+
+/**
+ * @brief Creates corpus of DNS responses with different record types.
+ */
+vector<pair<string, vector<unsigned char>>> createParseCorpus() {
+  vector<pair<string, vector<unsigned char>>> corpus;
+
+  DNSMessageBuilder a("www.example.com");
+  a.beginAnswer(DNS_RECTYPE_A); a.appendU32(0x5db8d822); a.endAnswer();
+  corpus.push_back({ "A", a.data() });
+
+  DNSMessageBuilder aaaa("www.example.com");
+  aaaa.beginAnswer(DNS_RECTYPE_AAAA); aaaa.appendBytes(string("\x26\x06\x28\x00\x02\x20\x00\x01\x02\x48\x18\x93\x25\xc8\x19\x46", 16)); aaaa.endAnswer();
+  corpus.push_back({ "AAAA", aaaa.data() });
+
+  DNSMessageBuilder cname("www.example.com");
+  for (int i = 0; i < 4; ++i) {
+    cname.beginAnswer(DNS_RECTYPE_CNAME);
+    cname.appendName("edge" + to_string(i) + ".cdn.example.net");
+    cname.endAnswer();
+  }
+  cname.beginAnswer(DNS_RECTYPE_A); cname.appendU32(0x0a000001); cname.endAnswer();
+  corpus.push_back({ "CNAME_chain", cname.data() });
+
+  DNSMessageBuilder soa("example.com");
+  soa.beginAnswer(DNS_RECTYPE_SOA);
+  soa.appendName("ns1.example.com");
+  soa.appendName("hostmaster.example.com");
+  for (int i = 0; i < 5; ++i)
+    soa.appendU32(3600 * (i + 1));
+  soa.endAnswer();
+  corpus.push_back({ "SOA", soa.data() });
+
+  DNSMessageBuilder txt("example.com");
+  txt.beginAnswer(DNS_RECTYPE_TXT);
+  txt.appendU8(60);
+  txt.appendBytes("v=spf1 include:_spf.example.com ip4:192.0.2.0/24 -all xxxxx");
+  txt.endAnswer();
+  corpus.push_back({ "TXT", txt.data() });
+
+  DNSMessageBuilder dnskey("example.com");
+  dnskey.beginAnswer(DNS_RECTYPE_DNSKEY);
+  dnskey.appendU16(257); dnskey.appendU8(3); dnskey.appendU8(8);
+  dnskey.appendBytes(string(256, '\x5a'));
+  dnskey.endAnswer();
+  corpus.push_back({ "DNSKEY", dnskey.data() });
+
+  DNSMessageBuilder rrsig("example.com");
+  rrsig.beginAnswer(DNS_RECTYPE_RSIG);
+  rrsig.appendU16(DNS_RECTYPE_A); rrsig.appendU8(8); rrsig.appendU8(2);
+  rrsig.appendU32(300); rrsig.appendU32(1600000000); rrsig.appendU32(1500000000);
+  rrsig.appendU16(12345);
+  rrsig.appendName("example.com");
+  rrsig.appendBytes(string(256, '\x33'));
+  rrsig.endAnswer();
+  corpus.push_back({ "RRSIG", rrsig.data() });
+
+  return corpus;
+}
+
+/**
+ * @brief Creates answer record with unique domain name for statistics benchmarks.
+ */
+SDnsAnswerRecord createRecord(unsigned int index) {
+  SDnsAnswerRecord record;
+  memset(&record.header, 0, sizeof(SDnsAnswerHeader));
+  record.header.type = DNS_RECTYPE_A;
+  record.domainName = "host" + to_string(index) + ".example.com";
+  record.answerData = "10.0." + to_string((index >> 8) & 0xff) + "." + to_string(index & 0xff);
+  record.typeString = "A";
+  return record;
+}
+
+/**
+ * @brief Writes pcap file with Ethernet/IPv4/UDP frames carrying corpus messages.
+ *
+ * @return true when file was written.
+ */
+bool writeBenchPcap(const string &fileName, const vector<pair<string, vector<unsigned char>>> &corpus, unsigned int packets) {
+  PcapWriter writer;
+  if (!writer.open(fileName))
+    return false;
+  SPcapWriterPacket params = { false, false, false, 0 };
+  for (unsigned int i = 0; i < packets; ++i) {
+    writer.setTime(1500000000 + i / 1000, (i % 1000) * 1000);
+    params.client = i;
+    writer.writeDnsResponse(corpus[i % corpus.size()].second, params);
+  }
+  return writer.close();
+}
+
+/**
+ * @brief Supportive function returning copy of IPv4 frame with four NOP options
+ * inserted after fixed IP header (IP header length 24 B).
+ */
+static vector<unsigned char> withIPv4Options(vector<unsigned char> frame) {
+  frame.insert(frame.begin() + 14 + 20, 4, 0x01);
+  frame[14] = 0x46;
+  unsigned int totalLen = ((frame[16] << 8) | frame[17]) + 4;
+  frame[16] = totalLen >> 8;
+  frame[17] = totalLen & 0xff;
+  return frame;
+}
+
+/**
+ * @brief Checks hand-built BPF program of pcapProcessor (dnsResponseFilter) by
+ * pcap_offline_filter on frames written by PcapWriter, benchmark fails when
+ * any frame is not passed or dropped as expected.
+ */
+void checkResponseFilter(const vector<unsigned char> &response) {
+  vector<unsigned char> query = response;
+  query[2] &= 0x7f;
+  DNSMessageBuilder noAnswers("www.example.com");
+  struct SFilterCase {
+    const char *name;
+    const vector<unsigned char> *dns;
+    SPcapWriterPacket params;   // isIPv6, isTcp, forceFragments, client
+    bool isPassed;
+  } cases[] = {
+    { "IPv4 UDP response",        &response,           { false, false, false, 0 }, true  },
+    { "IPv6 UDP response",        &response,           { true,  false, false, 0 }, true  },
+    { "IPv4 UDP query",           &query,              { false, false, false, 0 }, false },
+    { "IPv6 UDP query",           &query,              { true,  false, false, 0 }, false },
+    { "IPv4 UDP no answers",      &noAnswers.data(),   { false, false, false, 0 }, false },
+    { "IPv6 UDP no answers",      &noAnswers.data(),   { true,  false, false, 0 }, false },
+    { "IPv4 UDP fragment",        &response,           { false, false, true,  0 }, true  },
+    { "IPv6 UDP fragment",        &response,           { true,  false, true,  0 }, true  },
+    { "IPv4 TCP from port 53",    &response,           { false, true,  false, 0 }, true  },
+    { "IPv6 TCP from port 53",    &response,           { true,  true,  false, 0 }, true  },
+  };
+
+  char fileName[] = "/tmp/dns-export-filter-XXXXXX";
+  int fd = mkstemp(fileName);
+  if (fd == -1)
+    utils::raisePerror("benchmark: mkstemp");
+  close(fd);
+  PcapWriter writer;
+  if (!writer.open(fileName))
+    utils::raiseError("benchmark: cannot write pcap file");
+  vector<const SFilterCase *> frameCases;  // case of each written frame, fragments have more frames
+  for (const SFilterCase &filterCase : cases) {
+    writer.writeDnsResponse(*filterCase.dns, filterCase.params);
+    while (frameCases.size() < writer.framesWritten())
+      frameCases.push_back(&filterCase);
+  }
+  if (!writer.close())
+    utils::raiseError("benchmark: cannot write pcap file");
+
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcap_t *pcapHandle = pcap_open_offline(fileName, errbuf);
+  if (pcapHandle == nullptr)
+    utils::raiseError(string("benchmark: cannot read pcap file: ") + errbuf);
+  vector<pair<string, vector<unsigned char>>> frames;
+  struct pcap_pkthdr *header;
+  const u_char *packet;
+  while (pcap_next_ex(pcapHandle, &header, &packet) == 1)
+    frames.push_back({ "", vector<unsigned char>(packet, packet + header->caplen) });
+  pcap_close(pcapHandle);
+  unlink(fileName);
+  if (frames.size() != frameCases.size())
+    utils::raiseError("benchmark: filter check read unexpected number of frames");
+
+  vector<bool> isPassed;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    frames[i].first = frameCases[i]->name;
+    isPassed.push_back(frameCases[i]->isPassed);
+  }
+  // header length of IPv4 is taken from packet, DNS header moves with options
+  frames.push_back({ "IPv4 UDP response with options", withIPv4Options(frames[0].second) });
+  isPassed.push_back(true);
+  frames.push_back({ "IPv4 UDP query with options", withIPv4Options(frames[2].second) });
+  isPassed.push_back(false);
+  frames.push_back({ "IPv4 UDP response not from port 53", frames[0].second });
+  frames.back().second[14 + 20 + 1] = 54;
+  isPassed.push_back(false);
+
+  struct bpf_program program = dnsResponseFilter();
+  for (size_t i = 0; i < frames.size(); ++i) {
+    struct pcap_pkthdr frameHeader;
+    memset(&frameHeader, 0, sizeof(frameHeader));
+    frameHeader.caplen = frameHeader.len = frames[i].second.size();
+    if ((pcap_offline_filter(&program, &frameHeader, frames[i].second.data()) != 0) != isPassed[i])
+      utils::raiseError("benchmark: BPF filter " + string(isPassed[i] ? "dropped " : "passed ") + frames[i].first);
+  }
+  cerr << "filter: " << frames.size() << " frames classified as expected" << endl;
+}
+
+/**
+ * @brief Checks that parse and addAnswerRecords of responses whose answers are
+ * already in statistics allocate nothing, benchmark fails otherwise.
+ *
+ * Corpus is processed twice first, so answers of parser and strings reused by
+ * it reach their capacity and every answer has its statistic record.
+ */
+void checkSteadyStateAllocations(const vector<pair<string, vector<unsigned char>>> &corpus) {
+  vector<vector<unsigned char>> buffers;
+  for (const auto &message : corpus) {
+    buffers.push_back(vector<unsigned char>(BENCH_BUFFER_SIZE, 0));
+    memcpy(buffers.back().data(), message.second.data(), message.second.size());
+  }
+  DNSResponse response;
+  DNSStatistic statistic;
+  unsigned long allocations = 0;
+  glb_bench_isCountingAllocations.store(true, memory_order_relaxed);
+  for (unsigned int round = 0; round < BENCH_ALLOC_ROUNDS + 2; ++round) {
+    unsigned long before = glb_bench_allocations.load(memory_order_relaxed);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+      if (!response.parse(buffers[i].data()))
+        utils::raiseError("benchmark: parse of " + corpus[i].first + " failed");
+      statistic.addAnswerRecords(response.answers);
+    }
+    if (round >= 2)
+      allocations += glb_bench_allocations.load(memory_order_relaxed) - before;
+  }
+  glb_bench_isCountingAllocations.store(false, memory_order_relaxed);
+  if (allocations != 0)
+    utils::raiseError("benchmark: " + to_string(allocations) + " allocations in steady state of parse and addAnswerRecords");
+  cerr << "allocations: none in " << BENCH_ALLOC_ROUNDS << " rounds of " << buffers.size() << " repeated responses" << endl;
+}
+
+/**
+ * @brief Supportive function returning table of statistics as map from
+ * domain name to count, benchmark fails when any name is in table twice.
+ */
+static map<string, unsigned int> recordTableCounts(const DNSStatistic &statistic) {
+  map<string, unsigned int> counts;
+  for (const auto &rec : statistic.getRecordTable()) {
+    if (!counts.insert({ rec.answerRec.domainName, rec.count }).second)
+      utils::raiseError("benchmark: record " + rec.answerRec.domainName + " is in statistics twice");
+  }
+  return counts;
+}
+
+/**
+ * @brief Checks eviction of DNSStatistic (expiry and CLOCK under memory cap)
+ * against brute-force model of counts and expiry times of all added records,
+ * benchmark fails when they differ.
+ *
+ * After every added answer table has to hold exactly the modelled records with
+ * their counts, so records moved by swap-with-last stay findable. Record may
+ * disappear only when it expired (expiry) or statistics were over cap, and
+ * expired record has to be gone within few passes of clock hand.
+ */
+void checkEviction() {
+  const unsigned int expiryFloor = 10;
+  const unsigned int answersPerSec = 20;
+  unsigned long evicted[2] = { 0, 0 };
+  srand(7);
+  for (int isCapped = 0; isCapped < 2; ++isCapped) {
+    struct SModelRecord {
+      unsigned int count;
+      __u32 expiresAt;
+    };
+    map<string, SModelRecord> model;
+    DNSStatistic statistic;
+    statistic.setEviction(isCapped ? 0 : expiryFloor, isCapped ? 64 * 1024 : 0);
+    SDnsClient client;
+    memset(&client, 0, sizeof(SDnsClient));
+    vector<SDnsAnswerRecord> answers(1);
+    for (unsigned int step = 0; step < BENCH_CHECK_STEPS; ++step) {
+      // half of answers are of few hot records, capped table gets many cold ones
+      unsigned int index = (rand() & 1) ? rand() % 32 : rand() % (isCapped ? 5000 : 300);
+      answers[0] = createRecord(index);
+      answers[0].header.timeToLive = index % 30;
+      string name = answers[0].domainName; // new record is moved from answers
+      client.time = 1500000000 + step / answersPerSec;
+      statistic.addAnswerRecords(answers, 1, &client);
+
+      SModelRecord &modelRecord = model[name];
+      ++modelRecord.count;
+      modelRecord.expiresAt = client.time + max(index % 30, expiryFloor);
+
+      map<string, unsigned int> counts = recordTableCounts(statistic);
+      for (auto it = model.begin(); it != model.end();) {
+        auto found = counts.find(it->first);
+        if (found == counts.end()) {
+          if (!isCapped && it->second.expiresAt >= client.time)
+            utils::raiseError("benchmark: record " + it->first + " was evicted before it expired");
+          ++evicted[isCapped];
+          it = model.erase(it);
+          continue;
+        }
+        if (found->second != it->second.count)
+          utils::raiseError("benchmark: record " + it->first + " has count " + to_string(found->second) +
+                            " instead of " + to_string(it->second.count) + " after eviction");
+        // whole table of at most 332 records is passed by hand within 2 s of answers
+        if (!isCapped && it->second.expiresAt + 5 < client.time)
+          utils::raiseError("benchmark: expired record " + it->first + " was not evicted");
+        ++it;
+      }
+      if (counts.size() != model.size())
+        utils::raiseError("benchmark: statistics hold " + to_string(counts.size()) + " records, model " + to_string(model.size()));
+      if (counts.count(name) == 0)
+        utils::raiseError("benchmark: just added record " + name + " was evicted");
+    }
+    if (evicted[isCapped] == 0)
+      utils::raiseError(string("benchmark: nothing was evicted by ") + (isCapped ? "memory cap" : "expiry"));
+  }
+  cerr << "eviction: " << evicted[0] << " expired and " << evicted[1] << " over cap records evicted as modelled" << endl;
+}
+
+/**
+ * @brief Checks ClientTracker against exact counters of all clients,
+ * benchmark fails when tracker breaks its guarantees.
+ *
+ * With capacity above number of clients tracker has to be exact. With fewer
+ * slots Space-Saving keeps sum of answers, overestimates answers of each
+ * client by at most minimal tracked count and tracks every client with more
+ * than 1/N of answers. Clients replaced in full tracker exercise deletion
+ * from open addressing table, lost or duplicated clients fail the check.
+ */
+void checkClientTracker() {
+  srand(11);
+  for (unsigned int capacity : { 4096u, 256u }) {
+    const unsigned int clientCount = 3000;
+    struct SExactClient {
+      __u64 answers;
+      __u64 bytes;
+    };
+    map<string, SExactClient> exact;
+    __u64 totalAnswers = 0;
+    ClientTracker tracker(capacity);
+    for (unsigned int step = 0; step < BENCH_CHECK_STEPS * 2; ++step) {
+      // skewed clients, some of them get more than 1/N of answers
+      unsigned int index = (rand() % 4 == 0) ? rand() % 8 : rand() % clientCount;
+      __u8 addr[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 10, 0, (__u8)(index >> 8), (__u8)index };
+      __u64 answers = 1 + rand() % 4;
+      __u64 bytes = 50 + rand() % 450;
+      tracker.add(addr, answers, bytes);
+      SExactClient &client = exact["10.0." + to_string(index >> 8) + "." + to_string(index & 0xff)];
+      client.answers += answers;
+      client.bytes += bytes;
+      totalAnswers += answers;
+    }
+
+    StatRecordVector records;
+    tracker.appendRecords(records);
+    map<string, SExactClient> tracked;
+    __u64 trackedAnswers = 0;
+    __u64 minAnswers = ULLONG_MAX;
+    for (size_t i = 0; i + 1 < records.size(); i += 2) {
+      const string &name = records[i].answerRec.domainName;
+      if (exact.count(name) == 0 || !tracked.insert({ name, { records[i].count, records[i + 1].count } }).second)
+        utils::raiseError("benchmark: client tracker holds unknown or duplicate client " + name);
+      if (i >= 2 && records[i].count > records[i - 2].count)
+        utils::raiseError("benchmark: client records are not ordered by answers");
+      trackedAnswers += records[i].count;
+      minAnswers = min(minAnswers, (__u64)records[i].count);
+    }
+    bool isExact = capacity >= clientCount;
+    if (tracked.size() != min((size_t)capacity, exact.size()))
+      utils::raiseError("benchmark: client tracker holds " + to_string(tracked.size()) + " clients");
+    if (trackedAnswers != totalAnswers)
+      utils::raiseError("benchmark: answers of tracked clients do not sum to all answers");
+    for (const auto &client : exact) {
+      auto found = tracked.find(client.first);
+      if (found == tracked.end()) {
+        if (isExact || client.second.answers * capacity > totalAnswers)
+          utils::raiseError("benchmark: client " + client.first + " is not tracked");
+        continue;
+      }
+      const SExactClient &estimate = found->second;
+      bool isValid = isExact ?
+        estimate.answers == client.second.answers && estimate.bytes == client.second.bytes :
+        estimate.answers >= client.second.answers && estimate.answers - client.second.answers <= minAnswers &&
+        estimate.bytes <= client.second.bytes;
+      if (!isValid)
+        utils::raiseError("benchmark: client " + client.first + " has wrong counters in tracker of " + to_string(capacity));
+    }
+  }
+  cerr << "clients: tracker exact with free slots and within Space-Saving bounds when full" << endl;
+}
+
+/**
+ * @brief Checks HyperLogLog estimates of sets of growing size against their
+ * exact sizes, benchmark fails when error exceeds BENCH_HLL_MAX_ERROR
+ * standard errors or merged registers differ from registers of union.
+ */
+void checkDistinctEstimates() {
+  vector<__u8> registers(HLL_REGISTERS);
+  vector<__u8> first(HLL_REGISTERS);
+  vector<__u8> second(HLL_REGISTERS);
+  double maxError = 0;
+  for (__u64 size : { 1, 10, 100, 1000, 10000, 100000, 1000000 }) {
+    fill(registers.begin(), registers.end(), 0);
+    fill(first.begin(), first.end(), 0);
+    fill(second.begin(), second.end(), 0);
+    for (__u64 value = 0; value < size; ++value) {
+      __u64 hash = hll::hash(&value, sizeof(value));
+      hll::add(registers.data(), hash);
+      hll::add(registers.data(), hash); // repeated values are not counted
+      // overlapping halves of set
+      if (value < size * 2 / 3)
+        hll::add(first.data(), hash);
+      if (value >= size / 3)
+        hll::add(second.data(), hash);
+    }
+    hll::merge(first.data(), second.data());
+    if (first != registers)
+      utils::raiseError("benchmark: merged registers differ from registers of union of " + to_string(size) + " values");
+    bool isLinear = false;
+    __u64 estimate = hll::estimate(registers.data(), &isLinear);
+    double error = fabs((double)estimate - size) / size;
+    double allowed = isLinear ? 0.02 : BENCH_HLL_MAX_ERROR * HLL_STANDARD_ERROR;
+    if (error > allowed && fabs((double)estimate - size) > 1)
+      utils::raiseError("benchmark: distinct estimate " + to_string(estimate) + " of " + to_string(size) + " values is out of bounds");
+    maxError = max(maxError, error);
+  }
+  cerr << "distinct: estimates within " << maxError * 100 << " % of exact counts" << endl;
+}
+
+/**
+ * @brief Checks ZoneRollup against exact counts of zones and their children,
+ * benchmark fails when totals differ or top children break Space-Saving bounds
+ * (sum of counts kept, overestimate at most minimal count of zone, every child
+ * with more than 1/ROLLUP_TOP_CHILDREN of answers of zone tracked).
+ */
+void checkZoneRollup() {
+  srand(13);
+  map<string, __u64> exactTotals;
+  map<string, map<string, __u64>> exactChildren;
+  ZoneRollup rollup(1);
+  SDnsAnswerRecord record = createRecord(0);
+  for (unsigned int step = 0; step < BENCH_CHECK_STEPS * 2; ++step) {
+    string zone = "zone" + to_string(rand() % 20) + ".example";
+    // few heavy children and long tail, some answers are for zone itself
+    unsigned int child = (rand() % 3 == 0) ? rand() % 3 : rand() % 40;
+    string label = "c" + to_string(child);
+    bool isZoneName = rand() % 10 == 0;
+    record.domainName = isZoneName ? zone : "www." + label + "." + zone;
+    __u64 count = 1 + rand() % 3;
+    rollup.add(record, count);
+    exactTotals[zone] += count;
+    if (!isZoneName)
+      exactChildren[zone][label] += count;
+  }
+
+  StatRecordVector records;
+  rollup.appendRecords(records);
+  string zone;
+  map<string, map<string, __u64>> trackedChildren;
+  for (const auto &rec : records) {
+    const string &name = rec.answerRec.domainName;
+    if (rec.answerRec.answerData == ROLLUP_DATA_TOTAL) {
+      zone = name;
+      if (exactTotals[zone] != rec.count)
+        utils::raiseError("benchmark: rollup total of " + zone + " differs from exact count");
+      continue;
+    }
+    map<string, __u64> &children = trackedChildren[zone];
+    string label = name.substr(0, name.find('.'));
+    if (name != label + "." + zone || !children.insert({ label, rec.count }).second)
+      utils::raiseError("benchmark: rollup holds unexpected or duplicate child " + name);
+  }
+  if (trackedChildren.size() != exactTotals.size())
+    utils::raiseError("benchmark: rollup holds wrong number of zones");
+  for (const auto &zoneChildren : exactChildren) {
+    const map<string, __u64> &tracked = trackedChildren[zoneChildren.first];
+    __u64 exactSum = 0, trackedSum = 0, minCount = ULLONG_MAX;
+    for (const auto &child : zoneChildren.second)
+      exactSum += child.second;
+    for (const auto &child : tracked) {
+      trackedSum += child.second;
+      minCount = min(minCount, child.second);
+    }
+    if (tracked.size() != ROLLUP_TOP_CHILDREN || trackedSum != exactSum)
+      utils::raiseError("benchmark: children of " + zoneChildren.first + " do not keep all answers");
+    for (const auto &child : zoneChildren.second) {
+      auto found = tracked.find(child.first);
+      if (found == tracked.end()) {
+        if (child.second * ROLLUP_TOP_CHILDREN > exactSum)
+          utils::raiseError("benchmark: frequent child " + child.first + "." + zoneChildren.first + " is not tracked");
+      } else if (found->second < child.second || found->second - child.second > minCount) {
+        utils::raiseError("benchmark: child " + child.first + "." + zoneChildren.first + " is out of Space-Saving bounds");
+      }
+    }
+  }
+  cerr << "rollup: " << exactTotals.size() << " zones exact, top children within Space-Saving bounds" << endl;
+}
+
+/**
+ * @brief Writes results as JSON to given stream.
+ */
+void writeJson(ostream &out, const vector<SBenchResult> &results) {
+  out << "{" << endl;
+  out << "  \"format\": 1," << endl;
+  out << "  \"benchmarks\": [" << endl;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const SBenchResult &result = results[i];
+    out << "    {\"name\": \"" << result.name << "\""
+        << ", \"iterations\": " << result.iterations
+        << ", \"ns_per_op\": " << result.nsPerOp
+        << ", \"ops_per_sec\": " << result.opsPerSec << "}"
+        << (i + 1 < results.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl;
+  out << "}" << endl;
+}
+
+int main(int argc, char * const argv[]) {
+  vector<SBenchResult> results;
+  vector<pair<string, vector<unsigned char>>> corpus = createParseCorpus();
+
+  // DNSResponse::parse on each record type
+  for (const auto &message : corpus) {
+    vector<unsigned char> buffer(BENCH_BUFFER_SIZE, 0);
+    memcpy(buffer.data(), message.second.data(), message.second.size());
+    DNSResponse response;
+    results.push_back(runBenchmark("parse/" + message.first, [&]() {
+      if (!response.parse(buffer.data()))
+        utils::raiseError("benchmark: parse of " + message.first + " failed");
+    }));
+  }
+
+  // hand-built BPF program passes only DNS responses with answers
+  checkResponseFilter(corpus[0].second);
+
+  // answers already in statistics are counted without allocation
+  checkSteadyStateAllocations(corpus);
+
+  // structures with bounded memory against exact brute-force references
+  checkEviction();
+  checkClientTracker();
+  checkDistinctEstimates();
+  checkZoneRollup();
+
+  // header classification of mixed batch, batch results have to match scalar reference
+  {
+    vector<vector<unsigned char>> messages;
+    for (unsigned int i = 0; i < 64; ++i) {
+      vector<unsigned char> message = corpus[i % corpus.size()].second;
+      switch (i % 8) {
+        case 1: message[2] &= 0x7f; break;     // query
+        case 2: message[3] |= 0x03; break;     // error code
+        case 3: message[6] = message[7] = 0; break;   // no answers
+        case 4: message[11] = 200; break;      // absurd additional count
+        case 5: message[4] = 0x80; break;      // absurd question count
+      }
+      messages.push_back(message);
+    }
+    srand(42);
+    for (unsigned int i = 0; i < 4096; ++i) {
+      vector<unsigned char> message(CLASSIFY_HEADER_SIZE);
+      for (auto &byte : message)
+        byte = (rand() & 1) ? 0 : rand() & 0xff;
+      messages.push_back(message);
+    }
+    vector<const unsigned char *> headers;
+    for (const auto &message : messages)
+      headers.push_back(message.data());
+    vector<EDnsParseError> verdicts(headers.size());
+    classify::headerBatch(headers.data(), headers.size(), verdicts.data());
+    for (size_t i = 0; i < headers.size(); ++i)
+      if (verdicts[i] != classify::headerScalar(headers[i]))
+        utils::raiseError("benchmark: batch classification differs from scalar on header " + to_string(i));
+
+    // first 64 headers are the mixed batch
+    unsigned int survivors = 0;
+    results.push_back(runBenchmark("classify/scalar64", [&]() {
+      for (unsigned int i = 0; i < 64; ++i)
+        survivors += classify::headerScalar(headers[i]) == DNS_PARSE_OK;
+    }));
+    results.push_back(runBenchmark("classify/batch64", [&]() {
+      survivors += classify::headerBatch(headers.data(), 64, verdicts.data());
+    }));
+    if (survivors == 0)
+      utils::raiseError("benchmark: classification rejected every header");
+  }
+
+  // DNSStatistic::addAnswerRecord on existing records in tables of growing size
+  for (unsigned int tableSize : { 100, 1000, 10000 }) {
+    DNSStatistic statistic;
+    vector<SDnsAnswerRecord> records;
+    for (unsigned int i = 0; i < tableSize; ++i) {
+      records.push_back(createRecord(i));
+      statistic.addAnswerRecord(records.back());
+    }
+    unsigned int next = 0;
+    results.push_back(runBenchmark("addAnswerRecord/" + to_string(tableSize), [&]() {
+      statistic.addAnswerRecord(records[next]);
+      next = (next + 7919) % tableSize;
+    }));
+  }
+
+  // statToString
+  {
+    DNSStatistic statistic;
+    SDnsStatRecord record = { createRecord(42), 1234, 0 };
+    size_t totalLen = 0;
+    results.push_back(runBenchmark("statToString", [&]() {
+      totalLen += statistic.statToString(record).size();
+    }));
+    if (totalLen == 0)
+      utils::raiseError("benchmark: statToString produced nothing");
+  }
+
+  // end-to-end processPcapFile throughput
+  {
+    char fileName[] = "/tmp/dns-export-bench-XXXXXX";
+    int fd = mkstemp(fileName);
+    if (fd == -1)
+      utils::raisePerror("benchmark: mkstemp");
+    close(fd);
+    if (!writeBenchPcap(fileName, corpus, BENCH_PCAP_PACKETS))
+      utils::raiseError("benchmark: cannot write pcap file");
+
+    utils::ProgramOptions options = {};
+    options.isPcapFile = true;
+    options.pcapFileName = fileName;
+    unsigned long runs = 0;
+    auto begin = chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_TIME_SEC || runs < 3) {
+      if (!processPcapFile(options, make_shared<DNSStatistic>()))
+        utils::raiseError("benchmark: processPcapFile failed");
+      ++runs;
+      elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    }
+    unlink(fileName);
+    unsigned long packets = runs * BENCH_PCAP_PACKETS;
+    SBenchResult result = { "processPcapFile/packets", packets, elapsed * 1e9 / packets, packets / elapsed };
+    cerr << result.name << ": " << result.opsPerSec << " packets/s" << endl;
+    results.push_back(result);
+  }
+
+  if (argc > 1) {
+    ofstream out(argv[1]);
+    if (!out)
+      utils::raiseError(string("benchmark: cannot open ") + argv[1]);
+    writeJson(out, results);
+  } else {
+    writeJson(cout, results);
+  }
+  return 0;
+}
@@ -0,0 +1,189 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    headerClassifier.cpp
+ * \brief   Batch pre-classification of DNS headers, rejecting packets which
+ *          DNSResponse::parse would reject by its header checks.
+ *          Implementation of headerClassifier.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <netinet/if_ether.h>
+
+#include "headerClassifier.hpp"
+
+#define CLASSIFY_SIZE_ETHERNET  14                      // size of Ethernet header
+#define CLASSIFY_LANE_HIGH      0x8000800080008000ull   // high bit of each 16 bit lane
+#define CLASSIFY_LANE_LOW       0x0001000100010001ull   // low bit of each 16 bit lane
+#define CLASSIFY_LANES          4                       // headers evaluated together in 64 bit words
+
+/* zero header filling unused lanes, it is not a response, so it never survives */
+static const unsigned char glb_classify_emptyHeader[CLASSIFY_HEADER_SIZE] = { 0 };
+
+/**
+ * @brief Supportive function returning high bit of each lane which is not zero.
+ */
+static inline __u64 lanesNotZero(__u64 words) {
+  return (((words & ~CLASSIFY_LANE_HIGH) + 0x7fff * CLASSIFY_LANE_LOW) | words) & CLASSIFY_LANE_HIGH;
+}
+
+/**
+ * @brief Supportive function returning high bit of each lane greater than CLASSIFY_MAX_COUNT.
+ *
+ * Lane is greater when its high bit is set or when adding (0x7fff - CLASSIFY_MAX_COUNT)
+ * to its low 15 bits carries into high bit, carry never leaves the lane.
+ */
+static inline __u64 lanesOverMax(__u64 words) {
+  return (((words & ~CLASSIFY_LANE_HIGH) + (0x7fff - CLASSIFY_MAX_COUNT) * CLASSIFY_LANE_LOW) | words) & CLASSIFY_LANE_HIGH;
+}
+
+/**
+ * @brief Supportive function loading header of one lane. Flags and answer count
+ * are placed into its lane of flags and answers, all four section counts are
+ * read by single load and checked against CLASSIFY_MAX_COUNT at once, result
+ * is placed into high bit of the lane of badCounts.
+ */
+static inline void loadLane(const unsigned char *header, unsigned int lane, __u64 *flags, __u64 *answers, __u64 *badCounts) {
+  __u64 counts;
+  memcpy(&counts, header + 4, sizeof(counts));
+  counts = be64toh(counts);   // question, answer, authority, additional from high lane
+  __u64 over = lanesOverMax(counts);
+  over |= over >> 32;
+  over |= over >> 16;
+  *flags |= (__u64)(header[2] << 8 | header[3]) << (lane * 16);
+  *answers |= ((counts >> 32) & 0xffff) << (lane * 16);
+  *badCounts |= (over & 0x8000) << (lane * 16);
+}
+
+/**
+ * @brief Supportive function spreading high bit of each lane over whole lane.
+ */
+static inline __u64 fillLanes(__u64 highBits) {
+  return (highBits >> 15) * 0xffff;
+}
+
+/**
+ * @brief Supportive function evaluating header predicates of four headers
+ * (fields of header i in 16 bit lane i of words) without branches in the
+ * same order of precedence as DNSResponse::parse.
+ *
+ * @param codes  filled with EDnsParseError of each lane
+ * @return __u64 high bit of each lane which has to be parsed (DNS_PARSE_OK)
+ */
+static inline __u64 classifyLanes(const unsigned char *const *lanes, __u64 *codes) {
+  __u64 flags = 0;
+  __u64 answers = 0;
+  __u64 isBadCounts = 0;
+  loadLane(lanes[0], 0, &flags, &answers, &isBadCounts);
+  loadLane(lanes[1], 1, &flags, &answers, &isBadCounts);
+  loadLane(lanes[2], 2, &flags, &answers, &isBadCounts);
+  loadLane(lanes[3], 3, &flags, &answers, &isBadCounts);
+  __u64 isBadFlags = lanesNotZero(flags & 0x007f * CLASSIFY_LANE_LOW);
+  __u64 isNotResponse = ~flags & CLASSIFY_LANE_HIGH;
+  __u64 isNoAnswers = ~lanesNotZero(answers) & CLASSIFY_LANE_HIGH;
+  // first failed check wins
+  isNotResponse &= ~isBadFlags;
+  isBadCounts &= ~(isBadFlags | isNotResponse);
+  isNoAnswers &= ~(isBadFlags | isNotResponse | isBadCounts);
+  *codes = (fillLanes(isBadFlags) & DNS_PARSE_BAD_FLAGS * CLASSIFY_LANE_LOW) |
+           (fillLanes(isNotResponse) & DNS_PARSE_NOT_RESPONSE * CLASSIFY_LANE_LOW) |
+           (fillLanes(isBadCounts) & DNS_PARSE_BAD_COUNTS * CLASSIFY_LANE_LOW) |
+           (fillLanes(isNoAnswers) & DNS_PARSE_NO_ANSWERS * CLASSIFY_LANE_LOW);
+  return ~(isBadFlags | isNotResponse | isBadCounts | isNoAnswers) & CLASSIFY_LANE_HIGH;
+}
+
+namespace classify {
+  /* headerScalar */
+  EDnsParseError headerScalar(const unsigned char *header) {
+    __u16 raw[6];
+    memcpy(raw, header, sizeof(raw));
+    unsigned int flags = ntohs(raw[1]);
+    if ((flags & 0x7f) != 0)
+      return DNS_PARSE_BAD_FLAGS;
+    if ((flags & 0x8000) == 0)
+      return DNS_PARSE_NOT_RESPONSE;
+    for (int i = 2; i < 6; ++i)
+      if (ntohs(raw[i]) > CLASSIFY_MAX_COUNT)
+        return DNS_PARSE_BAD_COUNTS;
+    if (ntohs(raw[3]) < 1)
+      return DNS_PARSE_NO_ANSWERS;
+    return DNS_PARSE_OK;
+  }
+
+  /* headerBatch */
+  unsigned int headerBatch(const unsigned char *const *headers, unsigned int count, EDnsParseError *results) {
+    unsigned int survivors = 0;
+    for (unsigned int begin = 0; begin < count; begin += CLASSIFY_LANES) {
+      unsigned int size = count - begin < CLASSIFY_LANES ? count - begin : CLASSIFY_LANES;
+      const unsigned char *const *lanes = headers + begin;
+      const unsigned char *padded[CLASSIFY_LANES];
+      if (size < CLASSIFY_LANES) {
+        for (unsigned int lane = 0; lane < CLASSIFY_LANES; ++lane)
+          padded[lane] = lane < size ? lanes[lane] : glb_classify_emptyHeader;
+        lanes = padded;
+      }
+      __u64 codes;
+      // high bits of surviving lanes are summed into top lane by multiplication
+      survivors += ((classifyLanes(lanes, &codes) >> 15) * CLASSIFY_LANE_LOW) >> 48;
+      results[begin] = (EDnsParseError)(codes & 0xffff);
+      if (size == CLASSIFY_LANES) {
+        results[begin + 1] = (EDnsParseError)((codes >> 16) & 0xffff);
+        results[begin + 2] = (EDnsParseError)((codes >> 32) & 0xffff);
+        results[begin + 3] = (EDnsParseError)(codes >> 48);
+      } else {
+        for (unsigned int lane = 1; lane < size; ++lane)
+          results[begin + lane] = (EDnsParseError)((codes >> (lane * 16)) & 0xffff);
+      }
+    }
+    return survivors;
+  }
+
+  /* locateUdpMessage */
+  const unsigned char *locateUdpMessage(const unsigned char *packet, unsigned int caplen, __u16 *etherType) {
+    if (caplen < CLASSIFY_SIZE_ETHERNET)
+      return nullptr;
+    const struct ether_header *eptr = (const struct ether_header *)packet;
+    const unsigned char *endOfPacket = packet + caplen;
+    const unsigned char *payload;
+    const unsigned char *endOfPayload;
+    *etherType = ntohs(eptr->ether_type);
+
+    if (*etherType == ETHERTYPE_IP) {
+      if (caplen < CLASSIFY_SIZE_ETHERNET + sizeof(struct ip))
+        return nullptr;
+      const struct ip *my_ip = (const struct ip *)(packet + CLASSIFY_SIZE_ETHERNET);
+      unsigned int size_ip = my_ip->ip_hl * 4;
+      payload = packet + CLASSIFY_SIZE_ETHERNET + size_ip;
+      endOfPayload = packet + CLASSIFY_SIZE_ETHERNET + ntohs(my_ip->ip_len);
+      if (size_ip < sizeof(struct ip) || endOfPayload < payload)
+        return nullptr;
+      if (my_ip->ip_p != IPPROTO_UDP || (ntohs(my_ip->ip_off) & (IP_MF | IP_OFFMASK)) != 0)
+        return nullptr;
+    } else if (*etherType == ETHERTYPE_IPV6) {
+      if (caplen < CLASSIFY_SIZE_ETHERNET + sizeof(struct ip6_hdr))
+        return nullptr;
+      const struct ip6_hdr *my_ip6 = (const struct ip6_hdr *)(packet + CLASSIFY_SIZE_ETHERNET);
+      if (my_ip6->ip6_nxt != IPPROTO_UDP)
+        return nullptr;
+      payload = packet + CLASSIFY_SIZE_ETHERNET + sizeof(struct ip6_hdr);
+      endOfPayload = payload + ntohs(my_ip6->ip6_plen);
+    } else {
+      return nullptr;
+    }
+
+    if (endOfPayload > endOfPacket)
+      endOfPayload = endOfPacket;
+    if (endOfPayload < payload || (unsigned int)(endOfPayload - payload) < sizeof(struct udphdr) + CLASSIFY_HEADER_SIZE)
+      return nullptr;
+    return payload + sizeof(struct udphdr);
+  }
+}
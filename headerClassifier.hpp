@@ -0,0 +1,64 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    headerClassifier.hpp
+ * @brief   Batch pre-classification of DNS headers, rejecting packets which
+ *          DNSResponse::parse would reject by its header checks.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+
+#define CLASSIFY_BATCH_SIZE     16    // queued packets classified together by pipeline parser
+#define CLASSIFY_MAX_COUNT      100   // larger section counts are rejected (same as DNSResponse::parse)
+#define CLASSIFY_HEADER_SIZE    12    // size of DNS header
+
+/*
+ * Most packets passing capture filter are rejected by first checks of
+ * DNSResponse::parse (not a response, error code, no answers, absurd counts).
+ * Those checks need only 12 bytes of header, so they are evaluated for whole
+ * batch of packets before any of them is decoded. Survivors (DNS_PARSE_OK)
+ * need full decode and parse, rejected packets skip both, which is where
+ * the gain comes from. Fields of four headers are packed into 16 bit lanes
+ * of 64 bit words, so each predicate is evaluated for four headers at once
+ * without branches (SWAR).
+ */
+
+namespace classify {
+  /**
+   * @brief Classifies one DNS header, reference for headerBatch.
+   *
+   * @param header  pointer to first byte of DNS message, at least CLASSIFY_HEADER_SIZE bytes
+   * @return EDnsParseError  error DNSResponse::parse would report by its header checks,
+   *                         DNS_PARSE_OK when message has to be parsed
+   */
+  EDnsParseError headerScalar(const unsigned char *header);
+
+  /**
+   * @brief Classifies headers of batch of DNS messages, same results as headerScalar.
+   *
+   * @param headers  pointers to first bytes of DNS messages, at least CLASSIFY_HEADER_SIZE bytes each
+   * @param count    number of messages, any count is accepted
+   * @param results  filled with result of each message
+   * @return unsigned int  number of messages which have to be parsed (DNS_PARSE_OK)
+   */
+  unsigned int headerBatch(const unsigned char *const *headers, unsigned int count, EDnsParseError *results);
+
+  /**
+   * @brief Finds DNS message in Ethernet frame carrying unfragmented IPv4 or
+   *        IPv6 (without extension headers) UDP datagram.
+   *
+   * @param packet     captured frame
+   * @param caplen     captured length of frame
+   * @param etherType  filled with Ethernet type of frame (host byte order)
+   * @return const unsigned char*  DNS message with at least CLASSIFY_HEADER_SIZE bytes
+   *                               or nullptr when frame is not such simple case
+   */
+  const unsigned char *locateUdpMessage(const unsigned char *packet, unsigned int caplen, __u16 *etherType);
+}
@@ -17,6 +17,14 @@
 
 #include "utils.hpp"
 #include "pcapProcessor.hpp"
+#include "StatisticSnapshot.hpp"
+#include "StatisticExporter.hpp"
+#include "metrics.hpp"
+#include "PacketPipeline.hpp"
+#include "numaPlacement.hpp"
+#include "DomainFilter.hpp"
+#include "ClientTracker.hpp"
+#include "allocators.hpp"
 
 using namespace std;
 using namespace utils;
@@ -47,14 +55,19 @@ ProgramOptions parseOptions(int argc, char * const argv[]) {
   }
 
   ProgramOptions resultOptions = {
-    false, false, false,
-    "", "", "", DEFAULT_STATISTIC_TIME
+    false, false, false, false, false, false, false, false, false, false,
+    "", {}, "", "", "", "text", "", "", "", "", "", DEFAULT_STATISTIC_TIME, 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, PLACEMENT_NODE_NONE
   };
 
   int opt = 0;
-  while ((opt = getopt(argc, argv, "r:i:s:t:")) != -1) {
+  while ((opt = getopt(argc, argv, "r:i:s:t:x:w:FS:e:o:R:m:P:Q:A:N:k:K:d:z:Dc:T:M:HU")) != -1) {
     switch (opt) {
-      case 'r': resultOptions.isPcapFile = true;           resultOptions.pcapFileName        = optarg; break;
+      case 'r':
+        if (!resultOptions.isPcapFile)
+          resultOptions.pcapFileName = optarg;
+        resultOptions.isPcapFile = true;
+        resultOptions.pcapFileNames.push_back(optarg);
+        break;
       case 'i': resultOptions.isInterface = true;          resultOptions.interface           = optarg; break;
       case 's': resultOptions.isSyslogserveAddress = true; resultOptions.syslogServerAddress = optarg; break;
       case 't': { // brackets because long value after case label
@@ -63,14 +76,131 @@ ProgramOptions parseOptions(int argc, char * const argv[]) {
           raiseErrorStreamHelp("For paramter -t \"" << optarg << "\" is not a valid whole positive number\n");
         resultOptions.sendTimeIntervalSec = value;
       } break;
+      case 'x': { // replay speed multiplier, "max" or 0 for as fast as possible
+        char *end = nullptr;
+        double value = (string(optarg) == "max") ? 0 : strtod(optarg, &end);
+        if (value < 0 || (end != nullptr && *end != 0))
+          raiseErrorStreamHelp("For paramter -x \"" << optarg << "\" is not a valid speed (positive number or \"max\")\n");
+        resultOptions.isReplay = true;
+        resultOptions.replaySpeed = value;
+      } break;
+      case 'w': {
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0)
+          raiseErrorStreamHelp("For paramter -w \"" << optarg << "\" is not a valid whole positive number\n");
+        resultOptions.workerCount = value;
+      } break;
+      case 'F': resultOptions.isFollow = true; break;
+      case 'S': resultOptions.isSnapshot = true;           resultOptions.snapshotFileName    = optarg; break;
+      case 'e': resultOptions.exportFormat = optarg; break;
+      case 'o': resultOptions.exportPath   = optarg; break;
+      case 'R': resultOptions.ringName     = optarg; break;
+      case 'm': resultOptions.metricsAddress = optarg; break;
+      case 'k': resultOptions.sampling     = optarg; break;
+      case 'd': resultOptions.domainFilterFileName = optarg; break;
+      case 'D': resultOptions.isDistinct = true; break;
+      case 'H': resultOptions.isHugePages = true; break;
+      case 'U': resultOptions.isAsyncOutput = true; break;
+      case 'c': { // number of tracked top clients
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0 || value > CLIENT_MAX_TRACKED)
+          raiseErrorStreamHelp("For paramter -c \"" << optarg << "\" is not a valid number of clients (1 - " << CLIENT_MAX_TRACKED << ")\n");
+        resultOptions.clientCount = value;
+      } break;
+      case 'T': { // minimal lifetime of records in seconds
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0)
+          raiseErrorStreamHelp("For paramter -T \"" << optarg << "\" is not a valid number of seconds\n");
+        resultOptions.expiryFloor = value;
+      } break;
+      case 'M': { // memory cap of records in MiB
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0)
+          raiseErrorStreamHelp("For paramter -M \"" << optarg << "\" is not a valid memory size in MiB\n");
+        resultOptions.memoryCapMb = value;
+      } break;
+      case 'z': { // rollup depth, 1 means registrable domain (eTLD+1)
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0 || value > 16)
+          raiseErrorStreamHelp("For paramter -z \"" << optarg << "\" is not a valid zone depth (1 - 16)\n");
+        resultOptions.rollupDepth = value;
+      } break;
+      case 'K': {
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0)
+          raiseErrorStreamHelp("For paramter -K \"" << optarg << "\" is not a valid whole positive number\n");
+        resultOptions.samplingMaxRate = value;
+      } break;
+      case 'P': { // number of parser threads of pipeline, 0 is valid
+        char *end = nullptr;
+        long value = strtol(optarg, &end, 10);
+        if (value < 0 || value > PIPELINE_MAX_PARSERS || *end != 0)
+          raiseErrorStreamHelp("For paramter -P \"" << optarg << "\" is not a valid number of parsers (0 - " << PIPELINE_MAX_PARSERS << ")\n");
+        resultOptions.isPipeline = true;
+        resultOptions.parserCount = value;
+      } break;
+      case 'Q': {
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0)
+          raiseErrorStreamHelp("For paramter -Q \"" << optarg << "\" is not a valid whole positive number\n");
+        resultOptions.queueDepth = value;
+      } break;
+      case 'A': { // comma separated cores, "-" leaves thread unpinned
+        stringstream cpus(optarg);
+        string cpu;
+        while (getline(cpus, cpu, ',')) {
+          char *end = nullptr;
+          long value = (cpu == "-") ? -1 : strtol(cpu.c_str(), &end, 10);
+          if (cpu.empty() || value < -1 || (end != nullptr && *end != 0))
+            raiseErrorStreamHelp("For paramter -A \"" << optarg << "\" is not a valid comma separated list of cores\n");
+          resultOptions.cpuList.push_back(value);
+        }
+      } break;
+      case 'N': { // NUMA node or "auto" for node of capture interface
+        char *end = nullptr;
+        long value = (string(optarg) == "auto") ? PLACEMENT_NODE_AUTO : strtol(optarg, &end, 10);
+        if (value < PLACEMENT_NODE_AUTO || value == PLACEMENT_NODE_NONE || (end != nullptr && *end != 0))
+          raiseErrorStreamHelp("For paramter -N \"" << optarg << "\" is not a valid NUMA node (number or \"auto\")\n");
+        resultOptions.numaNode = value;
+      } break;
       default:
         raiseError(nullptr, true);
     }
   }
 
+  // remaining arguments are additional pcap files (e.g. expanded by shell from glob after -r)
+  for (int i = optind; i < argc; ++i) {
+    if (!resultOptions.isPcapFile)
+      raiseErrorStreamHelp("Unexpected argument \"" << argv[i] << "\"\n");
+    resultOptions.pcapFileNames.push_back(argv[i]);
+  }
+
   return resultOptions;
 }
 
+/**
+ * Resolves NUMA node of options, makes it preferred node of all following allocations
+ * and restricts threads to its cores unless cores are given by -A.
+ * Returns node or PLACEMENT_NODE_NONE when node is unknown.
+ */
+int placeOnNumaNode(const ProgramOptions &options) {
+  int node = options.numaNode;
+  if (node == PLACEMENT_NODE_AUTO) {
+    node = placement::interfaceNode(options.interface);
+    if (node < 0) {
+      placement::report("NUMA node of interface " + options.interface + " is unknown, threads and memory are not placed");
+      return PLACEMENT_NODE_NONE;
+    }
+    placement::report("interface " + options.interface + " is local to node " + to_string(node));
+  }
+  if (!placement::preferNode(node))
+    return PLACEMENT_NODE_NONE;
+  // threads created later inherit affinity of main thread
+  if (options.cpuList.empty())
+    placement::pinThreadToNode(pthread_self(), node, "main");
+  return node;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, char * const argv[]) {
@@ -78,32 +208,131 @@ int main(int argc, char * const argv[]) {
   DWRITE(endl <<
     "Option values:" << endl <<
     "  Pcap file:             " << progOptions.pcapFileName        << endl <<
+    "  Pcap paths count:      " << progOptions.pcapFileNames.size() << endl <<
+    "  Worker threads:        " << progOptions.workerCount         << endl <<
     "  Interface:             " << progOptions.interface           << endl <<
     "  Syslog server address: " << progOptions.syslogServerAddress << endl <<
-    "  Send interval seconds: " << progOptions.sendTimeIntervalSec << endl
+    "  Send interval seconds: " << progOptions.sendTimeIntervalSec << endl <<
+    "  Replay speed:          " << progOptions.replaySpeed         << endl <<
+    "  Follow files:          " << progOptions.isFollow            << endl <<
+    "  Snapshot file:         " << progOptions.snapshotFileName    << endl <<
+    "  Export format:         " << progOptions.exportFormat        << endl <<
+    "  Export output:         " << progOptions.exportPath          << endl <<
+    "  Answer ring:           " << progOptions.ringName            << endl <<
+    "  Metrics endpoint:      " << progOptions.metricsAddress      << endl <<
+    "  Sampling:              " << progOptions.sampling            << endl <<
+    "  Sampling max rate:     " << progOptions.samplingMaxRate     << endl <<
+    "  Domain filter:         " << progOptions.domainFilterFileName << endl <<
+    "  Rollup depth:          " << progOptions.rollupDepth         << endl <<
+    "  Distinct counting:     " << progOptions.isDistinct          << endl <<
+    "  Tracked clients:       " << progOptions.clientCount         << endl <<
+    "  Expiry floor:          " << progOptions.expiryFloor         << endl <<
+    "  Memory cap MiB:        " << progOptions.memoryCapMb         << endl <<
+    "  Huge pages:            " << progOptions.isHugePages         << endl <<
+    "  Async output:          " << progOptions.isAsyncOutput       << endl <<
+    "  Pipeline parsers:      " << (progOptions.isPipeline ? to_string(progOptions.parserCount) : "off") << endl <<
+    "  Pipeline queue depth:  " << progOptions.queueDepth          << endl <<
+    "  Pinned cores:          " << progOptions.cpuList.size()      << endl <<
+    "  NUMA node:             " << progOptions.numaNode            << endl
   );
 
   // file and interface are mutual exclusive
   if (progOptions.isPcapFile && progOptions.isInterface)
     raiseError("Parameters -r and -i are mutual exclusive.", true);
+  if (progOptions.isReplay && !progOptions.isPcapFile)
+    raiseError("Parameter -x can be used only with -r.", true);
+  if (progOptions.isReplay && progOptions.pcapFileNames.size() > 1)
+    raiseError("Parameter -x replays only one file given by -r.", true);
+  if (progOptions.isFollow && (!progOptions.isPcapFile || progOptions.isReplay))
+    raiseError("Parameter -F can be used only with -r and not with -x.", true);
+  if ((progOptions.isPipeline || progOptions.queueDepth > 0) && !progOptions.isInterface && !progOptions.isReplay)
+    raiseError("Parameters -P and -Q can be used only with -i or -x.", true);
+  if (progOptions.queueDepth > 0 && !progOptions.isPipeline)
+    raiseError("Parameter -Q requires pipeline enabled by -P.", true);
+  if (!progOptions.cpuList.empty() && progOptions.isFollow)
+    raiseError("Parameter -A cannot be used with -F.", true);
+  if (!progOptions.sampling.empty() && !progOptions.isInterface && !progOptions.isReplay)
+    raiseError("Parameter -k can be used only with -i or -x.", true);
+  if (progOptions.samplingMaxRate > 0 && progOptions.sampling.empty())
+    raiseError("Parameter -K requires sampling enabled by -k.", true);
+  if (progOptions.numaNode == PLACEMENT_NODE_AUTO && !progOptions.isInterface)
+    raiseError("Parameter -N auto can be used only with -i.", true);
+
+  // SIGHUP has to be blocked before any thread is created, only reloading thread receives it
+  if (!progOptions.domainFilterFileName.empty() && !DomainFilter::install(progOptions.domainFilterFileName))
+    raiseError();
+
+  // memory policy has to be set before statistics, capture buffers and threads are created
+  if (progOptions.numaNode != PLACEMENT_NODE_NONE || !progOptions.cpuList.empty())
+    placement::enableReport();
+  if (progOptions.numaNode != PLACEMENT_NODE_NONE)
+    progOptions.numaNode = placeOnNumaNode(progOptions);
+
+  // large tables allocated from now on are backed by huge pages
+  if (progOptions.isHugePages)
+    allocators::enableHugePages();
 
   shared_ptr<DNSStatistic> statistic = make_shared<DNSStatistic>();
+  configureStatistic(progOptions, *statistic);
 
   if (progOptions.isSyslogserveAddress) {
     if (!statistic->initSyslogServer(progOptions.syslogServerAddress))
       raiseError();
   }
 
-  if (progOptions.isPcapFile) {
-    if (!processPcapFile(progOptions, statistic))
+  // sink used whenever statistics are not sent to syslog server
+  shared_ptr<StatisticExporter> exporter = createStatisticExporter(progOptions.exportFormat, progOptions.exportPath);
+  if (exporter == nullptr)
+    raiseError();
+  statistic->setExporter(exporter);
+
+  // slow syslog collector or disk shows up as queue depth instead of blocking capture
+  if (progOptions.isAsyncOutput) {
+    statistic->enableAsyncSyslog();
+    if (!progOptions.exportPath.empty())
+      exporter->enableAsyncOutput();
+  }
+
+  if (!progOptions.ringName.empty() && !initAnswerRing(progOptions.ringName))
+    raiseError();
+
+  if (!progOptions.metricsAddress.empty() && !metrics::startServer(progOptions.metricsAddress))
+    raiseError();
+
+  // resume statistics of previous run
+  if (progOptions.isSnapshot && access(progOptions.snapshotFileName.c_str(), F_OK) == 0) {
+    if (!loadSnapshot(progOptions.snapshotFileName, *statistic))
+      cerr << "Warning: snapshot cannot be loaded, starting with empty statistics." << endl;
+    DWRITE("Statistics resumed from snapshot, records: " << statistic->getStatistics().size());
+  }
+  if (progOptions.numaNode >= 0 && !statistic->getRecordTable().empty()) {
+    const StatRecordVector &records = statistic->getRecordTable();
+    placement::bindMemory(records.data(), records.size() * sizeof(SDnsStatRecord), progOptions.numaNode, "statistics table");
+  }
+
+  if (progOptions.isPcapFile && progOptions.isFollow) {
+    // tail files written by other process, exports are done periodically as in live mode
+    if (!followPcapFiles(progOptions, statistic))
+      raiseError();
+  }
+  else if (progOptions.isPcapFile && progOptions.isReplay) {
+    // replay through live analysis on virtual clock, exports are done during replay
+    if (!beginLiveDnsAnalysis(progOptions, statistic))
+      raiseError();
+  }
+  else if (progOptions.isPcapFile) {
+    if (!processPcapFiles(progOptions, statistic))
+      raiseError();
+
+    if (progOptions.isSnapshot && !writeSnapshot(progOptions.snapshotFileName, *statistic))
       raiseError();
 
     if (progOptions.isSyslogserveAddress) {
       if (!statistic->sendToSyslog()) {
         raiseError();
       }
-    } else
-      statistic->printStatistics();
+    } else if (!statistic->printStatistics())
+      raiseError();
   }
   else if (progOptions.isInterface) {
     // start capturing
@@ -0,0 +1,556 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    metrics.cpp
+ * \brief   Health counters of ingest and export served in Prometheus text
+ *          format by embedded HTTP endpoint.
+ *          Implementation of metrics.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+
+#include "utils.hpp"
+#include "metrics.hpp"
+
+#define METRICS_EXPORT_BUCKET_COUNT   9     // buckets of export duration histogram without +Inf
+#define METRICS_MAX_CLIENTS           16    // connections served at once, others wait in listen queue
+#define METRICS_MAX_REQUEST_SIZE      8192  // longer requests are refused
+#define METRICS_CLIENT_TIMEOUT_SEC    5     // connections idle longer are closed
+#define METRICS_POLL_TIMEOUT_MS       1000  // how often idle connections are checked
+
+using namespace std;
+
+/**
+ * Counters of one thread. Only owning thread writes to them, so relaxed
+ * load and store is enough and no lock is taken on packet path. Scraping
+ * thread reads them only.
+ */
+struct SMetricsThreadCounters {
+  atomic<__u64> packets;
+  atomic<__u64> etherTypes[METRICS_ETHER_COUNT];
+  atomic<__u64> protocols[METRICS_PROTOCOL_COUNT];
+  atomic<__u64> parseResults[DNS_PARSE_ERROR_COUNT];
+  atomic<__u64> answers;
+  atomic<__u64> evictions[METRICS_EVICT_COUNT];
+  atomic<__u64> exportCount[METRICS_EXPORT_COUNT];
+  atomic<__u64> exportFailures[METRICS_EXPORT_COUNT];
+  atomic<__u64> exportFailedSends[METRICS_EXPORT_COUNT];
+  atomic<__u64> exportTotalNs[METRICS_EXPORT_COUNT];
+  atomic<__u64> exportBuckets[METRICS_EXPORT_COUNT][METRICS_EXPORT_BUCKET_COUNT];
+};
+
+/**
+ * One connection of HTTP endpoint.
+ */
+struct SMetricsClient {
+  int fd;
+  string request;
+  string response;
+  size_t sent;        // bytes of response already sent
+  time_t lastActive;  // monotonic seconds of last read or write
+};
+
+static const char *glb_metrics_etherTypeNames[METRICS_ETHER_COUNT] = { "ipv4", "ipv6", "other" };
+static const char *glb_metrics_protocolNames[METRICS_PROTOCOL_COUNT] = { "udp", "tcp", "other" };
+static const char *glb_metrics_exportNames[METRICS_EXPORT_COUNT] = { "syslog", "exporter" };
+static const char *glb_metrics_evictionNames[METRICS_EVICT_COUNT] = { "expired", "memory" };
+
+static const char *glb_metrics_parseErrorNames[DNS_PARSE_ERROR_COUNT] = {
+  "ok", "null", "bad_flags", "not_response", "bad_counts", "no_answers", "filtered", "bad_answer"
+};
+
+/* upper bounds of export duration buckets */
+static const __u64 glb_metrics_exportBucketNs[METRICS_EXPORT_BUCKET_COUNT] = {
+  1000000ull, 5000000ull, 10000000ull, 50000000ull, 100000000ull,
+  500000000ull, 1000000000ull, 5000000000ull, 10000000000ull
+};
+static const char *glb_metrics_exportBucketNames[METRICS_EXPORT_BUCKET_COUNT] = {
+  "0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1", "5", "10"
+};
+
+/* counters of all threads which ever counted anything, never freed */
+static mutex glb_metrics_registryMutex;
+static vector<SMetricsThreadCounters *> glb_metrics_registry;
+
+static thread_local SMetricsThreadCounters *tl_metrics_counters = nullptr;
+
+/* additional metrics of other modules, removed collectors are empty */
+static mutex glb_metrics_collectorsMutex;
+static vector<function<void(string &)>> glb_metrics_collectors;
+
+/* gauges published by thread owning measured object */
+static atomic<__u64> glb_metrics_statRecords(0);
+static atomic<__u64> glb_metrics_statBytes(0);
+static atomic<bool>  glb_metrics_isPcapStats(false);
+static atomic<__u64> glb_metrics_pcapReceived(0);
+static atomic<__u64> glb_metrics_pcapDropped(0);
+static atomic<__u64> glb_metrics_pcapIfDropped(0);
+static atomic<bool>  glb_metrics_isExportQueue(false);
+static atomic<__u64> glb_metrics_exportInFlight[METRICS_EXPORT_COUNT];
+static atomic<__u64> glb_metrics_exportStalls[METRICS_EXPORT_COUNT];
+
+/**
+ * @brief Returns counters of calling thread, registers them on first use.
+ */
+static SMetricsThreadCounters *getThreadCounters() {
+  if (tl_metrics_counters == nullptr) {
+    tl_metrics_counters = new SMetricsThreadCounters();
+    lock_guard<mutex> lock(glb_metrics_registryMutex);
+    glb_metrics_registry.push_back(tl_metrics_counters);
+  }
+  return tl_metrics_counters;
+}
+
+/**
+ * @brief Increments counter owned by calling thread without locked instruction.
+ */
+static inline void add(atomic<__u64> &counter, __u64 value) {
+  counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/* now */
+__u64 metrics::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (__u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* countPacket */
+void metrics::countPacket() {
+  add(getThreadCounters()->packets, 1);
+}
+
+/* countEtherType */
+void metrics::countEtherType(__u16 etherType) {
+  EMetricsEtherType index = METRICS_ETHER_OTHER;
+  if (etherType == ETHERTYPE_IP)
+    index = METRICS_ETHER_IPV4;
+  else if (etherType == ETHERTYPE_IPV6)
+    index = METRICS_ETHER_IPV6;
+  add(getThreadCounters()->etherTypes[index], 1);
+}
+
+/* countProtocol */
+void metrics::countProtocol(__u8 protocol) {
+  EMetricsProtocol index = METRICS_PROTOCOL_OTHER;
+  if (protocol == IPPROTO_UDP)
+    index = METRICS_PROTOCOL_UDP;
+  else if (protocol == IPPROTO_TCP)
+    index = METRICS_PROTOCOL_TCP;
+  add(getThreadCounters()->protocols[index], 1);
+}
+
+/* countParseResult */
+void metrics::countParseResult(EDnsParseError error, unsigned int answers) {
+  SMetricsThreadCounters *counters = getThreadCounters();
+  add(counters->parseResults[error], 1);
+  add(counters->answers, answers);
+}
+
+/* recordExport */
+void metrics::recordExport(EMetricsExport way, __u64 durationNs, unsigned int failedSends, bool isOk) {
+  SMetricsThreadCounters *counters = getThreadCounters();
+  add(counters->exportCount[way], 1);
+  add(counters->exportTotalNs[way], durationNs);
+  add(counters->exportFailedSends[way], failedSends);
+  if (!isOk)
+    add(counters->exportFailures[way], 1);
+  for (unsigned int b = 0; b < METRICS_EXPORT_BUCKET_COUNT; ++b) {
+    if (durationNs <= glb_metrics_exportBucketNs[b]) {
+      add(counters->exportBuckets[way][b], 1);
+      break;
+    }
+  }
+}
+
+/* setStatisticsSize */
+void metrics::setStatisticsSize(__u64 records, __u64 bytes) {
+  glb_metrics_statRecords.store(records, memory_order_relaxed);
+  glb_metrics_statBytes.store(bytes, memory_order_relaxed);
+}
+
+/* setExportQueue */
+void metrics::setExportQueue(EMetricsExport way, __u64 inFlight, __u64 stalls) {
+  glb_metrics_exportInFlight[way].store(inFlight, memory_order_relaxed);
+  glb_metrics_exportStalls[way].store(stalls, memory_order_relaxed);
+  glb_metrics_isExportQueue.store(true, memory_order_relaxed);
+}
+
+/* countEviction */
+void metrics::countEviction(EMetricsEviction reason) {
+  add(getThreadCounters()->evictions[reason], 1);
+}
+
+/* setPcapStats */
+void metrics::setPcapStats(__u64 received, __u64 dropped, __u64 interfaceDropped) {
+  glb_metrics_pcapReceived.store(received, memory_order_relaxed);
+  glb_metrics_pcapDropped.store(dropped, memory_order_relaxed);
+  glb_metrics_pcapIfDropped.store(interfaceDropped, memory_order_relaxed);
+  glb_metrics_isPcapStats.store(true, memory_order_relaxed);
+}
+
+/* appendHeader */
+void metrics::appendHeader(string &out, const char *name, const char *type, const char *help) {
+  out += "# HELP "; out += name; out += ' '; out += help; out += '\n';
+  out += "# TYPE "; out += name; out += ' '; out += type; out += '\n';
+}
+
+/* appendSample */
+void metrics::appendSample(string &out, const char *name, const char *labelName, const char *labelValue, __u64 value) {
+  out += name;
+  if (labelName != nullptr) {
+    out += '{'; out += labelName; out += "=\""; out += labelValue; out += "\"}";
+  }
+  out += ' ';
+  out += to_string(value);
+  out += '\n';
+}
+
+/**
+ * @brief Appends all metrics aggregated over all threads.
+ *
+ * (See metrics.hpp for more info.)
+ */
+void metrics::writeMetrics(string &out) {
+  __u64 packets = 0;
+  __u64 answers = 0;
+  __u64 etherTypes[METRICS_ETHER_COUNT] = {};
+  __u64 protocols[METRICS_PROTOCOL_COUNT] = {};
+  __u64 parseResults[DNS_PARSE_ERROR_COUNT] = {};
+  __u64 evictions[METRICS_EVICT_COUNT] = {};
+  __u64 exportCount[METRICS_EXPORT_COUNT] = {};
+  __u64 exportFailures[METRICS_EXPORT_COUNT] = {};
+  __u64 exportFailedSends[METRICS_EXPORT_COUNT] = {};
+  __u64 exportTotalNs[METRICS_EXPORT_COUNT] = {};
+  __u64 exportBuckets[METRICS_EXPORT_COUNT][METRICS_EXPORT_BUCKET_COUNT] = {};
+
+  {
+    lock_guard<mutex> lock(glb_metrics_registryMutex);
+    for (const auto counters : glb_metrics_registry) {
+      packets += counters->packets.load(memory_order_relaxed);
+      answers += counters->answers.load(memory_order_relaxed);
+      for (unsigned int i = 0; i < METRICS_ETHER_COUNT; ++i)
+        etherTypes[i] += counters->etherTypes[i].load(memory_order_relaxed);
+      for (unsigned int i = 0; i < METRICS_PROTOCOL_COUNT; ++i)
+        protocols[i] += counters->protocols[i].load(memory_order_relaxed);
+      for (unsigned int i = 0; i < DNS_PARSE_ERROR_COUNT; ++i)
+        parseResults[i] += counters->parseResults[i].load(memory_order_relaxed);
+      for (unsigned int i = 0; i < METRICS_EVICT_COUNT; ++i)
+        evictions[i] += counters->evictions[i].load(memory_order_relaxed);
+      for (unsigned int w = 0; w < METRICS_EXPORT_COUNT; ++w) {
+        exportCount[w] += counters->exportCount[w].load(memory_order_relaxed);
+        exportFailures[w] += counters->exportFailures[w].load(memory_order_relaxed);
+        exportFailedSends[w] += counters->exportFailedSends[w].load(memory_order_relaxed);
+        exportTotalNs[w] += counters->exportTotalNs[w].load(memory_order_relaxed);
+        for (unsigned int b = 0; b < METRICS_EXPORT_BUCKET_COUNT; ++b)
+          exportBuckets[w][b] += counters->exportBuckets[w][b].load(memory_order_relaxed);
+      }
+    }
+  }
+
+  appendHeader(out, "dns_export_packets_total", "counter", "Packets passed to processing.");
+  appendSample(out, "dns_export_packets_total", nullptr, nullptr, packets);
+
+  appendHeader(out, "dns_export_ether_type_packets_total", "counter", "Packets by Ethernet type.");
+  for (unsigned int i = 0; i < METRICS_ETHER_COUNT; ++i)
+    appendSample(out, "dns_export_ether_type_packets_total", "ether_type", glb_metrics_etherTypeNames[i], etherTypes[i]);
+
+  appendHeader(out, "dns_export_protocol_datagrams_total", "counter", "IP datagrams by transport protocol.");
+  for (unsigned int i = 0; i < METRICS_PROTOCOL_COUNT; ++i)
+    appendSample(out, "dns_export_protocol_datagrams_total", "protocol", glb_metrics_protocolNames[i], protocols[i]);
+
+  appendHeader(out, "dns_export_responses_parsed_total", "counter", "DNS responses parsed successfully.");
+  appendSample(out, "dns_export_responses_parsed_total", nullptr, nullptr, parseResults[DNS_PARSE_OK]);
+
+  appendHeader(out, "dns_export_parse_failures_total", "counter", "DNS messages rejected by parser by reason.");
+  for (unsigned int i = DNS_PARSE_OK + 1; i < DNS_PARSE_ERROR_COUNT; ++i)
+    appendSample(out, "dns_export_parse_failures_total", "reason", glb_metrics_parseErrorNames[i], parseResults[i]);
+
+  appendHeader(out, "dns_export_answers_total", "counter", "Answer records added to statistics.");
+  appendSample(out, "dns_export_answers_total", nullptr, nullptr, answers);
+
+  appendHeader(out, "dns_export_statistics_records", "gauge", "Records in statistics table.");
+  appendSample(out, "dns_export_statistics_records", nullptr, nullptr, glb_metrics_statRecords.load(memory_order_relaxed));
+
+  appendHeader(out, "dns_export_statistics_memory_bytes", "gauge", "Estimated memory used by statistics table.");
+  appendSample(out, "dns_export_statistics_memory_bytes", nullptr, nullptr, glb_metrics_statBytes.load(memory_order_relaxed));
+
+  appendHeader(out, "dns_export_statistics_evicted_records_total", "counter", "Records evicted from statistics table by reason.");
+  for (unsigned int i = 0; i < METRICS_EVICT_COUNT; ++i)
+    appendSample(out, "dns_export_statistics_evicted_records_total", "reason", glb_metrics_evictionNames[i], evictions[i]);
+
+  appendHeader(out, "dns_export_export_duration_seconds", "histogram", "Duration of one export of statistics.");
+  for (unsigned int w = 0; w < METRICS_EXPORT_COUNT; ++w) {
+    __u64 cumulative = 0;
+    string prefix = string("dns_export_export_duration_seconds_bucket{way=\"") + glb_metrics_exportNames[w] + "\",le=\"";
+    for (unsigned int b = 0; b < METRICS_EXPORT_BUCKET_COUNT; ++b) {
+      cumulative += exportBuckets[w][b];
+      out += prefix + glb_metrics_exportBucketNames[b] + "\"} " + to_string(cumulative) + '\n';
+    }
+    out += prefix + "+Inf\"} " + to_string(exportCount[w]) + '\n';
+    char sum[32];
+    snprintf(sum, sizeof(sum), "%.9f", exportTotalNs[w] / 1e9);
+    out += string("dns_export_export_duration_seconds_sum{way=\"") + glb_metrics_exportNames[w] + "\"} " + sum + '\n';
+    appendSample(out, "dns_export_export_duration_seconds_count", "way", glb_metrics_exportNames[w], exportCount[w]);
+  }
+
+  appendHeader(out, "dns_export_export_failures_total", "counter", "Exports of statistics which failed.");
+  for (unsigned int w = 0; w < METRICS_EXPORT_COUNT; ++w)
+    appendSample(out, "dns_export_export_failures_total", "way", glb_metrics_exportNames[w], exportFailures[w]);
+
+  appendHeader(out, "dns_export_export_failed_sends_total", "counter", "Statistic records which failed to be sent.");
+  for (unsigned int w = 0; w < METRICS_EXPORT_COUNT; ++w)
+    appendSample(out, "dns_export_export_failed_sends_total", "way", glb_metrics_exportNames[w], exportFailedSends[w]);
+
+  if (glb_metrics_isExportQueue.load(memory_order_relaxed)) {
+    appendHeader(out, "dns_export_export_in_flight_writes", "gauge", "Asynchronous writes of export not finished yet.");
+    for (unsigned int w = 0; w < METRICS_EXPORT_COUNT; ++w)
+      appendSample(out, "dns_export_export_in_flight_writes", "way", glb_metrics_exportNames[w], glb_metrics_exportInFlight[w].load(memory_order_relaxed));
+    appendHeader(out, "dns_export_export_stalls_total", "counter", "Times export waited because all asynchronous writes were in flight.");
+    for (unsigned int w = 0; w < METRICS_EXPORT_COUNT; ++w)
+      appendSample(out, "dns_export_export_stalls_total", "way", glb_metrics_exportNames[w], glb_metrics_exportStalls[w].load(memory_order_relaxed));
+  }
+
+  if (glb_metrics_isPcapStats.load(memory_order_relaxed)) {
+    appendHeader(out, "dns_export_pcap_received_total", "counter", "Packets received by capture (pcap_stats ps_recv).");
+    appendSample(out, "dns_export_pcap_received_total", nullptr, nullptr, glb_metrics_pcapReceived.load(memory_order_relaxed));
+    appendHeader(out, "dns_export_pcap_dropped_total", "counter", "Packets dropped by kernel buffer (pcap_stats ps_drop).");
+    appendSample(out, "dns_export_pcap_dropped_total", nullptr, nullptr, glb_metrics_pcapDropped.load(memory_order_relaxed));
+    appendHeader(out, "dns_export_pcap_interface_dropped_total", "counter", "Packets dropped by interface (pcap_stats ps_ifdrop).");
+    appendSample(out, "dns_export_pcap_interface_dropped_total", nullptr, nullptr, glb_metrics_pcapIfDropped.load(memory_order_relaxed));
+  }
+
+  lock_guard<mutex> lock(glb_metrics_collectorsMutex);
+  for (const auto &collector : glb_metrics_collectors) {
+    if (collector)
+      collector(out);
+  }
+}
+
+/* addCollector */
+unsigned int metrics::addCollector(function<void(string &)> collector) {
+  lock_guard<mutex> lock(glb_metrics_collectorsMutex);
+  glb_metrics_collectors.push_back(collector);
+  return glb_metrics_collectors.size() - 1;
+}
+
+/* removeCollector */
+void metrics::removeCollector(unsigned int id) {
+  lock_guard<mutex> lock(glb_metrics_collectorsMutex);
+  if (id < glb_metrics_collectors.size())
+    glb_metrics_collectors[id] = nullptr;
+}
+
+/**
+ * @brief Supportive function returning monotonic time in seconds.
+ */
+static time_t monotonicSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/**
+ * @brief Supportive function building whole HTTP response for complete request head.
+ */
+static string buildResponse(const string &request) {
+  size_t methodEnd = request.find(' ');
+  size_t pathEnd = methodEnd == string::npos ? string::npos : request.find_first_of(" \r\n", methodEnd + 1);
+  string status = "200 OK";
+  string body;
+  if (pathEnd == string::npos) {
+    status = "400 Bad Request";
+    body = "Bad request.\n";
+  } else if (request.compare(0, methodEnd, "GET") != 0) {
+    status = "405 Method Not Allowed";
+    body = "Only GET is supported.\n";
+  } else {
+    string path = request.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+    path = path.substr(0, path.find('?'));
+    if (path == METRICS_PATH || path == "/") {
+      body.reserve(8192);
+      metrics::writeMetrics(body);
+    } else {
+      status = "404 Not Found";
+      body = "Metrics are served on " METRICS_PATH ".\n";
+    }
+  }
+  return
+    "HTTP/1.1 " + status + "\r\n"
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+    "Content-Length: " + to_string(body.size()) + "\r\n"
+    "Connection: close\r\n"
+    "\r\n" + body;
+}
+
+/**
+ * @brief Supportive function reading available request bytes, response is
+ * prepared when request head is complete.
+ *
+ * @return false when connection should be closed.
+ */
+static bool readClient(SMetricsClient &client) {
+  char buffer[2048];
+  ssize_t received;
+  while ((received = recv(client.fd, buffer, sizeof(buffer), 0)) > 0) {
+    client.request.append(buffer, received);
+    if (client.request.size() > METRICS_MAX_REQUEST_SIZE)
+      return false;
+  }
+  if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    return false;
+  if (client.request.find("\r\n\r\n") != string::npos || client.request.find("\n\n") != string::npos)
+    client.response = buildResponse(client.request);
+  return true;
+}
+
+/**
+ * @brief Supportive function sending as much of response as socket accepts.
+ *
+ * @return false when connection should be closed (response was sent or sending failed).
+ */
+static bool writeClient(SMetricsClient &client) {
+  while (client.sent < client.response.size()) {
+    ssize_t sent = send(client.fd, client.response.data() + client.sent, client.response.size() - client.sent, MSG_NOSIGNAL);
+    if (sent == -1 && errno == EINTR)
+      continue;
+    if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return true;
+    if (sent <= 0)
+      return false;
+    client.sent += sent;
+  }
+  return false;
+}
+
+/**
+ * @brief Supportive function running non-blocking loop of HTTP endpoint.
+ */
+static void serverLoop(int listenFd) {
+  vector<SMetricsClient> clients;
+  vector<struct pollfd> pollFds;
+  while (true) {
+    pollFds.clear();
+    pollFds.push_back({ listenFd, (short)(clients.size() < METRICS_MAX_CLIENTS ? POLLIN : 0), 0 });
+    for (const auto &client : clients)
+      pollFds.push_back({ client.fd, (short)(client.response.empty() ? POLLIN : POLLOUT), 0 });
+
+    if (poll(pollFds.data(), pollFds.size(), METRICS_POLL_TIMEOUT_MS) == -1 && errno != EINTR) {
+      cerr << "Metrics endpoint poll failed: " << strerror(errno) << endl;
+      return;
+    }
+    time_t now = monotonicSeconds();
+
+    // serve existing clients first, pollFds[i + 1] belongs to clients[i]
+    size_t kept = 0;
+    for (size_t i = 0; i < clients.size(); ++i) {
+      SMetricsClient &client = clients[i];
+      short events = pollFds[i + 1].revents;
+      bool isOpen = true;
+      if (events & (POLLERR | POLLNVAL)) {
+        isOpen = false;
+      } else if (events & (POLLIN | POLLHUP | POLLOUT)) {
+        client.lastActive = now;
+        if (client.response.empty())
+          isOpen = readClient(client);
+        if (isOpen && !client.response.empty())
+          isOpen = writeClient(client);
+      } else if (now - client.lastActive > METRICS_CLIENT_TIMEOUT_SEC) {
+        isOpen = false;
+      }
+      if (!isOpen) {
+        close(client.fd);
+        continue;
+      }
+      if (kept != i)
+        clients[kept] = move(client);
+      ++kept;
+    }
+    clients.resize(kept);
+
+    if (pollFds[0].revents & POLLIN) {
+      int fd;
+      while (clients.size() < METRICS_MAX_CLIENTS &&
+             (fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        clients.push_back({ fd, "", "", 0, now });
+        DWRITE("Metrics client connected, clients: " << clients.size());
+      }
+    }
+  }
+}
+
+/**
+ * @brief Starts HTTP endpoint serving metrics on its own thread.
+ *
+ * (See metrics.hpp for more info.)
+ */
+bool metrics::startServer(const string &address) {
+  string host = METRICS_DEFAULT_ADDRESS;
+  string port = address;
+  size_t colon = address.rfind(':');
+  if (colon != string::npos) {
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+      host = host.substr(1, host.size() - 2);
+  }
+
+  struct addrinfo hints;
+  struct addrinfo *resultAddrs;
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  int errCode = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &resultAddrs);
+  if (errCode != 0) {
+    cerr << "Cannot resolve metrics endpoint address \"" << address << "\": " << gai_strerror(errCode) << endl;
+    return false;
+  }
+
+  int listenFd = -1;
+  for (struct addrinfo *actAddr = resultAddrs; actAddr != nullptr; actAddr = actAddr->ai_next) {
+    listenFd = socket(actAddr->ai_family, actAddr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, actAddr->ai_protocol);
+    if (listenFd == -1)
+      continue;
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listenFd, actAddr->ai_addr, actAddr->ai_addrlen) == 0 && listen(listenFd, SOMAXCONN) == 0)
+      break;
+    close(listenFd);
+    listenFd = -1;
+  }
+  if (listenFd == -1) {
+    cerr << "Cannot listen on metrics endpoint address \"" << address << "\": " << strerror(errno) << endl;
+    freeaddrinfo(resultAddrs);
+    return false;
+  }
+  freeaddrinfo(resultAddrs);
+
+  // signals driving exports have to be delivered to processing thread, not to endpoint thread
+  sigset_t allSignals, oldSignals;
+  sigfillset(&allSignals);
+  pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+  thread(serverLoop, listenFd).detach();
+  pthread_sigmask(SIG_SETMASK, &oldSignals, nullptr);
+  DWRITE("Metrics endpoint listening on " << host << ":" << port);
+  return true;
+}
@@ -0,0 +1,157 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    metrics.hpp
+ * @brief   Health counters of ingest and export served in Prometheus text
+ *          format by embedded HTTP endpoint.
+ *
+ *          Counters are always gathered, endpoint is started only when
+ *          requested by -m option. Counting functions touch only counters
+ *          owned by calling thread, so packet path never takes a lock,
+ *          counters of all threads are summed when endpoint is scraped.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <functional>
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+
+#define METRICS_DEFAULT_ADDRESS "127.0.0.1"  // address of endpoint when only port is given
+#define METRICS_PATH            "/metrics"   // path served by endpoint
+
+/**
+ * @brief Link layer protocols counted by metrics::countEtherType.
+ */
+enum EMetricsEtherType {
+  METRICS_ETHER_IPV4 = 0,   /*!< ETHERTYPE_IP */
+  METRICS_ETHER_IPV6,       /*!< ETHERTYPE_IPV6 */
+  METRICS_ETHER_OTHER,      /*!< anything else */
+  METRICS_ETHER_COUNT       /*!< number of values in this enum */
+};
+
+/**
+ * @brief Transport protocols counted by metrics::countProtocol.
+ */
+enum EMetricsProtocol {
+  METRICS_PROTOCOL_UDP = 0, /*!< IPPROTO_UDP */
+  METRICS_PROTOCOL_TCP,     /*!< IPPROTO_TCP */
+  METRICS_PROTOCOL_OTHER,   /*!< anything else */
+  METRICS_PROTOCOL_COUNT    /*!< number of values in this enum */
+};
+
+/**
+ * @brief Ways how statistics are exported.
+ */
+enum EMetricsExport {
+  METRICS_EXPORT_SYSLOG = 0,  /*!< DNSStatistic::sendToSyslog */
+  METRICS_EXPORT_EXPORTER,    /*!< DNSStatistic::printStatistics (StatisticExporter sinks) */
+  METRICS_EXPORT_COUNT        /*!< number of values in this enum */
+};
+
+/**
+ * @brief Reasons of eviction of statistic records.
+ */
+enum EMetricsEviction {
+  METRICS_EVICT_EXPIRED = 0,  /*!< record was not seen for its TTL */
+  METRICS_EVICT_MEMORY,       /*!< record was evicted to keep memory cap */
+  METRICS_EVICT_COUNT         /*!< number of values in this enum */
+};
+
+namespace metrics {
+  /** @brief Returns monotonic time in nanoseconds. */
+  __u64 now();
+
+  /** @brief Counts one packet passed to processing. */
+  void countPacket();
+
+  /** @brief Counts one packet by its Ethernet type (host byte order). */
+  void countEtherType(__u16 etherType);
+
+  /** @brief Counts one datagram by its IP protocol number. */
+  void countProtocol(__u8 protocol);
+
+  /**
+   * @brief Counts result of one DNSResponse::parse call.
+   *
+   * @param error   DNS_PARSE_OK for parsed response, reason of failure otherwise
+   * @param answers number of answers of parsed response
+   */
+  void countParseResult(EDnsParseError error, unsigned int answers);
+
+  /**
+   * @brief Records one export of statistics.
+   *
+   * @param way           how statistics were exported
+   * @param durationNs    duration of whole export
+   * @param failedSends   number of records which failed to be sent
+   * @param isOk          false when export as whole failed
+   */
+  void recordExport(EMetricsExport way, __u64 durationNs, unsigned int failedSends, bool isOk);
+
+  /**
+   * @brief Publishes size of statistics table.
+   *
+   * Table is owned by processing thread, so it publishes its size itself
+   * from time to time instead of being read by scraping thread.
+   */
+  void setStatisticsSize(__u64 records, __u64 bytes);
+
+  /**
+   * @brief Publishes state of asynchronous output of export (see AsyncWriter).
+   *
+   * @param inFlight  writes queued or submitted and not finished yet
+   * @param stalls    times export waited because all buffers were in flight
+   */
+  void setExportQueue(EMetricsExport way, __u64 inFlight, __u64 stalls);
+
+  /** @brief Counts one record evicted from statistics table. */
+  void countEviction(EMetricsEviction reason);
+
+  /**
+   * @brief Publishes libpcap counters of capture handle (see pcap_stats).
+   */
+  void setPcapStats(__u64 received, __u64 dropped, __u64 interfaceDropped);
+
+  /**
+   * @brief Appends all metrics aggregated over all threads in Prometheus
+   *        text exposition format to given string.
+   */
+  void writeMetrics(std::string &out);
+
+  /**
+   * @brief Registers function appending additional metrics to output of writeMetrics.
+   *
+   * Collector is called on endpoint thread, so it can read only data which
+   * are safe to be read from other thread (e.g. atomic counters).
+   * @return id of collector for removeCollector
+   */
+  unsigned int addCollector(std::function<void(std::string &)> collector);
+
+  /** @brief Unregisters collector, it is not called anymore after return. */
+  void removeCollector(unsigned int id);
+
+  /** @brief Appends HELP and TYPE lines of one metric. */
+  void appendHeader(std::string &out, const char *name, const char *type, const char *help);
+
+  /** @brief Appends one sample, label is omitted when labelName is nullptr. */
+  void appendSample(std::string &out, const char *name, const char *labelName, const char *labelValue, __u64 value);
+
+  /**
+   * @brief Starts HTTP endpoint serving metrics on its own thread.
+   *
+   * Endpoint answers GET requests of METRICS_PATH (and "/"), any other
+   * path gets 404. Clients are served by non-blocking loop, one slow
+   * client does not block others.
+   *
+   * @param address "port", "host:port" or "[ipv6]:port", host defaults
+   *                to METRICS_DEFAULT_ADDRESS
+   * @return false when socket cannot be bound, error is written on stderr.
+   */
+  bool startServer(const std::string &address);
+}
@@ -0,0 +1,209 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    numaPlacement.cpp
+ * \brief   Pinning of threads to cores and placement of memory on NUMA node
+ *          local to capture interface.
+ *          Implementation of numaPlacement.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <cstdlib>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "numaPlacement.hpp"
+
+#define PLACEMENT_MAX_NODES   64  // nodes supported in node masks (one unsigned long)
+
+using namespace std;
+
+static bool glb_placement_isReport = false;
+
+/**
+ * @brief Supportive function parsing kernel cpu list format (e.g. "0-3,8-11").
+ */
+static void parseCpuList(const string &list, vector<int> &cpus) {
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == string::npos)
+      end = list.size();
+    string range = list.substr(pos, end - pos);
+    size_t dash = range.find('-');
+    int first = atoi(range.c_str());
+    int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+    for (int cpu = first; cpu <= last && !range.empty(); ++cpu)
+      cpus.push_back(cpu);
+    pos = end + 1;
+  }
+}
+
+/**
+ * @brief Supportive function formatting sorted cores as ranges (e.g. "0-3,8").
+ */
+static string formatCpuList(const vector<int> &cpus) {
+  string result;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    size_t last = i;
+    while (last + 1 < cpus.size() && cpus[last + 1] == cpus[last] + 1)
+      ++last;
+    if (!result.empty())
+      result += ',';
+    result += to_string(cpus[i]);
+    if (last > i)
+      result += '-' + to_string(cpus[last]);
+    i = last;
+  }
+  return result;
+}
+
+/**
+ * @brief Supportive function returning node of core or -1 when unknown.
+ */
+static int cpuNode(int cpu) {
+  for (int node = 0; node < PLACEMENT_MAX_NODES; ++node) {
+    vector<int> cpus;
+    if (!placement::nodeCpus(node, cpus))
+      continue;
+    for (int nodeCpu : cpus) {
+      if (nodeCpu == cpu)
+        return node;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Supportive function pinning thread to set of cores.
+ */
+static bool setAffinity(pthread_t thread, const vector<int> &cpus, const string &name) {
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (int cpu : cpus)
+    CPU_SET(cpu, &cpuSet);
+  int errCode = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuSet);
+  if (errCode != 0) {
+    cerr << "Warning: cannot pin " << name << " thread to cores " << formatCpuList(cpus) << ": " << strerror(errCode) << endl;
+    return false;
+  }
+  placement::report(name + " thread: " + placement::describeThread(thread));
+  return true;
+}
+
+/* enableReport */
+void placement::enableReport() {
+  glb_placement_isReport = true;
+}
+
+/* report */
+void placement::report(const string &line) {
+  if (glb_placement_isReport)
+    cerr << "Placement: " << line << endl;
+}
+
+/* interfaceNode */
+int placement::interfaceNode(const string &interface) {
+  ifstream file("/sys/class/net/" + interface + "/device/numa_node");
+  int node = -1;
+  if (!(file >> node))
+    return -1;
+  return node; // kernel reports -1 when device is not attached to any node
+}
+
+/* nodeCpus */
+bool placement::nodeCpus(int node, vector<int> &cpus) {
+  ifstream file("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+  string list;
+  if (!getline(file, list))
+    return false;
+  cpus.clear();
+  parseCpuList(list, cpus);
+  return true;
+}
+
+/* pinThread */
+bool placement::pinThread(pthread_t thread, int cpu, const string &name) {
+  if (cpu < 0)
+    return true;
+  return setAffinity(thread, { cpu }, name);
+}
+
+/* pinThreadToNode */
+bool placement::pinThreadToNode(pthread_t thread, int node, const string &name) {
+  vector<int> cpus;
+  if (!nodeCpus(node, cpus) || cpus.empty()) {
+    cerr << "Warning: NUMA node " << node << " has no cores, " << name << " thread is not pinned." << endl;
+    return false;
+  }
+  return setAffinity(thread, cpus, name);
+}
+
+/* preferNode */
+bool placement::preferNode(int node) {
+  if (node < 0 || node >= PLACEMENT_MAX_NODES)
+    return false;
+  unsigned long nodeMask = 1ul << node;
+  if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8 + 1) != 0) {
+    cerr << "Warning: cannot set memory policy to node " << node << ": " << strerror(errno) << endl;
+    return false;
+  }
+  report("memory policy: preferred node " + to_string(node));
+  return true;
+}
+
+/* bindMemory */
+bool placement::bindMemory(const void *address, size_t size, int node, const string &name) {
+  if (address == nullptr || size == 0 || node < 0 || node >= PLACEMENT_MAX_NODES)
+    return false;
+  unsigned long pageSize = sysconf(_SC_PAGESIZE);
+  unsigned long begin = (unsigned long)address & ~(pageSize - 1);
+  unsigned long end = ((unsigned long)address + size + pageSize - 1) & ~(pageSize - 1);
+  unsigned long nodeMask = 1ul << node;
+  if (syscall(SYS_mbind, begin, end - begin, MPOL_BIND, &nodeMask, sizeof(nodeMask) * 8 + 1, MPOL_MF_MOVE) != 0) {
+    cerr << "Warning: cannot bind " << name << " to NUMA node " << node << ": " << strerror(errno) << endl;
+    return false;
+  }
+  int actNode = memoryNode(address);
+  report(name + ": " + to_string((end - begin) / 1024) + " KiB on node " + (actNode < 0 ? string("unknown") : to_string(actNode)));
+  return true;
+}
+
+/* memoryNode */
+int placement::memoryNode(const void *address) {
+  int node = -1;
+  if (address == nullptr || syscall(SYS_get_mempolicy, &node, nullptr, 0, address, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+    return -1;
+  return node;
+}
+
+/* describeThread */
+string placement::describeThread(pthread_t thread) {
+  cpu_set_t cpuSet;
+  if (pthread_getaffinity_np(thread, sizeof(cpu_set_t), &cpuSet) != 0)
+    return "unknown";
+  vector<int> cpus;
+  set<int> nodes;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpuSet)) {
+      cpus.push_back(cpu);
+      nodes.insert(cpuNode(cpu));
+    }
+  }
+  string nodeList;
+  for (int node : nodes)
+    nodeList += (nodeList.empty() ? "" : ",") + (node < 0 ? string("?") : to_string(node));
+  return string(cpus.size() == 1 ? "core " : "cores ") + formatCpuList(cpus) +
+    (nodes.size() == 1 ? " (node " : " (nodes ") + nodeList + ")";
+}
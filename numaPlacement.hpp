@@ -0,0 +1,88 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    numaPlacement.hpp
+ * @brief   Pinning of threads to cores and placement of memory on NUMA node
+ *          local to capture interface.
+ *
+ *          Memory policies are set by mbind and set_mempolicy system calls
+ *          directly, so program does not depend on libnuma. On kernels
+ *          without NUMA support functions fail gracefully with warning.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#define PLACEMENT_NODE_AUTO   -2  // node is discovered from sysfs entry of capture interface
+#define PLACEMENT_NODE_NONE   -1  // memory is not placed
+
+namespace placement {
+  /**
+   * @brief Enables placement report, each following pin or bind is reported on stderr.
+   */
+  void enableReport();
+
+  /**
+   * @brief Writes line of placement report on stderr when report is enabled.
+   */
+  void report(const std::string &line);
+
+  /**
+   * @brief Returns NUMA node of network interface from
+   *        /sys/class/net/<interface>/device/numa_node or -1 when unknown.
+   */
+  int interfaceNode(const std::string &interface);
+
+  /**
+   * @brief Returns cores of NUMA node from /sys/devices/system/node/node<N>/cpulist.
+   *
+   * @return false when node does not exist.
+   */
+  bool nodeCpus(int node, std::vector<int> &cpus);
+
+  /**
+   * @brief Pins thread to one core, negative core means no pinning.
+   *
+   * Failure is reported on stderr as warning, success to placement report.
+   * @param name  name of thread used in report
+   */
+  bool pinThread(pthread_t thread, int cpu, const std::string &name);
+
+  /**
+   * @brief Restricts thread to all cores of NUMA node.
+   */
+  bool pinThreadToNode(pthread_t thread, int node, const std::string &name);
+
+  /**
+   * @brief Sets memory policy of calling thread to prefer given node.
+   *
+   * All memory allocated (first touched) by calling thread and threads
+   * created by it later is placed on node while it has free memory.
+   */
+  bool preferNode(int node);
+
+  /**
+   * @brief Binds pages of memory range to node and moves pages already
+   *        allocated elsewhere (mbind with MPOL_MF_MOVE).
+   *
+   * Range is extended to whole pages.
+   * @param name  name of memory used in report
+   */
+  bool bindMemory(const void *address, size_t size, int node, const std::string &name);
+
+  /**
+   * @brief Returns node where page of given address is placed or -1 when unknown.
+   */
+  int memoryNode(const void *address);
+
+  /**
+   * @brief Returns human readable cores and nodes thread can run on, e.g. "cores 0-3 (node 0)".
+   */
+  std::string describeThread(pthread_t thread);
+}
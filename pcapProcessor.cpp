@@ -12,25 +12,49 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
 
 #include <string.h>
 #include <pcap/pcap.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <netinet/if_ether.h>
 #include <netinet/ether.h>
 #include <unistd.h>
+#include <glob.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
 
 #include "utils.hpp"
 #include "pcapProcessor.hpp"
 #include "DNSStatistic.hpp"
 #include "DNSResponse.hpp"
+#include "IPDefragmenter.hpp"
+#include "perfStats.hpp"
+#include "PcapFollower.hpp"
+#include "StatisticSnapshot.hpp"
+#include "ShmRing.hpp"
+#include "metrics.hpp"
+#include "PacketPipeline.hpp"
+#include "numaPlacement.hpp"
+#include "PacketSampler.hpp"
+#include "allocators.hpp"
 
 #define SIZE_ETHERNET (14)
+#define DNS_HEADER_MIN_SIZE (12)
+#define FOLLOW_WAIT_TIMEOUT_MS (1000)
+#define METRICS_PUBLISH_PACKETS (4096) // gauges are published at least after this many packets
 
 using namespace std;
 using namespace utils;
@@ -41,6 +65,21 @@ using namespace utils;
  */
 static pcap_t *glb_pcapHandle = nullptr;
 
+/* ring publishing every parsed answer to co-located consumers, nullptr when disabled */
+static ShmRingProducer *glb_answerRing = nullptr;
+
+/* capture time of packet processed by calling thread, used for answers published to ring */
+static thread_local __u64 glb_actPacketTimeUsec = 0;
+
+/* sampling weight of packet processed by calling thread (see PacketSampler.hpp) */
+static thread_local unsigned int glb_actPacketWeight = 1;
+
+/* destination (client) of response processed by calling thread */
+static thread_local SDnsClient glb_actClient;
+
+/* answers parsed by pipeline parser thread are collected here instead of being added to statistics */
+static thread_local vector<SDnsAnswerRecord> *glb_answerOutput = nullptr;
+
 /* signal handleing specifiing flag which is use to print out statistins */
 static volatile sig_atomic_t glb_pcap_writeOutFlag = 0;
 static volatile sig_atomic_t glb_pcap_sendToSyslogFlag = 0;
@@ -53,7 +92,8 @@ void pcap_writeoutSignal(int signum) {
     glb_pcap_sendToSyslogFlag = 1;
   else
     return;
-  pcap_breakloop(glb_pcapHandle);
+  if (glb_pcapHandle != nullptr)
+    pcap_breakloop(glb_pcapHandle);
 }
 
 /**
@@ -118,18 +158,88 @@ pcap_t *openLivePcap(const string& interface) {
 }
 
 /**
- * @brief Function initialize pcapHandle with device specified by deviceName and sets filter in filterExpr.
+ * Hand-built classic BPF program for Ethernet frames passing to userspace only
+ * DNS responses which carry at least one answer:
+ *  - UDP over IPv4/IPv6 from source port 53 with QR bit set and ANCOUNT > 0
+ *  - TCP over IPv4/IPv6 from source port 53 (DNS header offset depends on TCP options)
+ *  - IPv4 non-first fragments and IPv6 fragments (ports are not known, defragmenter decides)
+ * IPv6 packets with extension headers other than fragment header are rejected.
+ */
+static struct bpf_insn glb_dnsResponseFilter[] = {
+  /*  0 */ BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 12),               // ether type
+  /*  1 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 1, 0),
+  /*  2 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IPV6, 14, 27),
+  // IPv4
+  /*  3 */ BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 20),               // flags and fragment offset
+  /*  4 */ BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, IP_OFFMASK, 24, 0),
+  /*  5 */ BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),               // X = IP header length
+  /*  6 */ BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 23),               // protocol
+  /*  7 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0),
+  /*  8 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 2, 21),
+  /*  9 */ BPF_STMT(BPF_LD  | BPF_H | BPF_IND, 14),               // TCP source port
+  /* 10 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 53, 18, 19),
+  /* 11 */ BPF_STMT(BPF_LD  | BPF_H | BPF_IND, 14),               // UDP source port
+  /* 12 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 53, 0, 17),
+  /* 13 */ BPF_STMT(BPF_LD  | BPF_B | BPF_IND, 14 + 8 + 2),       // DNS flags, upper byte
+  /* 14 */ BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 0, 15),     // QR bit
+  /* 15 */ BPF_STMT(BPF_LD  | BPF_H | BPF_IND, 14 + 8 + 6),       // DNS ANCOUNT
+  /* 16 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 13, 12),
+  // IPv6
+  /* 17 */ BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 20),               // next header
+  /* 18 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_FRAGMENT, 10, 0),
+  /* 19 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0),
+  /* 20 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 2, 9),
+  /* 21 */ BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 54),               // TCP source port
+  /* 22 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 53, 6, 7),
+  /* 23 */ BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 54),               // UDP source port
+  /* 24 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 53, 0, 5),
+  /* 25 */ BPF_STMT(BPF_LD  | BPF_B | BPF_ABS, 54 + 8 + 2),       // DNS flags, upper byte
+  /* 26 */ BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 0, 3),      // QR bit
+  /* 27 */ BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 54 + 8 + 6),       // DNS ANCOUNT
+  /* 28 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0),
+  /* 29 */ BPF_STMT(BPF_RET | BPF_K, 262144),                     // accept whole packet
+  /* 30 */ BPF_STMT(BPF_RET | BPF_K, 0),                          // reject
+};
+
+/**
+ * @brief Returns hand-built BPF program used on Ethernet.
+ *
+ * (See pcapProcessor.hpp for more info.)
+ */
+struct bpf_program dnsResponseFilter() {
+  struct bpf_program program = {
+    sizeof(glb_dnsResponseFilter) / sizeof(struct bpf_insn),
+    glb_dnsResponseFilter
+  };
+  return program;
+}
+
+/**
+ * @brief Function initialize pcapHandle with device specified by deviceName and sets filter.
  * On error function writes error description on strerr and returns false.
  *
+ * On Ethernet link type hand-built glb_dnsResponseFilter program is used, on
+ * other link types filterExpr is compiled.
+ *
  * @param pcapHandle  handle to pcap structure. Must not be null.
  * @param deviceName  name of interface device. No device is used when this string is empty.
- * @param filterExpr  filter expression for pcap. No filter is used when this string is empty.
+ * @param filterExpr  fallback filter expression for pcap. No filter is used when this string is empty.
  * @return true       When everything went ok.
  * @return false      When error ocurred.
  */
 bool initDeviceAndSetFilter(pcap_t *pcapHandle, const string& deviceName, const string& filterExpr) {
   if (pcapHandle == nullptr)
     return false;
+
+  if (pcap_datalink(pcapHandle) == DLT_EN10MB) {
+    struct bpf_program fp = dnsResponseFilter();
+    if (pcap_setfilter(pcapHandle, &fp) == -1) {
+      cerr << "Error: pcap_setfilter() failed: \"" << pcap_geterr(pcapHandle) << "\"" << endl;
+      return false;
+    }
+    return true;
+  }
+
   bpf_u_int32 mask = 0;
   bpf_u_int32 net = 0;
   struct bpf_program fp;
@@ -149,8 +259,10 @@ bool initDeviceAndSetFilter(pcap_t *pcapHandle, const string& deviceName, const
     }
     if (pcap_setfilter(pcapHandle, &fp) == -1) {
       cerr << "Error: pcap_setfilter() failed." << endl;
+      pcap_freecode(&fp);
       return false;
     }
+    pcap_freecode(&fp);
   }
   return true;
 }
@@ -186,76 +298,300 @@ bool isTcpMessageSegmented(struct tcphdr *my_tcp) {
  * and filling result of this parsing into DNSStatistic object.
  */
 void parseDnsData(const unsigned char *firstCharOfData, DNSResponse *respObj, std::shared_ptr<DNSStatistic> statObj) {
-  if (respObj->parse(firstCharOfData)) {
-    statObj->addAnswerRecords(respObj->answers);
+  PERF_BEGIN(parseBegin);
+  bool isParsed = respObj->parse(firstCharOfData);
+  PERF_END_NESTED(PERF_STAGE_PARSE, parseBegin);
+  if (isParsed) {
+    if (glb_answerRing != nullptr) {
+      for (const auto &answer : respObj->answers)
+        glb_answerRing->publish(answer, glb_actPacketTimeUsec);
+    }
+    if (glb_answerOutput != nullptr) {
+      // aggregated by pipeline aggregator thread, response object is not used after this
+      move(respObj->answers.begin(), respObj->answers.end(), back_inserter(*glb_answerOutput));
+    } else {
+      PERF_BEGIN(aggregateBegin);
+      statObj->addAnswerRecords(respObj->answers, glb_actPacketWeight, &glb_actClient);
+      PERF_END_NESTED(PERF_STAGE_AGGREGATE, aggregateBegin);
+    }
+    PERF_RECORDS(respObj->answers.size());
+    metrics::countParseResult(DNS_PARSE_OK, respObj->answers.size());
     DWRITE("records parsed: " << respObj->answers.size());
   } else {
+    PERF_PARSE_ERROR(respObj->lastParseError());
+    metrics::countParseResult(respObj->lastParseError(), 0);
     DWRITE("corrupted -> dumped");
   }
 }
 
 /**
- * @brief Function decodes packet captured by pcap and if it is and dns response of right
+ * @brief Supportive function decodes transport layer header and passes DNS payload to parseDnsData.
+ *
+ * @param protocol  IP protocol number of transport layer (only TCP and UDP are processed)
+ * @param data      pointer to first char of transport layer header
+ * @param len       number of bytes available from data pointer
+ * @param respObj   DNSResponse object used for parsing
+ * @param statObj   Instance of DNSStatistics object to be filled with new data
+ */
+void processTransportData(__u8 protocol, const unsigned char *data, unsigned int len, DNSResponse *respObj, std::shared_ptr<DNSStatistic> statObj) {
+  metrics::countProtocol(protocol);
+  switch (protocol) {
+    case IPPROTO_TCP: {
+      DPRINTF("protocol TCP (%d); ", protocol);
+      if (len < sizeof(struct tcphdr))
+        break;
+      struct tcphdr *tcpHeader = (struct tcphdr *)data;
+      unsigned int headerSize = getTcpHeaderSize(tcpHeader);
+      // break if payload is to small to carry full dns header
+      if (len < headerSize + 2 + DNS_HEADER_MIN_SIZE)
+        break;
+      // ignoring from statistics when tcp carries DNS payload in multiple segmets
+      if (!isTcpMessageSegmented(tcpHeader)) {
+        // dns message is after 2B specifiing length
+        // it is posible that this packet is last segment of segmented - parsing will fail and data are ignored
+        glb_actClient.bytes = len - headerSize - 2;
+        parseDnsData(data + headerSize + 2, respObj, statObj);
+      } else {
+        DWRITE("segmented");
+      }
+    } break;
+    case IPPROTO_UDP: {
+      DPRINTF("protocol UDP (%d); ", protocol);
+      // break if payload is to small to carry full dns header
+      if (len < sizeof(struct udphdr) + DNS_HEADER_MIN_SIZE)
+        break;
+      // parse dns packet to response
+      glb_actClient.bytes = len - sizeof(struct udphdr);
+      parseDnsData(data + sizeof(struct udphdr), respObj, statObj);
+    } break;
+    default:
+      DPRINTF("protocol %d\n", protocol);
+  }
+}
+
+/**
+ * @brief Supportive function passing one IP fragment to defragmenter and processing
+ * reassembled datagram if fragment completed it.
+ */
+void processFragment(
+  const SIpFragmentKey &key,
+  unsigned int offset,
+  bool moreFragments,
+  const unsigned char *data,
+  unsigned int len,
+  time_t now,
+  IPDefragmenter *defragmenter,
+  DNSResponse *respObj,
+  std::shared_ptr<DNSStatistic> statObj
+) {
+  DPRINTF("fragment id 0x%x offset %u len %u more %d; ", key.id, offset, len, (int)moreFragments);
+  const unsigned char *datagram = nullptr;
+  unsigned int datagramLen = 0;
+  if (defragmenter->addFragment(key, offset, moreFragments, data, len, now, &datagram, &datagramLen))
+    processTransportData(key.protocol, datagram, datagramLen, respObj, statObj);
+}
+
+/**
+ * @brief Supportive function decodes packet captured by pcap and if it is and dns response of right
  * type (see "Suported DNS Types" macors in DNSResponse.hpp) new record are added to the statistics object.
  *
- * @param packet  Pointer to first char of packet to be processed.
- * @param statObj Instance of DNSStatistics object to be filled with new data from actual packet
+ * IPv4 and IPv6 fragments are collected by defragmenter and reassembled datagram
+ * is processed when its last missing fragment arrives.
+ *
+ * @param header        Pcap header of the packet (capture length and time stamp are used).
+ * @param packet        Pointer to first char of packet to be processed.
+ * @param statObj       Instance of DNSStatistics object to be filled with new data from actual packet
+ * @param defragmenter  Defragmenter holding fragments of not yet complete datagrams.
  */
-void processOnePacket(const unsigned char *packet, std::shared_ptr<DNSStatistic> statObj) {
+void decodePacket(const struct pcap_pkthdr *header, const unsigned char *packet, std::shared_ptr<DNSStatistic> statObj, IPDefragmenter *defragmenter) {
   struct ether_header *eptr = (struct ether_header *)packet;
-  DNSResponse dnsResponse;
+  const unsigned char *endOfPacket = packet + header->caplen;
+  PooledObject<DNSResponse> dnsResponse; // reused by packets of this thread, keeps capacity of answers
 
+  if (header->caplen < SIZE_ETHERNET)
+    return;
+
+  metrics::countEtherType(ntohs(eptr->ether_type));
   switch (ntohs(eptr->ether_type)) {
     case ETHERTYPE_IP: { // IPv4
+      if (header->caplen < SIZE_ETHERNET + sizeof(struct ip))
+        break;
       struct ip *my_ip = (struct ip *)(packet + SIZE_ETHERNET); // skip Ethernet header
-      u_int size_ip = my_ip->ip_hl * 4;                    // length of IP header
-      switch (my_ip->ip_p)
-      {
-        case 6: { // TCP protocol
-          DPRINTF("protocol TCP (%d); ", my_ip->ip_p);
-          struct tcphdr *tcpHeader = (struct tcphdr *)(packet + SIZE_ETHERNET + size_ip);
-          unsigned int headerSize = getTcpHeaderSize(tcpHeader);
-          // break if payload is to small to carry full dns header
-          if ((htons(my_ip->ip_len) - headerSize) < 12)
+      memset(glb_actClient.addr, 0, 10); // IPv4-mapped IPv6 address
+      glb_actClient.addr[10] = glb_actClient.addr[11] = 0xff;
+      memcpy(glb_actClient.addr + 12, &(my_ip->ip_dst), 4);
+      u_int size_ip = my_ip->ip_hl * 4;                         // length of IP header
+      const unsigned char *payload = packet + SIZE_ETHERNET + size_ip;
+      const unsigned char *endOfPayload = packet + SIZE_ETHERNET + ntohs(my_ip->ip_len);
+      if (size_ip < sizeof(struct ip) || endOfPayload < payload)
+        break;
+      // do not read behind captured data, header itself may reach behind it
+      if (endOfPayload > endOfPacket)
+        endOfPayload = endOfPacket;
+      if (endOfPayload < payload)
+        break;
+
+      unsigned short fragOffset = ntohs(my_ip->ip_off);
+      if ((fragOffset & (IP_MF | IP_OFFMASK)) != 0) {
+        // truncated fragment cannot be reassembled
+        if (endOfPacket < packet + SIZE_ETHERNET + ntohs(my_ip->ip_len))
+          break;
+        SIpFragmentKey key;
+        memset(&key, 0, sizeof(SIpFragmentKey));
+        key.srcAddr[10] = key.srcAddr[11] = 0xff; // IPv4-mapped IPv6 address
+        key.dstAddr[10] = key.dstAddr[11] = 0xff;
+        memcpy(key.srcAddr + 12, &(my_ip->ip_src), 4);
+        memcpy(key.dstAddr + 12, &(my_ip->ip_dst), 4);
+        key.id = ntohs(my_ip->ip_id);
+        key.protocol = my_ip->ip_p;
+        processFragment(
+          key,
+          (fragOffset & IP_OFFMASK) * 8,
+          (fragOffset & IP_MF) != 0,
+          payload,
+          endOfPayload - payload,
+          header->ts.tv_sec,
+          defragmenter,
+          dnsResponse.get(),
+          statObj
+        );
+      } else {
+        processTransportData(my_ip->ip_p, payload, endOfPayload - payload, dnsResponse.get(), statObj);
+      }
+    } break;
+    case ETHERTYPE_IPV6: { // IPv6
+      if (header->caplen < SIZE_ETHERNET + sizeof(struct ip6_hdr))
+        break;
+      struct ip6_hdr *my_ip6 = (struct ip6_hdr *)(packet + SIZE_ETHERNET);
+      memcpy(glb_actClient.addr, &(my_ip6->ip6_dst), 16);
+      const unsigned char *payload = packet + SIZE_ETHERNET + sizeof(struct ip6_hdr);
+      const unsigned char *endOfPayload = payload + ntohs(my_ip6->ip6_plen);
+      bool isTruncated = endOfPayload > endOfPacket;
+      if (isTruncated)
+        endOfPayload = endOfPacket;
+
+      // skip extension headers until we get transport layer or fragment header
+      __u8 nextHeader = my_ip6->ip6_nxt;
+      bool isExtensionHeader = true;
+      while (isExtensionHeader && payload + 8 <= endOfPayload) {
+        switch (nextHeader) {
+          case IPPROTO_HOPOPTS:
+          case IPPROTO_ROUTING:
+          case IPPROTO_DSTOPTS:
+            nextHeader = payload[0];
+            payload += (payload[1] + 1) * 8;
             break;
-          // ignoring from statistics when tcp carries DNS payload in multiple segmets
-          if (!isTcpMessageSegmented(tcpHeader)) {
-            // dns message is after 2B specifiing length
-            // it is posible that this packet is last segment of segmented - parsing will fail and data are ignored
-            parseDnsData(
-              (const unsigned char *)tcpHeader + headerSize + 2,
-              &dnsResponse,
+          case IPPROTO_FRAGMENT: {
+            if (isTruncated)
+              return;
+            struct ip6_frag *my_frag = (struct ip6_frag *)payload;
+            SIpFragmentKey key;
+            memcpy(key.srcAddr, &(my_ip6->ip6_src), 16);
+            memcpy(key.dstAddr, &(my_ip6->ip6_dst), 16);
+            key.id = ntohl(my_frag->ip6f_ident);
+            key.protocol = my_frag->ip6f_nxt;
+            unsigned short fragOffset = ntohs(my_frag->ip6f_offlg);
+            payload += sizeof(struct ip6_frag);
+            processFragment(
+              key,
+              fragOffset & ~0x7,
+              (fragOffset & 0x1) != 0,
+              payload,
+              endOfPayload - payload,
+              header->ts.tv_sec,
+              defragmenter,
+              dnsResponse.get(),
               statObj
             );
-          } else {
-            DWRITE("segmented");
+            return;
           }
-        } break;
-        case 17: { // UDP protocol
-          DPRINTF("protocol UDP (%d); ", my_ip->ip_p);
-          struct udphdr *my_udp = (struct udphdr *)(packet + SIZE_ETHERNET + size_ip);
-          // break if payload is to small to carry full dns header
-          if ((htons(my_udp->len) - sizeof(my_udp)) < 12)
-            break;
-          // parse dns packet to response
-          parseDnsData(
-            packet + SIZE_ETHERNET + size_ip + sizeof(struct udphdr),
-            &dnsResponse,
-            statObj
-          );
-        } break;
-        default:
-          DPRINTF("protocol %d\n", my_ip->ip_p);
+          default:
+            isExtensionHeader = false;
+        }
       }
+      if (payload <= endOfPayload)
+        processTransportData(nextHeader, payload, endOfPayload - payload, dnsResponse.get(), statObj);
     } break;
-    case ETHERTYPE_IPV6: // IPv6
-      DPRINTF("Ethernet type is 0x%x, i.e., IPv6 packet\n", ntohs(eptr->ether_type));
-      break;
     default:
-      DPRINTF("Ethernet type 0x%x, not IPv4\n", ntohs(eptr->ether_type));
+      DPRINTF("Ethernet type 0x%x, not IPv4 nor IPv6\n", ntohs(eptr->ether_type));
   }
 }
 
+/**
+ * @brief Function processes one packet captured by pcap (see decodePacket)
+ * and records time spent in decoding when instrumentation is enabled.
+ */
+void processOnePacket(const struct pcap_pkthdr *header, const unsigned char *packet, std::shared_ptr<DNSStatistic> statObj, IPDefragmenter *defragmenter) {
+  PERF_BEGIN(decodeBegin);
+  PERF_PACKET();
+  metrics::countPacket();
+  glb_actPacketTimeUsec = header->ts.tv_sec * 1000000ull + header->ts.tv_usec;
+  glb_actClient.time = header->ts.tv_sec;
+  decodePacket(header, packet, statObj, defragmenter);
+  PERF_END_OUTER(PERF_STAGE_DECODE, decodeBegin);
+}
+
+/**
+ * @brief Supportive function publishing pcap counters to metrics when pcapHandle supports them.
+ */
+void publishPcapMetrics(pcap_t *pcapHandle) {
+  struct pcap_stat pcapStat;
+  if (pcapHandle != nullptr && pcap_stats(pcapHandle, &pcapStat) == 0)
+    metrics::setPcapStats(pcapStat.ps_recv, pcapStat.ps_drop, pcapStat.ps_ifdrop);
+}
+
+/**
+ * @brief Supportive function publishing gauges owned by processing thread to metrics
+ * (see metrics.hpp), pcap counters are published only when pcapHandle supports them.
+ */
+void publishMetrics(pcap_t *pcapHandle, const DNSStatistic &statObj) {
+  metrics::setStatisticsSize(statObj.recordCount(), statObj.memoryUsage());
+  publishPcapMetrics(pcapHandle);
+}
+
+/**
+ * @brief Supportive function passing drop counters of pcap and of pipeline queues
+ * to adaptive sampler, does nothing without sampler.
+ */
+void adaptSampler(PacketSampler *sampler, pcap_t *pcapHandle, __u64 pipelineDrops) {
+  struct pcap_stat pcapStat;
+  if (sampler == nullptr || pcapHandle == nullptr || pcap_stats(pcapHandle, &pcapStat) != 0)
+    return;
+  sampler->adapt(pcapStat.ps_recv, (__u64)pcapStat.ps_drop + pcapStat.ps_ifdrop + pipelineDrops);
+}
+
+/**
+ * @brief Configures counting modes of statistics by program options.
+ *
+ * (See pcapProcessor.hpp for more info.)
+ */
+void configureStatistic(const utils::ProgramOptions &options, DNSStatistic &statistic) {
+  if (options.rollupDepth > 0)
+    statistic.setRollup(options.rollupDepth);
+  if (options.isDistinct)
+    statistic.setDistinctCounting(max(1u, options.rollupDepth));
+  if (options.clientCount > 0)
+    statistic.setClientTracking(options.clientCount);
+  if (options.expiryFloor > 0 || options.memoryCapMb > 0)
+    statistic.setEviction(options.expiryFloor, (size_t)options.memoryCapMb << 20);
+}
+
+/**
+ * @brief Creates shared memory ring publishing parsed answers
+ *
+ * (See pcapProcessor.hpp for more info
+ */
+bool initAnswerRing(const std::string &name) {
+  ShmRingProducer *ring = new ShmRingProducer();
+  if (!ring->create(name)) {
+    delete ring;
+    return false;
+  }
+  delete glb_answerRing;
+  glb_answerRing = ring;
+  return true;
+}
+
 /**
  * @brief Fill statistics with data from one pcap file
  *
@@ -279,15 +615,335 @@ bool processPcapFile(utils::ProgramOptions options, std::shared_ptr<DNSStatistic
   #ifdef DEBUG
   int n = 0;
   #endif
+  IPDefragmenter defragmenter;
+  PERF_BEGIN(captureBegin);
   while ((packet = pcap_next(handle, &actPcapPacketHeader)) != NULL) {
+    PERF_END(PERF_STAGE_CAPTURE, captureBegin);
     DPRINTF("\nPacket no. %d:\n", ++n);
-    processOnePacket(packet, statObj);
+    processOnePacket(&actPcapPacketHeader, packet, statObj, &defragmenter);
+    PERF_RESTART(captureBegin);
   }
+  DWRITE("Reassembled datagrams: " << defragmenter.counters().reassembled);
+  PERF_REPORT(cerr, handle);
 
   pcap_close(handle);
   return true;
 }
 
+/**
+ * @brief Expands paths, glob patterns and directories to list of files.
+ *
+ * (See pcapProcessor.hpp for more info
+ */
+bool expandPcapPaths(const std::vector<std::string> &paths, std::vector<std::string> &files, bool isQuiet) {
+  vector<pair<off_t, string>> sizedFiles;
+  for (const auto &path : paths) {
+    vector<string> matches;
+    if (path.find_first_of("*?[") != string::npos) {
+      glob_t globResult;
+      if (glob(path.c_str(), 0, nullptr, &globResult) != 0) {
+        if (!isQuiet)
+          cerr << "Pattern \"" << path << "\" does not match any file." << endl;
+        globfree(&globResult);
+        return false;
+      }
+      for (size_t i = 0; i < globResult.gl_pathc; ++i)
+        matches.push_back(globResult.gl_pathv[i]);
+      globfree(&globResult);
+    } else {
+      matches.push_back(path);
+    }
+
+    for (const auto &match : matches) {
+      struct stat fileStat;
+      if (stat(match.c_str(), &fileStat) != 0) {
+        if (!isQuiet)
+          cerr << "Cannot access \"" << match << "\": " << strerror(errno) << endl;
+        return false;
+      }
+      if (!S_ISDIR(fileStat.st_mode)) {
+        sizedFiles.push_back({ fileStat.st_size, match });
+        continue;
+      }
+      // take all regular files in directory
+      DIR *dir = opendir(match.c_str());
+      if (dir == nullptr) {
+        if (!isQuiet)
+          cerr << "Cannot open directory \"" << match << "\": " << strerror(errno) << endl;
+        return false;
+      }
+      struct dirent *entry;
+      while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] == '.')
+          continue;
+        string entryPath = match + "/" + entry->d_name;
+        if (stat(entryPath.c_str(), &fileStat) == 0 && S_ISREG(fileStat.st_mode))
+          sizedFiles.push_back({ fileStat.st_size, entryPath });
+      }
+      closedir(dir);
+    }
+  }
+
+  // largest files first so long files do not end up at the tail of work queue
+  sort(sizedFiles.begin(), sizedFiles.end(), [](const pair<off_t, string> &a, const pair<off_t, string> &b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+  files.clear();
+  for (const auto &sizedFile : sizedFiles)
+    files.push_back(sizedFile.second);
+  return true;
+}
+
+/**
+ * @brief Fill statistics with data from all pcap files given in program options
+ *
+ * (See pcapProcessor.hpp for more info
+ */
+bool processPcapFiles(utils::ProgramOptions options, std::shared_ptr<DNSStatistic> statObj) {
+  if (statObj == nullptr)
+    return false;
+
+  vector<string> files;
+  if (!expandPcapPaths(options.pcapFileNames, files))
+    return false;
+  if (files.empty()) {
+    cerr << "No pcap files to process." << endl;
+    return false;
+  }
+
+  unsigned int workerCount = options.workerCount;
+  if (workerCount == 0)
+    workerCount = max(1u, thread::hardware_concurrency());
+  workerCount = min(workerCount, (unsigned int)files.size());
+  DWRITE("Processing " << files.size() << " files in " << workerCount << " workers");
+
+  // workers take next unprocessed file from shared cursor until all files are taken
+  atomic<size_t> nextFile(0);
+  atomic<size_t> failedCount(0);
+  vector<shared_ptr<DNSStatistic>> workerStats(workerCount);
+  auto worker = [&](unsigned int workerIndex) {
+    utils::ProgramOptions fileOptions = options;
+    size_t fileIndex;
+    while ((fileIndex = nextFile.fetch_add(1)) < files.size()) {
+      fileOptions.pcapFileName = files[fileIndex];
+      if (!processPcapFile(fileOptions, workerStats[workerIndex])) {
+        cerr << "Warning: pcap file \"" << files[fileIndex] << "\" skipped." << endl;
+        ++failedCount;
+      }
+    }
+  };
+
+  if (workerCount == 1) {
+    workerStats[0] = statObj;
+    worker(0);
+  } else {
+    vector<thread> workers;
+    for (unsigned int i = 0; i < workerCount; ++i) {
+      workerStats[i] = make_shared<DNSStatistic>();
+      configureStatistic(options, *workerStats[i]);
+      workers.emplace_back(worker, i);
+      if (i < options.cpuList.size())
+        placement::pinThread(workers.back().native_handle(), options.cpuList[i], "worker " + to_string(i));
+    }
+    for (auto &actWorker : workers)
+      actWorker.join();
+    for (const auto &workerStat : workerStats)
+      statObj->mergeStatistics(*workerStat);
+  }
+  publishMetrics(nullptr, *statObj);
+
+  return failedCount < files.size();
+}
+
+/**
+ * @brief Supportive function performing periodic export of given records.
+ *
+ * Records are sent to syslog server when it is specified. Without it records of
+ * pcap files (replay, follow mode) are exported by exporter of statistics (printed
+ * to stdout by default), live capture exports them only on SIGUSR1.
+ * Can be called from exporter thread of pipeline as DNSStatistic::sendToSyslog(records).
+ */
+bool exportStatistics(const utils::ProgramOptions &options, DNSStatistic &statObj, const StatRecords &records) {
+  if (!options.isSyslogserveAddress && options.isPcapFile)
+    return statObj.printStatistics(records);
+  if (!statObj.sendToSyslog(records)) {
+    DWRITE("sendToSyslog failed");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Supportive function returning monotonic wall clock time in seconds.
+ */
+double getMonotonicTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Supportive function sleeping until given virtual time offset is reached in real time.
+ *
+ * @param realStart       monotonic time when replay started
+ * @param virtualOffset   seconds of capture time elapsed since first packet
+ * @param speed           replay speed multiplier, 0 means no waiting
+ */
+void waitForVirtualTime(double realStart, double virtualOffset, double speed) {
+  if (speed <= 0)
+    return;
+  double remaining = realStart + virtualOffset / speed - getMonotonicTime();
+  if (remaining <= 0)
+    return;
+  struct timespec ts;
+  ts.tv_sec = (time_t)remaining;
+  ts.tv_nsec = (long)((remaining - ts.tv_sec) * 1e9);
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {} // continue sleeping after signal
+}
+
+/**
+ * @brief Clock of capture loop scheduling periodic exports. Live capture is
+ * driven by SIGALRM, replayed file by time stamps of its packets (virtual clock).
+ */
+struct SCaptureClock {
+  unsigned int interval;  // seconds between exports
+  bool isVirtual;         // time is given by time stamps of replayed packets
+  double speed;           // replay speed multiplier, 0 means no waiting
+  double realStart;       // monotonic time when first packet was replayed
+  double virtualStart;    // time stamp of first replayed packet, negative before it
+  double nextExport;      // virtual time of next export
+};
+
+/**
+ * @brief Supportive function creating clock of capture loop, replayed file
+ * (ProgramOptions::isReplay) is driven by time stamps of its packets.
+ */
+SCaptureClock createCaptureClock(const utils::ProgramOptions &options) {
+  SCaptureClock clock = { options.sendTimeIntervalSec, options.isReplay, options.replaySpeed, 0, -1, 0 };
+  return clock;
+}
+
+/**
+ * @brief Supportive function scheduling next periodic export, virtual clock
+ * schedules first export by first packet.
+ */
+void scheduleExport(SCaptureClock &clock) {
+  if (!clock.isVirtual)
+    alarm(clock.interval);
+  else if (clock.virtualStart >= 0)
+    clock.nextExport += clock.interval;
+}
+
+/**
+ * @brief Supportive function advancing virtual clock to time stamp of packet, replay
+ * is paced by clock speed. Does nothing on live capture, where SIGALRM raises export flag.
+ *
+ * When export is scheduled before packet, clock is advanced only to time of export,
+ * export flag is raised and packet has to be passed again after the export.
+ *
+ * @return true when packet has to wait for export
+ */
+bool advanceClock(SCaptureClock &clock, const struct pcap_pkthdr *header) {
+  if (!clock.isVirtual)
+    return false;
+  double virtualNow = header->ts.tv_sec + header->ts.tv_usec / 1e6;
+  if (clock.virtualStart < 0) {
+    clock.realStart = getMonotonicTime();
+    clock.virtualStart = virtualNow;
+    clock.nextExport = virtualNow + clock.interval;
+  }
+  if (virtualNow >= clock.nextExport) {
+    waitForVirtualTime(clock.realStart, clock.nextExport - clock.virtualStart, clock.speed);
+    DWRITE("Export at virtual time +" << clock.nextExport - clock.virtualStart << " s");
+    glb_pcap_sendToSyslogFlag = 1;
+    return true;
+  }
+  waitForVirtualTime(clock.realStart, virtualNow - clock.virtualStart, clock.speed);
+  return false;
+}
+
+/**
+ * @brief Supportive function running live capture loop feeding PacketPipeline,
+ * glb_pcapHandle has to be opened and signal handlers set. Packets are sampled
+ * by capture thread when sampler is given. Returns only on failure or at the end
+ * of replayed file, when all queued packets are processed and exported.
+ */
+bool runLivePipeline(const utils::ProgramOptions &options, std::shared_ptr<DNSStatistic> statObj, PacketSampler *sampler, SCaptureClock &clock) {
+  SPipelineConfig config = { options.parserCount, options.queueDepth, options.cpuList, options.numaNode };
+
+  // every parser has its own defragmenter, pipeline sends all fragments of datagram to same parser
+  vector<unique_ptr<IPDefragmenter>> defragmenters;
+  for (unsigned int i = 0; i < max(1u, config.parserCount); ++i)
+    defragmenters.emplace_back(new IPDefragmenter());
+  auto parse = [&defragmenters](unsigned int parserIndex, const struct pcap_pkthdr *header, const unsigned char *packet, vector<SDnsAnswerRecord> &answers, SDnsClient &client) {
+    glb_answerOutput = &answers;
+    processOnePacket(header, packet, nullptr, defragmenters[parserIndex].get());
+    glb_answerOutput = nullptr;
+    client = glb_actClient;
+  };
+  auto exportRecords = [statObj, &options](int requests, const StatRecords &records) {
+    if (requests & PIPELINE_REQUEST_PRINT)
+      statObj->printStatistics(records);
+    return (requests & PIPELINE_REQUEST_EXPORT) == 0 || exportStatistics(options, *statObj, records);
+  };
+  unique_ptr<SnapshotWriter> snapshotWriter(options.isSnapshot ? new SnapshotWriter(options.snapshotFileName) : nullptr);
+  auto exported = [&snapshotWriter](const DNSStatistic &statistic) {
+    if (snapshotWriter != nullptr)
+      snapshotWriter->requestSnapshot(statistic);
+  };
+
+  PacketPipeline pipeline(config, statObj, parse, exportRecords, exported);
+  const u_char *packet = NULL;  // packet of replayed file is held back by export scheduled before it
+  struct pcap_pkthdr actPcapPacketHeader;
+  unsigned int unpublishedPackets = 0;
+  bool isEndOfFile = false;
+  scheduleExport(clock);
+
+  while (!isEndOfFile && !pipeline.isFailed()) {
+    PERF_BEGIN(captureBegin);
+    while (packet != NULL || (packet = pcap_next(glb_pcapHandle, &actPcapPacketHeader)) != NULL) {
+      PERF_END(PERF_STAGE_CAPTURE, captureBegin);
+      if (advanceClock(clock, &actPcapPacketHeader))
+        break;
+      unsigned int weight = sampler != nullptr ? sampler->sample(&actPcapPacketHeader, packet) : 1;
+      if (weight > 0)
+        pipeline.pushPacket(&actPcapPacketHeader, packet, weight);
+      packet = NULL;
+      if (++unpublishedPackets == METRICS_PUBLISH_PACKETS) {
+        publishPcapMetrics(glb_pcapHandle);
+        adaptSampler(sampler, glb_pcapHandle, pipeline.droppedPackets());
+        unpublishedPackets = 0;
+      }
+      PERF_RESTART(captureBegin);
+    }
+    publishPcapMetrics(glb_pcapHandle);
+    adaptSampler(sampler, glb_pcapHandle, pipeline.droppedPackets());
+    unpublishedPackets = 0;
+    // replayed file ends when nothing was read and reading was not broken by signal
+    isEndOfFile = clock.isVirtual && packet == NULL && glb_pcap_writeOutFlag == 0;
+
+    if (glb_pcap_writeOutFlag == 1) {
+      pipeline.request(PIPELINE_REQUEST_PRINT);
+      PERF_REPORT(cerr, glb_pcapHandle);
+      allocators::report(cerr);
+      glb_pcap_writeOutFlag = 0;
+    }
+
+    if (glb_pcap_sendToSyslogFlag == 1) {
+      pipeline.request(PIPELINE_REQUEST_EXPORT);
+      scheduleExport(clock);
+      glb_pcap_sendToSyslogFlag = 0;
+    }
+  }
+  if (!isEndOfFile)
+    return false;
+  // replay is not slowed down by parsers, so it shows drops of live capture at replay speed
+  if (pipeline.droppedPackets() > 0)
+    cerr << "Warning: " << pipeline.droppedPackets() << " replayed packets were dropped because parser queues were full." << endl;
+  // last export of replayed file contains all packets
+  return pipeline.stop(PIPELINE_REQUEST_EXPORT);
+}
+
 /**
  * @brief Begins live packet capturing
  *
@@ -297,19 +953,124 @@ bool beginLiveDnsAnalysis(utils::ProgramOptions options, std::shared_ptr<DNSStat
   if (statObj == nullptr)
     return false;
 
-  DWRITE("Start capturing on " << options.interface << ".");
+  unique_ptr<PacketSampler> sampler;
+  if (!options.sampling.empty() && (sampler = createPacketSampler(options.sampling, options.samplingMaxRate)) == nullptr)
+    return false;
 
-  glb_pcapHandle = openLivePcap(options.interface);
+  if (options.isReplay) {
+    DWRITE("Replaying file: " << options.pcapFileName << " speed: " << options.replaySpeed);
+    glb_pcapHandle = openPcapFile(options.pcapFileName);
+  } else {
+    DWRITE("Start capturing on " << options.interface << ".");
+    glb_pcapHandle = openLivePcap(options.interface);
+  }
   if (glb_pcapHandle == nullptr)
     return false;
 
-  if (!initDeviceAndSetFilter(glb_pcapHandle, options.interface, DNS_PACKET_FILTER_EXP))
+  if (!initDeviceAndSetFilter(glb_pcapHandle, options.isReplay ? "" : options.interface, DNS_PACKET_FILTER_EXP))
    return false;
 
   // set signal handler
   signal(SIGUSR1, pcap_writeoutSignal); // for writing on stdout
   signal(SIGALRM, pcap_writeoutSignal);  // for sending to syslog server
 
+  SCaptureClock clock = createCaptureClock(options);
+  if (options.isPipeline) {
+    bool isOk = runLivePipeline(options, statObj, sampler.get(), clock);
+    PERF_REPORT(cerr, glb_pcapHandle);
+    pcap_close(glb_pcapHandle);
+    glb_pcapHandle = nullptr;
+    return isOk;
+  }
+
+  if (!options.cpuList.empty())
+    placement::pinThread(pthread_self(), options.cpuList[0], "capture");
+
+  const u_char *packet = NULL;  // packet of replayed file is held back by export scheduled before it
+  struct pcap_pkthdr actPcapPacketHeader;
+
+  #ifdef DEBUG
+  int n = 0;
+  #endif
+
+  IPDefragmenter defragmenter;
+  unique_ptr<SnapshotWriter> snapshotWriter(options.isSnapshot ? new SnapshotWriter(options.snapshotFileName) : nullptr);
+  unsigned int unpublishedPackets = 0;
+  bool isEndOfFile = false;
+  scheduleExport(clock);
+
+  while (!isEndOfFile) {
+    PERF_BEGIN(captureBegin);
+    while (packet != NULL || (packet = pcap_next(glb_pcapHandle, &actPcapPacketHeader)) != NULL) {
+      PERF_END(PERF_STAGE_CAPTURE, captureBegin);
+      if (advanceClock(clock, &actPcapPacketHeader))
+        break;
+      DPRINTF("\nPacket no. %d:\n", ++n);
+      glb_actPacketWeight = sampler != nullptr ? sampler->sample(&actPcapPacketHeader, packet) : 1;
+      if (glb_actPacketWeight > 0)
+        processOnePacket(&actPcapPacketHeader, packet, statObj, &defragmenter);
+      packet = NULL;
+      if (++unpublishedPackets == METRICS_PUBLISH_PACKETS) {
+        publishMetrics(glb_pcapHandle, *statObj);
+        adaptSampler(sampler.get(), glb_pcapHandle, 0);
+        unpublishedPackets = 0;
+      }
+      PERF_RESTART(captureBegin);
+    }
+    publishMetrics(glb_pcapHandle, *statObj);
+    adaptSampler(sampler.get(), glb_pcapHandle, 0);
+    unpublishedPackets = 0;
+    // replayed file ends when nothing was read and reading was not broken by signal
+    isEndOfFile = clock.isVirtual && packet == NULL && glb_pcap_writeOutFlag == 0;
+
+    if (glb_pcap_writeOutFlag == 1) {
+      statObj->printStatistics();
+      PERF_REPORT(cerr, glb_pcapHandle);
+      allocators::report(cerr);
+      glb_pcap_writeOutFlag = 0;
+    }
+
+    // last export of replayed file contains all packets
+    if (glb_pcap_sendToSyslogFlag == 1 || isEndOfFile) {
+      if (!exportStatistics(options, *statObj, statObj->getStatistics())) {
+        pcap_close(glb_pcapHandle);
+        glb_pcapHandle = nullptr;
+        return false;
+      }
+      if (snapshotWriter != nullptr)
+        snapshotWriter->requestSnapshot(*statObj);
+      scheduleExport(clock);
+      glb_pcap_sendToSyslogFlag = 0;
+    }
+  }
+
+  PERF_REPORT(cerr, glb_pcapHandle);
+  pcap_close(glb_pcapHandle);
+  glb_pcapHandle = nullptr;
+  return true;
+}
+
+/**
+ * @brief Follows growing and rotating *.pcap files as live source of packets
+ *
+ * (See pcapProcessor.hpp for more info
+ */
+bool followPcapFiles(utils::ProgramOptions options, std::shared_ptr<DNSStatistic> statObj) {
+  if (statObj == nullptr)
+    return false;
+
+  DWRITE("Following pcap files, first: " << options.pcapFileNames[0]);
+
+  PcapFollower follower(options.pcapFileNames);
+  struct bpf_program filter = {
+    sizeof(glb_dnsResponseFilter) / sizeof(struct bpf_insn),
+    glb_dnsResponseFilter
+  };
+
+  // set signal handler
+  signal(SIGUSR1, pcap_writeoutSignal); // for writing on stdout
+  signal(SIGALRM, pcap_writeoutSignal);  // for sending to syslog server
+
   const u_char *packet;
   struct pcap_pkthdr actPcapPacketHeader;
 
@@ -317,30 +1078,52 @@ bool beginLiveDnsAnalysis(utils::ProgramOptions options, std::shared_ptr<DNSStat
   int n = 0;
   #endif
 
+  IPDefragmenter defragmenter;
+  unique_ptr<SnapshotWriter> snapshotWriter(options.isSnapshot ? new SnapshotWriter(options.snapshotFileName) : nullptr);
+  unsigned int unpublishedPackets = 0;
   alarm(options.sendTimeIntervalSec);
 
   while (1) {
-    while ((packet = pcap_next(glb_pcapHandle, &actPcapPacketHeader)) != NULL) {
-      DPRINTF("\nPacket no. %d:\n", ++n);
-      processOnePacket(packet, statObj);
+    int result;
+    PERF_BEGIN(captureBegin);
+    while ((result = follower.next(&actPcapPacketHeader, &packet)) == 1) {
+      PERF_END(PERF_STAGE_CAPTURE, captureBegin);
+      if (pcap_offline_filter(&filter, &actPcapPacketHeader, packet)) {
+        DPRINTF("\nPacket no. %d:\n", ++n);
+        processOnePacket(&actPcapPacketHeader, packet, statObj, &defragmenter);
+      }
+      if (++unpublishedPackets == METRICS_PUBLISH_PACKETS) {
+        publishMetrics(nullptr, *statObj);
+        unpublishedPackets = 0;
+      }
+      if (glb_pcap_writeOutFlag == 1 || glb_pcap_sendToSyslogFlag == 1)
+        break;
+      PERF_RESTART(captureBegin);
     }
+    if (result == -1)
+      return false;
+    publishMetrics(nullptr, *statObj);
+    unpublishedPackets = 0;
 
     if (glb_pcap_writeOutFlag == 1) {
       statObj->printStatistics();
+      PERF_REPORT(cerr, nullptr);
+      allocators::report(cerr);
       glb_pcap_writeOutFlag = 0;
     }
 
     if (glb_pcap_sendToSyslogFlag == 1) {
-      if (!statObj->sendToSyslog()) {
-        DWRITE("sendToSyslog failed");
-        pcap_close(glb_pcapHandle);
+      if (!exportStatistics(options, *statObj, statObj->getStatistics()))
         return false;
-      }
+      if (snapshotWriter != nullptr)
+        snapshotWriter->requestSnapshot(*statObj);
       alarm(options.sendTimeIntervalSec);
       glb_pcap_sendToSyslogFlag = 0;
     }
+
+    if (result == 0)
+      follower.waitForData(FOLLOW_WAIT_TIMEOUT_MS);
   }
 
-  pcap_close(glb_pcapHandle);
   return true;
 }
@@ -14,13 +14,43 @@
 
 #include <memory>
 #include <signal.h>
+#include <pcap.h>
 
 #include "utils.hpp"
 #include "DNSStatistic.hpp"
 
-/* Here is specified pcap filter which will be used in this module for capturing */
+/*
+ * Here is specified pcap filter which will be used in this module for capturing
+ * on link types other than Ethernet. On Ethernet hand-built BPF program passing
+ * only DNS responses with answers is used instead (see pcapProcessor.cpp).
+ */
 #define DNS_PACKET_FILTER_EXP "(dst port 53) or (src port 53)"
 
+/**
+ * @brief Returns hand-built BPF program used on Ethernet, e.g. for pcap_offline_filter.
+ *
+ * Instructions are static, returned program must not be freed by pcap_freecode.
+ */
+struct bpf_program dnsResponseFilter();
+
+/**
+ * @brief Configures counting modes of statistics (rollup, distinct counting,
+ *        client tracking and eviction) by program options.
+ *
+ * Has to be called before any record is added.
+ */
+void configureStatistic(const utils::ProgramOptions &options, DNSStatistic &statistic);
+
+/**
+ * @brief Creates shared memory ring publishing parsed answers
+ *
+ * After successful call every answer parsed by any function of this module
+ * is published into POSIX shared memory object of given name (see ShmRing.hpp).
+ *
+ * @return false on failure, error is written on stderr.
+ */
+bool initAnswerRing(const std::string &name);
+
 /**
  * @brief Fill statistics with data from one pcap file
  *
@@ -34,6 +64,33 @@
  */
 bool processPcapFile(utils::ProgramOptions, std::shared_ptr<DNSStatistic>);
 
+/**
+ * @brief Fill statistics with data from all pcap files given in program options
+ *
+ * Every item of ProgramOptions::pcapFileNames can be path to file, glob pattern
+ * or directory (all regular files in it are taken). Files are processed by
+ * processPcapFile in ProgramOptions::workerCount threads, each into its private
+ * DNSStatistic, largest files first. Private statistics are merged into given
+ * DNSStatistic object at the end.
+ * Files which fail to be processed are reported on stderr and skipped.
+ *
+ * @return true   When at least one file was processed
+ * @return false  When paths cannot be expanded or all files failed.
+ */
+bool processPcapFiles(utils::ProgramOptions, std::shared_ptr<DNSStatistic>);
+
+/**
+ * @brief Expands paths, glob patterns and directories to list of files.
+ *
+ * @param paths   paths, glob patterns or directories
+ * @param files   filled with expanded file paths sorted from the largest file
+ * @param isQuiet when true errors are not written on stderr
+ * @return true   on success
+ * @return false  when some path does not exist or pattern matches nothing,
+ *                error is written on stderr.
+ */
+bool expandPcapPaths(const std::vector<std::string> &paths, std::vector<std::string> &files, bool isQuiet = false);
+
 /**
  * @brief Begins live packet capturing
  *
@@ -41,5 +98,32 @@ bool processPcapFile(utils::ProgramOptions, std::shared_ptr<DNSStatistic>);
  * specified interface. Capturing dns packet and filling statistics.
  * Very x seconds specified in ProgramOptions::sendTimeIntervalSec function
  * will invoke sendToSyslog() method on statistics.
+ * When ProgramOptions::isSnapshot is set, snapshot of statistics is written
+ * by background thread after each export (see StatisticSnapshot.hpp).
+ * When ProgramOptions::isPipeline is set, packets are processed by
+ * PacketPipeline with ProgramOptions::parserCount parser threads and
+ * aggregation and export run on their own threads.
+ * When ProgramOptions::sampling is set, only sampled packets are processed
+ * and counts are scaled estimates (see PacketSampler.hpp).
+ *
+ * When ProgramOptions::isReplay is set, ProgramOptions::pcapFileName is read
+ * instead of interface and exports are driven by virtual clock of packet
+ * time stamps instead of SIGALRM: every sendTimeIntervalSec of capture time
+ * statistics are exported (printed to stdout when no syslog server is
+ * specified) and once more after the end of file, when function returns.
+ * ProgramOptions::replaySpeed paces replay relative to capture time
+ * (1 = real time, N = N times faster, 0 = as fast as possible).
  */
 bool beginLiveDnsAnalysis(utils::ProgramOptions, std::shared_ptr<DNSStatistic>);
+
+/**
+ * @brief Follows growing and rotating *.pcap files as live source of packets
+ *
+ * Files given in ProgramOptions::pcapFileNames (paths, glob patterns or
+ * directories) are read by PcapFollower while tcpdump is still writing them,
+ * starting with the newest one and switching to next one on rotation.
+ * Statistics are exported same way as in beginLiveDnsAnalysis every
+ * ProgramOptions::sendTimeIntervalSec (printed to stdout when no syslog server
+ * is specified), including snapshots. Function never returns unless error occurs.
+ */
+bool followPcapFiles(utils::ProgramOptions, std::shared_ptr<DNSStatistic>);
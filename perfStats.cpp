@@ -0,0 +1,220 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    perfStats.cpp
+ * \brief   Low overhead hot path instrumentation of packet processing stages.
+ *          Implementation of perfStats.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#ifdef PERF_STATS
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <time.h>
+#include <pcap/pcap.h>
+
+#include "perfStats.hpp"
+
+#define PERF_HISTOGRAM_BUCKETS 256 // 4 buckets for every power of two of 64 bit value
+
+using namespace std;
+
+/**
+ * Counters of one thread. Only owning thread writes to them, so relaxed
+ * load and store is enough and no lock is taken on packet path. Reporting
+ * thread reads them only.
+ */
+struct SPerfThreadCounters {
+  atomic<__u64> packets;
+  atomic<__u64> records;
+  atomic<__u64> nestedNs;
+  atomic<__u64> parseErrors[DNS_PARSE_ERROR_COUNT];
+  atomic<__u64> stageCount[PERF_STAGE_COUNT];
+  atomic<__u64> stageTotalNs[PERF_STAGE_COUNT];
+  atomic<__u64> stageHistogram[PERF_STAGE_COUNT][PERF_HISTOGRAM_BUCKETS];
+};
+
+static const char *glb_perf_stageNames[PERF_STAGE_COUNT] = {
+  "capture", "decode", "parse", "aggregate", "export"
+};
+
+static const char *glb_perf_parseErrorNames[DNS_PARSE_ERROR_COUNT] = {
+  "ok", "null", "bad_flags", "not_response", "bad_counts", "no_answers", "filtered", "bad_answer"
+};
+
+/* counters of all threads which ever recorded anything, never freed */
+static mutex glb_perf_registryMutex;
+static vector<SPerfThreadCounters *> glb_perf_registry;
+static __u64 glb_perf_startNs = perf::now();
+
+static thread_local SPerfThreadCounters *tl_perf_counters = nullptr;
+
+/**
+ * @brief Returns counters of calling thread, registers them on first use.
+ */
+static SPerfThreadCounters *getThreadCounters() {
+  if (tl_perf_counters == nullptr) {
+    tl_perf_counters = new SPerfThreadCounters();
+    lock_guard<mutex> lock(glb_perf_registryMutex);
+    glb_perf_registry.push_back(tl_perf_counters);
+  }
+  return tl_perf_counters;
+}
+
+/**
+ * @brief Increments counter owned by calling thread without locked instruction.
+ */
+static inline void add(atomic<__u64> &counter, __u64 value) {
+  counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * @brief Maps duration to histogram bucket keeping 2 bits of precision after highest bit.
+ */
+static unsigned int bucketOf(__u64 value) {
+  if (value < 4)
+    return value;
+  unsigned int msb = 63 - __builtin_clzll(value);
+  return msb * 4 + ((value >> (msb - 2)) & 0x3);
+}
+
+/**
+ * @brief Returns middle value of histogram bucket.
+ */
+static __u64 bucketValue(unsigned int bucket) {
+  if (bucket < 4)
+    return bucket;
+  unsigned int msb = bucket / 4;
+  __u64 lower = (__u64)(4 | (bucket & 0x3)) << (msb - 2);
+  return lower + ((__u64)1 << (msb - 2)) / 2;
+}
+
+/**
+ * @brief Returns value of given percentile from histogram.
+ */
+static __u64 percentile(const vector<__u64> &histogram, __u64 count, double fraction) {
+  __u64 threshold = (__u64)(count * fraction);
+  __u64 sum = 0;
+  for (unsigned int i = 0; i < PERF_HISTOGRAM_BUCKETS; ++i) {
+    sum += histogram[i];
+    if (sum > threshold)
+      return bucketValue(i);
+  }
+  return 0;
+}
+
+/* now */
+__u64 perf::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (__u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* recordStage */
+void perf::recordStage(EPerfStage stage, __u64 durationNs) {
+  SPerfThreadCounters *counters = getThreadCounters();
+  add(counters->stageCount[stage], 1);
+  add(counters->stageTotalNs[stage], durationNs);
+  add(counters->stageHistogram[stage][bucketOf(durationNs)], 1);
+}
+
+/* recordNestedStage */
+void perf::recordNestedStage(EPerfStage stage, __u64 durationNs) {
+  recordStage(stage, durationNs);
+  add(getThreadCounters()->nestedNs, durationNs);
+}
+
+/* recordOuterStage */
+void perf::recordOuterStage(EPerfStage stage, __u64 durationNs) {
+  SPerfThreadCounters *counters = getThreadCounters();
+  __u64 nested = counters->nestedNs.load(memory_order_relaxed);
+  counters->nestedNs.store(0, memory_order_relaxed);
+  recordStage(stage, durationNs > nested ? durationNs - nested : 0);
+}
+
+/* countPacket */
+void perf::countPacket() {
+  add(getThreadCounters()->packets, 1);
+}
+
+/* countRecords */
+void perf::countRecords(unsigned int count) {
+  add(getThreadCounters()->records, count);
+}
+
+/* countParseError */
+void perf::countParseError(EDnsParseError error) {
+  add(getThreadCounters()->parseErrors[error], 1);
+}
+
+/**
+ * @brief Writes report aggregated over all threads to given stream.
+ *
+ * (See perfStats.hpp for more info.)
+ */
+void perf::printReport(std::ostream &out, struct pcap *pcapHandle) {
+  __u64 packets = 0;
+  __u64 records = 0;
+  __u64 parseErrors[DNS_PARSE_ERROR_COUNT] = {};
+  __u64 stageCount[PERF_STAGE_COUNT] = {};
+  __u64 stageTotalNs[PERF_STAGE_COUNT] = {};
+  vector<vector<__u64>> histograms(PERF_STAGE_COUNT, vector<__u64>(PERF_HISTOGRAM_BUCKETS, 0));
+
+  {
+    lock_guard<mutex> lock(glb_perf_registryMutex);
+    for (const auto counters : glb_perf_registry) {
+      packets += counters->packets.load(memory_order_relaxed);
+      records += counters->records.load(memory_order_relaxed);
+      for (unsigned int i = 0; i < DNS_PARSE_ERROR_COUNT; ++i)
+        parseErrors[i] += counters->parseErrors[i].load(memory_order_relaxed);
+      for (unsigned int s = 0; s < PERF_STAGE_COUNT; ++s) {
+        stageCount[s] += counters->stageCount[s].load(memory_order_relaxed);
+        stageTotalNs[s] += counters->stageTotalNs[s].load(memory_order_relaxed);
+        for (unsigned int b = 0; b < PERF_HISTOGRAM_BUCKETS; ++b)
+          histograms[s][b] += counters->stageHistogram[s][b].load(memory_order_relaxed);
+      }
+    }
+  }
+
+  double elapsedSec = (now() - glb_perf_startNs) / 1e9;
+  // formatting of caller's stream is restored at the end
+  ios_base::fmtflags flags = out.flags();
+  streamsize precision = out.precision();
+  out << "--- dns-export performance report ---" << endl;
+  out << fixed << setprecision(1);
+  out << "elapsed:  " << elapsedSec << " s" << endl;
+  out << "packets:  " << packets << " (" << packets / elapsedSec << "/s)" << endl;
+  out << "records:  " << records << " (" << records / elapsedSec << "/s)" << endl;
+  out << left << setw(10) << "stage" << right
+      << setw(12) << "count" << setw(14) << "total_ms"
+      << setw(10) << "avg_ns" << setw(10) << "p50_ns" << setw(10) << "p99_ns" << endl;
+  for (unsigned int s = 0; s < PERF_STAGE_COUNT; ++s) {
+    out << left << setw(10) << glb_perf_stageNames[s] << right
+        << setw(12) << stageCount[s]
+        << setw(14) << stageTotalNs[s] / 1e6
+        << setw(10) << (stageCount[s] ? stageTotalNs[s] / stageCount[s] : 0)
+        << setw(10) << percentile(histograms[s], stageCount[s], 0.50)
+        << setw(10) << percentile(histograms[s], stageCount[s], 0.99) << endl;
+  }
+  out << "parse failures:";
+  for (unsigned int i = DNS_PARSE_OK + 1; i < DNS_PARSE_ERROR_COUNT; ++i)
+    out << " " << glb_perf_parseErrorNames[i] << "=" << parseErrors[i];
+  out << endl;
+
+  struct pcap_stat pcapStat;
+  if (pcapHandle != nullptr && pcap_stats(pcapHandle, &pcapStat) == 0) {
+    out << "pcap:     received " << pcapStat.ps_recv
+        << " dropped " << pcapStat.ps_drop
+        << " ifdropped " << pcapStat.ps_ifdrop << endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+#endif // PERF_STATS
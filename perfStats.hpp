@@ -0,0 +1,101 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    perfStats.hpp
+ * @brief   Low overhead hot path instrumentation of packet processing stages.
+ *
+ *          Whole module is compiled out unless PERF_STATS macro is defined
+ *          (see "perf" target in Makefile). Use only PERF_* macros in code.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <ostream>
+#include <linux/types.h>
+
+#include "DNSResponse.hpp"
+
+/**
+ * @brief Measured stages of packet processing.
+ */
+enum EPerfStage {
+  PERF_STAGE_CAPTURE = 0,   /*!< waiting in pcap_next for packet */
+  PERF_STAGE_DECODE,        /*!< L2 - L4 decoding without parse and aggregate */
+  PERF_STAGE_PARSE,         /*!< DNSResponse::parse */
+  PERF_STAGE_AGGREGATE,     /*!< DNSStatistic::addAnswerRecords */
+  PERF_STAGE_EXPORT,        /*!< building and sending one syslog message */
+  PERF_STAGE_COUNT          /*!< number of values in this enum */
+};
+
+#ifdef PERF_STATS
+
+struct pcap;
+
+#define PERF_BEGIN(T)             __u64 T = perf::now()
+#define PERF_RESTART(T)           T = perf::now()
+#define PERF_END(STAGE, T)        perf::recordStage(STAGE, perf::now() - T)
+#define PERF_END_NESTED(STAGE, T) perf::recordNestedStage(STAGE, perf::now() - T)
+#define PERF_END_OUTER(STAGE, T)  perf::recordOuterStage(STAGE, perf::now() - T)
+#define PERF_PACKET()             perf::countPacket()
+#define PERF_RECORDS(N)           perf::countRecords(N)
+#define PERF_PARSE_ERROR(E)       perf::countParseError(E)
+#define PERF_REPORT(OUT, HANDLE)  perf::printReport(OUT, HANDLE)
+
+namespace perf {
+  /**
+   * @brief Returns monotonic time in nanoseconds.
+   */
+  __u64 now();
+
+  /**
+   * @brief Adds one duration sample of stage to counters of calling thread.
+   */
+  void recordStage(EPerfStage stage, __u64 durationNs);
+
+  /**
+   * @brief Same as recordStage, but duration is also subtracted from
+   *        enclosing stage recorded by recordOuterStage.
+   */
+  void recordNestedStage(EPerfStage stage, __u64 durationNs);
+
+  /**
+   * @brief Records enclosing stage reduced by durations of nested stages
+   *        recorded since previous call of this function.
+   */
+  void recordOuterStage(EPerfStage stage, __u64 durationNs);
+
+  /** @brief Counts one processed packet. */
+  void countPacket();
+
+  /** @brief Counts answer records passed to statistics. */
+  void countRecords(unsigned int count);
+
+  /** @brief Counts one failure of DNSResponse::parse by its reason. */
+  void countParseError(EDnsParseError error);
+
+  /**
+   * @brief Writes report aggregated over all threads to given stream.
+   *
+   * Report contains packets/s, records/s, p50/p99 time of each stage in ns,
+   * parse failures by reason and, when pcap handle is given and supports it,
+   * kernel drop counters from pcap_stats.
+   */
+  void printReport(std::ostream &out, struct pcap *pcapHandle);
+}
+
+#else
+
+#define PERF_BEGIN(T)             do {} while(0)
+#define PERF_RESTART(T)           do {} while(0)
+#define PERF_END(STAGE, T)        do {} while(0)
+#define PERF_END_NESTED(STAGE, T) do {} while(0)
+#define PERF_END_OUTER(STAGE, T)  do {} while(0)
+#define PERF_PACKET()             do {} while(0)
+#define PERF_RECORDS(N)           do {} while(0)
+#define PERF_PARSE_ERROR(E)       do {} while(0)
+#define PERF_REPORT(OUT, HANDLE)  do {} while(0)
+
+#endif // PERF_STATS
@@ -0,0 +1,87 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    DNSMessageBuilder.cpp
+ * \brief   Class composing DNS response messages in wire format.
+ *          Implementation of DNSMessageBuilder.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <string>
+#include <sstream>
+
+#include "DNSMessageBuilder.hpp"
+
+#define DNS_HEADER_SIZE (12)
+
+using namespace std;
+
+/** Constructor */
+DNSMessageBuilder::DNSMessageBuilder(const string &qname, unsigned short transactionID) : _data(DNS_HEADER_SIZE, 0) {
+  _dataLenOffset = 0;
+  _data[0] = transactionID >> 8;
+  _data[1] = transactionID & 0xff;
+  _data[2] = 0x81; // QR, RD
+  _data[3] = 0x80; // RA
+  _data[5] = 1;    // one question
+  appendName(qname);
+  appendU16(1);    // type A
+  appendU16(1);    // class IN
+}
+
+void DNSMessageBuilder::appendU8(unsigned char value) {
+  _data.push_back(value);
+}
+
+void DNSMessageBuilder::appendU16(unsigned short value) {
+  appendU8(value >> 8);
+  appendU8(value & 0xff);
+}
+
+void DNSMessageBuilder::appendU32(unsigned int value) {
+  appendU16(value >> 16);
+  appendU16(value & 0xffff);
+}
+
+void DNSMessageBuilder::appendBytes(const string &bytes) {
+  _data.insert(_data.end(), bytes.begin(), bytes.end());
+}
+
+/* appendName */
+void DNSMessageBuilder::appendName(const string &name) {
+  stringstream labels(name);
+  string label;
+  while (getline(labels, label, '.')) {
+    appendU8(label.size());
+    appendBytes(label);
+  }
+  appendU8(0);
+}
+
+/* beginAnswer */
+void DNSMessageBuilder::beginAnswer(unsigned short type, unsigned int timeToLive) {
+  appendU16(0xc000 | DNS_HEADER_SIZE);
+  appendU16(type);
+  appendU16(1);
+  appendU32(timeToLive);
+  _dataLenOffset = _data.size();
+  appendU16(0);
+  // increment answer count in header
+  unsigned short count = ((_data[6] << 8) | _data[7]) + 1;
+  _data[6] = count >> 8;
+  _data[7] = count & 0xff;
+}
+
+/* endAnswer */
+void DNSMessageBuilder::endAnswer() {
+  unsigned short len = _data.size() - _dataLenOffset - 2;
+  _data[_dataLenOffset] = len >> 8;
+  _data[_dataLenOffset + 1] = len & 0xff;
+}
+
+/* data */
+const vector<unsigned char> &DNSMessageBuilder::data() const {
+  return _data;
+}
@@ -0,0 +1,61 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    DNSMessageBuilder.hpp
+ * @brief   Class composing DNS response messages in wire format.
+ *          Used by benchmark and pcap generator tools.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Builder of DNS response wire format.
+ *
+ * Message contains one question and answers added by beginAnswer/endAnswer.
+ * Question is always at offset 12 so answer owner names are written as
+ * compression pointer 0xc00c pointing to question name.
+ */
+class DNSMessageBuilder {
+public:
+  /**
+   * @brief Constructor, creates response header and question for qname of type A.
+   */
+  DNSMessageBuilder(const std::string &qname, unsigned short transactionID = 0);
+
+  void appendU8(unsigned char value);
+  void appendU16(unsigned short value);
+  void appendU32(unsigned int value);
+  void appendBytes(const std::string &bytes);
+
+  /**
+   * @brief Appends domain name as sequence of labels without compression.
+   */
+  void appendName(const std::string &name);
+
+  /**
+   * @brief Begins answer of given type and time to live.
+   *
+   * Answer data has to be appended afterwards and answer finished by endAnswer.
+   */
+  void beginAnswer(unsigned short type, unsigned int timeToLive = 300);
+
+  /**
+   * @brief Finishes answer begun by beginAnswer, fills its data length.
+   */
+  void endAnswer();
+
+  /**
+   * @brief Returns composed message.
+   */
+  const std::vector<unsigned char> &data() const;
+
+private:
+  std::vector<unsigned char> _data;
+  size_t _dataLenOffset;
+};
@@ -0,0 +1,205 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    PcapWriter.cpp
+ * \brief   Class writing DNS responses as Ethernet frames into *.pcap file.
+ *          Implementation of PcapWriter.hpp.
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+#include "PcapWriter.hpp"
+
+#define SIZE_ETHERNET     (14)
+#define SIZE_IPV4_HEADER  (20)
+#define SIZE_IPV6_HEADER  (40)
+#define SIZE_IPV6_FRAG    (8)
+#define SIZE_UDP_HEADER   (8)
+#define SIZE_TCP_HEADER   (20)
+#define CLIENT_PORT       (40000)
+
+using namespace std;
+
+/** Constructor */
+PcapWriter::PcapWriter() {
+  _sec = 0;
+  _usec = 0;
+  _frames = 0;
+  _ipId = 0;
+}
+
+/* open */
+bool PcapWriter::open(const string &fileName) {
+  _out.open(fileName, ios::binary | ios::trunc);
+  if (!_out)
+    return false;
+  // magic, version 2.4, zone, sigfigs, snaplen, Ethernet link type
+  const unsigned int fileHeader[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+  _out.write((const char *)fileHeader, sizeof(fileHeader));
+  return _out.good();
+}
+
+/* close */
+bool PcapWriter::close() {
+  _out.flush();
+  bool isGood = _out.good();
+  _out.close();
+  return isGood;
+}
+
+/* setTime */
+void PcapWriter::setTime(unsigned int sec, unsigned int usec) {
+  _sec = sec;
+  _usec = usec;
+}
+
+/* writeDnsResponse */
+void PcapWriter::writeDnsResponse(const vector<unsigned char> &dns, const SPcapWriterPacket &params) {
+  vector<unsigned char> segment;
+  unsigned char protocol;
+  if (params.isTcp) {
+    protocol = 6;
+    segment.assign(SIZE_TCP_HEADER + 2, 0);
+    segment[1] = 53;
+    segment[2] = CLIENT_PORT >> 8; segment[3] = CLIENT_PORT & 0xff;
+    segment[7] = 1;                 // sequence number
+    segment[11] = 1;                // acknowledgment number
+    segment[12] = 0x50;             // header length 5 words
+    segment[13] = 0x18;             // ACK, PSH
+    segment[14] = 0xff; segment[15] = 0xff;
+    segment[SIZE_TCP_HEADER] = dns.size() >> 8;
+    segment[SIZE_TCP_HEADER + 1] = dns.size() & 0xff;
+  } else {
+    protocol = 17;
+    unsigned short udpLen = SIZE_UDP_HEADER + dns.size();
+    segment.assign(SIZE_UDP_HEADER, 0);
+    segment[1] = 53;
+    segment[2] = CLIENT_PORT >> 8; segment[3] = CLIENT_PORT & 0xff;
+    segment[4] = udpLen >> 8; segment[5] = udpLen & 0xff;
+  }
+  segment.insert(segment.end(), dns.begin(), dns.end());
+
+  ++_ipId;
+  if (params.isIPv6)
+    writeIPv6(segment, protocol, params);
+  else
+    writeIPv4(segment, protocol, params);
+}
+
+/* framesWritten */
+unsigned long PcapWriter::framesWritten() const {
+  return _frames;
+}
+
+/**
+ * @brief Private method writing one frame with pcap record header.
+ */
+void PcapWriter::writeFrame(const vector<unsigned char> &frame) {
+  const unsigned int recordHeader[4] = { _sec, _usec, (unsigned int)frame.size(), (unsigned int)frame.size() };
+  _out.write((const char *)recordHeader, sizeof(recordHeader));
+  _out.write((const char *)frame.data(), frame.size());
+  ++_frames;
+}
+
+/**
+ * @brief Supportive function computing size of fragment payload for given transport payload.
+ *
+ * @return unsigned int size of fragment payload, zero if datagram is not fragmented.
+ */
+static unsigned int fragmentSize(size_t payloadSize, size_t maxPayload, bool isTcp, bool forceFragments) {
+  if (isTcp)
+    return 0;
+  if (payloadSize > maxPayload)
+    return maxPayload & ~0x7;
+  if (forceFragments && payloadSize > 8)
+    return ((payloadSize / 2) + 7) & ~0x7;
+  return 0;
+}
+
+/**
+ * @brief Private method writing transport payload in one or more IPv4 frames.
+ */
+void PcapWriter::writeIPv4(const vector<unsigned char> &payload, unsigned char protocol, const SPcapWriterPacket &params) {
+  unsigned int chunk = fragmentSize(payload.size(), PCAP_WRITER_MTU - SIZE_IPV4_HEADER, params.isTcp, params.forceFragments);
+  if (chunk == 0)
+    chunk = payload.size();
+
+  for (size_t offset = 0; offset < payload.size(); offset += chunk) {
+    size_t len = min((size_t)chunk, payload.size() - offset);
+    bool moreFragments = offset + len < payload.size();
+    unsigned short ipLen = SIZE_IPV4_HEADER + len;
+    unsigned short fragField = (offset / 8) | (moreFragments ? 0x2000 : 0);
+
+    vector<unsigned char> frame(SIZE_ETHERNET + SIZE_IPV4_HEADER, 0);
+    frame[0] = 0x02; frame[5] = 0x01;   // destination MAC
+    frame[6] = 0x02; frame[11] = 0x02;  // source MAC
+    frame[12] = 0x08;                   // IPv4
+    unsigned char *ip = &(frame[SIZE_ETHERNET]);
+    ip[0] = 0x45;
+    ip[2] = ipLen >> 8; ip[3] = ipLen & 0xff;
+    ip[4] = (_ipId >> 8) & 0xff; ip[5] = _ipId & 0xff;
+    ip[6] = fragField >> 8; ip[7] = fragField & 0xff;
+    ip[8] = 64;
+    ip[9] = protocol;
+    ip[12] = 192; ip[13] = 0; ip[14] = 2; ip[15] = 53;                  // resolver 192.0.2.53
+    ip[16] = 10; ip[17] = (params.client >> 16) & 0xff;
+    ip[18] = (params.client >> 8) & 0xff; ip[19] = params.client & 0xff; // client 10.x.x.x
+    unsigned int checksum = 0;
+    for (unsigned int i = 0; i < SIZE_IPV4_HEADER; i += 2)
+      checksum += (ip[i] << 8) | ip[i + 1];
+    checksum = (checksum & 0xffff) + (checksum >> 16);
+    checksum = ~((checksum & 0xffff) + (checksum >> 16)) & 0xffff;
+    ip[10] = checksum >> 8; ip[11] = checksum & 0xff;
+
+    frame.insert(frame.end(), payload.begin() + offset, payload.begin() + offset + len);
+    writeFrame(frame);
+  }
+}
+
+/**
+ * @brief Private method writing transport payload in one or more IPv6 frames.
+ */
+void PcapWriter::writeIPv6(const vector<unsigned char> &payload, unsigned char protocol, const SPcapWriterPacket &params) {
+  unsigned int chunk = fragmentSize(payload.size(), PCAP_WRITER_MTU - SIZE_IPV6_HEADER - SIZE_IPV6_FRAG, params.isTcp, params.forceFragments);
+  bool isFragmented = chunk != 0;
+  if (!isFragmented)
+    chunk = payload.size();
+
+  for (size_t offset = 0; offset < payload.size(); offset += chunk) {
+    size_t len = min((size_t)chunk, payload.size() - offset);
+    bool moreFragments = offset + len < payload.size();
+    unsigned short payloadLen = len + (isFragmented ? SIZE_IPV6_FRAG : 0);
+
+    vector<unsigned char> frame(SIZE_ETHERNET + SIZE_IPV6_HEADER, 0);
+    frame[0] = 0x02; frame[5] = 0x01;
+    frame[6] = 0x02; frame[11] = 0x02;
+    frame[12] = 0x86; frame[13] = 0xdd; // IPv6
+    unsigned char *ip = &(frame[SIZE_ETHERNET]);
+    ip[0] = 0x60;
+    ip[4] = payloadLen >> 8; ip[5] = payloadLen & 0xff;
+    ip[6] = isFragmented ? 44 : protocol;
+    ip[7] = 64;
+    ip[8] = 0x20; ip[9] = 0x01; ip[10] = 0x0d; ip[11] = 0xb8; ip[23] = 53;   // resolver 2001:db8::53
+    ip[24] = 0x20; ip[25] = 0x01; ip[26] = 0x0d; ip[27] = 0xb8; ip[28] = 1;  // client 2001:db8:100::x
+    ip[37] = (params.client >> 16) & 0xff;
+    ip[38] = (params.client >> 8) & 0xff;
+    ip[39] = params.client & 0xff;
+
+    if (isFragmented) {
+      unsigned short offlg = (offset & ~0x7) | (moreFragments ? 1 : 0);
+      const unsigned char fragHeader[SIZE_IPV6_FRAG] = {
+        protocol, 0, (unsigned char)(offlg >> 8), (unsigned char)(offlg & 0xff),
+        (unsigned char)(_ipId >> 24), (unsigned char)(_ipId >> 16), (unsigned char)(_ipId >> 8), (unsigned char)_ipId
+      };
+      frame.insert(frame.end(), fragHeader, fragHeader + SIZE_IPV6_FRAG);
+    }
+    frame.insert(frame.end(), payload.begin() + offset, payload.begin() + offset + len);
+    writeFrame(frame);
+  }
+}
@@ -0,0 +1,84 @@
+/******************************************************************************/
+/**
+ * @project ISA - Export DNS information with help of Syslog protocol
+ * @file    PcapWriter.hpp
+ * @brief   Class writing DNS responses as Ethernet frames into *.pcap file.
+ *          Used by benchmark and pcap generator tools.
+ * @author  Petr Fusek (xfusek08)
+ * @date    19.11.2018
+ */
+/******************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#define PCAP_WRITER_MTU 1500  // maximal size of IP packet, larger datagrams are fragmented
+
+/**
+ * @brief Parameters of one written DNS response.
+ */
+struct SPcapWriterPacket {
+  bool isIPv6;              /*!< send over IPv6 instead of IPv4 */
+  bool isTcp;               /*!< send over TCP instead of UDP */
+  bool forceFragments;      /*!< split UDP datagram into IP fragments even if it fits to MTU */
+  unsigned int client;      /*!< identification of client, used as low bits of destination address */
+};
+
+/**
+ * @brief Class writing DNS responses as Ethernet frames into *.pcap file.
+ *
+ * File is written in classic pcap format with microsecond time stamps and
+ * Ethernet link type, so no libpcap is needed to create it.
+ */
+class PcapWriter {
+public:
+  /** Constructor */
+  PcapWriter();
+
+  /**
+   * @brief Creates file and writes pcap file header.
+   *
+   * @return true on success, false when file cannot be written.
+   */
+  bool open(const std::string &fileName);
+
+  /**
+   * @brief Flushes and closes file.
+   *
+   * @return true when all data were written.
+   */
+  bool close();
+
+  /**
+   * @brief Sets time stamp of following frames.
+   */
+  void setTime(unsigned int sec, unsigned int usec);
+
+  /**
+   * @brief Writes DNS message as response from port 53.
+   *
+   * UDP datagrams larger than PCAP_WRITER_MTU or with forceFragments flag are
+   * written as IP fragments. TCP messages are written in one segment with
+   * 2 B length prefix.
+   */
+  void writeDnsResponse(const std::vector<unsigned char> &dns, const SPcapWriterPacket &params);
+
+  /**
+   * @brief Returns number of frames written so far.
+   */
+  unsigned long framesWritten() const;
+
+private: /* private implementation is documented in *.cpp file */
+  std::ofstream _out;
+  unsigned int _sec;
+  unsigned int _usec;
+  unsigned long _frames;
+  unsigned int _ipId;
+
+  void writeFrame(const std::vector<unsigned char> &frame);
+  void writeIPv4(const std::vector<unsigned char> &payload, unsigned char protocol, const SPcapWriterPacket &params);
+  void writeIPv6(const std::vector<unsigned char> &payload, unsigned char protocol, const SPcapWriterPacket &params);
+};
@@ -0,0 +1,312 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    pcapGenerator.cpp
+ * \brief   Tool generating synthetic *.pcap files with DNS responses for
+ *          reproducible load testing of dns-export.
+ *
+ *          Domain names are drawn from Zipf distribution over configured
+ *          cardinality, record types by weighted mix. Share of TCP, IPv6 and
+ *          fragmented responses is configurable. Same name always resolves
+ *          to same data, so statistics behave like real traffic.
+ *          Build with "make pcapgen".
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
+#include "../utils.hpp"
+#include "../DNSResponse.hpp"
+#include "DNSMessageBuilder.hpp"
+#include "PcapWriter.hpp"
+
+#define DEFAULT_PACKETS       100000
+#define DEFAULT_CARDINALITY   10000
+#define DEFAULT_ZIPF_EXPONENT 1.0
+#define DEFAULT_MAX_ANSWERS   3
+#define DEFAULT_TCP_SHARE     0.05
+#define DEFAULT_IPV6_SHARE    0.2
+#define DEFAULT_FRAG_RATE     0.01
+#define DEFAULT_RATE          10000        // virtual packets per second for time stamps
+#define DEFAULT_TYPE_MIX      "A=50,AAAA=20,CNAME=10,MX=3,NS=3,SOA=3,TXT=5,DNSKEY=2,RRSIG=3,DS=1"
+#define START_TIME_SEC        1540000000
+#define NAMES_PER_ZONE        100
+#define CLIENT_COUNT          5000
+
+using namespace std;
+using namespace utils;
+
+/**
+ * @brief Options of generator.
+ */
+struct SGeneratorOptions {
+  string outputFileName;
+  unsigned long packets;
+  unsigned int cardinality;
+  double zipfExponent;
+  unsigned int maxAnswers;
+  double tcpShare;
+  double ipv6Share;
+  double fragRate;
+  unsigned int rate;
+  string typeMix;
+  unsigned long seed;
+};
+
+/**
+ * @brief One record type of mix with its weight.
+ */
+struct STypeWeight {
+  string name;
+  unsigned short type;
+  double weight;
+};
+
+/* Display program help */
+void printHelp() {
+  cout <<
+    "Usage: dns-pcap-gen -o <file.pcap> [options]\n"
+    "  -o <file>   output pcap file\n"
+    "  -n <num>    number of DNS responses (default " << DEFAULT_PACKETS << ")\n"
+    "  -c <num>    number of distinct domain names (default " << DEFAULT_CARDINALITY << ")\n"
+    "  -z <float>  Zipf exponent of name popularity (default " << DEFAULT_ZIPF_EXPONENT << ")\n"
+    "  -a <num>    maximal number of answers per response (default " << DEFAULT_MAX_ANSWERS << ")\n"
+    "  -t <float>  share of responses over TCP (default " << DEFAULT_TCP_SHARE << ")\n"
+    "  -6 <float>  share of responses over IPv6 (default " << DEFAULT_IPV6_SHARE << ")\n"
+    "  -f <float>  share of UDP responses written as IP fragments (default " << DEFAULT_FRAG_RATE << ")\n"
+    "  -r <num>    virtual responses per second used for time stamps (default " << DEFAULT_RATE << ")\n"
+    "  -m <mix>    record type weights (default " << DEFAULT_TYPE_MIX << ")\n"
+    "  -s <num>    random seed (default 1)\n";
+}
+
+/**
+ * @brief Parses share option value in interval <0, 1>.
+ */
+double parseShare(char opt, const char *value) {
+  char *end = nullptr;
+  double result = strtod(value, &end);
+  if (*end != 0 || result < 0 || result > 1)
+    raiseErrorStreamHelp("For parameter -" << opt << " \"" << value << "\" is not a number from 0 to 1\n");
+  return result;
+}
+
+/**
+ * @brief Parses whole positive number option value.
+ */
+unsigned long parsePositive(char opt, const char *value) {
+  char *end = nullptr;
+  long result = strtol(value, &end, 10);
+  if (*end != 0 || result <= 0)
+    raiseErrorStreamHelp("For parameter -" << opt << " \"" << value << "\" is not a valid whole positive number\n");
+  return result;
+}
+
+SGeneratorOptions parseOptions(int argc, char * const argv[]) {
+  SGeneratorOptions options = {
+    "", DEFAULT_PACKETS, DEFAULT_CARDINALITY, DEFAULT_ZIPF_EXPONENT, DEFAULT_MAX_ANSWERS,
+    DEFAULT_TCP_SHARE, DEFAULT_IPV6_SHARE, DEFAULT_FRAG_RATE, DEFAULT_RATE, DEFAULT_TYPE_MIX, 1
+  };
+
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "ho:n:c:z:a:t:6:f:r:m:s:")) != -1) {
+    switch (opt) {
+      case 'h': printHelp(); exit(EXIT_SUCCESS);
+      case 'o': options.outputFileName = optarg; break;
+      case 'n': options.packets = parsePositive(opt, optarg); break;
+      case 'c': options.cardinality = parsePositive(opt, optarg); break;
+      case 'z': options.zipfExponent = strtod(optarg, nullptr); break;
+      case 'a': options.maxAnswers = parsePositive(opt, optarg); break;
+      case 't': options.tcpShare = parseShare(opt, optarg); break;
+      case '6': options.ipv6Share = parseShare(opt, optarg); break;
+      case 'f': options.fragRate = parseShare(opt, optarg); break;
+      case 'r': options.rate = parsePositive(opt, optarg); break;
+      case 'm': options.typeMix = optarg; break;
+      case 's': options.seed = parsePositive(opt, optarg); break;
+      default:
+        raiseError(nullptr, true);
+    }
+  }
+  if (options.outputFileName.empty())
+    raiseError("Output file (-o) has to be specified.", true);
+  if (options.maxAnswers > 100)
+    raiseError("At most 100 answers per response are supported by dns-export.", true);
+  return options;
+}
+
+/**
+ * @brief Parses record type mix in format "TYPE=weight,TYPE=weight,...".
+ */
+vector<STypeWeight> parseTypeMix(const string &mix) {
+  const vector<STypeWeight> knownTypes = {
+    { "A", DNS_RECTYPE_A, 0 }, { "AAAA", DNS_RECTYPE_AAAA, 0 }, { "CNAME", DNS_RECTYPE_CNAME, 0 },
+    { "MX", DNS_RECTYPE_MX, 0 }, { "NS", DNS_RECTYPE_NS, 0 }, { "SOA", DNS_RECTYPE_SOA, 0 },
+    { "TXT", DNS_RECTYPE_TXT, 0 }, { "DNSKEY", DNS_RECTYPE_DNSKEY, 0 }, { "RRSIG", DNS_RECTYPE_RSIG, 0 },
+    { "DS", DNS_RECTYPE_DS, 0 }
+  };
+  vector<STypeWeight> result;
+  stringstream items(mix);
+  string item;
+  while (getline(items, item, ',')) {
+    size_t eq = item.find('=');
+    string name = item.substr(0, eq);
+    auto known = find_if(knownTypes.begin(), knownTypes.end(), [&](const STypeWeight &t) { return t.name == name; });
+    if (eq == string::npos || known == knownTypes.end())
+      raiseErrorStreamHelp("Invalid record type mix item \"" << item << "\"\n");
+    STypeWeight weight = *known;
+    weight.weight = strtod(item.c_str() + eq + 1, nullptr);
+    if (weight.weight > 0)
+      result.push_back(weight);
+  }
+  if (result.empty())
+    raiseError("Record type mix does not contain any type with positive weight.", true);
+  return result;
+}
+
+/**
+ * @brief Simple deterministic hash used to derive answer data from name rank.
+ */
+unsigned int mix32(unsigned int value) {
+  value ^= value >> 16;
+  value *= 0x7feb352d;
+  value ^= value >> 15;
+  value *= 0x846ca68b;
+  value ^= value >> 16;
+  return value;
+}
+
+/**
+ * @brief Appends answer of given type for name of given rank to message.
+ */
+void appendAnswer(DNSMessageBuilder &message, unsigned short type, unsigned int rank, unsigned int index, const string &zone) {
+  unsigned int seed = mix32(rank * 131 + index);
+  message.beginAnswer(type, 60 + seed % 3600);
+  switch (type) {
+    case DNS_RECTYPE_A:
+      message.appendU32(seed);
+      break;
+    case DNS_RECTYPE_AAAA:
+      message.appendU32(0x20010db8);
+      message.appendU32(mix32(seed));
+      message.appendU32(mix32(seed + 1));
+      message.appendU32(seed);
+      break;
+    case DNS_RECTYPE_CNAME:
+      message.appendName("edge" + to_string(seed % 1000) + ".cdn.example.net");
+      break;
+    case DNS_RECTYPE_MX:
+      message.appendU16(10 * (index + 1));
+      message.appendName("mx" + to_string(index + 1) + "." + zone);
+      break;
+    case DNS_RECTYPE_NS:
+      message.appendName("ns" + to_string(index + 1) + "." + zone);
+      break;
+    case DNS_RECTYPE_SOA:
+      message.appendName("ns1." + zone);
+      message.appendName("hostmaster." + zone);
+      message.appendU32(2018000000 + seed % 1000);
+      message.appendU32(7200);
+      message.appendU32(3600);
+      message.appendU32(1209600);
+      message.appendU32(300);
+      break;
+    case DNS_RECTYPE_TXT: {
+      string text = "v=spf1 include:_spf." + zone + " ~all " + to_string(seed);
+      message.appendU8(text.size());
+      message.appendBytes(text);
+    } break;
+    case DNS_RECTYPE_DNSKEY:
+      message.appendU16(index == 0 ? 257 : 256);
+      message.appendU8(3);
+      message.appendU8(8);
+      for (unsigned int i = 0; i < 32; ++i)
+        message.appendU32(mix32(seed + i));
+      break;
+    case DNS_RECTYPE_RSIG:
+      message.appendU16(DNS_RECTYPE_A);
+      message.appendU8(8);
+      message.appendU8(3);
+      message.appendU32(300);
+      message.appendU32(START_TIME_SEC + 2592000);
+      message.appendU32(START_TIME_SEC - 86400);
+      message.appendU16(seed & 0xffff);
+      message.appendName(zone);
+      for (unsigned int i = 0; i < 32; ++i)
+        message.appendU32(mix32(seed + i));
+      break;
+    case DNS_RECTYPE_DS:
+      message.appendU16(seed & 0xffff);
+      message.appendU8(8);
+      message.appendU8(2);
+      for (unsigned int i = 0; i < 8; ++i)
+        message.appendU32(mix32(seed + i));
+      break;
+  }
+  message.endAnswer();
+}
+
+int main(int argc, char * const argv[]) {
+  SGeneratorOptions options = parseOptions(argc, argv);
+  vector<STypeWeight> typeMix = parseTypeMix(options.typeMix);
+
+  mt19937_64 random(options.seed);
+  uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  // cumulative distribution of Zipf popularity over name ranks
+  vector<double> zipfCdf(options.cardinality);
+  double sum = 0;
+  for (unsigned int rank = 0; rank < options.cardinality; ++rank) {
+    sum += 1.0 / pow(rank + 1, options.zipfExponent);
+    zipfCdf[rank] = sum;
+  }
+
+  vector<double> typeCdf;
+  double typeSum = 0;
+  for (const auto &type : typeMix) {
+    typeSum += type.weight;
+    typeCdf.push_back(typeSum);
+  }
+
+  PcapWriter writer;
+  if (!writer.open(options.outputFileName))
+    raiseErrorStream("Cannot create output file \"" << options.outputFileName << "\"");
+
+  for (unsigned long i = 0; i < options.packets; ++i) {
+    unsigned long usecTotal = i * 1000000ull / options.rate;
+    writer.setTime(START_TIME_SEC + usecTotal / 1000000, usecTotal % 1000000);
+
+    unsigned int rank = lower_bound(zipfCdf.begin(), zipfCdf.end(), uniform(random) * sum) - zipfCdf.begin();
+    rank = min(rank, options.cardinality - 1);
+    string zone = "zone" + to_string(rank / NAMES_PER_ZONE) + ".example";
+    DNSMessageBuilder message("host" + to_string(rank) + "." + zone, i & 0xffff);
+
+    unsigned int answers = 1 + random() % options.maxAnswers;
+    for (unsigned int a = 0; a < answers; ++a) {
+      unsigned int typeIndex = lower_bound(typeCdf.begin(), typeCdf.end(), uniform(random) * typeSum) - typeCdf.begin();
+      typeIndex = min(typeIndex, (unsigned int)typeMix.size() - 1);
+      appendAnswer(message, typeMix[typeIndex].type, rank, a, zone);
+    }
+
+    SPcapWriterPacket params;
+    params.isTcp = uniform(random) < options.tcpShare;
+    params.isIPv6 = uniform(random) < options.ipv6Share;
+    params.forceFragments = !params.isTcp && uniform(random) < options.fragRate;
+    params.client = random() % CLIENT_COUNT;
+    writer.writeDnsResponse(message.data(), params);
+  }
+
+  if (!writer.close())
+    raiseErrorStream("Writing to output file \"" << options.outputFileName << "\" failed");
+
+  cerr << "Written " << options.packets << " responses in "
+       << writer.framesWritten() << " frames to " << options.outputFileName << endl;
+  return 0;
+}
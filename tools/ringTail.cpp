@@ -0,0 +1,74 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    ringTail.cpp
+ * \brief   Example consumer of shared memory ring of dns-export (-R option).
+ *
+ *          Prints every answer published into ring as one line
+ *          "time domain type data" and number of dropped entries on exit
+ *          (SIGINT or SIGTERM). Build with "make ringtail".
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <signal.h>
+#include <unistd.h>
+
+#include "../utils.hpp"
+#include "../ShmRing.hpp"
+
+#define RING_POLL_INTERVAL_USEC 1000  // sleep when ring is empty
+
+using namespace std;
+
+static volatile sig_atomic_t glb_isRunning = 1;
+
+void stopSignal(int) {
+  glb_isRunning = 0;
+}
+
+int main(int argc, char * const argv[]) {
+  if (argc != 2 || string(argv[1]) == "-h") {
+    cout << "Usage: dns-ring-tail <shared memory name>   (e.g. /dns-export)" << endl;
+    return argc == 2 ? 0 : 1;
+  }
+
+  ShmRingConsumer consumer;
+  if (!consumer.open(argv[1]))
+    utils::raiseError();
+
+  signal(SIGINT, stopSignal);
+  signal(SIGTERM, stopSignal);
+
+  unsigned long long received = 0;
+  string line;
+  while (glb_isRunning) {
+    const SShmRingEntry *entry = consumer.next();
+    if (entry == nullptr) {
+      cout.flush();
+      usleep(RING_POLL_INTERVAL_USEC);
+      continue;
+    }
+    // build line from entry in shared memory, print it only when entry was not overwritten meanwhile
+    char timeString[32];
+    snprintf(timeString, sizeof(timeString), "%llu.%06llu ",
+      (unsigned long long)entry->timestampUsec / 1000000, (unsigned long long)entry->timestampUsec % 1000000);
+    line = timeString;
+    line.append(ShmRingConsumer::domain(entry), entry->domainLen) += ' ';
+    line.append(ShmRingConsumer::typeString(entry), entry->typeLen) += ' ';
+    line.append(ShmRingConsumer::data(entry), entry->dataLen);
+    if (entry->flags & SHM_RING_FLAG_TRUNCATED)
+      line += " [truncated]";
+    if (consumer.release()) {
+      cout << line << '\n';
+      ++received;
+    }
+  }
+  cout.flush();
+  cerr << "Received " << received << " answers, dropped " << consumer.dropped() << "." << endl;
+  return 0;
+}
@@ -0,0 +1,216 @@
+/******************************************************************************/
+/**
+ * \project ISA - Export DNS information with help of Syslog protocol
+ * \file    snapshotMerge.cpp
+ * \brief   Tool merging statistic snapshots of many dns-export instances.
+ *
+ *          Input snapshots (written by dns-export -S) are sorted by record
+ *          key, so they are combined by k-way merge streaming over memory
+ *          mapped files. Counts of same records are summed, registers of
+ *          distinct estimates are merged and estimated again. Result is written
+ *          as new snapshot, as top N records by count or as all records in
+ *          dns-export text format. Memory use does not depend on size of
+ *          inputs (only on N of top records).
+ *          Build with "make snapmerge".
+ * \author  Petr Fusek (xfusek08)
+ * \date    19.11.2018
+ */
+/******************************************************************************/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+
+#include "../utils.hpp"
+#include "../StatisticSnapshot.hpp"
+#include "../DistinctCounter.hpp"
+
+using namespace std;
+using namespace utils;
+
+/**
+ * @brief Options of merge tool.
+ */
+struct SMergeOptions {
+  string outputFileName;          // merged snapshot, empty when not requested
+  unsigned long topCount;         // number of top records to print, 0 when not requested
+  vector<string> inputFileNames;
+};
+
+/**
+ * @brief Position of k-way merge in one input snapshot.
+ */
+struct SMergeCursor {
+  const SnapshotReader *reader;
+  size_t index;
+};
+
+/**
+ * @brief One of top records by count.
+ */
+struct STopRecord {
+  __u64 count;
+  string key;
+  SSnapshotRecord record;
+};
+
+void printHelp() {
+  cout <<
+    "Usage: dns-snapshot-merge [options] <snapshot> ...\n"
+    "  -o <file>   write merged snapshot into file\n"
+    "  -n <num>    print <num> records with highest count\n"
+    "  -h          print this help\n"
+    "When neither -o nor -n is given, all merged records are printed in\n"
+    "dns-export format \"domain type data count\" ordered by key." << endl;
+}
+
+SMergeOptions parseOptions(int argc, char * const argv[]) {
+  SMergeOptions options = { "", 0, {} };
+  int opt;
+  while ((opt = getopt(argc, argv, "ho:n:")) != -1) {
+    switch (opt) {
+      case 'h': printHelp(); exit(EXIT_SUCCESS);
+      case 'o': options.outputFileName = optarg; break;
+      case 'n': {
+        long value = strtol(optarg, nullptr, 10);
+        if (value <= 0)
+          raiseErrorStream("For paramter -n \"" << optarg << "\" is not a valid whole positive number");
+        options.topCount = value;
+      } break;
+      default:
+        printHelp();
+        raiseError();
+    }
+  }
+  for (int i = optind; i < argc; ++i)
+    options.inputFileNames.push_back(argv[i]);
+  if (options.inputFileNames.empty()) {
+    printHelp();
+    raiseError("No input snapshot given.");
+  }
+  return options;
+}
+
+/**
+ * @brief Prints one record in dns-export format "domain type data count".
+ */
+void printRecord(const char *key, const SSnapshotRecord &record, __u64 count) {
+  size_t dataPos = record.domainLen + record.typeLen + 2;
+  cout.write(key, record.domainLen) << ' ';
+  cout.write(key + record.domainLen + 1, record.typeLen) << ' ';
+  cout.write(key + dataPos, record.keyLen - dataPos) << ' ' << count << '\n';
+}
+
+/**
+ * @brief Returns true when record is distinct estimate (see DistinctCounter.hpp).
+ */
+bool isDistinctRecord(const char *key, const SSnapshotRecord &record) {
+  return record.typeLen == strlen(DISTINCT_RECORD_TYPE) &&
+    memcmp(key + record.domainLen + 1, DISTINCT_RECORD_TYPE, record.typeLen) == 0;
+}
+
+int main(int argc, char * const argv[]) {
+  SMergeOptions options = parseOptions(argc, argv);
+
+  vector<unique_ptr<SnapshotReader>> readers;
+  for (const auto &fileName : options.inputFileNames) {
+    readers.emplace_back(new SnapshotReader());
+    if (!readers.back()->open(fileName))
+      raiseError();
+  }
+
+  SnapshotStreamWriter writer;
+  if (!options.outputFileName.empty() && !writer.open(options.outputFileName))
+    raiseError();
+  bool isPrintAll = options.outputFileName.empty() && options.topCount == 0;
+
+  // heap of cursors with smallest key on top
+  auto cursorGreater = [](const SMergeCursor &a, const SMergeCursor &b) {
+    const SSnapshotRecord &recA = a.reader->record(a.index);
+    const SSnapshotRecord &recB = b.reader->record(b.index);
+    return SnapshotReader::compareKeys(a.reader->key(recA), recA.keyLen, b.reader->key(recB), recB.keyLen) > 0;
+  };
+  priority_queue<SMergeCursor, vector<SMergeCursor>, decltype(cursorGreater)> cursors(cursorGreater);
+  for (const auto &reader : readers) {
+    if (reader->recordCount() > 0)
+      cursors.push({ reader.get(), 0 });
+  }
+
+  // heap of top records with smallest count on top
+  auto topGreater = [](const STopRecord &a, const STopRecord &b) { return a.count > b.count; };
+  priority_queue<STopRecord, vector<STopRecord>, decltype(topGreater)> top(topGreater);
+
+  unsigned long mergedCount = 0;
+  unsigned long droppedCount = 0;
+  vector<__u8> registers(HLL_REGISTERS);
+  while (!cursors.empty()) {
+    // take all records with smallest key, sum their counts and merge registers of estimates
+    SMergeCursor first = cursors.top();
+    SSnapshotRecord merged = first.reader->record(first.index);
+    const char *key = first.reader->key(merged);
+    merged.count = 0;
+    size_t inputCount = 0;
+    size_t registerCount = 0;
+    fill(registers.begin(), registers.end(), 0);
+    while (!cursors.empty()) {
+      SMergeCursor actCursor = cursors.top();
+      const SSnapshotRecord &actRecord = actCursor.reader->record(actCursor.index);
+      if (SnapshotReader::compareKeys(key, merged.keyLen, actCursor.reader->key(actRecord), actRecord.keyLen) != 0)
+        break;
+      merged.count += actRecord.count;
+      const __u8 *actRegisters = actCursor.reader->registers(actRecord);
+      if (actRegisters != nullptr) {
+        hll::merge(registers.data(), actRegisters);
+        ++registerCount;
+      }
+      ++inputCount;
+      cursors.pop();
+      if (++actCursor.index < actCursor.reader->recordCount())
+        cursors.push(actCursor);
+    }
+
+    // estimates are not additive, without registers of all inputs they cannot be merged
+    bool hasRegisters = registerCount > 0;
+    if (isDistinctRecord(key, merged) && registerCount != inputCount) {
+      ++droppedCount;
+      continue;
+    }
+    if (hasRegisters)
+      merged.count = hll::estimate(registers.data());
+    ++mergedCount;
+
+    if (!options.outputFileName.empty() && !writer.addRecord(key, merged, hasRegisters ? registers.data() : nullptr))
+      raiseError();
+    if (isPrintAll)
+      printRecord(key, merged, merged.count);
+    if (options.topCount > 0 && (top.size() < options.topCount || merged.count > top.top().count)) {
+      top.push({ merged.count, string(key, merged.keyLen), merged });
+      if (top.size() > options.topCount)
+        top.pop();
+    }
+  }
+
+  if (!options.outputFileName.empty() && !writer.close())
+    raiseError();
+
+  if (options.topCount > 0) {
+    vector<STopRecord> topRecords;
+    while (!top.empty()) {
+      topRecords.push_back(top.top());
+      top.pop();
+    }
+    for (auto it = topRecords.rbegin(); it != topRecords.rend(); ++it)
+      printRecord(it->key.data(), it->record, it->count);
+  }
+  cout.flush();
+  if (droppedCount > 0)
+    cerr << "Warning: " << droppedCount << " distinct estimates without registers were dropped, they cannot be merged." << endl;
+  cerr << "Merged " << readers.size() << " snapshots into " << mergedCount << " records." << endl;
+  return 0;
+}
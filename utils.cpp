@@ -93,7 +93,7 @@ string utils::getActTimeStampString() {
   struct tm* timeInfo;
   struct timeval tv;
   char buffer1 [50];
-  char buffer2 [50];
+  char buffer2 [64];
 
   gettimeofday(&tv, NULL);
 
@@ -106,7 +106,7 @@ string utils::getActTimeStampString() {
 
   /* 2018-09-20T22:14:15.003Z */
   strftime(buffer1, 50, "%Y-%m-%dT%H:%M:%S", timeInfo);
-  sprintf(buffer2, "%s.%03dZ", buffer1, millisec);
+  snprintf(buffer2, 64, "%.40s.%03dZ", buffer1, millisec);
 
   return string(buffer2);
 }
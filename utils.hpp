@@ -10,7 +10,7 @@
 
 #pragma once
 
-#define STREAM_TO_STR(S)         static_cast<std::ostringstream&>(ostringstream() << S).str()
+#define STREAM_TO_STR(S)         static_cast<std::ostringstream&>(std::ostringstream().flush() << S).str()
 #define raiseErrorStream(S)      utils::raiseError(STREAM_TO_STR(S))
 #define raiseErrorStreamHelp(S)  utils::raiseError(STREAM_TO_STR(S), true)
 
@@ -23,16 +23,43 @@
 #endif
 
 #include <string>
+#include <vector>
 
 namespace utils {
   struct ProgramOptions {
     bool isPcapFile;                    // flag if *.pcap file is specified
     bool isInterface;                   // flag if network interface device is specified
     bool isSyslogserveAddress;          // flag if syslog server address or name was specified
-    std::string   pcapFileName;         // path to *.pcap file
+    bool isReplay;                      // flag if pcap file is replayed through live analysis on virtual clock
+    bool isFollow;                      // flag if pcap files are followed while they are written
+    bool isSnapshot;                    // flag if statistics are persisted into snapshot file and resumed from it (all records are rebuilt, see loadSnapshot)
+    bool isPipeline;                    // flag if live capture is processed by staged multithreaded pipeline
+    bool isDistinct;                    // flag if distinct names, addresses and clients are estimated
+    bool isHugePages;                   // flag if large tables are backed by huge pages, allocators are reported at exit
+    bool isAsyncOutput;                 // flag if syslog datagrams and export file are written asynchronously by io_uring
+    std::string   pcapFileName;         // path to *.pcap file (first of pcapFileNames)
+    std::vector<std::string> pcapFileNames; // paths, globs or directories with *.pcap files
     std::string   interface;            // name of network interface device
     std::string   syslogServerAddress;  // address or domain name of syslog server
+    std::string   snapshotFileName;     // path to snapshot file loaded on start and rewritten periodically
+    std::string   exportFormat;         // format of exported statistics when not sent to syslog (text, json, binary)
+    std::string   exportPath;           // output of exported statistics, empty for stdout
+    std::string   ringName;             // name of shared memory ring for parsed answers, empty when disabled
+    std::string   metricsAddress;       // [address:]port of HTTP metrics endpoint, empty when disabled
+    std::string   sampling;             // packet sampling "<mode>:<N>" of live capture, empty when disabled
+    std::string   domainFilterFileName; // file of allowed and denied zones reloaded on SIGHUP, empty when disabled
     unsigned int sendTimeIntervalSec;   // interval in seconds in which statistics will be send to syslog server
+    double replaySpeed;                 // speed of replay relative to capture time, 0 means as fast as possible
+    unsigned int workerCount;           // number of threads processing pcap files, 0 means number of cores
+    unsigned int parserCount;           // number of parser threads of pipeline, 0 means parsing in capture thread
+    unsigned int queueDepth;            // number of slots of pipeline queues, 0 means default
+    unsigned int samplingMaxRate;       // maximal N of adaptive sampling, 0 means fixed N
+    unsigned int rollupDepth;           // labels of zone before public suffix in rollup mode, 0 means exact records
+    unsigned int clientCount;           // number of tracked top clients, 0 means clients are not tracked
+    unsigned int expiryFloor;           // minimal seconds records are kept after last use, 0 means no expiry
+    unsigned int memoryCapMb;           // maximal memory of statistic records in MiB, 0 means no cap
+    std::vector<int> cpuList;           // cores of threads (capture, aggregator, exporter, parsers or file workers), -1 not pinned
+    int numaNode;                       // NUMA node of threads and memory, -2 node of interface, -1 no placement
   } ;
 
   /**